@@ -0,0 +1,72 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "set.h"
+#include "setalloc.h"
+
+#define ROUND_COUNT (1 << 15)
+#define ENTRY_COUNT 400
+
+uint64_t hash_fn(uint32_t value) { return value * 0x9E3779B97F4A7C15ull; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// One short-lived set per round, the way a request handler would use one
+static size_t run_round(const set_allocator_t *allocator, uint32_t round) {
+  set_t set;
+  set_init_with_allocator(set, hash_fn, equals_fn, allocator);
+  for (uint32_t i = 0; i < ENTRY_COUNT; i++) {
+    uint32_t entry = round + i * 7;
+    set_add(set, entry);
+  }
+  size_t hits = 0;
+  for (uint32_t i = 0; i < ENTRY_COUNT; i++) {
+    hits += set_has(set, round + i);
+  }
+  set_free(set);
+  return hits;
+}
+
+static void report(const char *name, double start, size_t hits) {
+  double elapsed = now_ms() - start;
+  printf("%-24s %8.1f ms %8.2f Krounds/s (%zu hits)\n", name, elapsed,
+         ROUND_COUNT / elapsed, hits);
+}
+
+int main(void) {
+  double start = now_ms();
+  size_t hits = 0;
+  for (uint32_t round = 0; round < ROUND_COUNT; round++) {
+    hits += run_round(set_libc_allocator(), round);
+  }
+  report("libc", start, hits);
+
+  set_arena_t arena;
+  set_arena_init(&arena, 1 << 20);
+  start = now_ms();
+  hits = 0;
+  for (uint32_t round = 0; round < ROUND_COUNT; round++) {
+    hits += run_round(&arena.allocator, round);
+    set_arena_reset(&arena);
+  }
+  report("arena", start, hits);
+  set_arena_free(&arena);
+
+  set_pool_t pool;
+  set_pool_init(&pool, 32768, 16);
+  start = now_ms();
+  hits = 0;
+  for (uint32_t round = 0; round < ROUND_COUNT; round++) {
+    hits += run_round(&pool.allocator, round);
+  }
+  report("pool", start, hits);
+  set_pool_free(&pool);
+}
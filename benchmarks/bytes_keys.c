@@ -0,0 +1,86 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "set.h"
+
+#define ENTRY_COUNT (1 << 20)
+#define ROUNDS 4
+
+static uint64_t fnv1a(const char *bytes, size_t len) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < len; i++) {
+    hash = (hash ^ (uint8_t)bytes[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+uint64_t str_hash_fn(const char *value) { return fnv1a(value, strlen(value)); }
+bool str_equals_fn(const char *a, const char *b) { return strcmp(a, b) == 0; }
+uint64_t bytes_hash_fn(set_bytes_t key) { return fnv1a(key.bytes, key.len); }
+
+typedef set_type(const char *) str_set_t;
+typedef set_type_bytes() bytes_set_t;
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void report(const char *name, double start) {
+  printf("%-32s %8.1f ms\n", name, now_ms() - start);
+}
+
+static int key(char *buffer, uint32_t i) {
+  return snprintf(buffer, 32, "user:%08x:session", i * 2654435761u);
+}
+
+int main(void) {
+  char buffer[32];
+  size_t hits = 0;
+
+  // Keys the caller has to keep alive: one strdup() each
+  double start = now_ms();
+  str_set_t str_set;
+  set_init(str_set, str_hash_fn, str_equals_fn);
+  for (uint32_t i = 0; i < ENTRY_COUNT; i++) {
+    key(buffer, i);
+    set_add(str_set, strdup(buffer));
+  }
+  report("strdup() + set_add", start);
+  start = now_ms();
+  for (int round = 0; round < ROUNDS; round++) {
+    for (uint32_t i = 0; i < ENTRY_COUNT; i++) {
+      key(buffer, i + round);
+      hits += set_has(str_set, buffer);
+    }
+  }
+  report("set_has", start);
+  set_foreach_unordered(str_set, addr) {
+    free((char *)set_get_entry(str_set, addr));
+  }
+  set_free(str_set);
+
+  // Keys copied into the arena of the set
+  start = now_ms();
+  bytes_set_t bytes_set;
+  set_bytes_init(bytes_set, bytes_hash_fn);
+  for (uint32_t i = 0; i < ENTRY_COUNT; i++) {
+    int len = key(buffer, i);
+    set_bytes_add(bytes_set, buffer, len);
+  }
+  report("set_bytes_add", start);
+  start = now_ms();
+  for (int round = 0; round < ROUNDS; round++) {
+    for (uint32_t i = 0; i < ENTRY_COUNT; i++) {
+      int len = key(buffer, i + round);
+      hits += set_bytes_has(bytes_set, buffer, len);
+    }
+  }
+  report("set_bytes_has", start);
+  set_bytes_free(bytes_set);
+
+  printf("%zu hits\n", hits);
+}
@@ -0,0 +1,65 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "set.h"
+
+#define ENTRY_COUNT (1 << 21)
+
+uint64_t hash_fn(uint32_t value) { return value * 0x9E3779B97F4A7C15ull; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef map_type(uint32_t, uint32_t) map_t;
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+int main(void) {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/set_bench_%d.bin", (int)getpid());
+
+  map_t map;
+  map_init(map, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < ENTRY_COUNT; i++) {
+    map_add(map, i, i);
+  }
+
+  // The writer stalls for as long as set_clone() takes
+  double start = now_ms();
+  map_t clone = map_clone(map);
+  printf("%-32s %8.2f ms stall\n", "map_clone", now_ms() - start);
+  map_free(clone);
+
+  // and only for the fork() of a checkpoint
+  set_checkpoint_t checkpoint;
+  start = now_ms();
+  if (!map_checkpoint(map, path, &checkpoint)) {
+    printf("map_checkpoint failed\n");
+    map_free(map);
+    return 1;
+  }
+  printf("%-32s %8.2f ms stall\n", "map_checkpoint", now_ms() - start);
+
+  // Keeps writing until the checkpoint is on disk
+  size_t writes = 0;
+  uint32_t key = ENTRY_COUNT;
+  while (set_checkpoint_poll(&checkpoint) == SET_CHECKPOINT_RUNNING) {
+    for (int i = 0; i < 1000; i++, key++) {
+      map_add(map, key, key);
+    }
+    writes += 1000;
+  }
+  double elapsed = now_ms() - start;
+  printf("%-32s %8.1f ms, %llu of %llu bytes, %zu writes meanwhile\n",
+         checkpoint.state == SET_CHECKPOINT_DONE ? "checkpoint written"
+                                                 : "checkpoint failed",
+         elapsed,
+         (unsigned long long)set_checkpoint_bytes_written(&checkpoint),
+         (unsigned long long)checkpoint.total_bytes, writes);
+  map_free(map);
+  remove(path);
+}
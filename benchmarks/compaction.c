@@ -0,0 +1,69 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "set.h"
+
+#define ENTRY_COUNT (1 << 21)
+#define LOOKUP_COUNT (1 << 22)
+
+uint64_t hash_fn(uint32_t value) { return value * 0x9E3779B97F4A7C15ull; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+
+static uint32_t lookups[LOOKUP_COUNT];
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void run_lookups(set_t set, const char *name) {
+  double start = now_ms();
+  size_t hits = 0;
+  for (size_t i = 0; i < LOOKUP_COUNT; i++) {
+    hits += set_has(set, lookups[i]);
+  }
+  double elapsed = now_ms() - start;
+  printf("%-24s %8.1f ms %8.2f Mlookups/s (%zu hits, capacity %zu)\n", name,
+         elapsed, LOOKUP_COUNT / elapsed / 1000.0, hits, set.capacity);
+}
+
+int main(void) {
+  srand(1);
+  for (size_t i = 0; i < LOOKUP_COUNT; i++) {
+    lookups[i] = (uint32_t)(rand() % (ENTRY_COUNT * 2));
+  }
+
+  // Grows the set to twice its final size and churns it, so that the live
+  // nodes end up scattered through buffers with half of their slots free
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < ENTRY_COUNT * 2; i++) {
+    uint32_t entry = (uint32_t)(rand() % (ENTRY_COUNT * 2));
+    set_add(set, entry);
+  }
+  for (uint32_t i = 0; i < ENTRY_COUNT * 4; i++) {
+    uint32_t entry = (uint32_t)(rand() % (ENTRY_COUNT * 2));
+    if (set_size(set) > ENTRY_COUNT) {
+      set_remove(set, entry);
+    } else {
+      set_add(set, entry);
+    }
+  }
+  run_lookups(set, "fragmented");
+
+  double start = now_ms();
+  set_compact(set, SET_LAYOUT_BFS);
+  printf("%-24s %8.1f ms\n", "set_compact (BFS)", now_ms() - start);
+  run_lookups(set, "compacted (BFS)");
+
+  start = now_ms();
+  set_compact(set, SET_LAYOUT_VEB);
+  printf("%-24s %8.1f ms\n", "set_compact (vEB)", now_ms() - start);
+  run_lookups(set, "compacted (vEB)");
+
+  set_free(set);
+}
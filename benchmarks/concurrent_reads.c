@@ -0,0 +1,146 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "set.h"
+
+#define ENTRY_COUNT (1 << 20)
+#define LOOKUPS_PER_READER (1 << 21)
+#define MAX_READERS 8
+
+uint64_t hash_fn(uint32_t value) { return value * 0x9E3779B97F4A7C15ull; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef map_type(uint32_t, uint32_t) map_t;
+typedef map_concurrent_type(uint32_t, uint32_t) concurrent_map_t;
+
+static map_t locked_map;
+static pthread_rwlock_t locked_map_lock = PTHREAD_RWLOCK_INITIALIZER;
+static concurrent_map_t concurrent_map;
+static bool readers_done;
+static uint32_t locked_next_key = ENTRY_COUNT;
+static uint32_t concurrent_next_key = ENTRY_COUNT;
+// CPU time of each reader, which unlike the wall time does not depend on
+// how the scheduler shares the cores between readers and the writer
+static double reader_cpu_ms[MAX_READERS];
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static double thread_cpu_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void *locked_reader(void *arg) {
+  double start = thread_cpu_ms();
+  size_t sum = 0;
+  for (uint32_t i = 0; i < LOOKUPS_PER_READER; i++) {
+    uint32_t key = (i + (uint32_t)(uintptr_t)arg) * 2654435761u % ENTRY_COUNT;
+    pthread_rwlock_rdlock(&locked_map_lock);
+    uint32_t *value = map_get(locked_map, key);
+    sum += value != NULL ? *value : 0;
+    pthread_rwlock_unlock(&locked_map_lock);
+  }
+  reader_cpu_ms[(uintptr_t)arg] = thread_cpu_ms() - start;
+  return (void *)sum;
+}
+
+static void *concurrent_reader(void *arg) {
+  int reader = map_concurrent_reader(concurrent_map);
+  double start = thread_cpu_ms();
+  size_t sum = 0;
+  for (uint32_t i = 0; i < LOOKUPS_PER_READER; i++) {
+    uint32_t key = (i + (uint32_t)(uintptr_t)arg) * 2654435761u % ENTRY_COUNT;
+    uint32_t value = 0;
+    map_concurrent_get(concurrent_map, reader, key, &value);
+    sum += value;
+  }
+  reader_cpu_ms[(uintptr_t)arg] = thread_cpu_ms() - start;
+  return (void *)sum;
+}
+
+// Until every reader is done, the writer keeps bumping values, and adds one
+// key and removes another every 64 writes
+static void *locked_writer(void *arg) {
+  (void)arg;
+  size_t writes = 0;
+  for (; !__atomic_load_n(&readers_done, __ATOMIC_ACQUIRE); writes++) {
+    pthread_rwlock_wrlock(&locked_map_lock);
+    if (writes % 64 == 0) {
+      uint32_t key = locked_next_key++;
+      map_add(locked_map, key, key);
+      map_remove(locked_map, key - ENTRY_COUNT);
+    } else {
+      (*map_get(locked_map, locked_next_key - writes % 64))++;
+    }
+    pthread_rwlock_unlock(&locked_map_lock);
+  }
+  return (void *)writes;
+}
+
+static void *concurrent_writer(void *arg) {
+  (void)arg;
+  size_t writes = 0;
+  for (; !__atomic_load_n(&readers_done, __ATOMIC_ACQUIRE); writes++) {
+    if (writes % 64 == 0) {
+      uint32_t key = concurrent_next_key++;
+      map_concurrent_add(concurrent_map, key, key);
+      map_concurrent_remove(concurrent_map, key - ENTRY_COUNT);
+    } else {
+      uint32_t key = concurrent_next_key - writes % 64;
+      map_concurrent_update(concurrent_map, key, key + 1);
+    }
+  }
+  return (void *)writes;
+}
+
+static void run(const char *name, size_t reader_count,
+                void *(*reader)(void *), void *(*writer)(void *)) {
+  pthread_t readers[MAX_READERS];
+  pthread_t writer_thread;
+  readers_done = false;
+  double start = now_ms();
+  pthread_create(&writer_thread, NULL, writer, NULL);
+  for (uintptr_t i = 0; i < reader_count; i++) {
+    pthread_create(&readers[i], NULL, reader, (void *)i);
+  }
+  for (size_t i = 0; i < reader_count; i++) {
+    pthread_join(readers[i], NULL);
+  }
+  double elapsed = now_ms() - start;
+  __atomic_store_n(&readers_done, true, __ATOMIC_RELEASE);
+  void *writes;
+  pthread_join(writer_thread, &writes);
+  double cpu = 0;
+  for (size_t i = 0; i < reader_count; i++) {
+    cpu += reader_cpu_ms[i];
+  }
+  printf("%-20s %zu readers %8.1f ms %8.2f Mlookups/s %8.2f Mlookups/cpu-s "
+         "%8.2f Mwrites/s\n",
+         name, reader_count, elapsed,
+         (double)reader_count * LOOKUPS_PER_READER / elapsed / 1000.0,
+         (double)reader_count * LOOKUPS_PER_READER / cpu / 1000.0,
+         (double)(size_t)writes / elapsed / 1000.0);
+}
+
+int main(void) {
+  map_init(locked_map, hash_fn, equals_fn);
+  map_concurrent_init(concurrent_map, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < ENTRY_COUNT; i++) {
+    map_add(locked_map, i, i);
+    map_concurrent_add(concurrent_map, i, i);
+  }
+
+  for (size_t readers = 1; readers <= MAX_READERS; readers *= 2) {
+    run("rwlock", readers, locked_reader, locked_writer);
+    run("left-right readers", readers, concurrent_reader, concurrent_writer);
+  }
+  map_free(locked_map);
+  map_concurrent_free(concurrent_map);
+}
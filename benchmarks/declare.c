@@ -0,0 +1,84 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "set.h"
+
+#define ENTRY_COUNT (1 << 16)
+#define ROUNDS 20
+#define SITE_COUNT 16
+
+uint64_t hash_fn(uint32_t value) { return value * 0x9E3779B97F4A7C15ull; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+set_declare(u32_set, uint32_t)
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// A program that touches the set from many places: every site adds, looks up
+// and removes once, either with the macros or with the declared functions.
+// Each kind of site goes in its own section so its size can be measured.
+#define MACRO_SITE(n)                                                          \
+  __attribute__((noinline, section("macro_site_code"))) static size_t          \
+      macro_site_##n(u32_set_t *set, uint32_t entry) {                         \
+    set_add((*set), entry);                                                    \
+    size_t found = set_has((*set), entry ^ 1);                                 \
+    set_remove((*set), entry >> 1);                                            \
+    return found;                                                              \
+  }
+
+#define DECLARED_SITE(n)                                                       \
+  __attribute__((noinline, section("declared_site_code"))) static size_t       \
+      declared_site_##n(u32_set_t *set, uint32_t entry) {                      \
+    u32_set_add(set, entry);                                                   \
+    size_t found = u32_set_has(set, entry ^ 1);                                \
+    u32_set_remove(set, entry >> 1);                                           \
+    return found;                                                              \
+  }
+
+#define SITES(site)                                                            \
+  site(0) site(1) site(2) site(3) site(4) site(5) site(6) site(7) site(8)      \
+      site(9) site(10) site(11) site(12) site(13) site(14) site(15)
+
+SITES(MACRO_SITE)
+SITES(DECLARED_SITE)
+
+#define SITE_POINTER(prefix) prefix##0, prefix##1, prefix##2, prefix##3,       \
+    prefix##4, prefix##5, prefix##6, prefix##7, prefix##8, prefix##9,          \
+    prefix##10, prefix##11, prefix##12, prefix##13, prefix##14, prefix##15
+
+typedef size_t (*site_t)(u32_set_t *, uint32_t);
+
+static site_t macro_sites[SITE_COUNT] = {SITE_POINTER(macro_site_)};
+static site_t declared_sites[SITE_COUNT] = {SITE_POINTER(declared_site_)};
+
+extern char __start_macro_site_code[], __stop_macro_site_code[];
+extern char __start_declared_site_code[], __stop_declared_site_code[];
+
+static void run(const char *name, site_t *sites, size_t site_bytes) {
+  size_t hits = 0;
+  double start = now_ms();
+  for (int round = 0; round < ROUNDS; round++) {
+    u32_set_t set;
+    u32_set_init(&set, hash_fn, equals_fn);
+    for (uint32_t i = 0; i < ENTRY_COUNT; i++) {
+      hits += sites[i % SITE_COUNT](&set, i);
+    }
+    u32_set_free(&set);
+  }
+  double elapsed = now_ms() - start;
+  printf("%-24s %6zu bytes per site %8.2f Mops/s (%zu hits)\n", name,
+         site_bytes / SITE_COUNT, 3.0 * ENTRY_COUNT * ROUNDS / elapsed / 1000.0,
+         hits);
+}
+
+int main(void) {
+  run("set_add() and friends", macro_sites,
+      __stop_macro_site_code - __start_macro_site_code);
+  run("set_declare() functions", declared_sites,
+      __stop_declared_site_code - __start_declared_site_code);
+}
@@ -0,0 +1,68 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "set.h"
+
+#define ENTRY_COUNT (1 << 20)
+
+uint64_t hash_fn(uint32_t value) { return value * 0x9E3779B97F4A7C15ull; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+typedef set_type_flat(uint32_t) flat_set_t;
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void report(const char *name, double start, size_t capacity) {
+  double elapsed = now_ms() - start;
+  printf("%-24s %8.1f ms %8.2f Minserts/s (capacity %zu)\n", name, elapsed,
+         ENTRY_COUNT / elapsed / 1000.0, capacity);
+}
+
+// Fills a tree set under the given growth policy, or reserved up front when
+// percent is 0
+static void fill_tree(const char *name, uint32_t percent, size_t increment) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  double start = now_ms();
+  if (percent == 0) {
+    set_reserve(set, ENTRY_COUNT);
+  } else {
+    set_growth_policy(set, percent, increment);
+  }
+  for (uint32_t i = 0; i < ENTRY_COUNT; i++) {
+    set_add(set, i);
+  }
+  report(name, start, set.capacity);
+  set_free(set);
+}
+
+int main(void) {
+  fill_tree("tree 2x", 200, 0);
+  fill_tree("tree 1.5x", 150, 0);
+  fill_tree("tree +64K slots", 100, 1 << 16);
+  fill_tree("tree set_reserve", 0, 0);
+
+  flat_set_t flat;
+  set_init(flat, hash_fn, equals_fn);
+  double start = now_ms();
+  for (uint32_t i = 0; i < ENTRY_COUNT; i++) {
+    set_add(flat, i);
+  }
+  report("flat 2x", start, flat.capacity);
+  set_free(flat);
+
+  set_init(flat, hash_fn, equals_fn);
+  start = now_ms();
+  set_reserve(flat, ENTRY_COUNT);
+  for (uint32_t i = 0; i < ENTRY_COUNT; i++) {
+    set_add(flat, i);
+  }
+  report("flat set_reserve", start, flat.capacity);
+  set_free(flat);
+}
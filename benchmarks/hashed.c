@@ -0,0 +1,118 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "set.h"
+#include "sethash.h"
+
+#define ENTRY_COUNT (1 << 20)
+#define ROUNDS 20
+
+bool equals_fn(uint64_t a, uint64_t b) { return a == b; }
+bool str_equals_fn(const char *a, const char *b) { return strcmp(a, b) == 0; }
+
+typedef set_type(uint64_t) set_t;
+typedef set_type(const char *) str_set_t;
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void report(const char *name, double start, size_t ops) {
+  double elapsed = now_ms() - start;
+  printf("%-40s %8.1f ms %8.2f Mops/s\n", name, elapsed,
+         ops / elapsed / 1000.0);
+}
+
+int main(void) {
+  uint64_t *keys = malloc(sizeof(uint64_t) * ENTRY_COUNT);
+  uint64_t *hashes = malloc(sizeof(uint64_t) * ENTRY_COUNT);
+  for (uint64_t i = 0; i < ENTRY_COUNT; i++) {
+    keys[i] = i * 0x9E3779B97F4A7C15ull;
+  }
+
+  // Hashing alone, one key at a time and four at a time
+  uint64_t checksum = 0;
+  double start = now_ms();
+  for (int round = 0; round < ROUNDS; round++) {
+    for (size_t i = 0; i < ENTRY_COUNT; i++) {
+      hashes[i] = set_hash_u64(keys[i] + round);
+    }
+    checksum += hashes[round];
+  }
+  report("set_hash_u64 loop", start, (size_t)ENTRY_COUNT * ROUNDS);
+  start = now_ms();
+  for (int round = 0; round < ROUNDS; round++) {
+    keys[0] += round;
+    set_hash_u64_many(keys, ENTRY_COUNT, SET_HASH_SEED, hashes);
+    checksum += hashes[round];
+  }
+  keys[0] = 0;
+  report("set_hash_u64_many", start, (size_t)ENTRY_COUNT * ROUNDS);
+  set_hash_u64_many(keys, ENTRY_COUNT, SET_HASH_SEED, hashes);
+
+  // Integer keys with their hashes known up front
+  set_t set;
+  set_init(set, set_hash_u64, equals_fn);
+  start = now_ms();
+  for (size_t i = 0; i < ENTRY_COUNT; i++) {
+    set_add(set, keys[i]);
+  }
+  report("set_add", start, ENTRY_COUNT);
+  set_free(set);
+
+  set_init(set, set_hash_u64, equals_fn);
+  start = now_ms();
+  for (size_t i = 0; i < ENTRY_COUNT; i++) {
+    set_add_hashed(set, hashes[i], keys[i]);
+  }
+  report("set_add_hashed", start, ENTRY_COUNT);
+
+  size_t hits = 0;
+  start = now_ms();
+  for (size_t i = 0; i < ENTRY_COUNT; i++) {
+    hits += set_has(set, keys[i]);
+  }
+  report("set_has", start, ENTRY_COUNT);
+  start = now_ms();
+  for (size_t i = 0; i < ENTRY_COUNT; i++) {
+    hits += set_has_hashed(set, hashes[i], keys[i]);
+  }
+  report("set_has_hashed", start, ENTRY_COUNT);
+  set_free(set);
+
+  // String keys, where the hash is most of the cost of a lookup
+  char (*strings)[48] = malloc(48 * ENTRY_COUNT);
+  const char **string_ptrs = malloc(sizeof(char *) * ENTRY_COUNT);
+  for (size_t i = 0; i < ENTRY_COUNT; i++) {
+    snprintf(strings[i], 48, "tenant-%zu/object/%016llx", i % 97,
+             (unsigned long long)keys[i]);
+    string_ptrs[i] = strings[i];
+  }
+  set_hash_string_many(string_ptrs, ENTRY_COUNT, SET_HASH_SEED, hashes);
+  str_set_t str_set;
+  set_init(str_set, set_hash_string, str_equals_fn);
+  for (size_t i = 0; i < ENTRY_COUNT; i++) {
+    set_add_hashed(str_set, hashes[i], string_ptrs[i]);
+  }
+  start = now_ms();
+  for (size_t i = 0; i < ENTRY_COUNT; i++) {
+    hits += set_has(str_set, string_ptrs[i]);
+  }
+  report("set_has, strings", start, ENTRY_COUNT);
+  start = now_ms();
+  for (size_t i = 0; i < ENTRY_COUNT; i++) {
+    hits += set_has_hashed(str_set, hashes[i], string_ptrs[i]);
+  }
+  report("set_has_hashed, strings", start, ENTRY_COUNT);
+  set_free(str_set);
+
+  printf("%zu hits, checksum %llx\n", hits, (unsigned long long)checksum);
+  free(string_ptrs);
+  free(strings);
+  free(hashes);
+  free(keys);
+}
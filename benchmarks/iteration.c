@@ -0,0 +1,66 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "set.h"
+
+#define ENTRY_COUNT (1 << 22)
+
+uint64_t hash_fn(uint32_t value) { return value * 0x9E3779B97F4A7C15ull; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void report(const char *name, double start, size_t visited,
+                   uint64_t sum) {
+  double elapsed = now_ms() - start;
+  printf("%-32s %8.1f ms %8.2f Mentries/s (sum %llu)\n", name, elapsed,
+         visited / elapsed / 1000.0, (unsigned long long)sum);
+}
+
+static void run(set_t set, const char *ordered_name,
+                const char *unordered_name) {
+  double start = now_ms();
+  uint64_t sum = 0;
+  size_t visited = 0;
+  for (tree_addr_t cursor = set_first(set); tree_is_valid_addr(cursor);
+       cursor = set_next(set, cursor)) {
+    sum += set_get_entry(set, cursor);
+    visited++;
+  }
+  report(ordered_name, start, visited, sum);
+
+  start = now_ms();
+  sum = 0;
+  visited = 0;
+  set_foreach_unordered(set, cursor) {
+    sum += set_get_entry(set, cursor);
+    visited++;
+  }
+  report(unordered_name, start, visited, sum);
+}
+
+int main(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < ENTRY_COUNT; i++) {
+    set_add(set, i);
+  }
+  run(set, "set_next (dense)", "set_foreach_unordered (dense)");
+
+  // Keeps one entry in 64, which leaves most bitmap words empty
+  for (uint32_t i = 0; i < ENTRY_COUNT; i++) {
+    if (i % 64 != 0) {
+      set_remove(set, i);
+    }
+  }
+  run(set, "set_next (sparse)", "set_foreach_unordered (sparse)");
+
+  set_free(set);
+}
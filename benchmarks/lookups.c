@@ -0,0 +1,78 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "set.h"
+
+#define ENTRY_COUNT (1 << 22)
+#define LOOKUP_COUNT (1 << 22)
+
+uint64_t hash_fn(uint32_t value) { return value * 0x9E3779B97F4A7C15ull; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+typedef set_type_flat(uint32_t) flat_set_t;
+
+static uint32_t lookups[LOOKUP_COUNT];
+static bool found[LOOKUP_COUNT];
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void report(const char *name, double start, size_t hits) {
+  double elapsed = now_ms() - start;
+  printf("%-24s %8.1f ms %8.2f Mlookups/s (%zu hits)\n", name, elapsed,
+         LOOKUP_COUNT / elapsed / 1000.0, hits);
+}
+
+static size_t count_found(void) {
+  size_t hits = 0;
+  for (size_t i = 0; i < LOOKUP_COUNT; i++) {
+    hits += found[i];
+  }
+  return hits;
+}
+
+int main(void) {
+  // Even keys are in the sets, so about half of the lookups hit
+  srand(1);
+  for (size_t i = 0; i < LOOKUP_COUNT; i++) {
+    lookups[i] = (uint32_t)(rand() % (ENTRY_COUNT * 2));
+  }
+
+  set_t set;
+  flat_set_t flat;
+  set_init(set, hash_fn, equals_fn);
+  set_init(flat, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < ENTRY_COUNT; i++) {
+    uint32_t entry = i * 2;
+    set_add(set, entry);
+    set_add(flat, entry);
+  }
+
+  double start = now_ms();
+  for (size_t i = 0; i < LOOKUP_COUNT; i++) {
+    found[i] = set_has(set, lookups[i]);
+  }
+  report("tree set_has", start, count_found());
+
+  start = now_ms();
+  set_has_many(set, lookups, LOOKUP_COUNT, found);
+  report("tree set_has_many", start, count_found());
+
+  start = now_ms();
+  for (size_t i = 0; i < LOOKUP_COUNT; i++) {
+    found[i] = set_has(flat, lookups[i]);
+  }
+  report("flat set_has", start, count_found());
+
+  start = now_ms();
+  set_has_many(flat, lookups, LOOKUP_COUNT, found);
+  report("flat set_has_many", start, count_found());
+
+  set_free(set);
+  set_free(flat);
+}
@@ -0,0 +1,73 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "set.h"
+
+#define ENTRY_COUNT (1 << 21)
+#define LOOKUP_COUNT (1 << 16)
+
+uint64_t hash_fn(uint32_t value) { return value * 0x9E3779B97F4A7C15ull; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void report(const char *name, double start) {
+  printf("%-32s %8.1f ms\n", name, now_ms() - start);
+}
+
+static size_t lookup(set_t set) {
+  size_t hits = 0;
+  for (uint32_t i = 0; i < LOOKUP_COUNT; i++) {
+    hits += set_has(set, i * 97 % (ENTRY_COUNT * 2));
+  }
+  return hits;
+}
+
+int main(void) {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/set_bench_%d.bin", (int)getpid());
+
+  // What a restart costs without a saved file
+  double start = now_ms();
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < ENTRY_COUNT; i++) {
+    uint32_t entry = i * 2;
+    set_add(set, entry);
+  }
+  size_t hits = lookup(set);
+  report("rebuild + lookups", start);
+
+  start = now_ms();
+  set_save(set, path);
+  report("set_save", start);
+  set_free(set);
+
+  start = now_ms();
+  set_t mapped;
+  if (!set_mmap_open(mapped, path, hash_fn, equals_fn)) {
+    printf("set_mmap_open failed\n");
+    remove(path);
+    return 1;
+  }
+  report("set_mmap_open", start);
+
+  start = now_ms();
+  size_t mapped_hits = lookup(mapped);
+  report("lookups on the mapping", start);
+  printf("%zu hits in memory, %zu on the mapping\n", hits, mapped_hits);
+  set_free(mapped);
+
+  start = now_ms();
+  bool intact = set_file_verify(path);
+  report(intact ? "set_file_verify" : "set_file_verify (failed)", start);
+  remove(path);
+}
@@ -0,0 +1,79 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "set.h"
+
+// Built once as is and once more with -DSET_NODE_FLAGS=true, see the Makefile
+#define MAX_ENTRIES (1 << 20)
+#define LOOKUP_COUNT (1 << 21)
+
+uint64_t hash_fn(uint32_t value) { return value * 0x9E3779B97F4A7C15ull; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+
+static uint32_t lookups[LOOKUP_COUNT];
+static bool found[LOOKUP_COUNT];
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void report(const char *name, uint32_t n, double start, size_t ops) {
+  double elapsed = now_ms() - start;
+  printf("%-16s %-12s %8u entries %8.1f ms %8.2f Mops/s\n",
+         SET_NODE_FLAGS ? "flags in nodes" : "flag bitmaps", name, n, elapsed,
+         ops / elapsed / 1000.0);
+}
+
+// Sets that fit in cache and one that does not
+static void run(uint32_t n) {
+  // Even keys go in, so about half of the lookups hit
+  srand(1);
+  for (size_t i = 0; i < LOOKUP_COUNT; i++) {
+    lookups[i] = (uint32_t)(rand() % (n * 2));
+  }
+
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  double start = now_ms();
+  for (uint32_t i = 0; i < n; i++) {
+    set_add(set, i * 2);
+  }
+  report("set_add", n, start, n);
+
+  size_t hits = 0;
+  start = now_ms();
+  for (size_t i = 0; i < LOOKUP_COUNT; i++) {
+    hits += set_has(set, lookups[i]);
+  }
+  report("set_has", n, start, LOOKUP_COUNT);
+
+  // Batched descents check the inited bit of every node they land on
+  start = now_ms();
+  set_has_many(set, lookups, LOOKUP_COUNT, found);
+  report("set_has_many", n, start, LOOKUP_COUNT);
+  for (size_t i = 0; i < LOOKUP_COUNT; i++) {
+    hits -= found[i];
+  }
+
+  start = now_ms();
+  for (uint32_t i = 0; i < n; i += 2) {
+    set_remove(set, i * 2);
+  }
+  report("set_remove", n, start, n / 2);
+
+  if (hits != 0) {
+    printf("set_has and set_has_many disagree\n");
+  }
+  set_free(set);
+}
+
+int main(void) {
+  run(1 << 12);
+  run(1 << 16);
+  run(MAX_ENTRIES);
+}
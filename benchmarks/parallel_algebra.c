@@ -0,0 +1,70 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "set.h"
+
+#define ENTRY_COUNT (1 << 22)
+
+uint64_t hash_fn(uint32_t value) { return value * 0x9E3779B97F4A7C15ull; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+set_declare_parallel(set, set_t)
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Prints the time since start and the speedup over the single-threaded
+// time, and returns the time
+static double report(const char *name, size_t threads, double start,
+                     double single, set_t *result) {
+  double elapsed = now_ms() - start;
+  printf("%-12s %2zu threads %8.1f ms %5.2fx (%zu entries)\n", name, threads,
+         elapsed, single > 0 ? single / elapsed : 1.0, set_size((*result)));
+  set_free((*result));
+  return elapsed;
+}
+
+int main(void) {
+  // a holds the multiples of 2 and b the multiples of 3, so they overlap by a
+  // third
+  set_t a;
+  set_t b;
+  set_init(a, hash_fn, equals_fn);
+  set_init(b, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < ENTRY_COUNT; i++) {
+    uint32_t entry = i * 2;
+    set_add(a, entry);
+    entry = i * 3;
+    set_add(b, entry);
+  }
+
+  size_t max_threads = (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+  double single[3] = {0};
+  for (size_t threads = 1; threads <= max_threads; threads++) {
+    set_t result;
+    double elapsed;
+    double start = now_ms();
+    set_union_parallel(&result, &a, &b, threads);
+    elapsed = report("union", threads, start, single[0], &result);
+    single[0] = threads == 1 ? elapsed : single[0];
+
+    start = now_ms();
+    set_intersect_parallel(&result, &a, &b, threads);
+    elapsed = report("intersect", threads, start, single[1], &result);
+    single[1] = threads == 1 ? elapsed : single[1];
+
+    start = now_ms();
+    set_difference_parallel(&result, &a, &b, threads);
+    elapsed = report("difference", threads, start, single[2], &result);
+    single[2] = threads == 1 ? elapsed : single[2];
+  }
+
+  set_free(a);
+  set_free(b);
+}
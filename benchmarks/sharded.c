@@ -0,0 +1,100 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "set.h"
+
+#define ENTRY_COUNT (1 << 20)
+#define MAX_THREADS 32
+
+uint64_t hash_fn(uint32_t value) { return value * 0x9E3779B97F4A7C15ull; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+typedef set_sharded_type(uint32_t, 64) spin_set_t;
+typedef set_sharded_type_lock(uint32_t, 64, SET_SHARD_RWLOCK) rw_set_t;
+
+static set_t locked_set;
+static pthread_mutex_t locked_set_mutex = PTHREAD_MUTEX_INITIALIZER;
+static spin_set_t spin_set;
+static rw_set_t rw_set;
+static size_t thread_count;
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Each thread adds its slice of the entries in a scrambled order, then looks
+// all of it up twice
+#define WORKER(name, add, has)                                                 \
+  static void *name(void *arg) {                                               \
+    uint32_t slice = ENTRY_COUNT / thread_count;                               \
+    uint32_t first = (uint32_t)(uintptr_t)arg * slice;                         \
+    for (uint32_t i = 0; i < slice; i++) {                                     \
+      add(first + (i * 2654435761u & (slice - 1)));                            \
+    }                                                                          \
+    size_t hits = 0;                                                           \
+    for (int round = 0; round < 2; round++) {                                  \
+      for (uint32_t i = 0; i < slice; i++) {                                   \
+        hits += has(first + (i * 2246822519u & (slice - 1)));                  \
+      }                                                                        \
+    }                                                                          \
+    return (void *)hits;                                                       \
+  }
+
+#define locked_add(entry)                                                      \
+  do {                                                                         \
+    pthread_mutex_lock(&locked_set_mutex);                                     \
+    set_add(locked_set, entry);                                                \
+    pthread_mutex_unlock(&locked_set_mutex);                                   \
+  } while (0)
+
+#define locked_has(entry)                                                      \
+  ({                                                                           \
+    pthread_mutex_lock(&locked_set_mutex);                                     \
+    bool found = set_has(locked_set, entry);                                   \
+    pthread_mutex_unlock(&locked_set_mutex);                                   \
+    found;                                                                     \
+  })
+
+#define spin_add(entry) set_sharded_add(spin_set, entry)
+#define spin_has(entry) set_sharded_has(spin_set, entry)
+#define rw_add(entry) set_sharded_add(rw_set, entry)
+#define rw_has(entry) set_sharded_has(rw_set, entry)
+
+WORKER(locked_worker, locked_add, locked_has)
+WORKER(spin_worker, spin_add, spin_has)
+WORKER(rw_worker, rw_add, rw_has)
+
+static void run(const char *name, void *(*worker)(void *)) {
+  pthread_t threads[MAX_THREADS];
+  double start = now_ms();
+  for (uintptr_t i = 0; i < thread_count; i++) {
+    pthread_create(&threads[i], NULL, worker, (void *)i);
+  }
+  for (size_t i = 0; i < thread_count; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  double elapsed = now_ms() - start;
+  printf("%-20s %2zu threads %8.1f ms %8.2f Mops/s\n", name, thread_count,
+         elapsed, 3.0 * ENTRY_COUNT / elapsed / 1000.0);
+}
+
+int main(void) {
+  for (thread_count = 1; thread_count <= MAX_THREADS; thread_count *= 2) {
+    set_init(locked_set, hash_fn, equals_fn);
+    run("one mutex", locked_worker);
+    set_free(locked_set);
+
+    set_sharded_init(spin_set, hash_fn, equals_fn);
+    run("sharded, spinlocks", spin_worker);
+    set_sharded_free(spin_set);
+
+    set_sharded_init(rw_set, hash_fn, equals_fn);
+    run("sharded, rwlocks", rw_worker);
+    set_sharded_free(rw_set);
+  }
+}
@@ -0,0 +1,70 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "set.h"
+
+#define ENTRY_COUNT (1 << 20)
+#define ROUNDS 100
+
+uint64_t hash_fn(uint32_t value) { return value * 0x9E3779B97F4A7C15ull; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void report(const char *name, double start) {
+  printf("%-32s %10.4f ms per round\n", name, (now_ms() - start) / ROUNDS);
+}
+
+int main(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < ENTRY_COUNT; i++) {
+    set_add(set, i);
+  }
+
+  // What a writable copy per command costs
+  uint32_t entry = ENTRY_COUNT;
+  double start = now_ms();
+  for (int i = 0; i < ROUNDS; i++) {
+    set_t clone = set_clone(set);
+    set_add(clone, entry);
+    set_free(clone);
+  }
+  report("set_clone + set_add", start);
+
+  // Readers taking views of a set nobody writes to
+  start = now_ms();
+  for (int i = 0; i < ROUNDS; i++) {
+    set_t snapshot = set_snapshot(set);
+    set_free(snapshot);
+  }
+  report("set_snapshot", start);
+
+  // A write after every view copies the few chunks it lands on
+  start = now_ms();
+  for (int i = 0; i < ROUNDS; i++) {
+    set_t snapshot = set_snapshot(set);
+    set_add(set, entry);
+    entry++;
+    set_free(snapshot);
+  }
+  report("set_snapshot + set_add", start);
+
+  // Views that outlive many writes copy each chunk at most once
+  start = now_ms();
+  set_t snapshot = set_snapshot(set);
+  for (int i = 0; i < ROUNDS; i++) {
+    set_add(set, entry);
+    entry++;
+  }
+  report("set_snapshot + many set_add", start);
+  set_free(snapshot);
+  set_free(set);
+}
@@ -0,0 +1,106 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "set.h"
+
+#define MAX_ENTRIES (1 << 12)
+#define LOOKUPS (1 << 22)
+
+uint64_t identity_hash_fn(uint32_t value) { return value; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+uint64_t string_hash_fn(const char *value) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (; *value != '\0'; value++) {
+    hash = (hash ^ (uint8_t)*value) * 0x100000001b3ull;
+  }
+  return hash;
+}
+bool string_equals_fn(const char *a, const char *b) {
+  return strcmp(a, b) == 0;
+}
+
+typedef set_type(uint32_t) set_t;
+typedef set_type(const char *) string_set_t;
+
+set_declare_static(ids, set_t, identity_hash_fn, equals_fn)
+set_declare_static(strings, string_set_t, string_hash_fn, string_equals_fn)
+
+static set_t set;
+static string_set_t string_set;
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void report(const char *name, size_t n, double start, size_t ops) {
+  double elapsed = now_ms() - start;
+  printf("%-32s %5zu entries %8.1f ms %8.2f Mops/s\n", name, n, elapsed,
+         ops / elapsed / 1000.0);
+}
+
+// Adds n keys, looks them up LOOKUPS times in all and removes them again.
+// The smaller the set, the more of the time goes to the calls.
+#define RUN(name, set, keys, n, add, has, remove)                              \
+  do {                                                                         \
+    double start = now_ms();                                                   \
+    size_t hits = 0;                                                           \
+    for (size_t i = 0; i < (n); i++) {                                         \
+      add(set, (keys)[i]);                                                     \
+    }                                                                          \
+    for (size_t round = 0; round < LOOKUPS / (n); round++) {                   \
+      for (size_t i = 0; i < (n); i++) {                                       \
+        hits += has(set, (keys)[(i * 2654435761u) % (n)]);                     \
+      }                                                                        \
+    }                                                                          \
+    for (size_t i = 0; i < (n); i++) {                                         \
+      remove(set, (keys)[i]);                                                  \
+    }                                                                          \
+    report(name, n, start, LOOKUPS + 2 * (n));                                 \
+    if (hits != LOOKUPS) {                                                     \
+      printf("missing entries\n");                                             \
+    }                                                                          \
+  } while (0)
+
+#define pointer_add(set, entry) ids_add(&set, entry)
+#define pointer_has(set, entry) ids_has(&set, entry)
+#define pointer_remove(set, entry) ids_remove(&set, entry)
+#define string_add(set, entry) strings_add(&set, entry)
+#define string_has(set, entry) strings_has(&set, entry)
+#define string_remove(set, entry) strings_remove(&set, entry)
+
+int main(void) {
+  uint32_t *ints = malloc(sizeof(uint32_t) * MAX_ENTRIES);
+  for (uint32_t i = 0; i < MAX_ENTRIES; i++) {
+    ints[i] = i * 2654435761u;
+  }
+  char(*buffers)[16] = malloc(16 * MAX_ENTRIES);
+  const char **strings = malloc(sizeof(char *) * MAX_ENTRIES);
+  for (uint32_t i = 0; i < MAX_ENTRIES; i++) {
+    snprintf(buffers[i], 16, "key-%u", i);
+    strings[i] = buffers[i];
+  }
+
+  set_init(set, identity_hash_fn, equals_fn);
+  set_init(string_set, string_hash_fn, string_equals_fn);
+  for (size_t n = 64; n <= MAX_ENTRIES; n *= 8) {
+    RUN("uint32_t, function pointers", set, ints, n, set_add, set_has,
+        set_remove);
+    RUN("uint32_t, set_declare_static", set, ints, n, pointer_add,
+        pointer_has, pointer_remove);
+    RUN("string, function pointers", string_set, strings, n, set_add,
+        set_has, set_remove);
+    RUN("string, set_declare_static", string_set, strings, n, string_add,
+        string_has, string_remove);
+  }
+  set_free(set);
+  set_free(string_set);
+
+  free(ints);
+  free(buffers);
+  free(strings);
+}
@@ -21,12 +21,72 @@
 #endif
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#ifndef SET_SHARED_NIL
+#define SET_SHARED_NIL false
+#endif // !SET_SHARED_NIL
+
+#ifndef SET_SUBTREE_COUNTS
+#define SET_SUBTREE_COUNTS true
+#endif // !SET_SUBTREE_COUNTS
+
+/* With SET_NODE_FLAGS, tree nodes also carry their own color and inited bits,
+ * so checking them reads the node instead of two bitmaps beside it. The bits
+ * come out of the subtree count, which then tops out at 2^30 - 1. */
+#ifndef SET_NODE_FLAGS
+#define SET_NODE_FLAGS false
+#endif // !SET_NODE_FLAGS
+
+/* Most slots a tree set grows to. With SET_NODE_FLAGS, more would overflow
+ * the 30-bit subtree counts. */
+#define TREE_MAX_CAPACITY (SET_NODE_FLAGS ? (size_t)1 << 30 : SIZE_MAX)
+
+/* Default growth policy of new sets, see set_growth_policy() */
+#ifndef SET_GROWTH_PERCENT
+#define SET_GROWTH_PERCENT 200
+#endif // !SET_GROWTH_PERCENT
+
+#ifndef SET_GROWTH_INCREMENT
+#define SET_GROWTH_INCREMENT 0
+#endif // !SET_GROWTH_INCREMENT
+
+/* Fewest entries of the larger input per thread of the parallel set
+ * algebra, so that the work of a range covers starting its thread */
+#ifndef SET_PARALLEL_MIN_RANGE
+#define SET_PARALLEL_MIN_RANGE 4096
+#endif // !SET_PARALLEL_MIN_RANGE
+
+/* Tree sets share their storage with snapshots in chunks of this many bytes,
+ * a multiple of the page size. A write copies the chunk it lands in. */
+#ifndef SET_SNAPSHOT_CHUNK
+#define SET_SNAPSHOT_CHUNK (64 << 10)
+#endif // !SET_SNAPSHOT_CHUNK
 
 #define HASH_NIL 0
 #define IDX_NIL 0
@@ -47,6 +107,53 @@
 
 #define TREE_SIZE_LIMIT 4294967295
 
+/* Number of lookups the batched lookups keep in flight at once */
+#define TREE_BATCH_WIDTH 16
+
+#define SET_BACKEND_TREE 1
+#define SET_BACKEND_FLAT 2
+#define SET_BACKEND_BTREE 3
+#define SET_BACKEND_FROZEN 4
+
+/* Node orders for set_compact() */
+#define SET_LAYOUT_BFS 1
+#define SET_LAYOUT_VEB 2
+
+/* Files written by set_save(). The magic number also rejects files written
+ * on a machine of the other byte order. */
+#define SET_FILE_MAGIC 0x48544553 // "SETH"
+#define SET_FILE_VERSION 1
+#define SET_FILE_HEADER_SIZE 64
+#define SET_FILE_SHARED_NIL 1
+#define SET_FILE_SUBTREE_COUNTS 2
+#define SET_FILE_NODE_FLAGS 4
+
+/* States of a set_checkpoint_t */
+#define SET_CHECKPOINT_RUNNING 0
+#define SET_CHECKPOINT_DONE 1
+#define SET_CHECKPOINT_FAILED 2
+
+/* Reader threads a set_concurrent_type() can register */
+#ifndef SET_MAX_READERS
+#define SET_MAX_READERS 64
+#endif // !SET_MAX_READERS
+
+/* Locks guarding the shards of a set_sharded_type() */
+#define SET_SHARD_SPINLOCK 1
+#define SET_SHARD_RWLOCK 2
+
+#define BTREE_NODE_KEYS 16
+#define BTREE_NODE_CHUNK 8
+
+#define FLAT_CTRL_EMPTY 0x80
+#define FLAT_CTRL_DELETED 0xFE
+#define FLAT_GROUP_WIDTH 16
+
+/* With SET_SHARED_NIL, every leaf points at this single black sentinel slot,
+ * which tree_init allocates first. Only tree_transplant writes its parent,
+ * which the delete fixup then reads. */
+#define TREE_SHARED_NIL_ADDR 1
+
 typedef uint32_t tree_addr_t;
 typedef uint32_t tree_idx_t;
 
@@ -54,6 +161,13 @@ typedef struct {
   tree_addr_t left;
   tree_addr_t right;
   tree_addr_t parent;
+#if SET_NODE_FLAGS
+  uint32_t count : 30;
+  uint32_t colors_bit : 1;
+  uint32_t inited_bit : 1;
+#else
+  uint32_t count;
+#endif
   uint64_t hash;
 } tree_node_t;
 
@@ -62,126 +176,2684 @@ typedef struct {
   tree_addr_t prev;
 } tree_collision_t;
 
-#define ALLOC_CHUNK 512
+/* A tree set cannot grow past TREE_MAX_CAPACITY, and wrapping its subtree
+ * counts would corrupt it, so it stops the program instead */
+static inline void tree_capacity_exceeded(void) {
+  assert(!"tree set grown past TREE_MAX_CAPACITY");
+  abort();
+}
 
-/* Actually freeing and remallocing seems like a really expensive way to
- * do this, let's try to find something better */
+typedef struct {
+  uint64_t hash;
+  tree_addr_t addr;
+} tree_hash_pair_t;
 
-#define map_add(map, key_var, value_var)                                       \
-  do {                                                                         \
-    tree_addr_t leaf_addr = tree_add(map, key_var, map_alloc_new_node,         \
-                                     map_write_key, map_find_duplicate);       \
-                                                                               \
-    if (tree_is_valid_addr(leaf_addr)) {                                       \
-      map_write_value(map, leaf_addr, value_var);                              \
-    }                                                                          \
-  } while (0)
+/* Allocator for the buffers a set or map owns, chosen per instance with
+ * set_init_with_allocator(). alloc gets an alignment of 0 for the alignment
+ * of malloc(); realloc is only called on blocks allocated that way. ctx is
+ * passed to every call. */
+typedef struct {
+  void *(*alloc)(void *ctx, size_t size, size_t align);
+  void *(*realloc)(void *ctx, void *ptr, size_t size);
+  void (*free)(void *ctx, void *ptr);
+  void *ctx;
+} set_allocator_t;
 
-#define map_alloc_new_node(map)                                                \
-  tree_alloc_new_node(map, map_create_entry, map_realloc_entries)
+static inline void *tree_libc_alloc(void *ctx, size_t size, size_t align) {
+  (void)ctx;
+  if (align == 0) {
+    return malloc(size);
+  }
+  return aligned_alloc(align, (size + align - 1) / align * align);
+}
 
-#define map_clear_entry(map, addr)                                             \
-  do {                                                                         \
-    tree_idx_t clear_idx = tree_idx(addr);                                     \
-    assert(map.capacity > clear_idx);                                          \
-    memset(&map.keys[clear_idx], 0x00, sizeof(typeof(map.keys)));              \
-    memset(&map.values[clear_idx], 0x00, sizeof(typeof(map.values)));          \
-  } while (0)
+static inline void *tree_libc_realloc(void *ctx, void *ptr, size_t size) {
+  (void)ctx;
+  return realloc(ptr, size);
+}
 
-#define map_clone(map)                                                         \
-  tree_clone(set, map_malloc_entries, map_get_key, map_write_key)
+static inline void tree_libc_free(void *ctx, void *ptr) {
+  (void)ctx;
+  free(ptr);
+}
 
-#define map_create_entry(map, idx)                                             \
-  do {                                                                         \
-    memset(&map.keys[idx], 0x00, sizeof(typeof(*map.keys)));                   \
-    memset(&map.values[idx], 0x00, sizeof(typeof(*map.values)));               \
-  } while (0)
+/* The default allocator, which calls malloc(), realloc() and free() */
+static inline const set_allocator_t *set_libc_allocator(void) {
+  static const set_allocator_t allocator = {
+      .alloc = tree_libc_alloc,
+      .realloc = tree_libc_realloc,
+      .free = tree_libc_free,
+      .ctx = NULL,
+  };
+  return &allocator;
+}
 
-#define map_empty(map) tree_empty(map, map_init, map_free)
+/* B+tree node of four cache lines. Leaves map sorted hashes to entry
+ * addresses, with equal hashes next to each other. Internal nodes hold child
+ * node addresses and the largest hash below every child but the last. Unused
+ * hash slots are UINT64_MAX so that searches can scan the whole node. */
+typedef struct {
+  uint64_t hashes[BTREE_NODE_KEYS];
+  tree_addr_t children[BTREE_NODE_KEYS];
+  tree_addr_t parent;
+  tree_addr_t next;
+  tree_addr_t prev;
+  uint16_t count;
+  bool is_leaf;
+} __attribute__((aligned(64))) btree_node_t;
 
-#define map_find_duplicate(map, node_addr, key_var)                            \
-  tree_find_duplicate(map, node_addr, key_var, map_get_key, keys)
+typedef struct {
+  tree_addr_t leaf;
+  uint32_t pos;
+} btree_cursor_t;
 
-#define map_find_node_entry(map, hash_value, key_var)                          \
-  tree_find_node_entry(map, hash_value, key_var, map_find_duplicate)
+/* Number of hashes in the node below hash, without branching on the keys */
+static inline uint32_t btree_count_less(const btree_node_t *node,
+                                        uint64_t hash) {
+  uint32_t count = 0;
+#ifdef __AVX2__
+  /* AVX2 only compares signed 64-bit lanes, so flip the sign bits first */
+  const __m256i bias = _mm256_set1_epi64x((long long)0x8000000000000000ull);
+  __m256i needle = _mm256_xor_si256(_mm256_set1_epi64x((long long)hash), bias);
+  for (int i = 0; i < BTREE_NODE_KEYS; i += 4) {
+    __m256i keys = _mm256_xor_si256(
+        _mm256_load_si256((const __m256i *)&node->hashes[i]), bias);
+    __m256i less = _mm256_cmpgt_epi64(needle, keys);
+    count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(less)));
+  }
+#else
+  for (int i = 0; i < BTREE_NODE_KEYS; i++) {
+    count += node->hashes[i] < hash;
+  }
+#endif
+  return count;
+}
 
-#define map_free(map) tree_free(map, map_free_data)
+/* Slice of the hash-sorted entries column that shares one hash */
+typedef struct {
+  tree_idx_t start;
+  tree_idx_t end;
+} frozen_run_t;
 
-#define map_free_data(set)                                                     \
-  do {                                                                         \
-    free(set.keys);                                                            \
-    free(set.values);                                                          \
-  } while (0)
+/* First SET_FILE_HEADER_SIZE bytes of a saved set. The storage block of the
+ * tree follows as it is in memory, so that addresses stay valid. */
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t flags;
+  uint32_t entry_bytes;
+  uint64_t capacity;
+  uint64_t size;
+  uint64_t storage_bytes;
+  tree_addr_t root;
+  tree_addr_t free_list_start;
+  uint64_t data_checksum;
+  uint64_t header_checksum;
+} tree_file_header_t;
+
+_Static_assert(sizeof(tree_file_header_t) == SET_FILE_HEADER_SIZE,
+               "the file header must fill SET_FILE_HEADER_SIZE bytes");
+
+/* Storage of a tree set shared with its snapshots. The block lives in an
+ * anonymous file cut into SET_SNAPSHOT_CHUNK chunks, and every handle maps
+ * the file chunks of its version in order into a range of its own, so its
+ * columns stay contiguous. refs counts the handles mapping each file chunk;
+ * free_chunks holds the ones no handle maps. */
+typedef struct {
+  pthread_mutex_t lock;
+  int fd;
+  uint32_t handles;
+  size_t chunks;
+  size_t file_chunks;
+  uint32_t *refs;
+  uint32_t *free_chunks;
+  size_t free_count;
+} tree_cow_t;
+
+/* Set in the chunk map of a handle for chunks no other handle maps, which
+ * it writes in place */
+#define TREE_COW_OWNED 0x80000000u
+
+/* A set_save() running in a forked child, see set_checkpoint(). cow and
+ * cow_chunks keep the chunks of a snapshot-sharing set it writes alive. */
+typedef struct {
+  pid_t pid;
+  int state;
+  uint64_t total_bytes;
+  uint64_t bytes_written;
+  uint64_t *shared_written;
+  tree_cow_t *cow;
+  uint32_t *cow_chunks;
+} set_checkpoint_t;
+
+/* Stable LSD radix sort of pairs by hash, one byte per pass. Passes where
+ * every hash has the same byte are skipped, which is most of them for small
+ * hash values. Scratch must hold n pairs as well. */
+static inline void tree_radix_sort(tree_hash_pair_t *pairs,
+                                   tree_hash_pair_t *scratch, size_t n) {
+  size_t counts[8][256] = {{0}};
+  for (size_t i = 0; i < n; i++) {
+    for (int byte = 0; byte < 8; byte++) {
+      counts[byte][(pairs[i].hash >> (byte * 8)) & 0xFF]++;
+    }
+  }
+
+  tree_hash_pair_t *from = pairs;
+  tree_hash_pair_t *to = scratch;
+  for (int byte = 0; byte < 8; byte++) {
+    size_t *count = counts[byte];
+    if (n == 0 || count[(from[0].hash >> (byte * 8)) & 0xFF] == n) {
+      continue;
+    }
+    size_t offset = 0;
+    for (int bucket = 0; bucket < 256; bucket++) {
+      size_t bucket_count = count[bucket];
+      count[bucket] = offset;
+      offset += bucket_count;
+    }
+    for (size_t i = 0; i < n; i++) {
+      to[count[(from[i].hash >> (byte * 8)) & 0xFF]++] = from[i];
+    }
+    tree_hash_pair_t *swap = from;
+    from = to;
+    to = swap;
+  }
+
+  if (from != pairs) {
+    memcpy(pairs, from, sizeof(tree_hash_pair_t) * n);
+  }
+}
+
+/* Writes the distinct hashes of n sorted pairs in Eytzinger order (the root
+ * at 1, the children of k at 2k and 2k + 1) by walking it in order. The run
+ * of entries for each hash goes in the same position of runs. */
+static inline void frozen_eytzinger_fill(uint64_t *hashes, frozen_run_t *runs,
+                                         const tree_hash_pair_t *sorted,
+                                         size_t n, size_t count) {
+  size_t k = 1;
+  while (2 * k <= count) {
+    k *= 2;
+  }
+  size_t i = 0;
+  for (size_t rank = 0; rank < count; rank++) {
+    size_t start = i;
+    uint64_t hash = sorted[i].hash;
+    while (i < n && sorted[i].hash == hash) {
+      i++;
+    }
+    hashes[k] = hash;
+    runs[k] = (frozen_run_t){.start = start, .end = i};
+
+    if (2 * k + 1 <= count) {
+      k = 2 * k + 1;
+      while (2 * k <= count) {
+        k *= 2;
+      }
+    } else {
+      while (k & 1) {
+        k >>= 1;
+      }
+      k >>= 1;
+    }
+  }
+}
+
+/* Control byte scans over one probe group of the flat backend. Each returns a
+ * 16-bit mask with bit i set when byte i of the group matches. Full slots hold
+ * the low 7 hash bits, so their high bit is always clear. */
+#ifndef __SSE2__
+static inline uint64_t flat_swar_load(const uint8_t *ctrl) {
+  uint64_t word;
+  memcpy(&word, ctrl, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  word = __builtin_bswap64(word);
+#endif
+  return word;
+}
+
+/* Gathers the high bit of every byte into the low 8 bits */
+static inline uint32_t flat_swar_movemask(uint64_t word) {
+  word = (word & 0x8080808080808080ull) >> 7;
+  return (uint32_t)((word * 0x0102040810204080ull) >> 56);
+}
+#endif
+
+static inline uint32_t flat_group_match(const uint8_t *group, uint8_t h2) {
+#ifdef __SSE2__
+  __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)h2)));
+#else
+  /* May report false positives next to a true match, which the caller's
+   * equality check filters out */
+  uint32_t mask = 0;
+  for (int i = 0; i < 2; i++) {
+    uint64_t x = flat_swar_load(&group[i * 8]) ^ (0x0101010101010101ull * h2);
+    mask |= flat_swar_movemask((x - 0x0101010101010101ull) & ~x) << (i * 8);
+  }
+  return mask;
+#endif
+}
+
+static inline uint32_t flat_group_match_empty(const uint8_t *group) {
+#ifdef __SSE2__
+  __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+  return _mm_movemask_epi8(
+      _mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)FLAT_CTRL_EMPTY)));
+#else
+  uint32_t mask = 0;
+  for (int i = 0; i < 2; i++) {
+    uint64_t word = flat_swar_load(&group[i * 8]);
+    mask |= flat_swar_movemask(word & (~word << 6)) << (i * 8);
+  }
+  return mask;
+#endif
+}
+
+static inline uint32_t flat_group_match_empty_or_deleted(const uint8_t *group) {
+#ifdef __SSE2__
+  return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+  return flat_swar_movemask(flat_swar_load(group)) |
+         flat_swar_movemask(flat_swar_load(&group[8])) << 8;
+#endif
+}
+
+/* Spreads user hashes (often the identity) over the probe group index and
+ * the 7 control bits */
+static inline uint64_t flat_mix(uint64_t hash) {
+  hash *= 0x9E3779B97F4A7C15ull;
+  return hash ^ (hash >> 32);
+}
+
+/* Index of the first set bit at or after from in a bitmap of n_bytes bytes
+ * (bit i in byte i / 8), or n_bytes * 8 if there is none. Reads a word at a
+ * time, and skips 256 bits at a time through empty stretches with AVX2. */
+static inline size_t tree_bitmap_next(const uint8_t *bits, size_t n_bytes,
+                                      size_t from) {
+  size_t n_bits = n_bytes * 8;
+  size_t word_i = from / 64;
+  size_t n_words = (n_bytes + 7) / 8;
+  if (from >= n_bits) {
+    return n_bits;
+  }
+  uint64_t word = 0;
+  while (true) {
+    size_t word_bytes = n_bytes - word_i * 8 < 8 ? n_bytes - word_i * 8 : 8;
+    word = 0;
+    memcpy(&word, &bits[word_i * 8], word_bytes);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    if (word_i == from / 64) {
+      word &= ~0ull << (from % 64);
+    }
+    if (word != 0) {
+      return word_i * 64 + __builtin_ctzll(word);
+    }
+    word_i++;
+#ifdef __AVX2__
+    while (word_i + 4 <= n_bytes / 8) {
+      __m256i block = _mm256_loadu_si256((const __m256i *)&bits[word_i * 8]);
+      if (!_mm256_testz_si256(block, block)) {
+        break;
+      }
+      word_i += 4;
+    }
+#endif
+    if (word_i >= n_words) {
+      return n_bits;
+    }
+  }
+}
+
+static inline bool tree_layout_is_inited(const uint8_t *inited,
+                                         tree_addr_t addr) {
+  tree_idx_t idx = addr - 1;
+  return addr != 0 && (inited[idx / 8] >> (idx % 8) & 1) != 0;
+}
+
+/* Writes the inited nodes below root to order level by level, using order
+ * itself as the queue, and returns how many there are */
+static inline size_t tree_layout_bfs(const tree_node_t *nodes,
+                                     const uint8_t *inited, tree_addr_t root,
+                                     tree_addr_t *order) {
+  size_t n = 0;
+  if (tree_layout_is_inited(inited, root)) {
+    order[n++] = root;
+  }
+  for (size_t i = 0; i < n; i++) {
+    const tree_node_t *node = &nodes[order[i] - 1];
+    if (tree_layout_is_inited(inited, node->left)) {
+      order[n++] = node->left;
+    }
+    if (tree_layout_is_inited(inited, node->right)) {
+      order[n++] = node->right;
+    }
+  }
+  return n;
+}
+
+static inline int tree_layout_height(const tree_node_t *nodes,
+                                     const uint8_t *inited, tree_addr_t addr) {
+  if (!tree_layout_is_inited(inited, addr)) {
+    return 0;
+  }
+  int left = tree_layout_height(nodes, inited, nodes[addr - 1].left);
+  int right = tree_layout_height(nodes, inited, nodes[addr - 1].right);
+  return 1 + (left > right ? left : right);
+}
+
+/* Van Emde Boas order: the top half of the levels below addr are laid out
+ * first, then every subtree hanging off them, each recursively in the same
+ * way, so that a search touches O(log_B n) blocks of any size B. skip levels
+ * are descended without output to reach the roots of those subtrees. */
+static inline void tree_layout_veb(const tree_node_t *nodes,
+                                   const uint8_t *inited, tree_addr_t addr,
+                                   int skip, int height, tree_addr_t *order,
+                                   size_t *n) {
+  if (!tree_layout_is_inited(inited, addr)) {
+    return;
+  }
+  if (skip > 0) {
+    tree_layout_veb(nodes, inited, nodes[addr - 1].left, skip - 1, height,
+                    order, n);
+    tree_layout_veb(nodes, inited, nodes[addr - 1].right, skip - 1, height,
+                    order, n);
+  } else if (height == 1) {
+    order[(*n)++] = addr;
+  } else {
+    int top = height / 2;
+    tree_layout_veb(nodes, inited, addr, 0, top, order, n);
+    tree_layout_veb(nodes, inited, addr, top, height - top, order, n);
+  }
+}
+
+/* Not a cryptographic hash, only there to catch torn and corrupted files.
+ * Continues from checksum, so that data can be fed in parts. n must be a
+ * multiple of 8. */
+static inline uint64_t tree_file_checksum(uint64_t checksum, const void *data,
+                                          size_t n) {
+  const unsigned char *bytes = data;
+  for (size_t i = 0; i < n; i += 8) {
+    uint64_t word;
+    memcpy(&word, &bytes[i], sizeof(word));
+    checksum = (checksum ^ word) * 0x9E3779B97F4A7C15ull;
+    checksum ^= checksum >> 29;
+  }
+  return checksum;
+}
+
+static inline uint64_t tree_file_header_checksum(const tree_file_header_t *h) {
+  return tree_file_checksum(0, h,
+                            offsetof(tree_file_header_t, header_checksum));
+}
+
+/* Checks everything in the header that can be checked without reading the
+ * data, which keeps opening a large file down to a few page faults */
+static inline bool tree_file_header_ok(const tree_file_header_t *header,
+                                       size_t file_bytes, uint32_t flags,
+                                       uint32_t entry_bytes) {
+  return file_bytes >= SET_FILE_HEADER_SIZE &&
+         header->magic == SET_FILE_MAGIC &&
+         header->version == SET_FILE_VERSION &&
+         header->header_checksum == tree_file_header_checksum(header) &&
+         header->flags == flags && header->entry_bytes == entry_bytes &&
+         header->storage_bytes == file_bytes - SET_FILE_HEADER_SIZE &&
+         header->capacity % 8 == 0 && header->capacity <= TREE_SIZE_LIMIT &&
+         header->size <= header->capacity;
+}
+
+/* Maps a whole file privately, so that writes to the mapping stay in memory.
+ * Returns NULL, with *bytes left alone, if that fails. */
+static inline char *tree_file_map(const char *path, size_t *bytes) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  void *base = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= SET_FILE_HEADER_SIZE) {
+    base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (base == MAP_FAILED) {
+    return NULL;
+  }
+  *bytes = st.st_size;
+  return base;
+}
+
+/* An anonymous file for a tree_cow_t, or -1 */
+static inline int tree_cow_file(void) {
+#ifdef SYS_memfd_create
+  return (int)syscall(SYS_memfd_create, "set.h", 1 /* MFD_CLOEXEC */);
+#else
+  static uint32_t files = 0;
+  char name[64];
+  snprintf(name, sizeof(name), "/set.h.%ld.%u", (long)getpid(),
+           __atomic_fetch_add(&files, 1, __ATOMIC_RELAXED));
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd >= 0) {
+    shm_unlink(name);
+  }
+  return fd;
+#endif
+}
 
-#define map_get(map, key)                                                      \
+/* Maps the file chunks listed in map into a fresh range, each run of
+ * consecutive ones with one call. Returns NULL if that fails. */
+static inline char *tree_cow_map(const tree_cow_t *cow, const uint32_t *map,
+                                 int prot) {
+  size_t bytes = cow->chunks * SET_SNAPSHOT_CHUNK;
+  char *base =
+      mmap(NULL, bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) {
+    return NULL;
+  }
+  size_t run;
+  for (size_t i = 0; i < cow->chunks; i += run) {
+    uint32_t first = map[i] & ~TREE_COW_OWNED;
+    for (run = 1; i + run < cow->chunks &&
+                  (map[i + run] & ~TREE_COW_OWNED) == first + run;
+         run++) {
+    }
+    if (mmap(base + i * SET_SNAPSHOT_CHUNK, run * SET_SNAPSHOT_CHUNK, prot,
+             MAP_SHARED | MAP_FIXED, cow->fd,
+             (off_t)first * SET_SNAPSHOT_CHUNK) == MAP_FAILED) {
+      munmap(base, bytes);
+      return NULL;
+    }
+  }
+  return base;
+}
+
+/* Moves a storage block of bytes into the chunks of a new tree_cow_t, all
+ * owned by the one handle on them, whose chunk map goes to *map and range to
+ * *base. Returns NULL, with block left alone, if that fails. */
+static inline tree_cow_t *tree_cow_create(const char *block, size_t bytes,
+                                          uint32_t **map, char **base) {
+  tree_cow_t *cow = calloc(1, sizeof(tree_cow_t));
+  cow->chunks = (bytes + SET_SNAPSHOT_CHUNK - 1) / SET_SNAPSHOT_CHUNK;
+  cow->file_chunks = cow->chunks;
+  cow->handles = 1;
+  cow->refs = malloc(sizeof(uint32_t) * cow->chunks);
+  cow->free_chunks = malloc(sizeof(uint32_t) * cow->chunks);
+  *map = malloc(sizeof(uint32_t) * cow->chunks);
+  for (size_t i = 0; i < cow->chunks; i++) {
+    cow->refs[i] = 1;
+    (*map)[i] = (uint32_t)i | TREE_COW_OWNED;
+  }
+
+  cow->fd = tree_cow_file();
+  bool ok = cow->fd >= 0 && cow->chunks < TREE_COW_OWNED &&
+            ftruncate(cow->fd, (off_t)(cow->chunks * SET_SNAPSHOT_CHUNK)) == 0;
+  size_t done = 0;
+  while (ok && done < bytes) {
+    ssize_t n = pwrite(cow->fd, block + done, bytes - done, (off_t)done);
+    ok = n > 0 || (n < 0 && errno == EINTR);
+    done += n > 0 ? (size_t)n : 0;
+  }
+  *base = ok ? tree_cow_map(cow, *map, PROT_READ | PROT_WRITE) : NULL;
+  if (*base == NULL) {
+    if (cow->fd >= 0) {
+      close(cow->fd);
+    }
+    free(*map);
+    free(cow->free_chunks);
+    free(cow->refs);
+    free(cow);
+    return NULL;
+  }
+  pthread_mutex_init(&cow->lock, NULL);
+  return cow;
+}
+
+/* Adds a handle on the chunks in map and returns its chunk map. The handle
+ * of map, mapped at base, no longer owns any of them, and its range turns
+ * read-only so that a write that skips tree_touch() faults. */
+static inline uint32_t *tree_cow_pin(tree_cow_t *cow, uint32_t *map,
+                                     char *base) {
+  uint32_t *pinned = malloc(sizeof(uint32_t) * cow->chunks);
+  pthread_mutex_lock(&cow->lock);
+  for (size_t i = 0; i < cow->chunks; i++) {
+    if (map[i] & TREE_COW_OWNED) {
+      map[i] &= ~TREE_COW_OWNED;
+    }
+    pinned[i] = map[i];
+    cow->refs[map[i]]++;
+  }
+  cow->handles++;
+  pthread_mutex_unlock(&cow->lock);
+  mprotect(base, cow->chunks * SET_SNAPSHOT_CHUNK, PROT_READ);
+  return pinned;
+}
+
+/* A file chunk no handle maps, doubling the file when there is none, or
+ * UINT32_MAX if the file cannot grow */
+static inline uint32_t tree_cow_take(tree_cow_t *cow) {
+  if (cow->free_count == 0) {
+    size_t grown = cow->file_chunks * 2;
+    if (grown > TREE_COW_OWNED ||
+        ftruncate(cow->fd, (off_t)(grown * SET_SNAPSHOT_CHUNK)) != 0) {
+      return UINT32_MAX;
+    }
+    cow->refs = realloc(cow->refs, sizeof(uint32_t) * grown);
+    cow->free_chunks = realloc(cow->free_chunks, sizeof(uint32_t) * grown);
+    /* Lowest first, so that copied chunks tend to line up in the file */
+    for (size_t i = grown; i-- > cow->file_chunks;) {
+      cow->refs[i] = 0;
+      cow->free_chunks[cow->free_count++] = (uint32_t)i;
+    }
+    cow->file_chunks = grown;
+  }
+  return cow->free_chunks[--cow->free_count];
+}
+
+/* Gives the handle with map and base chunk i of its own to write: in place
+ * once no other handle maps it, otherwise by copying it into a free file
+ * chunk mapped over it. Stops the program if that fails, since the write
+ * cannot go anywhere else. */
+static inline void tree_cow_own(tree_cow_t *cow, uint32_t *map, char *base,
+                                size_t i) {
+  char *chunk = base + i * SET_SNAPSHOT_CHUNK;
+  uint32_t file_chunk = map[i];
+  pthread_mutex_lock(&cow->lock);
+  bool ok;
+  if (cow->refs[file_chunk] == 1) {
+    ok = mprotect(chunk, SET_SNAPSHOT_CHUNK, PROT_READ | PROT_WRITE) == 0;
+  } else {
+    uint32_t fresh = tree_cow_take(cow);
+    off_t offset = (off_t)fresh * SET_SNAPSHOT_CHUNK;
+    ok = fresh != UINT32_MAX &&
+         pwrite(cow->fd, chunk, SET_SNAPSHOT_CHUNK, offset) ==
+             SET_SNAPSHOT_CHUNK &&
+         mmap(chunk, SET_SNAPSHOT_CHUNK, PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_FIXED, cow->fd, offset) != MAP_FAILED;
+    if (ok) {
+      cow->refs[file_chunk]--;
+      cow->refs[fresh] = 1;
+      file_chunk = fresh;
+    }
+  }
+  pthread_mutex_unlock(&cow->lock);
+  if (!ok) {
+    assert(!"copying a chunk shared with a snapshot failed");
+    abort();
+  }
+  map[i] = file_chunk | TREE_COW_OWNED;
+}
+
+/* Copy on write of the chunks under bytes at ptr, before they change */
+static inline void tree_cow_touch(tree_cow_t *cow, uint32_t *map, char *base,
+                                  const void *ptr, size_t bytes) {
+  size_t offset = (size_t)((const char *)ptr - base);
+  size_t last = (offset + bytes - 1) / SET_SNAPSHOT_CHUNK;
+  for (size_t i = offset / SET_SNAPSHOT_CHUNK; i <= last; i++) {
+    if (!(map[i] & TREE_COW_OWNED)) {
+      tree_cow_own(cow, map, base, i);
+    }
+  }
+}
+
+/* Drops the handle with map, and unmaps its range at base unless that is
+ * NULL. Chunks no handle maps anymore are freed, and the file goes with the
+ * last handle. */
+static inline void tree_cow_release(tree_cow_t *cow, uint32_t *map,
+                                    char *base) {
+  pthread_mutex_lock(&cow->lock);
+  bool last = --cow->handles == 0;
+  for (size_t i = 0; i < cow->chunks && !last; i++) {
+    uint32_t file_chunk = map[i] & ~TREE_COW_OWNED;
+    if (--cow->refs[file_chunk] == 0) {
+      cow->free_chunks[cow->free_count++] = file_chunk;
+#ifdef FALLOC_FL_PUNCH_HOLE
+      fallocate(cow->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                (off_t)file_chunk * SET_SNAPSHOT_CHUNK, SET_SNAPSHOT_CHUNK);
+#endif
+    }
+  }
+  pthread_mutex_unlock(&cow->lock);
+  if (base != NULL) {
+    munmap(base, cow->chunks * SET_SNAPSHOT_CHUNK);
+  }
+  free(map);
+  if (last) {
+    close(cow->fd);
+    free(cow->free_chunks);
+    free(cow->refs);
+    pthread_mutex_destroy(&cow->lock);
+    free(cow);
+  }
+}
+
+/* Writes header and data to a temporary file next to path, then renames it
+ * over path, so that processes that have the old file mapped keep it. Sticks
+ * to system calls without malloc(), since checkpoints run this in a forked
+ * child. The count of data bytes written so far goes to written, if set. */
+static inline bool tree_file_write(const char *path, tree_file_header_t header,
+                                   const void *data, uint64_t *written) {
+  size_t path_len = strlen(path);
+  char tmp_path[path_len + sizeof(".tmp")];
+  memcpy(tmp_path, path, path_len);
+  memcpy(&tmp_path[path_len], ".tmp", sizeof(".tmp"));
+  int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+
+  /* The data goes first, so that its checksum is known for the header */
+  const char *bytes = data;
+  uint64_t checksum = header.storage_bytes;
+  uint64_t done = 0;
+  bool ok = lseek(fd, SET_FILE_HEADER_SIZE, SEEK_SET) >= 0;
+  while (ok && done < header.storage_bytes) {
+    size_t chunk = header.storage_bytes - done;
+    chunk = chunk < (1 << 20) ? chunk : (1 << 20);
+    ssize_t n = write(fd, &bytes[done], chunk);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    /* Short writes only happen once the disk is full */
+    ok = n > 0 && (size_t)n % 8 == 0;
+    if (ok) {
+      checksum = tree_file_checksum(checksum, &bytes[done], n);
+      done += n;
+      if (written != NULL) {
+        __atomic_store_n(written, done, __ATOMIC_RELAXED);
+      }
+    }
+  }
+  header.data_checksum = checksum;
+  header.header_checksum = tree_file_header_checksum(&header);
+  ok = ok && pwrite(fd, &header, sizeof(header), 0) == sizeof(header);
+  ok = ok && fsync(fd) == 0;
+  ok = close(fd) == 0 && ok;
+  ok = ok && rename(tmp_path, path) == 0;
+  if (!ok) {
+    unlink(tmp_path);
+    return false;
+  }
+
+  /* Makes the rename itself durable */
+  char dir_path[path_len + 2];
+  memcpy(dir_path, path, path_len + 1);
+  char *slash = strrchr(dir_path, '/');
+  if (slash == NULL) {
+    memcpy(dir_path, ".", 2);
+  } else if (slash == dir_path) {
+    dir_path[1] = '\0';
+  } else {
+    *slash = '\0';
+  }
+  int dir_fd = open(dir_path, O_RDONLY);
+  if (dir_fd >= 0) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+  return true;
+}
+
+/* Reads a file written by set_save() in full and checks both checksums. Use
+ * it where a bad file has to be caught before serving from it, since
+ * set_mmap_open() only checks the header. */
+static inline bool set_file_verify(const char *path) {
+  size_t bytes = 0;
+  char *base = tree_file_map(path, &bytes);
+  if (base == NULL) {
+    return false;
+  }
+  const tree_file_header_t *header = (const tree_file_header_t *)base;
+  bool ok = tree_file_header_ok(header, bytes, header->flags,
+                                header->entry_bytes) &&
+            header->data_checksum ==
+                tree_file_checksum(header->storage_bytes,
+                                   base + SET_FILE_HEADER_SIZE,
+                                   header->storage_bytes);
+  munmap(base, bytes);
+  return ok;
+}
+
+/* Forks a child that writes header and data to path and exits. The child
+ * sees the memory of this process as it was at the fork, copied on write as
+ * either side changes it, which makes the file a consistent image. Chunks
+ * shared with snapshots are mapped shared instead, so the handle cow_chunks
+ * on them, if not NULL, keeps them from changing until the child is done. */
+static inline bool tree_checkpoint_fork(set_checkpoint_t *checkpoint,
+                                        const char *path,
+                                        tree_file_header_t header,
+                                        const void *data, tree_cow_t *cow,
+                                        uint32_t *cow_chunks) {
+  /* A checkpoint that fails to start polls as failed */
+  *checkpoint = (set_checkpoint_t){
+      .pid = -1,
+      .state = SET_CHECKPOINT_FAILED,
+      .total_bytes = header.storage_bytes,
+      .shared_written = NULL,
+  };
+  void *shared = mmap(NULL, sizeof(uint64_t), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    if (cow != NULL) {
+      tree_cow_release(cow, cow_chunks, NULL);
+    }
+    return false;
+  }
+  checkpoint->shared_written = shared;
+  checkpoint->cow = cow;
+  checkpoint->cow_chunks = cow_chunks;
+  pid_t pid = fork();
+  if (pid == 0) {
+    _exit(tree_file_write(path, header, data, checkpoint->shared_written)
+              ? 0
+              : 1);
+  }
+  if (pid < 0) {
+    munmap(shared, sizeof(uint64_t));
+    checkpoint->shared_written = NULL;
+    if (cow != NULL) {
+      tree_cow_release(cow, cow_chunks, NULL);
+      checkpoint->cow = NULL;
+    }
+    return false;
+  }
+  checkpoint->pid = pid;
+  checkpoint->state = SET_CHECKPOINT_RUNNING;
+  return true;
+}
+
+static inline void tree_checkpoint_finish(set_checkpoint_t *checkpoint,
+                                          int status) {
+  checkpoint->state = WIFEXITED(status) && WEXITSTATUS(status) == 0
+                          ? SET_CHECKPOINT_DONE
+                          : SET_CHECKPOINT_FAILED;
+  checkpoint->bytes_written = *checkpoint->shared_written;
+  munmap(checkpoint->shared_written, sizeof(uint64_t));
+  checkpoint->shared_written = NULL;
+  if (checkpoint->cow != NULL) {
+    tree_cow_release(checkpoint->cow, checkpoint->cow_chunks, NULL);
+    checkpoint->cow = NULL;
+  }
+}
+
+/* Data bytes of the set written so far, out of checkpoint->total_bytes */
+static inline uint64_t
+set_checkpoint_bytes_written(const set_checkpoint_t *checkpoint) {
+  if (checkpoint->shared_written == NULL) {
+    return checkpoint->bytes_written;
+  }
+  return __atomic_load_n(checkpoint->shared_written, __ATOMIC_RELAXED);
+}
+
+/* Returns the state of a checkpoint without waiting for it */
+static inline int set_checkpoint_poll(set_checkpoint_t *checkpoint) {
+  int status;
+  if (checkpoint->state == SET_CHECKPOINT_RUNNING &&
+      waitpid(checkpoint->pid, &status, WNOHANG) == checkpoint->pid) {
+    tree_checkpoint_finish(checkpoint, status);
+  }
+  return checkpoint->state;
+}
+
+/* Waits for a checkpoint to end and returns whether the file was written */
+static inline bool set_checkpoint_wait(set_checkpoint_t *checkpoint) {
+  int status;
+  if (checkpoint->state == SET_CHECKPOINT_RUNNING) {
+    pid_t waited;
+    do {
+      waited = waitpid(checkpoint->pid, &status, 0);
+    } while (waited < 0 && errno == EINTR);
+    tree_checkpoint_finish(checkpoint, waited < 0 ? -1 : status);
+  }
+  return checkpoint->state == SET_CHECKPOINT_DONE;
+}
+
+/* Lock of one shard of a sharded set. Which member is used is fixed by the
+ * type of the set, see set_sharded_type_lock(). */
+typedef union {
+  uint32_t spin;
+  pthread_rwlock_t rw;
+} set_shard_lock_t;
+
+/* Spins on a plain load until the lock looks free, and yields the CPU every
+ * so often, so that a holder that got preempted runs again when there are
+ * more threads than cores */
+static inline void sharded_spin_lock(uint32_t *lock) {
+  uint32_t spins = 0;
+  while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE) != 0) {
+    while (__atomic_load_n(lock, __ATOMIC_RELAXED) != 0) {
+      if (++spins % 128 == 0) {
+        sched_yield();
+      } else {
+#ifdef __SSE2__
+        _mm_pause();
+#endif
+      }
+    }
+  }
+}
+
+static inline void sharded_lock_init(set_shard_lock_t *lock, size_t kind) {
+  if (kind == SET_SHARD_RWLOCK) {
+    pthread_rwlock_init(&lock->rw, NULL);
+  } else {
+    lock->spin = 0;
+  }
+}
+
+static inline void sharded_lock_destroy(set_shard_lock_t *lock, size_t kind) {
+  if (kind == SET_SHARD_RWLOCK) {
+    pthread_rwlock_destroy(&lock->rw);
+  }
+}
+
+/* Readers share a rwlock; a spinlock has one holder at a time either way */
+static inline void sharded_lock_read(set_shard_lock_t *lock, size_t kind) {
+  if (kind == SET_SHARD_RWLOCK) {
+    pthread_rwlock_rdlock(&lock->rw);
+  } else {
+    sharded_spin_lock(&lock->spin);
+  }
+}
+
+static inline void sharded_lock_write(set_shard_lock_t *lock, size_t kind) {
+  if (kind == SET_SHARD_RWLOCK) {
+    pthread_rwlock_wrlock(&lock->rw);
+  } else {
+    sharded_spin_lock(&lock->spin);
+  }
+}
+
+static inline void sharded_unlock(set_shard_lock_t *lock, size_t kind) {
+  if (kind == SET_SHARD_RWLOCK) {
+    pthread_rwlock_unlock(&lock->rw);
+  } else {
+    __atomic_store_n(&lock->spin, 0, __ATOMIC_RELEASE);
+  }
+}
+
+/* Shared state of a set_concurrent_type(), which keeps its set twice
+ * (left-right). Readers look in the copy read names while the writer
+ * changes the other one, publishes it by flipping read, waits for the
+ * readers still in the old copy to leave it and repeats the change there.
+ * A reader marks itself in on one of two sides before it loads read, and
+ * the writer moves new readers to the other side between its two waits, so
+ * that it only ever waits for readers that came before the flip. A writer
+ * that has waited a while sets waiting, and readers that see it as they
+ * leave hand it the CPU. size is on a line of its own since the writer
+ * stores it on every write. */
+typedef struct {
+  uint32_t read __attribute__((aligned(64)));
+  uint32_t side;
+  uint32_t waiting;
+  uint32_t reader_count;
+  size_t size __attribute__((aligned(64)));
+  struct {
+    uint32_t in[2];
+  } __attribute__((aligned(64))) readers[SET_MAX_READERS];
+} tree_sync_t;
+
+static inline void tree_sync_init(tree_sync_t *sync) {
+  memset(sync, 0x00, sizeof(*sync));
+}
+
+/* Registers a reader thread and returns its id, or -1 past SET_MAX_READERS */
+static inline int tree_sync_register(tree_sync_t *sync) {
+  uint32_t id = __atomic_fetch_add(&sync->reader_count, 1, __ATOMIC_SEQ_CST);
+  if (id >= SET_MAX_READERS) {
+    __atomic_fetch_sub(&sync->reader_count, 1, __ATOMIC_SEQ_CST);
+    return -1;
+  }
+  return (int)id;
+}
+
+/* Waits until no reader is in on side. A reader that stays in for long was
+ * most likely preempted in a lookup, so the writer then yields the CPU and
+ * asks readers to yield it back once they are out. */
+static inline void tree_sync_drain(tree_sync_t *sync, uint32_t side) {
+  uint32_t reader_count =
+      __atomic_load_n(&sync->reader_count, __ATOMIC_SEQ_CST);
+  if (reader_count > SET_MAX_READERS) {
+    reader_count = SET_MAX_READERS;
+  }
+  bool waited = false;
+  for (uint32_t i = 0; i < reader_count; i++) {
+    uint32_t spins = 0;
+    while (__atomic_load_n(&sync->readers[i].in[side], __ATOMIC_ACQUIRE)) {
+      if (++spins >= 128) {
+        if (!waited) {
+          __atomic_store_n(&sync->waiting, 1, __ATOMIC_RELAXED);
+          waited = true;
+        }
+        sched_yield();
+      } else {
+#ifdef __SSE2__
+        _mm_pause();
+#endif
+      }
+    }
+  }
+  if (waited) {
+    __atomic_store_n(&sync->waiting, 0, __ATOMIC_RELAXED);
+  }
+}
+
+/* Sends readers to the copy the writer just changed, and returns once no
+ * reader is left in the other one, which the writer may then change. Only
+ * the writer stores read and side, so it loads them relaxed. */
+static inline void tree_sync_publish(tree_sync_t *sync) {
+  uint32_t read = __atomic_load_n(&sync->read, __ATOMIC_RELAXED);
+  __atomic_store_n(&sync->read, read ^ 1, __ATOMIC_SEQ_CST);
+  uint32_t side = __atomic_load_n(&sync->side, __ATOMIC_RELAXED);
+  tree_sync_drain(sync, side ^ 1);
+  __atomic_store_n(&sync->side, side ^ 1, __ATOMIC_SEQ_CST);
+  tree_sync_drain(sync, side);
+}
+
+/* Marks reader in and returns the copy it may read until it calls
+ * tree_sync_read_end() with *side. Never waits: the writer leaves the copy
+ * alone until the reader is out. */
+static inline uint32_t tree_sync_read_begin(tree_sync_t *sync, int reader,
+                                            uint32_t *side) {
+  assert(reader >= 0 && reader < SET_MAX_READERS);
+  *side = __atomic_load_n(&sync->side, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&sync->readers[reader].in[*side], 1, __ATOMIC_SEQ_CST);
+  return __atomic_load_n(&sync->read, __ATOMIC_SEQ_CST);
+}
+
+/* The release orders every read of the copy before the writer sees the
+ * reader out. Yielding to a waiting writer is not waiting for it: the
+ * reader carries on as soon as it gets the CPU back. */
+static inline void tree_sync_read_end(tree_sync_t *sync, int reader,
+                                      uint32_t side) {
+  __atomic_store_n(&sync->readers[reader].in[side], 0, __ATOMIC_RELEASE);
+  if (__atomic_load_n(&sync->waiting, __ATOMIC_RELAXED)) {
+    sched_yield();
+  }
+}
+
+/* A key of a set_type_bytes() or map_type_bytes(): len bytes at bytes.
+ * Stored keys point into the arena of their set and are followed by a NUL,
+ * keys to look up can point anywhere. */
+typedef struct {
+  const char *bytes;
+  size_t len;
+} set_bytes_t;
+
+/* Append-only block holding the keys of a set_type_bytes(). dead counts the
+ * bytes of removed keys, which go away the next time the keys are copied.
+ * refs counts the handles on data once a snapshot shares it. */
+typedef struct {
+  char *data;
+  size_t used;
+  size_t capacity;
+  size_t dead;
+  uint32_t *refs;
+} tree_arena_t;
+
+/* Hashes decide which keys get compared at all, so only the lengths and
+ * then the bytes are checked here */
+static inline bool tree_bytes_equals(set_bytes_t a, set_bytes_t b) {
+  return a.len == b.len && memcmp(a.bytes, b.bytes, a.len) == 0;
+}
+
+#define ALLOC_CHUNK 512
+#define ARENA_CHUNK 4096
+
+/* Actually freeing and remallocing seems like a really expensive way to
+ * do this, let's try to find something better */
+
+#define btree_add(set, entry_var, find_entry, alloc_entry, write_entry)        \
+  btree_add_hashed(set, set.hash_fn(entry_var), entry_var, find_entry,         \
+                   alloc_entry, write_entry)
+
+#define btree_add_hashed(set, hash_value, entry_var, find_entry, alloc_entry,  \
+                         write_entry)                                          \
   ({                                                                           \
-    uint64_t hash = map.hash_fn(key);                                          \
-    tree_addr_t node_addr = map_find_node_entry(map, hash, key);               \
-    typeof(map.values) retval = NULL;                                          \
-    if (tree_is_valid_addr(node_addr)) {                                       \
-      tree_idx_t idx = tree_idx(node_addr);                                    \
-      assert(map.capacity > idx);                                              \
-      retval = &map.values[idx];                                               \
+    uint64_t btree_add_hash = (hash_value);                                    \
+    tree_addr_t btree_add_retval = 0;                                          \
+    if (!tree_is_valid_addr(find_entry(set, btree_add_hash, entry_var))) {     \
+      btree_add_retval = alloc_entry(set);                                     \
+      write_entry(set, btree_add_retval, entry_var);                           \
+      tree_addr_t btree_add_leaf = btree_find_leaf(set, btree_add_hash);       \
+      btree_insert(set, btree_add_leaf,                                        \
+                   btree_count_less(btree_get_node(set, btree_add_leaf),       \
+                                    btree_add_hash),                           \
+                   btree_add_hash, btree_add_retval);                          \
+      set.size++;                                                              \
     }                                                                          \
-    retval;                                                                    \
+    btree_add_retval;                                                          \
   })
 
-#define map_get_key(map, addr)                                                 \
+#define btree_alloc_entry(set, realloc_entries)                                \
   ({                                                                           \
-    tree_idx_t idx = tree_idx(addr);                                           \
-    assert(map.capacity > idx);                                                \
-    map.keys[idx];                                                             \
+    if (!tree_is_valid_addr(set.free_list_start)) {                            \
+      btree_grow(set, tree_grown_capacity(set), realloc_entries);              \
+    }                                                                          \
+    tree_addr_t alloc_entry_retval = set.free_list_start;                      \
+    set.free_list_start = set.free_list[tree_idx(alloc_entry_retval)];         \
+    set.free_list[tree_idx(alloc_entry_retval)] = 0;                           \
+    alloc_entry_retval;                                                        \
   })
 
-#define map_get_value(map, addr)                                               \
+/* Nodes live in one cache-line aligned buffer, so any btree_node_t pointer
+ * has to be fetched again after this */
+#define btree_alloc_node(set, leaf)                                            \
   ({                                                                           \
-    tree_idx_t idx = tree_idx(addr);                                           \
-    assert(map.capacity > idx);                                                \
-    map.values[idx];                                                           \
+    bool alloc_node_leaf = (leaf);                                             \
+    tree_addr_t alloc_node_retval = set.btree_free_node;                       \
+    if (tree_is_valid_addr(alloc_node_retval)) {                               \
+      set.btree_free_node = btree_get_node(set, alloc_node_retval)->next;      \
+    } else {                                                                   \
+      if (set.btree_node_count == set.btree_node_capacity) {                   \
+        btree_node_t *alloc_node_grown = tree_aligned_alloc(                   \
+            set, 64, sizeof(btree_node_t) * set.btree_node_capacity * 2);      \
+        memcpy(alloc_node_grown, set.btree_nodes,                              \
+               sizeof(btree_node_t) * set.btree_node_count);                   \
+        tree_dealloc(set, set.btree_nodes);                                    \
+        set.btree_nodes = alloc_node_grown;                                    \
+        set.btree_node_capacity *= 2;                                          \
+      }                                                                        \
+      alloc_node_retval = tree_addr(set.btree_node_count);                     \
+      set.btree_node_count++;                                                  \
+    }                                                                          \
+    btree_node_t *alloc_node = btree_get_node(set, alloc_node_retval);         \
+    *alloc_node = (btree_node_t){.is_leaf = alloc_node_leaf};                  \
+    memset(alloc_node->hashes, 0xFF, sizeof(alloc_node->hashes));              \
+    alloc_node_retval;                                                         \
   })
 
-#define map_has(map, key)                                                      \
+/* Position of child_addr (a node, or an entry in leaves) inside node */
+#define btree_child_pos(node, child_addr)                                      \
   ({                                                                           \
-    uint64_t hash = map.hash_fn(key);                                          \
-    tree_addr_t node_addr = map_find_node_entry(map, hash, key);               \
-    tree_is_valid_addr(node_addr);                                             \
+    uint32_t child_pos = 0;                                                    \
+    while ((node)->children[child_pos] != (child_addr)) {                      \
+      child_pos++;                                                             \
+    }                                                                          \
+    child_pos;                                                                 \
   })
 
-#define map_init(set, hash_function, equals_function)                          \
-  tree_init(map, hash_function, equals_function, map_malloc_entries,           \
-            map_alloc_new_node)
+#define btree_clone(set, malloc_entries, move_entry)                           \
+  ({                                                                           \
+    typeof(set) clone = set;                                                   \
+    clone.btree_nodes =                                                        \
+        tree_aligned_alloc(set, 64,                                            \
+                           sizeof(btree_node_t) * set.btree_node_capacity);    \
+    memcpy(clone.btree_nodes, set.btree_nodes,                                 \
+           sizeof(btree_node_t) * set.btree_node_count);                       \
+    clone.btree_leaves = tree_malloc(set, sizeof(tree_addr_t) * set.capacity); \
+    memcpy(clone.btree_leaves, set.btree_leaves,                               \
+           sizeof(tree_addr_t) * set.capacity);                                \
+    clone.free_list = tree_malloc(set, sizeof(tree_addr_t) * set.capacity);    \
+    memcpy(clone.free_list, set.free_list,                                     \
+           sizeof(tree_addr_t) * set.capacity);                                \
+    malloc_entries(clone);                                                     \
+    tree_addr_t clone_addr = btree_first(set);                                 \
+    while (tree_is_valid_addr(clone_addr)) {                                   \
+      move_entry(clone, clone_addr, set, clone_addr);                          \
+      clone_addr = btree_next(set, clone_addr);                                \
+    }                                                                          \
+    clone;                                                                     \
+  })
 
-#define map_malloc_entries(map)                                                \
-  do {                                                                         \
-    map.keys = malloc(sizeof(typeof(*map.keys)) * map.capacity);               \
-    map.values = malloc(sizeof(typeof(*map.values)) * map.capacity);           \
-  } while (0)
+/* Entry address at a cursor, or 0 past the end */
+#define btree_cursor_addr(set, cursor)                                         \
+  ({                                                                           \
+    btree_cursor_t cursor_addr_cursor = (cursor);                              \
+    tree_is_valid_addr(cursor_addr_cursor.leaf)                                \
+        ? btree_get_node(set, cursor_addr_cursor.leaf)                         \
+              ->children[cursor_addr_cursor.pos]                               \
+        : 0;                                                                   \
+  })
 
-#define map_realloc_entries(map)                                               \
-  do {                                                                         \
-    map.keys = realloc(map.keys, sizeof(typeof(*map.keys)) * map.capacity);    \
-    map.values =                                                               \
-        realloc(map.keys, sizeof(typeof(*map.values)) * map.capacity);         \
-  } while (0)
+#define btree_cursor_next(set, cursor)                                         \
+  ({                                                                           \
+    btree_cursor_t cursor_next = (cursor);                                     \
+    btree_node_t *cursor_next_leaf = btree_get_node(set, cursor_next.leaf);    \
+    if (++cursor_next.pos >= cursor_next_leaf->count) {                        \
+      cursor_next.leaf = cursor_next_leaf->next;                               \
+      cursor_next.pos = 0;                                                     \
+    }                                                                          \
+    cursor_next;                                                               \
+  })
 
-#define map_remove(set, entry)                                                 \
-  tree_remove(set, entry, map_find_node_entry, map_clear_entry)
+/* Walks the run of equal hashes starting at their lower bound */
+#define btree_find_entry(set, hash_value, entry_var, get_entry)                \
+  ({                                                                           \
+    uint64_t btree_find_hash = (hash_value);                                   \
+    btree_cursor_t btree_find_cursor =                                         \
+        btree_lower_bound(set, btree_find_hash);                               \
+    tree_addr_t btree_find_retval = 0;                                         \
+    while (tree_is_valid_addr(btree_find_cursor.leaf)) {                       \
+      btree_node_t *btree_find_leaf =                                          \
+          btree_get_node(set, btree_find_cursor.leaf);                         \
+      if (btree_find_leaf->hashes[btree_find_cursor.pos] != btree_find_hash) { \
+        break;                                                                 \
+      }                                                                        \
+      tree_addr_t btree_find_addr =                                            \
+          btree_find_leaf->children[btree_find_cursor.pos];                    \
+      if (set.equals_fn(get_entry(set, btree_find_addr), entry_var)) {         \
+        btree_find_retval = btree_find_addr;                                   \
+        break;                                                                 \
+      }                                                                        \
+      btree_find_cursor = btree_cursor_next(set, btree_find_cursor);           \
+    }                                                                          \
+    btree_find_retval;                                                         \
+  })
 
-#define map_size(tree) tree_size(tree)
+/* Leaf whose range covers hash_value. Internal nodes store the largest hash
+ * of every child but the last, so the first separator not below the hash
+ * picks the child. */
+#define btree_find_leaf(set, hash_value)                                       \
+  ({                                                                           \
+    uint64_t find_leaf_hash = (hash_value);                                    \
+    tree_addr_t find_leaf_addr = set.btree_root;                               \
+    btree_node_t *find_leaf_node = btree_get_node(set, find_leaf_addr);        \
+    while (!find_leaf_node->is_leaf) {                                         \
+      find_leaf_addr = find_leaf_node->children[btree_count_less(              \
+          find_leaf_node, find_leaf_hash)];                                    \
+      find_leaf_node = btree_get_node(set, find_leaf_addr);                    \
+    }                                                                          \
+    find_leaf_addr;                                                            \
+  })
 
-#define map_type(key_type, value_type)                                         \
-  struct {                                                                     \
+#define btree_first(set)                                                       \
+  ({                                                                           \
+    btree_node_t *btree_first_node = btree_get_node(set, set.btree_root);      \
+    while (!btree_first_node->is_leaf) {                                       \
+      btree_first_node = btree_get_node(set, btree_first_node->children[0]);   \
+    }                                                                          \
+    btree_first_node->count > 0 ? btree_first_node->children[0] : 0;           \
+  })
+
+#define btree_free(set, free_data)                                             \
+  do {                                                                         \
+    tree_dealloc(set, set.btree_nodes);                                        \
+    tree_dealloc(set, set.btree_leaves);                                       \
+    tree_dealloc(set, set.free_list);                                          \
+    free_data(set);                                                            \
+  } while (0)
+
+#define btree_free_entry(set, addr)                                            \
+  do {                                                                         \
+    set.free_list[tree_idx(addr)] = set.free_list_start;                       \
+    set.free_list_start = addr;                                                \
+  } while (0)
+
+#define btree_free_node(set, addr)                                             \
+  do {                                                                         \
+    btree_get_node(set, addr)->next = set.btree_free_node;                     \
+    set.btree_free_node = addr;                                                \
+  } while (0)
+
+#define btree_get_node(set, addr) (&set.btree_nodes[tree_idx(addr)])
+
+/* Grows the entry columns of set to new_capacity slots and puts the new slots
+ * in front of the free list, lowest address first */
+#define btree_grow(set, new_capacity, realloc_entries)                         \
+  do {                                                                         \
+    tree_idx_t grow_idx = set.capacity;                                        \
+    set.capacity = (new_capacity);                                             \
+    set.free_list =                                                            \
+        tree_realloc(set, set.free_list, sizeof(tree_addr_t) * set.capacity);  \
+    set.btree_leaves = tree_realloc(set, set.btree_leaves,                     \
+                                    sizeof(tree_addr_t) * set.capacity);       \
+    realloc_entries(set);                                                      \
+    for (tree_idx_t grow_i = grow_idx; grow_i < set.capacity - 1; grow_i++) {  \
+      set.free_list[grow_i] = tree_addr(grow_i + 1);                           \
+    }                                                                          \
+    set.free_list[set.capacity - 1] = set.free_list_start;                     \
+    set.free_list_start = tree_addr(grow_idx);                                 \
+  } while (0)
+
+#define btree_init(set, hash_function, equals_function, malloc_entries)        \
+  do {                                                                         \
+    set.capacity = ALLOC_CHUNK;                                                \
+    set.size = 0;                                                              \
+    set.free_list = tree_malloc(set, sizeof(tree_addr_t) * set.capacity);      \
+    for (tree_idx_t i = 0; i < set.capacity - 1; i++) {                        \
+      set.free_list[i] = tree_addr(i + 1);                                     \
+    }                                                                          \
+    set.free_list[set.capacity - 1] = 0;                                       \
+    set.free_list_start = tree_addr(0);                                        \
+    tree_set_default_growth(set);                                              \
+    set.btree_leaves = tree_malloc(set, sizeof(tree_addr_t) * set.capacity);   \
+    malloc_entries(set);                                                       \
+    set.btree_node_capacity = BTREE_NODE_CHUNK;                                \
+    set.btree_node_count = 0;                                                  \
+    set.btree_free_node = 0;                                                   \
+    set.btree_nodes =                                                          \
+        tree_aligned_alloc(set, 64,                                            \
+                           sizeof(btree_node_t) * set.btree_node_capacity);    \
+    set.btree_root = btree_alloc_node(set, true);                              \
+    set.hash_fn = hash_function;                                               \
+    set.equals_fn = equals_function;                                           \
+  } while (0)
+
+/* Inserts child_addr with separator hash_value at pos, splitting full nodes
+ * in half on the way up */
+#define btree_insert(set, node_addr, pos, hash_value, child_addr)              \
+  do {                                                                         \
+    tree_addr_t ins_addr = (node_addr);                                        \
+    uint32_t ins_pos = (pos);                                                  \
+    uint64_t ins_hash = (hash_value);                                          \
+    tree_addr_t ins_child = (child_addr);                                      \
+    while (true) {                                                             \
+      btree_node_t *ins_node = btree_get_node(set, ins_addr);                  \
+      if (ins_node->count < BTREE_NODE_KEYS) {                                 \
+        btree_place(set, ins_addr, ins_pos, ins_hash, ins_child);              \
+        break;                                                                 \
+      }                                                                        \
+                                                                               \
+      tree_addr_t ins_right_addr = btree_alloc_node(set, ins_node->is_leaf);   \
+      ins_node = btree_get_node(set, ins_addr);                                \
+      btree_node_t *ins_right = btree_get_node(set, ins_right_addr);           \
+      uint32_t ins_half = BTREE_NODE_KEYS / 2;                                 \
+      for (uint32_t i = ins_half; i < BTREE_NODE_KEYS; i++) {                  \
+        ins_right->hashes[i - ins_half] = ins_node->hashes[i];                 \
+        ins_right->children[i - ins_half] = ins_node->children[i];             \
+        btree_set_parent(set, ins_right, ins_right->children[i - ins_half],    \
+                         ins_right_addr);                                      \
+        ins_node->hashes[i] = UINT64_MAX;                                      \
+        ins_node->children[i] = 0;                                             \
+      }                                                                        \
+      ins_node->count = ins_half;                                              \
+      ins_right->count = BTREE_NODE_KEYS - ins_half;                           \
+      ins_right->parent = ins_node->parent;                                    \
+      if (ins_node->is_leaf) {                                                 \
+        ins_right->next = ins_node->next;                                      \
+        ins_right->prev = ins_addr;                                            \
+        if (tree_is_valid_addr(ins_node->next)) {                              \
+          btree_get_node(set, ins_node->next)->prev = ins_right_addr;          \
+        }                                                                      \
+        ins_node->next = ins_right_addr;                                       \
+      }                                                                        \
+                                                                               \
+      if (ins_pos <= ins_half) {                                               \
+        btree_place(set, ins_addr, ins_pos, ins_hash, ins_child);              \
+      } else {                                                                 \
+        btree_place(set, ins_right_addr, ins_pos - ins_half, ins_hash,         \
+                    ins_child);                                                \
+      }                                                                        \
+      uint64_t ins_left_max = ins_node->hashes[ins_node->count - 1];           \
+      if (!ins_node->is_leaf) {                                                \
+        ins_node->hashes[ins_node->count - 1] = UINT64_MAX;                    \
+      }                                                                        \
+                                                                               \
+      if (!tree_is_valid_addr(ins_node->parent)) {                             \
+        tree_addr_t ins_root_addr = btree_alloc_node(set, false);              \
+        btree_node_t *ins_root = btree_get_node(set, ins_root_addr);           \
+        ins_root->hashes[0] = ins_left_max;                                    \
+        ins_root->children[0] = ins_addr;                                      \
+        ins_root->children[1] = ins_right_addr;                                \
+        ins_root->count = 2;                                                   \
+        btree_get_node(set, ins_addr)->parent = ins_root_addr;                 \
+        btree_get_node(set, ins_right_addr)->parent = ins_root_addr;           \
+        set.btree_root = ins_root_addr;                                        \
+        break;                                                                 \
+      }                                                                        \
+                                                                               \
+      btree_node_t *ins_parent = btree_get_node(set, ins_node->parent);        \
+      uint32_t ins_idx = btree_child_pos(ins_parent, ins_addr);                \
+      ins_hash = ins_parent->hashes[ins_idx];                                  \
+      ins_parent->hashes[ins_idx] = ins_left_max;                              \
+      ins_pos = ins_idx + 1;                                                   \
+      ins_child = ins_right_addr;                                              \
+      ins_addr = ins_node->parent;                                             \
+    }                                                                          \
+  } while (0)
+
+/* Cursor at the first entry with a hash not below hash_value */
+#define btree_lower_bound(set, hash_value)                                     \
+  ({                                                                           \
+    uint64_t lower_bound_hash = (hash_value);                                  \
+    tree_addr_t lower_bound_leaf = btree_find_leaf(set, lower_bound_hash);     \
+    btree_node_t *lower_bound_node = btree_get_node(set, lower_bound_leaf);    \
+    btree_cursor_t lower_bound_retval = {                                      \
+        .leaf = lower_bound_leaf,                                              \
+        .pos = btree_count_less(lower_bound_node, lower_bound_hash),           \
+    };                                                                         \
+    if (lower_bound_retval.pos == lower_bound_node->count) {                   \
+      lower_bound_retval.leaf = lower_bound_node->next;                        \
+      lower_bound_retval.pos = 0;                                              \
+    }                                                                          \
+    lower_bound_retval;                                                        \
+  })
+
+#define btree_next(set, addr)                                                  \
+  ({                                                                           \
+    tree_addr_t btree_next_addr = (addr);                                      \
+    tree_addr_t btree_next_leaf = set.btree_leaves[tree_idx(btree_next_addr)]; \
+    btree_cursor_t btree_next_cursor = {                                       \
+        .leaf = btree_next_leaf,                                               \
+        .pos = btree_child_pos(btree_get_node(set, btree_next_leaf),           \
+                               btree_next_addr),                               \
+    };                                                                         \
+    btree_cursor_addr(set, btree_cursor_next(set, btree_next_cursor));         \
+  })
+
+/* Shifts the tail of a node with room to spare and stores the child at pos */
+#define btree_place(set, node_addr, pos, hash_value, child_addr)               \
+  do {                                                                         \
+    btree_node_t *place_node = btree_get_node(set, node_addr);                 \
+    uint32_t place_pos = (pos);                                                \
+    uint32_t place_tail = place_node->count - place_pos;                       \
+    memmove(&place_node->hashes[place_pos + 1],                                \
+            &place_node->hashes[place_pos],                                    \
+            sizeof(uint64_t) * place_tail);                                    \
+    memmove(&place_node->children[place_pos + 1],                              \
+            &place_node->children[place_pos],                                  \
+            sizeof(tree_addr_t) * place_tail);                                 \
+    place_node->hashes[place_pos] = (hash_value);                              \
+    place_node->children[place_pos] = (child_addr);                            \
+    place_node->count++;                                                       \
+    btree_set_parent(set, place_node, child_addr, node_addr);                  \
+  } while (0)
+
+/* Leaves that run empty are unlinked from their parent, and so on up. Nodes
+ * are never merged, and the root collapses while it has a single child. */
+#define btree_remove(set, entry, find_entry)                                   \
+  btree_remove_hashed(set, set.hash_fn(entry), entry, find_entry)
+
+#define btree_remove_hashed(set, hash_value, entry, find_entry)                \
+  do {                                                                         \
+    tree_addr_t rm_addr = find_entry(set, (hash_value), entry);                \
+    if (!tree_is_valid_addr(rm_addr)) {                                        \
+      break;                                                                   \
+    }                                                                          \
+    tree_addr_t rm_node_addr = set.btree_leaves[tree_idx(rm_addr)];            \
+    tree_addr_t rm_child = rm_addr;                                            \
+    while (true) {                                                             \
+      btree_node_t *rm_node = btree_get_node(set, rm_node_addr);               \
+      uint32_t rm_pos = btree_child_pos(rm_node, rm_child);                    \
+      uint32_t rm_tail = rm_node->count - rm_pos - 1;                          \
+      memmove(&rm_node->hashes[rm_pos], &rm_node->hashes[rm_pos + 1],          \
+              sizeof(uint64_t) * rm_tail);                                     \
+      memmove(&rm_node->children[rm_pos], &rm_node->children[rm_pos + 1],      \
+              sizeof(tree_addr_t) * rm_tail);                                  \
+      rm_node->count--;                                                        \
+      rm_node->hashes[rm_node->count] = UINT64_MAX;                            \
+      rm_node->children[rm_node->count] = 0;                                   \
+      if (!rm_node->is_leaf && rm_pos == rm_node->count &&                     \
+          rm_node->count > 0) {                                                \
+        rm_node->hashes[rm_node->count - 1] = UINT64_MAX;                      \
+      }                                                                        \
+      if (rm_node->count > 0 || rm_node_addr == set.btree_root) {              \
+        break;                                                                 \
+      }                                                                        \
+      if (rm_node->is_leaf) {                                                  \
+        if (tree_is_valid_addr(rm_node->prev)) {                               \
+          btree_get_node(set, rm_node->prev)->next = rm_node->next;            \
+        }                                                                      \
+        if (tree_is_valid_addr(rm_node->next)) {                               \
+          btree_get_node(set, rm_node->next)->prev = rm_node->prev;            \
+        }                                                                      \
+      }                                                                        \
+      rm_child = rm_node_addr;                                                 \
+      rm_node_addr = rm_node->parent;                                          \
+      btree_free_node(set, rm_child);                                          \
+    }                                                                          \
+                                                                               \
+    btree_node_t *rm_root = btree_get_node(set, set.btree_root);               \
+    while (!rm_root->is_leaf && rm_root->count == 1) {                         \
+      tree_addr_t rm_old_root = set.btree_root;                                \
+      set.btree_root = rm_root->children[0];                                   \
+      btree_free_node(set, rm_old_root);                                       \
+      rm_root = btree_get_node(set, set.btree_root);                           \
+      rm_root->parent = 0;                                                     \
+    }                                                                          \
+                                                                               \
+    btree_free_entry(set, rm_addr);                                            \
+    set.size--;                                                                \
+  } while (0)
+
+#define btree_reserve(set, n, realloc_entries)                                 \
+  do {                                                                         \
+    size_t reserve_n = ((n) + 7) / 8 * 8;                                      \
+    if (reserve_n > set.capacity) {                                            \
+      btree_grow(set, reserve_n, realloc_entries);                             \
+    }                                                                          \
+  } while (0)
+
+/* Entries keep the address of their leaf, nodes the address of their parent */
+#define btree_set_parent(set, node, child_addr, parent_addr)                   \
+  do {                                                                         \
+    if ((node)->is_leaf) {                                                     \
+      set.btree_leaves[tree_idx(child_addr)] = (parent_addr);                  \
+    } else {                                                                   \
+      btree_get_node(set, child_addr)->parent = (parent_addr);                 \
+    }                                                                          \
+  } while (0)
+
+#define btree_type_fields()                                                    \
+  btree_node_t *btree_nodes;                                                   \
+  tree_addr_t *btree_leaves;                                                   \
+  tree_addr_t btree_root;                                                      \
+  tree_addr_t btree_free_node;                                                 \
+  uint32_t btree_node_capacity;                                                \
+  uint32_t btree_node_count;
+
+/* Appends the key at addr, which still points at the caller's bytes, to the
+ * arena and points it there. The room was reserved before the add. */
+#define bytes_append(owner, addr, key_column)                                  \
+  do {                                                                         \
+    tree_requires_writable(owner.base);                                        \
+    set_bytes_t *bytes_key = &owner.base.key_column[tree_idx(addr)];           \
+    tree_touch(owner.base, bytes_key, sizeof(set_bytes_t));                    \
+    char *bytes_dst = owner.arena.data + owner.arena.used;                     \
+    memcpy(bytes_dst, bytes_key->bytes, bytes_key->len);                       \
+    bytes_dst[bytes_key->len] = '\0';                                          \
+    bytes_key->bytes = bytes_dst;                                              \
+    owner.arena.used += bytes_key->len + 1;                                    \
+  } while (0)
+
+/* Copies the keys into an arena that fits them exactly, after compacting
+ * the tree */
+#define bytes_compact(owner, layout, compact_base, key_column)                 \
+  do {                                                                         \
+    compact_base(owner.base, layout);                                          \
+    bytes_rebuild(owner, owner.arena.used - owner.arena.dead, key_column);     \
+  } while (0)
+
+#define bytes_free(owner, free_base)                                           \
+  do {                                                                         \
+    bytes_release_arena(owner);                                                \
+    free_base(owner.base);                                                     \
+  } while (0)
+
+#define bytes_init(owner, hash_function, init_base)                            \
+  do {                                                                         \
+    init_base(owner.base, hash_function, tree_bytes_equals);                   \
+    owner.arena = (tree_arena_t){0};                                           \
+  } while (0)
+
+/* Copies the keys of the set into a new arena of new_capacity bytes, in
+ * storage order, leaving out the bytes of removed keys */
+#define bytes_rebuild(owner, new_capacity, key_column)                         \
+  do {                                                                         \
+    tree_requires_writable(owner.base);                                        \
+    size_t bytes_capacity = (new_capacity);                                    \
+    char *bytes_data =                                                         \
+        bytes_capacity > 0 ? tree_malloc(owner.base, bytes_capacity) : NULL;   \
+    size_t bytes_used = 0;                                                     \
+    for (tree_addr_t bytes_addr = tree_unordered_next(owner.base, 0);          \
+         tree_is_valid_addr(bytes_addr);                                       \
+         bytes_addr = tree_unordered_next(owner.base, bytes_addr)) {           \
+      set_bytes_t *bytes_key = &owner.base.key_column[tree_idx(bytes_addr)];   \
+      tree_touch(owner.base, bytes_key, sizeof(set_bytes_t));                  \
+      memcpy(bytes_data + bytes_used, bytes_key->bytes, bytes_key->len + 1);   \
+      bytes_key->bytes = bytes_data + bytes_used;                              \
+      bytes_used += bytes_key->len + 1;                                        \
+    }                                                                          \
+    bytes_release_arena(owner);                                                \
+    owner.arena = (tree_arena_t){bytes_data, bytes_used, bytes_capacity, 0};   \
+  } while (0)
+
+/* Drops the handle of owner on its arena, which goes with the last one */
+#define bytes_release_arena(owner)                                             \
+  do {                                                                         \
+    if (owner.arena.refs == NULL ||                                            \
+        __atomic_sub_fetch(owner.arena.refs, 1, __ATOMIC_ACQ_REL) == 0) {      \
+      if (owner.arena.data != NULL) {                                          \
+        tree_dealloc(owner.base, owner.arena.data);                            \
+      }                                                                        \
+      free(owner.arena.refs);                                                  \
+    }                                                                          \
+  } while (0)
+
+/* Removes a key and counts its bytes as dead. Returns whether it was
+ * there. */
+#define bytes_remove(owner, key_ptr, key_len, remove_base)                     \
+  ({                                                                           \
+    set_bytes_t bytes_gone = {(const char *)(key_ptr), (key_len)};             \
+    size_t bytes_size = owner.base.size;                                       \
+    remove_base(owner.base, bytes_gone);                                       \
+    bool bytes_removed = owner.base.size != bytes_size;                        \
+    if (bytes_removed) {                                                       \
+      owner.arena.dead += bytes_gone.len + 1;                                  \
+    }                                                                          \
+    bytes_removed;                                                             \
+  })
+
+/* Makes room for n more bytes. A full arena is copied into one twice the
+ * size of its live keys, so removed keys are reclaimed as it grows. */
+#define bytes_reserve(owner, n, key_column)                                    \
+  do {                                                                         \
+    size_t bytes_need = (n);                                                   \
+    if (owner.arena.capacity - owner.arena.used < bytes_need) {                \
+      size_t bytes_target = ARENA_CHUNK;                                       \
+      while (bytes_target <                                                    \
+             2 * (owner.arena.used - owner.arena.dead + bytes_need)) {         \
+        bytes_target *= 2;                                                     \
+      }                                                                        \
+      bytes_rebuild(owner, bytes_target, key_column);                          \
+    }                                                                          \
+  } while (0)
+
+/* A read-only handle on owner, with a snapshot_base() of its tree and a
+ * handle on its arena. The keys of the snapshot stay where they are, since
+ * the set only appends past them and copies its keys into a new arena
+ * rather than moving them. */
+#define bytes_snapshot(owner, snapshot_base)                                   \
+  ({                                                                           \
+    if (owner.arena.refs == NULL) {                                            \
+      owner.arena.refs = malloc(sizeof(uint32_t));                             \
+      *owner.arena.refs = 1;                                                   \
+    }                                                                          \
+    __atomic_add_fetch(owner.arena.refs, 1, __ATOMIC_RELAXED);                 \
+    typeof(owner) bytes_view = owner;                                          \
+    bytes_view.base = snapshot_base(owner.base);                               \
+    bytes_view;                                                                \
+  })
+
+#define flat_add(set, entry_var, find_entry, write_entry, rehash)              \
+  flat_add_hashed(set, set.hash_fn(entry_var), entry_var, find_entry,          \
+                  write_entry, rehash)
+
+/* flat_add with the unmixed hash of entry_var already at hand */
+#define flat_add_hashed(set, hash_value, entry_var, find_entry, write_entry,   \
+                        rehash)                                                \
+  ({                                                                           \
+    uint64_t flat_add_hash = flat_mix(hash_value);                             \
+    tree_addr_t flat_add_retval = 0;                                           \
+    if (!tree_is_valid_addr(find_entry(set, flat_add_hash, entry_var))) {      \
+      size_t flat_add_slot = flat_find_slot(set, flat_add_hash);               \
+      if (set.growth_left == 0 &&                                              \
+          set.ctrl[flat_add_slot] == FLAT_CTRL_EMPTY) {                        \
+        rehash(set, flat_grown_capacity(set));                                 \
+        flat_add_slot = flat_find_slot(set, flat_add_hash);                    \
+      }                                                                        \
+      if (set.ctrl[flat_add_slot] == FLAT_CTRL_EMPTY) {                        \
+        set.growth_left--;                                                     \
+      }                                                                        \
+      set.ctrl[flat_add_slot] = flat_h2(flat_add_hash);                        \
+      flat_add_retval = tree_addr(flat_add_slot);                              \
+      write_entry(set, flat_add_retval, entry_var);                            \
+      set.size++;                                                              \
+    }                                                                          \
+    flat_add_retval;                                                           \
+  })
+
+#define flat_clone(set, malloc_entries, move_entry)                            \
+  ({                                                                           \
+    typeof(set) clone = set;                                                   \
+    clone.ctrl = tree_malloc(set, set.capacity);                               \
+    memcpy(clone.ctrl, set.ctrl, set.capacity);                                \
+    malloc_entries(clone);                                                     \
+    tree_addr_t clone_addr = flat_first(set);                                  \
+    while (tree_is_valid_addr(clone_addr)) {                                   \
+      move_entry(clone, clone_addr, set, clone_addr);                          \
+      clone_addr = flat_next(set, clone_addr);                                 \
+    }                                                                          \
+    clone;                                                                     \
+  })
+
+#define flat_find_entry(set, hash_value, entry_var, get_entry)                 \
+  ({                                                                           \
+    uint64_t flat_find_hash = (hash_value);                                    \
+    size_t flat_find_group = flat_h1(flat_find_hash) & flat_group_mask(set);   \
+    tree_addr_t flat_find_retval = 0;                                          \
+    for (size_t flat_probe = 1;; flat_probe++) {                               \
+      const uint8_t *flat_find_ctrl =                                          \
+          &set.ctrl[flat_find_group * FLAT_GROUP_WIDTH];                       \
+      uint32_t flat_match =                                                    \
+          flat_group_match(flat_find_ctrl, flat_h2(flat_find_hash));           \
+      while (flat_match != 0) {                                                \
+        tree_addr_t flat_find_addr = tree_addr(                                \
+            flat_find_group * FLAT_GROUP_WIDTH + __builtin_ctz(flat_match));   \
+        if (set.equals_fn(get_entry(set, flat_find_addr), entry_var)) {        \
+          flat_find_retval = flat_find_addr;                                   \
+          break;                                                               \
+        }                                                                      \
+        flat_match &= flat_match - 1;                                          \
+      }                                                                        \
+      if (tree_is_valid_addr(flat_find_retval) ||                              \
+          flat_group_match_empty(flat_find_ctrl) != 0) {                       \
+        break;                                                                 \
+      }                                                                        \
+      flat_find_group = (flat_find_group + flat_probe) & flat_group_mask(set); \
+    }                                                                          \
+    flat_find_retval;                                                          \
+  })
+
+/* Index of the first empty or deleted slot on the probe path of a hash */
+#define flat_find_slot(set, hash_value)                                        \
+  ({                                                                           \
+    uint64_t flat_slot_hash = (hash_value);                                    \
+    size_t flat_slot_group = flat_h1(flat_slot_hash) & flat_group_mask(set);   \
+    size_t flat_slot_retval;                                                   \
+    for (size_t flat_probe = 1;; flat_probe++) {                               \
+      uint32_t flat_free_slots = flat_group_match_empty_or_deleted(            \
+          &set.ctrl[flat_slot_group * FLAT_GROUP_WIDTH]);                      \
+      if (flat_free_slots != 0) {                                              \
+        flat_slot_retval = flat_slot_group * FLAT_GROUP_WIDTH +                \
+            __builtin_ctz(flat_free_slots);                                    \
+        break;                                                                 \
+      }                                                                        \
+      flat_slot_group = (flat_slot_group + flat_probe) & flat_group_mask(set); \
+    }                                                                          \
+    flat_slot_retval;                                                          \
+  })
+
+/* Batched flat lookups: hashes a group of keys and prefetches the control
+ * group each probe starts at before running the probes one by one */
+#define flat_find_many(set, keys, n, find_entry, write_out, out)               \
+  do {                                                                         \
+    typeof(&*(keys)) many_keys = (keys);                                       \
+    size_t many_n = (n);                                                       \
+    for (size_t many_base = 0; many_base < many_n;                             \
+         many_base += TREE_BATCH_WIDTH) {                                      \
+      size_t many_width = many_n - many_base < TREE_BATCH_WIDTH                \
+                              ? many_n - many_base                             \
+                              : TREE_BATCH_WIDTH;                              \
+      uint64_t many_hashes[TREE_BATCH_WIDTH];                                  \
+      for (size_t many_j = 0; many_j < many_width; many_j++) {                 \
+        many_hashes[many_j] =                                                  \
+            flat_mix(set.hash_fn(many_keys[many_base + many_j]));              \
+        __builtin_prefetch(&set.ctrl[(flat_h1(many_hashes[many_j]) &           \
+                                      flat_group_mask(set)) *                  \
+                                     FLAT_GROUP_WIDTH]);                       \
+      }                                                                        \
+      for (size_t many_j = 0; many_j < many_width; many_j++) {                 \
+        write_out(set, out, many_base + many_j,                                \
+                  find_entry(set, many_hashes[many_j],                         \
+                             many_keys[many_base + many_j]));                  \
+      }                                                                        \
+    }                                                                          \
+  } while (0)
+
+#define flat_first(set) flat_next(set, 0)
+
+#define flat_free(set, free_data)                                              \
+  do {                                                                         \
+    tree_dealloc(set, set.ctrl);                                               \
+    free_data(set);                                                            \
+  } while (0)
+
+/* Rehashing at the same capacity is enough to clear out tombstones, unless
+ * the table is at least half full with live entries */
+#define flat_grown_capacity(set)                                               \
+  (set.size >= flat_max_load(set.capacity) / 2 ? set.capacity * 2              \
+                                                : set.capacity)
+
+#define flat_group_mask(set) (set.capacity / FLAT_GROUP_WIDTH - 1)
+
+#define flat_group_start(slot) ((slot) & ~(size_t)(FLAT_GROUP_WIDTH - 1))
+
+#define flat_h1(hash_value) ((hash_value) >> 7)
+
+#define flat_h2(hash_value) ((uint8_t)((hash_value) & 0x7F))
+
+#define flat_init(set, hash_function, equals_function, malloc_entries)         \
+  do {                                                                         \
+    set.capacity = FLAT_GROUP_WIDTH;                                           \
+    set.size = 0;                                                              \
+    set.growth_left = flat_max_load(set.capacity);                             \
+    set.ctrl = tree_malloc(set, set.capacity);                                 \
+    memset(set.ctrl, FLAT_CTRL_EMPTY, set.capacity);                           \
+    malloc_entries(set);                                                       \
+    set.hash_fn = hash_function;                                               \
+    set.equals_fn = equals_function;                                           \
+  } while (0)
+
+#define flat_is_full(set, slot) ((set.ctrl[slot] & FLAT_CTRL_EMPTY) == 0)
+
+/* Keeps at least 1/8 of the slots empty, so that every probe terminates */
+#define flat_max_load(capacity) ((capacity) - (capacity) / 8)
+
+/* Address of the first full slot after addr in slot order, or 0 */
+#define flat_next(set, addr)                                                   \
+  ({                                                                           \
+    size_t flat_next_slot = (addr);                                            \
+    tree_addr_t flat_next_retval = 0;                                          \
+    while (flat_next_slot < set.capacity) {                                    \
+      size_t flat_next_group = flat_group_start(flat_next_slot);               \
+      uint32_t flat_full_mask =                                                \
+          ~flat_group_match_empty_or_deleted(&set.ctrl[flat_next_group]) &     \
+          (0xFFFFu << (flat_next_slot - flat_next_group));                     \
+      if ((flat_full_mask & 0xFFFF) != 0) {                                    \
+        flat_next_retval =                                                     \
+            tree_addr(flat_next_group + __builtin_ctz(flat_full_mask));        \
+        break;                                                                 \
+      }                                                                        \
+      flat_next_slot = flat_next_group + FLAT_GROUP_WIDTH;                     \
+    }                                                                          \
+    flat_next_retval;                                                          \
+  })
+
+/* Moves every entry into fresh columns of new_capacity slots */
+#define flat_rehash(set, new_capacity, get_entry, move_entry, malloc_entries,  \
+                    free_data)                                                 \
+  do {                                                                         \
+    typeof(set) flat_old = set;                                                \
+    set.capacity = (new_capacity);                                             \
+    set.growth_left = flat_max_load(set.capacity) - set.size;                  \
+    set.ctrl = tree_malloc(set, set.capacity);                                 \
+    memset(set.ctrl, FLAT_CTRL_EMPTY, set.capacity);                           \
+    malloc_entries(set);                                                       \
+    for (size_t flat_i = 0; flat_i < flat_old.capacity; flat_i++) {            \
+      if (!flat_is_full(flat_old, flat_i)) {                                   \
+        continue;                                                              \
+      }                                                                        \
+      tree_addr_t flat_from = tree_addr(flat_i);                               \
+      uint64_t flat_rehash_hash =                                              \
+          flat_mix(set.hash_fn(get_entry(flat_old, flat_from)));               \
+      size_t flat_to = flat_find_slot(set, flat_rehash_hash);                  \
+      set.ctrl[flat_to] = flat_h2(flat_rehash_hash);                           \
+      move_entry(set, tree_addr(flat_to), flat_old, flat_from);                \
+    }                                                                          \
+    flat_free(flat_old, free_data);                                            \
+  } while (0)
+
+/* Rehashes set once into the smallest capacity that holds n entries */
+#define flat_reserve(set, n, rehash)                                           \
+  do {                                                                         \
+    size_t reserve_capacity = set.capacity;                                    \
+    while (flat_max_load(reserve_capacity) < (n)) {                            \
+      reserve_capacity *= 2;                                                   \
+    }                                                                          \
+    if (reserve_capacity > set.capacity) {                                     \
+      rehash(set, reserve_capacity);                                           \
+    }                                                                          \
+  } while (0)
+
+/* A slot can go back to empty if its group still has an empty slot, as no
+ * probe sequence continues past such a group */
+#define flat_remove(set, entry, find_entry)                                    \
+  flat_remove_hashed(set, set.hash_fn(entry), entry, find_entry)
+
+#define flat_remove_hashed(set, hash_value, entry, find_entry)                 \
+  do {                                                                         \
+    tree_addr_t flat_remove_addr =                                             \
+        find_entry(set, flat_mix(hash_value), entry);                          \
+    if (!tree_is_valid_addr(flat_remove_addr)) {                               \
+      break;                                                                   \
+    }                                                                          \
+    size_t flat_remove_slot = tree_idx(flat_remove_addr);                      \
+    size_t flat_remove_group = flat_group_start(flat_remove_slot);             \
+    if (flat_group_match_empty(&set.ctrl[flat_remove_group]) != 0) {           \
+      set.ctrl[flat_remove_slot] = FLAT_CTRL_EMPTY;                            \
+      set.growth_left++;                                                       \
+    } else {                                                                   \
+      set.ctrl[flat_remove_slot] = FLAT_CTRL_DELETED;                          \
+    }                                                                          \
+    set.size--;                                                                \
+  } while (0)
+
+#define flat_type_fields()                                                     \
+  uint8_t *ctrl;                                                               \
+  size_t growth_left;
+
+#define frozen_clone(set, malloc_entries, move_entry)                          \
+  ({                                                                           \
+    typeof(set) clone = set;                                                   \
+    size_t clone_hash_bytes = frozen_hash_bytes(set.frozen_count);             \
+    clone.frozen_hashes = tree_aligned_alloc(set, 64, clone_hash_bytes);       \
+    memcpy(clone.frozen_hashes, set.frozen_hashes, clone_hash_bytes);          \
+    clone.frozen_runs =                                                        \
+        tree_malloc(set, sizeof(frozen_run_t) * (set.frozen_count + 1));       \
+    memcpy(clone.frozen_runs, set.frozen_runs,                                 \
+           sizeof(frozen_run_t) * (set.frozen_count + 1));                     \
+    malloc_entries(clone);                                                     \
+    for (tree_idx_t i = 0; i < set.size; i++) {                                \
+      move_entry(clone, tree_addr(i), set, tree_addr(i));                      \
+    }                                                                          \
+    clone;                                                                     \
+  })
+
+/* Entries of a frozen set are sorted by hash, so a range count is the
+ * distance between two lower bounds */
+#define frozen_count_range(set, lo, hi)                                        \
+  ({                                                                           \
+    tree_addr_t frozen_range_lo = frozen_lower_bound(set, lo);                 \
+    tree_addr_t frozen_range_hi = frozen_lower_bound(set, hi);                 \
+    size_t frozen_range_start =                                                \
+        frozen_range_lo ? tree_idx(frozen_range_lo) : set.size;                \
+    size_t frozen_range_end =                                                  \
+        frozen_range_hi ? tree_idx(frozen_range_hi) : set.size;                \
+    frozen_range_start < frozen_range_end                                      \
+        ? frozen_range_end - frozen_range_start                                \
+        : 0;                                                                   \
+  })
+
+#define frozen_find_entry(set, hash_value, entry_var, get_entry)               \
+  ({                                                                           \
+    uint64_t frozen_hash = (hash_value);                                       \
+    size_t frozen_k = frozen_lower_bound_slot(set, frozen_hash);               \
+    tree_addr_t frozen_find_retval = 0;                                        \
+    if (frozen_k != 0 && set.frozen_hashes[frozen_k] == frozen_hash) {         \
+      frozen_run_t frozen_run = set.frozen_runs[frozen_k];                     \
+      for (tree_idx_t frozen_i = frozen_run.start; frozen_i < frozen_run.end;  \
+           frozen_i++) {                                                       \
+        if (set.equals_fn(get_entry(set, tree_addr(frozen_i)), entry_var)) {   \
+          frozen_find_retval = tree_addr(frozen_i);                            \
+          break;                                                               \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+    frozen_find_retval;                                                        \
+  })
+
+/* Entries of a frozen set are sorted by hash, so addresses run in order */
+#define frozen_first(set) (set.size > 0 ? tree_addr(0) : 0)
+
+#define frozen_free(set, free_data)                                            \
+  do {                                                                         \
+    tree_dealloc(set, set.frozen_hashes);                                      \
+    tree_dealloc(set, set.frozen_runs);                                        \
+    free_data(set);                                                            \
+  } while (0)
+
+/* Eytzinger array size, rounded up to whole cache lines */
+#define frozen_hash_bytes(count)                                               \
+  (((count) + 1) * sizeof(uint64_t) + 63) / 64 * 64
+
+#define frozen_init(set, hash_function, equals_function, malloc_entries)       \
+  do {                                                                         \
+    set.capacity = 0;                                                          \
+    set.size = 0;                                                              \
+    set.frozen_count = 0;                                                      \
+    set.frozen_hashes = tree_aligned_alloc(set, 64, frozen_hash_bytes(0));     \
+    set.frozen_runs = tree_malloc(set, sizeof(frozen_run_t));                  \
+    malloc_entries(set);                                                       \
+    set.hash_fn = hash_function;                                               \
+    set.equals_fn = equals_function;                                           \
+  } while (0)
+
+#define frozen_lower_bound(set, hash_value)                                    \
+  ({                                                                           \
+    size_t frozen_bound_k = frozen_lower_bound_slot(set, hash_value);          \
+    frozen_bound_k != 0 ? tree_addr(set.frozen_runs[frozen_bound_k].start)     \
+                        : 0;                                                   \
+  })
+
+/* Branchless descent over the Eytzinger array, prefetching the cache line
+ * that holds the hashes four levels further down. The bits shifted out at
+ * the end are the right turns taken after the last left turn, which lands on
+ * the slot of the lower bound of the hash, or 0 if every hash is lower. */
+#define frozen_lower_bound_slot(set, hash_value)                               \
+  ({                                                                           \
+    uint64_t frozen_slot_hash = (hash_value);                                  \
+    size_t frozen_slot_k = 1;                                                  \
+    while (frozen_slot_k <= set.frozen_count) {                                \
+      __builtin_prefetch(&set.frozen_hashes[frozen_slot_k * 16]);              \
+      frozen_slot_k = 2 * frozen_slot_k +                                      \
+                      (set.frozen_hashes[frozen_slot_k] < frozen_slot_hash);   \
+    }                                                                          \
+    frozen_slot_k >> __builtin_ffsll(~(long long)frozen_slot_k);               \
+  })
+
+#define frozen_next(set, addr)                                                 \
+  ({                                                                           \
+    tree_addr_t frozen_next_addr = (addr);                                     \
+    frozen_next_addr < set.size ? frozen_next_addr + 1 : 0;                    \
+  })
+
+#define frozen_type_fields()                                                   \
+  uint64_t *frozen_hashes;                                                     \
+  frozen_run_t *frozen_runs;                                                   \
+  size_t frozen_count;
+
+#define map_add(map, key_var, value_var)                                       \
+  do {                                                                         \
+    tree_addr_t leaf_addr = tree_dispatch(                                     \
+        map,                                                                   \
+        tree_add(map, key_var, map_alloc_new_node, map_write_key,              \
+                 map_find_duplicate, map_entry_columns),                       \
+        flat_add(map, key_var, map_flat_find_entry, map_write_key,             \
+                 map_flat_rehash),                                             \
+        btree_add(map, key_var, map_btree_find_entry, map_btree_alloc_entry,   \
+                  map_write_key),                                              \
+        tree_read_only(map));                                                  \
+                                                                               \
+    if (tree_is_valid_addr(leaf_addr)) {                                       \
+      map_write_value(map, leaf_addr, value_var);                              \
+    }                                                                          \
+  } while (0)
+
+/* map_add() with the hash of key_var already at hand, which must be what
+ * hash_fn returns for it */
+#define map_add_hashed(map, hash_value, key_var, value_var)                    \
+  do {                                                                         \
+    uint64_t map_add_hash = (hash_value);                                      \
+    assert(map_add_hash == map.hash_fn(key_var));                              \
+    tree_addr_t leaf_addr = tree_dispatch(                                     \
+        map,                                                                   \
+        tree_add_hashed(map, map_add_hash, key_var, map_alloc_new_node,        \
+                        map_write_key, map_find_duplicate, map_entry_columns), \
+        flat_add_hashed(map, map_add_hash, key_var, map_flat_find_entry,       \
+                        map_write_key, map_flat_rehash),                       \
+        btree_add_hashed(map, map_add_hash, key_var, map_btree_find_entry,     \
+                         map_btree_alloc_entry, map_write_key),                \
+        tree_read_only(map));                                                  \
+                                                                               \
+    if (tree_is_valid_addr(leaf_addr)) {                                       \
+      map_write_value(map, leaf_addr, value_var);                              \
+    }                                                                          \
+  } while (0)
+
+#define map_alloc_new_node(map)                                                \
+  tree_alloc_new_node(map, map_create_entry, map_entry_columns)
+
+#define map_btree_alloc_entry(map)                                             \
+  btree_alloc_entry(map, map_realloc_entries)
+
+#define map_btree_find_entry(map, hash_value, key_var)                         \
+  btree_find_entry(map, hash_value, key_var, map_get_key)
+
+/* Adds a copy of the key_len bytes at key_ptr to a map_type_bytes(), with
+ * value_var. Returns whether the key was new; a key that was there keeps its
+ * value. */
+#define map_bytes_add(bytes_map, key_ptr, key_len, value_var)                  \
+  ({                                                                           \
+    set_bytes_t bytes_new_key = {(const char *)(key_ptr), (key_len)};          \
+    bytes_reserve(bytes_map, bytes_new_key.len + 1, keys);                     \
+    tree_addr_t bytes_new_addr =                                               \
+        tree_add(bytes_map.base, bytes_new_key, map_alloc_new_node,            \
+                 map_write_key, map_find_duplicate, map_entry_columns);        \
+    if (tree_is_valid_addr(bytes_new_addr)) {                                  \
+      map_write_value(bytes_map.base, bytes_new_addr, value_var);              \
+      bytes_append(bytes_map, bytes_new_addr, keys);                           \
+    }                                                                          \
+    tree_is_valid_addr(bytes_new_addr);                                        \
+  })
+
+/* map_compact() that also drops the bytes of removed keys from the arena */
+#define map_bytes_compact(bytes_map, layout)                                   \
+  bytes_compact(bytes_map, layout, map_compact, keys)
+
+#define map_bytes_free(bytes_map) bytes_free(bytes_map, map_free)
+
+/* Pointer to the value of the key_len bytes at key_ptr, or NULL */
+#define map_bytes_get(bytes_map, key_ptr, key_len)                             \
+  map_get(bytes_map.base, ((set_bytes_t){(const char *)(key_ptr), (key_len)}))
+
+#define map_bytes_has(bytes_map, key_ptr, key_len)                             \
+  map_has(bytes_map.base, ((set_bytes_t){(const char *)(key_ptr), (key_len)}))
+
+/* hash_function takes a set_bytes_t */
+#define map_bytes_init(bytes_map, hash_function)                               \
+  bytes_init(bytes_map, hash_function, map_init)
+
+#define map_bytes_remove(bytes_map, key_ptr, key_len)                          \
+  bytes_remove(bytes_map, key_ptr, key_len, map_remove)
+
+#define map_bytes_size(bytes_map) map_size(bytes_map.base)
+
+/* A read-only map_snapshot() of a map_type_bytes() that keeps its keys alive,
+ * released with map_bytes_free() */
+#define map_bytes_snapshot(bytes_map) bytes_snapshot(bytes_map, map_snapshot)
+
+/* Starts writing map to path in the background, see set_checkpoint() */
+#define map_checkpoint(map, path, checkpoint)                                  \
+  tree_checkpoint(map, path, checkpoint, map_entry_columns)
+
+#define map_clear_entry(map, addr)                                             \
+  do {                                                                         \
+    tree_idx_t clear_idx = tree_idx(addr);                                     \
+    assert(map.capacity > clear_idx);                                          \
+    tree_touch(map, &map.keys[clear_idx], sizeof(*map.keys));                  \
+    tree_touch(map, &map.values[clear_idx], sizeof(*map.values));              \
+    memset(&map.keys[clear_idx], 0x00, sizeof(typeof(*map.keys)));             \
+    memset(&map.values[clear_idx], 0x00, sizeof(typeof(*map.values)));         \
+    tree_write_inited(map, addr, false);                                       \
+  } while (0)
+
+#define map_clone(map)                                                         \
+  tree_dispatch(map, tree_clone(map, map_entry_columns),                       \
+                flat_clone(map, map_malloc_entries, map_move_entry),           \
+                btree_clone(map, map_malloc_entries, map_move_entry),          \
+                frozen_clone(map, map_malloc_entries, map_move_entry))
+
+#define map_copy_in(map, addr, idx, keys, values)                              \
+  do {                                                                         \
+    map_write_key(map, addr, (keys)[idx]);                                     \
+    map_write_value(map, addr, (values)[idx]);                                 \
+  } while (0)
+
+#define map_copy_out(map, addr, pos, keys, values)                             \
+  do {                                                                         \
+    (keys)[pos] = map_get_key(map, addr);                                      \
+    (values)[pos] = map_get_value(map, addr);                                  \
+  } while (0)
+
+/* Moves the live nodes of a tree map to the front of its buffers in
+ * SET_LAYOUT_BFS or SET_LAYOUT_VEB order and shrinks the buffers if they are
+ * mostly free. Addresses held from before are invalidated. */
+#define map_compact(map, layout)                                               \
+  tree_compact(map, layout, map_move_entry, map_entry_columns)
+
+/* Adds key_var with value_var from the writer thread of a
+ * map_concurrent_type(). Returns whether key_var was new. */
+#define map_concurrent_add(concurrent, key_var, value_var)                     \
+  ({                                                                           \
+    typeof(*concurrent.copies[0].keys) sync_add_key = (key_var);               \
+    typeof(*concurrent.copies[0].values) sync_add_value = (value_var);         \
+    uint64_t sync_add_hash = concurrent.copies[0].hash_fn(sync_add_key);       \
+    sync_write(concurrent, sync_map_add, sync_add_hash, sync_add_key,          \
+               sync_add_value);                                                \
+  })
+
+#define map_concurrent_free(concurrent) sync_free(concurrent, map_free)
+
+/* Looks key up from the reader thread with the given id, without waiting,
+ * and copies its value to value_out. Returns whether key was found. */
+#define map_concurrent_get(concurrent, reader, key, value_out)                 \
+  sync_lookup(concurrent, reader, key, map_find_node_entry, keys, values,      \
+              value_out)
+
+#define map_concurrent_has(concurrent, reader, key)                            \
+  sync_lookup(concurrent, reader, key, map_find_node_entry, keys, values,      \
+              (typeof(concurrent.copies[0].values))NULL)
+
+#define map_concurrent_init(concurrent, hash_function, equals_function)        \
+  sync_init(concurrent, hash_function, equals_function, map_init)
+
+#define map_concurrent_reader(concurrent) tree_sync_register(&concurrent.sync)
+
+/* Removes key from the writer thread. Returns whether it was in the map. */
+#define map_concurrent_remove(concurrent, key)                                 \
+  ({                                                                           \
+    typeof(*concurrent.copies[0].keys) sync_remove_key = (key);                \
+    uint64_t sync_remove_hash = concurrent.copies[0].hash_fn(sync_remove_key); \
+    sync_write(concurrent, sync_remove, sync_remove_hash, sync_remove_key,     \
+               map_find_node_entry, map_clear_entry, map_entry_columns);       \
+  })
+
+#define map_concurrent_size(concurrent) sync_size(concurrent)
+
+/* A map_type() with one writer thread and readers that never wait, see
+ * set_concurrent_type() */
+#define map_concurrent_type(key_type, value_type)                              \
+  struct {                                                                     \
+    map_type(key_type, value_type) copies[2];                                  \
+    tree_sync_t sync;                                                          \
+  }
+
+/* Replaces the value of key from the writer thread. Returns whether key was
+ * in the map. */
+#define map_concurrent_update(concurrent, key, value_var)                      \
+  ({                                                                           \
+    typeof(*concurrent.copies[0].keys) sync_update_key = (key);                \
+    typeof(*concurrent.copies[0].values) sync_update_value = (value_var);      \
+    uint64_t sync_update_hash = concurrent.copies[0].hash_fn(sync_update_key); \
+    sync_write(concurrent, sync_map_update, sync_update_hash, sync_update_key, \
+               sync_update_value);                                             \
+  })
+
+/* Number of entries with a hash in [lo, hi). O(log n) for tree types with
+ * subtree counts and frozen types, otherwise a scan over the range. */
+#define map_count_range(map, lo, hi)                                           \
+  tree_dispatch(map,                                                           \
+                tree_count_range(map, lo, hi, map_range_first,                 \
+                                 map_range_next),                              \
+                (tree_requires_ordered(map), (size_t)0),                       \
+                tree_count_range_scan(map, lo, hi, map_range_first,            \
+                                      map_range_next),                         \
+                frozen_count_range(map, lo, hi))
+
+#define map_create_entry(map, idx)                                             \
+  do {                                                                         \
+    tree_touch(map, &map.keys[idx], sizeof(*map.keys));                        \
+    tree_touch(map, &map.values[idx], sizeof(*map.values));                    \
+    memset(&map.keys[idx], 0x00, sizeof(typeof(*map.keys)));                   \
+    memset(&map.values[idx], 0x00, sizeof(typeof(*map.values)));               \
+  } while (0)
+
+/* Defines the tree map type name##_t and functions on a pointer to it:
+ * name##_init(), name##_free(), name##_add(), name##_get(), name##_has(),
+ * name##_remove() and name##_size(). Each operation is expanded once, in
+ * its function, instead of at every call site. */
+#define map_declare(name, key_type, value_type)                                \
+  typedef map_type(key_type, value_type) name##_t;                             \
+                                                                               \
+  static inline void name##_init(name##_t *map,                                \
+                                 uint64_t (*hash_function)(key_type),          \
+                                 bool (*equals_function)(key_type,             \
+                                                         key_type)) {          \
+    map_init((*map), hash_function, equals_function);                          \
+  }                                                                            \
+                                                                               \
+  static inline void name##_free(name##_t *map) { map_free((*map)); }          \
+                                                                               \
+  static inline bool name##_add(name##_t *map, key_type key,                   \
+                                value_type value) {                            \
+    size_t size_before = map->size;                                            \
+    map_add((*map), key, value);                                               \
+    return map->size != size_before;                                           \
+  }                                                                            \
+                                                                               \
+  static inline value_type *name##_get(name##_t *map, key_type key) {          \
+    return map_get((*map), key);                                               \
+  }                                                                            \
+                                                                               \
+  static inline bool name##_has(name##_t *map, key_type key) {                 \
+    return map_has((*map), key);                                               \
+  }                                                                            \
+                                                                               \
+  static inline bool name##_remove(name##_t *map, key_type key) {              \
+    size_t size_before = map->size;                                            \
+    map_remove((*map), key);                                                   \
+    return map->size != size_before;                                           \
+  }                                                                            \
+                                                                               \
+  static inline size_t name##_size(name##_t *map) { return map_size((*map)); }
+
+/* Defines prefix##_add(), prefix##_get(), prefix##_has() and
+ * prefix##_remove() for the tree map type map_type_name. They work like
+ * map_add() and friends on a pointer to the map, but call hash_function and
+ * equals_function directly rather than through the pointers in the map, so
+ * the compiler can inline them. The map is still set up with map_init() and
+ * the same two functions, and the other map_* operations keep working. */
+#define map_declare_static(prefix, map_type_name, hash_function,               \
+                           equals_function)                                    \
+  static inline bool prefix##_add(                                             \
+      map_type_name *map, typeof(*((map_type_name *)NULL)->keys) key,          \
+      typeof(*((map_type_name *)NULL)->values) value) {                        \
+    tree_requires_backend((*map), SET_BACKEND_TREE);                           \
+    typeof(&equals_function) const declared_equals = equals_function;          \
+    tree_addr_t addr =                                                         \
+        tree_add_hashed((*map), hash_function(key), key, map_alloc_new_node,   \
+                        map_write_key, map_static_find_duplicate,              \
+                        map_entry_columns);                                    \
+    if (tree_is_valid_addr(addr)) {                                            \
+      map_write_value((*map), addr, value);                                    \
+    }                                                                          \
+    return tree_is_valid_addr(addr);                                           \
+  }                                                                            \
+                                                                               \
+  static inline typeof(((map_type_name *)NULL)->values) prefix##_get(          \
+      map_type_name *map, typeof(*((map_type_name *)NULL)->keys) key) {        \
+    tree_requires_backend((*map), SET_BACKEND_TREE);                           \
+    typeof(&equals_function) const declared_equals = equals_function;          \
+    tree_addr_t addr =                                                         \
+        map_static_find_node_entry((*map), hash_function(key), key);           \
+    return map_value_at((*map), addr);                                         \
+  }                                                                            \
+                                                                               \
+  static inline bool prefix##_has(                                             \
+      map_type_name *map, typeof(*((map_type_name *)NULL)->keys) key) {        \
+    tree_requires_backend((*map), SET_BACKEND_TREE);                           \
+    typeof(&equals_function) const declared_equals = equals_function;          \
+    return tree_is_valid_addr(                                                 \
+        map_static_find_node_entry((*map), hash_function(key), key));          \
+  }                                                                            \
+                                                                               \
+  static inline bool prefix##_remove(                                          \
+      map_type_name *map, typeof(*((map_type_name *)NULL)->keys) key) {        \
+    tree_requires_backend((*map), SET_BACKEND_TREE);                           \
+    typeof(&equals_function) const declared_equals = equals_function;          \
+    size_t size_before = map->size;                                            \
+    tree_remove_hashed((*map), hash_function(key), key,                        \
+                       map_static_find_node_entry, map_clear_entry,            \
+                       map_entry_columns);                                     \
+    return map->size != size_before;                                           \
+  }
+
+#define map_empty(map) tree_empty(map, map_init_with_allocator, map_free)
+
+/* Calls column(map, field) on every entry column, which tree maps carve out
+ * of their single storage block */
+#define map_entry_columns(map, column)                                         \
+  column(map, keys);                                                           \
+  column(map, values)
+
+#define map_find_duplicate(map, node_addr, key_var)                            \
+  tree_find_duplicate(map, node_addr, key_var, map_get_key, keys)
+
+#define map_find_entry(map, key_var)                                           \
+  map_find_entry_hashed(map, map.hash_fn(key_var), key_var)
+
+#define map_find_entry_hashed(map, hash_value, key_var)                        \
+  ({                                                                           \
+    uint64_t map_find_hash = (hash_value);                                     \
+    tree_dispatch(map, map_find_node_entry(map, map_find_hash, key_var),       \
+                  map_flat_find_entry(map, flat_mix(map_find_hash), key_var),  \
+                  map_btree_find_entry(map, map_find_hash, key_var),           \
+                  map_frozen_find_entry(map, map_find_hash, key_var));         \
+  })
+
+#define map_find_node_entry(map, hash_value, key_var)                          \
+  tree_find_node_entry(map, hash_value, key_var, map_find_duplicate)
+
+#define map_first(map)                                                         \
+  tree_dispatch(map, tree_first(map), flat_first(map), btree_first(map),       \
+                frozen_first(map))
+
+#define map_flat_find_entry(map, hash_value, key_var)                          \
+  flat_find_entry(map, hash_value, key_var, map_get_key)
+
+#define map_flat_rehash(map, new_capacity)                                     \
+  flat_rehash(map, new_capacity, map_get_key, map_move_entry,                  \
+              map_malloc_entries, map_free_data)
+
+/* Loops over every address of map in storage order rather than hash order,
+ * which streams through the keys and values of tree types instead of chasing
+ * pointers */
+#define map_foreach_unordered(map, addr)                                       \
+  for (tree_addr_t addr = map_unordered_first(map); tree_is_valid_addr(addr);  \
+       addr = map_unordered_next(map, addr))
+
+#define map_free(map)                                                          \
+  tree_dispatch(map, tree_free(map),                                           \
+                flat_free(map, map_free_data),                                 \
+                btree_free(map, map_free_data),                                \
+                frozen_free(map, map_free_data))
+
+#define map_free_data(set)                                                     \
+  do {                                                                         \
+    tree_dealloc(set, set.keys);                                               \
+    tree_dealloc(set, set.values);                                             \
+  } while (0)
+
+#define map_freeze(frozen, map)                                                \
+  tree_freeze(frozen, map, map_get_key, map_move_entry, map_malloc_entries,    \
+              map_first, map_next)
+
+#define map_frozen_find_entry(map, hash_value, key_var)                        \
+  frozen_find_entry(map, hash_value, key_var, map_get_key)
+
+/* Initializes map with n key/value pairs. Tree maps are built in one pass
+ * with a single allocation, other types add the pairs one by one. */
+#define map_from_arrays(map, keys, values, n, hash_function, equals_function)  \
+  tree_dispatch(map,                                                           \
+                tree_from_array(map, keys, n, hash_function, equals_function,  \
+                                map_entry_columns, map_copy_in, values),       \
+                map_from_arrays_by_add(map, keys, values, n, hash_function,    \
+                                       equals_function),                       \
+                map_from_arrays_by_add(map, keys, values, n, hash_function,    \
+                                       equals_function),                       \
+                tree_read_only(map))
+
+#define map_from_arrays_by_add(map, keys, values, n, hash_function,            \
+                               equals_function)                                \
+  do {                                                                         \
+    map_init(map, hash_function, equals_function);                             \
+    map_reserve(map, n);                                                       \
+    for (size_t from_i = 0; from_i < (n); from_i++) {                          \
+      map_add(map, (keys)[from_i], (values)[from_i]);                          \
+    }                                                                          \
+  } while (0)
+
+#define map_get(map, key) map_value_at(map, map_find_entry(map, key))
+
+/* map_get() with the hash of key already at hand, which must be what
+ * hash_fn returns for it */
+#define map_get_hashed(map, hash_value, key)                                   \
+  ({                                                                           \
+    uint64_t map_get_hash = (hash_value);                                      \
+    assert(map_get_hash == map.hash_fn(key));                                  \
+    map_value_at(map, map_find_entry_hashed(map, map_get_hash, key));          \
+  })
+
+#define map_get_key(map, addr)                                                 \
+  ({                                                                           \
+    tree_idx_t idx = tree_idx(addr);                                           \
+    assert(map.capacity > idx);                                                \
+    map.keys[idx];                                                             \
+  })
+
+/* Looks up n keys and writes a pointer to the value of each, or NULL when
+ * the key is not in map, to out */
+#define map_get_many(map, keys, n, out)                                        \
+  tree_dispatch(                                                               \
+      map,                                                                     \
+      tree_find_many(map, keys, n, map_find_duplicate, map_get_out, out),      \
+      flat_find_many(map, keys, n, map_flat_find_entry, map_get_out, out),     \
+      tree_find_many_seq(map, keys, n, map_btree_find_entry, map_get_out,      \
+                         out),                                                 \
+      tree_find_many_seq(map, keys, n, map_frozen_find_entry, map_get_out,     \
+                         out))
+
+#define map_get_out(map, out, pos, addr) ((out)[pos] = map_value_at(map, addr))
+
+#define map_get_value(map, addr)                                               \
+  ({                                                                           \
+    tree_idx_t idx = tree_idx(addr);                                           \
+    assert(map.capacity > idx);                                                \
+    map.values[idx];                                                           \
+  })
+
+/* Sets how a full tree or btree map grows: to percent of its capacity, but by
+ * at least increment slots. Doubling is (200, 0), 1.5x is (150, 0) and fixed
+ * steps of k slots are (100, k). Flat maps always double. */
+#define map_growth_policy(map, percent, increment)                             \
+  do {                                                                         \
+    map.growth_percent = (percent);                                            \
+    map.growth_increment = (increment);                                        \
+  } while (0)
+
+#define map_has(map, key) tree_is_valid_addr(map_find_entry(map, key))
+
+#define map_has_hashed(map, hash_value, key)                                   \
+  ({                                                                           \
+    uint64_t map_has_hash = (hash_value);                                      \
+    assert(map_has_hash == map.hash_fn(key));                                  \
+    tree_is_valid_addr(map_find_entry_hashed(map, map_has_hash, key));         \
+  })
+
+#define map_init(map, hash_function, equals_function)                          \
+  map_init_with_allocator(map, hash_function, equals_function,                 \
+                          set_libc_allocator())
+
+/* Initializes map with its buffers coming from allocator_ptr, which has to
+ * outlive it */
+#define map_init_with_allocator(map, hash_function, equals_function,           \
+                                allocator_ptr)                                 \
+  do {                                                                         \
+    map.allocator = (allocator_ptr);                                           \
+    tree_dispatch(map,                                                         \
+                  tree_init(map, hash_function, equals_function,               \
+                            map_entry_columns, map_alloc_new_node),            \
+                  flat_init(map, hash_function, equals_function,               \
+                            map_malloc_entries),                               \
+                  btree_init(map, hash_function, equals_function,              \
+                             map_malloc_entries),                              \
+                  frozen_init(map, hash_function, equals_function,             \
+                              map_malloc_entries));                            \
+  } while (0)
+
+/* Moves the entries of b into a. Every hash in a must be lower than every
+ * hash in b. b is consumed. */
+#define map_join(a, b)                                                         \
+  tree_join(a, b, map_get_key, map_find_node_entry, map_clear_entry,           \
+            map_alloc_new_node, map_move_entry, map_entry_columns)
+
+/* Address of the first entry whose hash is not below hash_value, or 0 */
+#define map_lower_bound(map, hash_value)                                       \
+  tree_dispatch(map, tree_lower_bound(map, hash_value),                        \
+                (tree_requires_ordered(map), (tree_addr_t)0),                  \
+                btree_cursor_addr(map, btree_lower_bound(map, hash_value)),    \
+                frozen_lower_bound(map, hash_value))
+
+#define map_malloc_entries(map)                                                \
+  do {                                                                         \
+    map.keys = tree_malloc(map, sizeof(typeof(*map.keys)) * map.capacity);     \
+    map.values = tree_malloc(map, sizeof(typeof(*map.values)) * map.capacity); \
+  } while (0)
+
+/* Opens a map saved with map_save(), see set_mmap_open() */
+#define map_mmap_open(map, path, hash_function, equals_function)               \
+  tree_mmap_open(map, path, hash_function, equals_function, map_entry_columns)
+
+#define map_move_entry(map, to_addr, src, from_addr)                           \
+  do {                                                                         \
+    map_write_key(map, to_addr, map_get_key(src, from_addr));                  \
+    map_write_value(map, to_addr, map_get_value(src, from_addr));              \
+  } while (0)
+
+#define map_next(map, addr)                                                    \
+  tree_dispatch(map, tree_next(map, addr), flat_next(map, addr),               \
+                btree_next(map, addr), frozen_next(map, addr))
+
+#define map_random_sample(map, k, out_addrs)                                   \
+  tree_random_sample(map, k, out_addrs)
+
+/* First entry with a hash in [lo, hi), or 0. Iterate the range with
+ * map_range_next(). */
+#define map_range_first(map, lo, hi)                                           \
+  tree_range_first(map, lo, hi, map_lower_bound, map_get_key)
+
+#define map_range_next(map, addr, hi)                                          \
+  tree_range_next(map, addr, hi, map_next, map_get_key)
+
+#define map_rank(map, key) tree_rank(map, key, map_find_node_entry)
+
+#define map_realloc_entries(map)                                               \
+  do {                                                                         \
+    map.keys = tree_realloc(map, map.keys,                                     \
+                            sizeof(typeof(*map.keys)) * map.capacity);         \
+    map.values =                                                               \
+        tree_realloc(map, map.values,                                          \
+                     sizeof(typeof(*map.values)) * map.capacity);              \
+  } while (0)
+
+#define map_remove(map, key)                                                   \
+  tree_dispatch(map,                                                           \
+                tree_remove(map, key, map_find_node_entry, map_clear_entry,    \
+                            map_entry_columns),                                \
+                flat_remove(map, key, map_flat_find_entry),                    \
+                btree_remove(map, key, map_btree_find_entry),                  \
+                tree_read_only(map))
+
+#define map_remove_hashed(map, hash_value, key)                                \
+  do {                                                                         \
+    uint64_t map_remove_hash = (hash_value);                                   \
+    assert(map_remove_hash == map.hash_fn(key));                               \
+    tree_dispatch(map,                                                         \
+                  tree_remove_hashed(map, map_remove_hash, key,                \
+                                     map_find_node_entry, map_clear_entry,     \
+                                     map_entry_columns),                       \
+                  flat_remove_hashed(map, map_remove_hash, key,                \
+                                     map_flat_find_entry),                     \
+                  btree_remove_hashed(map, map_remove_hash, key,               \
+                                      map_btree_find_entry),                   \
+                  tree_read_only(map));                                        \
+  } while (0)
+
+/* Removes every entry with a hash in [lo, hi) and returns how many there
+ * were */
+#define map_remove_hash_range(map, lo, hi)                                     \
+  tree_remove_hash_range(map, lo, hi, map_alloc_new_node, map_clear_entry,     \
+                         map_entry_columns)
+
+/* Grows map in one step to room for n entries in total, so that filling it
+ * up to n does not reallocate */
+#define map_reserve(map, n)                                                    \
+  tree_dispatch(map, tree_reserve(map, n, map_entry_columns),                  \
+                flat_reserve(map, n, map_flat_rehash),                         \
+                btree_reserve(map, n, map_realloc_entries),                    \
+                tree_read_only(map))
+
+#define map_save(map, path) tree_save(map, path, map_entry_columns)
+
+#define map_select(map, k) tree_select(map, k)
+
+/* Adds a key/value pair to the shard the hash of key_var picks, under its
+ * lock. Returns whether the key was new; the value of a key already there is
+ * left alone, as in map_add. */
+#define map_sharded_add(sharded, key_var, value_var)                           \
+  ({                                                                           \
+    uint64_t sharded_hash = sharded.shards[0].shard.hash_fn(key_var);          \
+    typeof(sharded.shards[0]) *sharded_slot =                                  \
+        &sharded.shards[sharded_index(sharded, sharded_hash)];                 \
+    sharded_lock_write(&sharded_slot->lock, sharded_lock_kind(sharded));       \
+    tree_addr_t sharded_addr = tree_add_hashed(                                \
+        sharded_slot->shard, sharded_hash, key_var, map_alloc_new_node,        \
+        map_write_key, map_find_duplicate, map_entry_columns);                 \
+    if (tree_is_valid_addr(sharded_addr)) {                                    \
+      map_write_value(sharded_slot->shard, sharded_addr, value_var);           \
+    }                                                                          \
+    sharded_unlock(&sharded_slot->lock, sharded_lock_kind(sharded));           \
+    tree_is_valid_addr(sharded_addr);                                          \
+  })
+
+#define map_sharded_free(sharded) sharded_free(sharded, map_free)
+
+/* Copies the value of key into *value_out and returns true, or returns false
+ * if key is not in the map. Pointers into a shard would outlive its lock. */
+#define map_sharded_get(sharded, key, value_out)                               \
+  ({                                                                           \
+    uint64_t sharded_hash = sharded.shards[0].shard.hash_fn(key);              \
+    typeof(sharded.shards[0]) *sharded_slot =                                  \
+        &sharded.shards[sharded_index(sharded, sharded_hash)];                 \
+    sharded_lock_read(&sharded_slot->lock, sharded_lock_kind(sharded));        \
+    tree_addr_t sharded_addr =                                                 \
+        map_find_node_entry(sharded_slot->shard, sharded_hash, key);           \
+    if (tree_is_valid_addr(sharded_addr)) {                                    \
+      *(value_out) = map_get_value(sharded_slot->shard, sharded_addr);         \
+    }                                                                          \
+    sharded_unlock(&sharded_slot->lock, sharded_lock_kind(sharded));           \
+    tree_is_valid_addr(sharded_addr);                                          \
+  })
+
+#define map_sharded_has(sharded, key)                                          \
+  sharded_has(sharded, key, map_find_node_entry)
+
+#define map_sharded_init(sharded, hash_function, equals_function)              \
+  sharded_init(sharded, hash_function, equals_function, map_init)
+
+#define map_sharded_remove(sharded, key)                                       \
+  sharded_remove(sharded, key, map_find_node_entry, map_clear_entry,           \
+                 map_entry_columns)
+
+#define map_sharded_shards(sharded) sharded_count(sharded)
+
+#define map_sharded_size(sharded) sharded_size(sharded)
+
+/* A map_snapshot() of shard i, the one covering the i-th slice of the hash
+ * range, for walking it without holding its lock */
+#define map_sharded_snapshot(sharded, i)                                       \
+  sharded_snapshot(sharded, i, map_entry_columns)
+
+/* Writes the pairs of every shard, each under its lock, to two arrays of at
+ * least map_sharded_size() elements. The shards split the hash range in
+ * order, so the pairs come out in hash order. Returns the number written. */
+#define map_sharded_to_arrays(sharded, keys, values)                           \
+  ({                                                                           \
+    size_t sharded_n = 0;                                                      \
+    for (size_t sharded_i = 0; sharded_i < sharded_count(sharded);             \
+         sharded_i++) {                                                        \
+      typeof(sharded.shards[0]) *sharded_slot = &sharded.shards[sharded_i];    \
+      sharded_lock_read(&sharded_slot->lock, sharded_lock_kind(sharded));      \
+      sharded_n += tree_to_array(sharded_slot->shard, map_copy_out,            \
+                                 (keys) + sharded_n, (values) + sharded_n);    \
+      sharded_unlock(&sharded_slot->lock, sharded_lock_kind(sharded));         \
+    }                                                                          \
+    sharded_n;                                                                 \
+  })
+
+/* A map split into n_shards tree maps by hash, each behind a spinlock, for
+ * many threads writing at once */
+#define map_sharded_type(key_type, value_type, n_shards)                       \
+  map_sharded_type_lock(key_type, value_type, n_shards, SET_SHARD_SPINLOCK)
+
+#define map_sharded_type_lock(key_type, value_type, n_shards, lock_id)         \
+  sharded_type(map_type(key_type, value_type), n_shards, lock_id)
+
+#define map_size(tree) tree_size(tree)
+
+/* A read-only view of map as it is now, released with map_free(). O(1) for
+ * tree maps, which share their storage with the view until map is next
+ * changed; a clone for other types. */
+#define map_snapshot(map)                                                      \
+  tree_dispatch(map, tree_snapshot(map, map_entry_columns), map_clone(map),    \
+                map_clone(map), map_clone(map))
+
+/* Moves the entries of map with a hash below pivot_hash into lower and the
+ * others into upper. map is consumed. */
+#define map_split(map, pivot_hash, lower, upper)                               \
+  tree_split(map, pivot_hash, lower, upper, map_alloc_new_node,                \
+             map_move_entry, map_clear_entry, map_entry_columns)
+
+/* Lookup callbacks of map_declare_static(), comparing keys with the
+ * declared_equals of the function they expand in */
+#define map_static_find_duplicate(map, node_addr, key_var)                     \
+  tree_find_duplicate_with(map, node_addr, key_var, map_get_key, keys,         \
+                           declared_equals)
+
+#define map_static_find_node_entry(map, hash_value, key_var)                   \
+  tree_find_node_entry(map, hash_value, key_var, map_static_find_duplicate)
+
+#define map_thaw(map, frozen)                                                  \
+  tree_dispatch(                                                               \
+      map,                                                                     \
+      tree_thaw(map, frozen, map_get_key, map_move_entry, map_entry_columns),  \
+      map_thaw_by_add(map, frozen), map_thaw_by_add(map, frozen),              \
+      tree_read_only(map))
+
+#define map_thaw_by_add(map, frozen)                                           \
+  do {                                                                         \
+    map_init(map, frozen.hash_fn, frozen.equals_fn);                           \
+    map_reserve(map, frozen.size);                                             \
+    for (tree_addr_t thaw_addr = map_first(frozen);                            \
+         tree_is_valid_addr(thaw_addr);                                        \
+         thaw_addr = map_next(frozen, thaw_addr)) {                            \
+      typeof(*frozen.keys) thaw_key = map_get_key(frozen, thaw_addr);          \
+      typeof(*frozen.values) thaw_value = map_get_value(frozen, thaw_addr);    \
+      map_add(map, thaw_key, thaw_value);                                      \
+    }                                                                          \
+  } while (0)
+
+/* Writes the keys and values of map in iteration order (hash order for
+ * ordered types) to two arrays of at least map_size(map) elements. Returns
+ * the number of pairs written. */
+#define map_to_arrays(map, keys, values)                                       \
+  tree_dispatch(                                                               \
+      map, tree_to_array(map, map_copy_out, keys, values),                     \
+      tree_to_array_seq(map, flat_first, flat_next, map_copy_out, keys,        \
+                        values),                                               \
+      tree_to_array_seq(map, btree_first, btree_next, map_copy_out, keys,      \
+                        values),                                               \
+      tree_to_array_seq(map, frozen_first, frozen_next, map_copy_out, keys,    \
+                        values))
+
+#define map_type(key_type, value_type)                                         \
+  map_type_backend(key_type, value_type, SET_BACKEND_TREE)
+
+#define map_type_backend(key_type, value_type, backend_id)                     \
+  struct {                                                                     \
     key_type *keys;                                                            \
     value_type *values;                                                        \
     uint64_t (*hash_fn)(key_type);                                             \
     bool (*equals_fn)(key_type, key_type);                                     \
+    const set_allocator_t *allocator;                                          \
     tree_type_fields()                                                         \
+    flat_type_fields()                                                         \
+    btree_type_fields()                                                        \
+    frozen_type_fields()                                                       \
+    uint8_t backend[backend_id];                                               \
+  }
+
+#define map_type_btree(key_type, value_type)                                   \
+  map_type_backend(key_type, value_type, SET_BACKEND_BTREE)
+
+/* A tree map from byte strings to value_type that owns copies of its keys.
+ * The copies live in one arena rather than a malloc() each. */
+#define map_type_bytes(value_type)                                             \
+  struct {                                                                     \
+    map_type(set_bytes_t, value_type) base;                                    \
+    tree_arena_t arena;                                                        \
   }
 
+#define map_type_frozen(key_type, value_type)                                  \
+  map_type_backend(key_type, value_type, SET_BACKEND_FROZEN)
+
+#define map_type_flat(key_type, value_type)                                    \
+  map_type_backend(key_type, value_type, SET_BACKEND_FLAT)
+
+#define map_unordered_first(map)                                               \
+  tree_dispatch(map, tree_unordered_next(map, 0), flat_first(map),             \
+                btree_first(map), frozen_first(map))
+
+#define map_unordered_next(map, addr)                                          \
+  tree_dispatch(map, tree_unordered_next(map, addr), flat_next(map, addr),     \
+                btree_next(map, addr), frozen_next(map, addr))
+
+/* Address of the first entry whose hash is above hash_value, or 0 */
+#define map_upper_bound(map, hash_value)                                       \
+  tree_upper_bound(map, hash_value, map_lower_bound)
+
+/* Pointer to the value at addr, or NULL if addr is 0. The value can be
+ * written through it, so a tree map copies its chunk if a snapshot shares
+ * it; pointers into snapshots are read-only. */
+#define map_value_at(map, addr)                                                \
+  ({                                                                           \
+    tree_addr_t value_at_addr = (addr);                                        \
+    typeof(map.values) value_at_retval = NULL;                                 \
+    if (tree_is_valid_addr(value_at_addr)) {                                   \
+      tree_idx_t value_at_idx = tree_idx(value_at_addr);                       \
+      assert(map.capacity > value_at_idx);                                     \
+      value_at_retval = &map.values[value_at_idx];                             \
+      tree_touch(map, value_at_retval, sizeof(*value_at_retval));              \
+    }                                                                          \
+    value_at_retval;                                                           \
+  })
+
 #define map_write_key(map, addr, key)                                          \
   do {                                                                         \
     tree_idx_t map_write_key_idx = tree_idx(addr);                             \
     assert(map.capacity > map_write_key_idx);                                  \
+    tree_touch(map, &map.keys[map_write_key_idx], sizeof(*map.keys));          \
     map.keys[map_write_key_idx] = key;                                         \
   } while (0)
 
@@ -189,98 +2861,985 @@ typedef struct {
   do {                                                                         \
     tree_idx_t map_write_value_idx = tree_idx(addr);                           \
     assert(map.capacity > map_write_value_idx);                                \
+    tree_touch(map, &map.values[map_write_value_idx], sizeof(*map.values));    \
     map.values[map_write_value_idx] = value;                                   \
   } while (0)
 
 #define set_add(set, entry_var)                                                \
-  tree_add(set, entry_var, set_alloc_new_node, set_write_entry,                \
-           set_find_duplicate)
+  tree_dispatch(set,                                                           \
+                tree_add(set, entry_var, set_alloc_new_node, set_write_entry,  \
+                         set_find_duplicate, set_entry_columns),               \
+                flat_add(set, entry_var, set_flat_find_entry, set_write_entry, \
+                         set_flat_rehash),                                     \
+                btree_add(set, entry_var, set_btree_find_entry,                \
+                          set_btree_alloc_entry, set_write_entry),             \
+                tree_read_only(set))
+
+/* set_add() with the hash of entry_var already at hand, which must be what
+ * hash_fn returns for it. Skips the call to hash_fn. */
+#define set_add_hashed(set, hash_value, entry_var)                             \
+  ({                                                                           \
+    uint64_t set_add_hash = (hash_value);                                      \
+    assert(set_add_hash == set.hash_fn(entry_var));                            \
+    tree_dispatch(set,                                                         \
+                  tree_add_hashed(set, set_add_hash, entry_var,                \
+                                  set_alloc_new_node, set_write_entry,         \
+                                  set_find_duplicate, set_entry_columns),      \
+                  flat_add_hashed(set, set_add_hash, entry_var,                \
+                                  set_flat_find_entry, set_write_entry,        \
+                                  set_flat_rehash),                            \
+                  btree_add_hashed(set, set_add_hash, entry_var,               \
+                                   set_btree_find_entry,                       \
+                                   set_btree_alloc_entry, set_write_entry),    \
+                  tree_read_only(set));                                        \
+  })
 
 #define set_alloc_new_node(set)                                                \
-  tree_alloc_new_node(set, set_create_entry, set_realloc_entries)
+  tree_alloc_new_node(set, set_create_entry, set_entry_columns)
+
+#define set_btree_alloc_entry(set)                                             \
+  btree_alloc_entry(set, set_realloc_entries)
+
+#define set_btree_find_entry(set, hash_value, entry_var)                       \
+  btree_find_entry(set, hash_value, entry_var, set_get_entry)
+
+/* Adds a copy of the key_len bytes at key_ptr to a set_type_bytes().
+ * Returns whether they were new. */
+#define set_bytes_add(bytes_set, key_ptr, key_len)                             \
+  ({                                                                           \
+    set_bytes_t bytes_new_key = {(const char *)(key_ptr), (key_len)};          \
+    bytes_reserve(bytes_set, bytes_new_key.len + 1, entries);                  \
+    tree_addr_t bytes_new_addr = set_add(bytes_set.base, bytes_new_key);       \
+    if (tree_is_valid_addr(bytes_new_addr)) {                                  \
+      bytes_append(bytes_set, bytes_new_addr, entries);                        \
+    }                                                                          \
+    tree_is_valid_addr(bytes_new_addr);                                        \
+  })
+
+/* set_compact() that also drops the bytes of removed keys from the arena */
+#define set_bytes_compact(bytes_set, layout)                                   \
+  bytes_compact(bytes_set, layout, set_compact, entries)
+
+#define set_bytes_free(bytes_set) bytes_free(bytes_set, set_free)
+
+#define set_bytes_has(bytes_set, key_ptr, key_len)                             \
+  set_has(bytes_set.base, ((set_bytes_t){(const char *)(key_ptr), (key_len)}))
+
+/* hash_function takes a set_bytes_t */
+#define set_bytes_init(bytes_set, hash_function)                               \
+  bytes_init(bytes_set, hash_function, set_init)
+
+#define set_bytes_remove(bytes_set, key_ptr, key_len)                          \
+  bytes_remove(bytes_set, key_ptr, key_len, set_remove)
+
+#define set_bytes_size(bytes_set) set_size(bytes_set.base)
+
+/* A read-only set_snapshot() of a set_type_bytes() that keeps its keys alive,
+ * released with set_bytes_free() */
+#define set_bytes_snapshot(bytes_set) bytes_snapshot(bytes_set, set_snapshot)
+
+/* Starts writing set to path as set_save() would, from a forked child, and
+ * returns at once. The file holds set as it was at the call however it
+ * changes meanwhile. Poll or wait on checkpoint for the outcome. */
+#define set_checkpoint(set, path, checkpoint)                                  \
+  tree_checkpoint(set, path, checkpoint, set_entry_columns)
 
 #define set_clear_entry(set, addr)                                             \
   do {                                                                         \
-    tree_idx_t clear_idx = tree_idx(addr);                                     \
-    assert(set.capacity > clear_idx);                                          \
-    memset(&set.entries[clear_idx], 0x00, sizeof(typeof(set.entries)));        \
-    tree_write_inited(set, addr, false);                                       \
+    tree_idx_t clear_idx = tree_idx(addr);                                     \
+    assert(set.capacity > clear_idx);                                          \
+    tree_touch(set, &set.entries[clear_idx], sizeof(*set.entries));            \
+    memset(&set.entries[clear_idx], 0x00, sizeof(typeof(*set.entries)));       \
+    tree_write_inited(set, addr, false);                                       \
+  } while (0)
+
+#define set_clone(set)                                                         \
+  tree_dispatch(set, tree_clone(set, set_entry_columns),                       \
+                flat_clone(set, set_malloc_entries, set_move_entry),           \
+                btree_clone(set, set_malloc_entries, set_move_entry),          \
+                frozen_clone(set, set_malloc_entries, set_move_entry))
+
+#define set_copy_in(set, addr, idx, entries)                                   \
+  set_write_entry(set, addr, (entries)[idx])
+
+#define set_copy_out(set, addr, pos, entries)                                  \
+  ((entries)[pos] = set_get_entry(set, addr))
+
+/* Moves the live nodes of a tree set to the front of its buffers in
+ * SET_LAYOUT_BFS or SET_LAYOUT_VEB order and shrinks the buffers if they are
+ * mostly free. Addresses held from before are invalidated. */
+#define set_compact(set, layout)                                               \
+  tree_compact(set, layout, set_move_entry, set_entry_columns)
+
+/* Adds entry_var from the writer thread of a set_concurrent_type(). Returns
+ * whether it was new. */
+#define set_concurrent_add(concurrent, entry_var)                              \
+  ({                                                                           \
+    typeof(*concurrent.copies[0].entries) sync_add_entry = (entry_var);        \
+    uint64_t sync_add_hash = concurrent.copies[0].hash_fn(sync_add_entry);     \
+    sync_write(concurrent, sync_set_add, sync_add_hash, sync_add_entry);       \
+  })
+
+/* Frees the set once no reader uses it anymore */
+#define set_concurrent_free(concurrent) sync_free(concurrent, set_free)
+
+/* Whether entry is in the set, looked up from the reader thread with the
+ * given id. The reader never waits for the writer, and the answer is the
+ * state of the set at some point during the call. */
+#define set_concurrent_has(concurrent, reader, entry)                          \
+  sync_lookup(concurrent, reader, entry, set_find_node_entry, entries,         \
+              entries, (typeof(concurrent.copies[0].entries))NULL)
+
+#define set_concurrent_init(concurrent, hash_function, equals_function)        \
+  sync_init(concurrent, hash_function, equals_function, set_init)
+
+/* Registers the calling thread as a reader and returns the id it passes to
+ * lookups, or -1 once SET_MAX_READERS are registered */
+#define set_concurrent_reader(concurrent) tree_sync_register(&concurrent.sync)
+
+/* Removes entry from the writer thread. Returns whether it was in the set. */
+#define set_concurrent_remove(concurrent, entry)                               \
+  ({                                                                           \
+    typeof(*concurrent.copies[0].entries) sync_remove_entry = (entry);         \
+    uint64_t sync_remove_hash =                                                \
+        concurrent.copies[0].hash_fn(sync_remove_entry);                       \
+    sync_write(concurrent, sync_remove, sync_remove_hash, sync_remove_entry,   \
+               set_find_node_entry, set_clear_entry, set_entry_columns);       \
+  })
+
+/* Number of entries, readable from any thread */
+#define set_concurrent_size(concurrent) sync_size(concurrent)
+
+/* A set_type() with one writer thread and any number of reader threads
+ * that never wait for it. The set is kept twice: readers look in one copy
+ * while the writer changes the other, and each write is published at once
+ * by sending new readers to the changed copy, see tree_sync_t. The writer
+ * may use the plain set_* lookups on either of the copies between its
+ * writes, but any change must go through the set_concurrent_* calls. */
+#define set_concurrent_type(entry_type)                                        \
+  struct {                                                                     \
+    set_type(entry_type) copies[2];                                            \
+    tree_sync_t sync;                                                          \
+  }
+
+/* Number of entries with a hash in [lo, hi). O(log n) for tree types with
+ * subtree counts and frozen types, otherwise a scan over the range. */
+#define set_count_range(set, lo, hi)                                           \
+  tree_dispatch(set,                                                           \
+                tree_count_range(set, lo, hi, set_range_first,                 \
+                                 set_range_next),                              \
+                (tree_requires_ordered(set), (size_t)0),                       \
+                tree_count_range_scan(set, lo, hi, set_range_first,            \
+                                      set_range_next),                         \
+                frozen_count_range(set, lo, hi))
+
+#define set_create_entry(set, idx)                                             \
+  do {                                                                         \
+    tree_touch(set, &set.entries[idx], sizeof(*set.entries));                  \
+    memset(&set.entries[idx], 0x00, sizeof(typeof(*set.entries)));             \
+  } while (0)
+
+/* Defines the tree set type name##_t and functions on a pointer to it:
+ * name##_init(), name##_free(), name##_add(), name##_has(), name##_remove()
+ * and name##_size(). Each operation is expanded once, in its function,
+ * instead of at every call site. */
+#define set_declare(name, entry_type)                                          \
+  typedef set_type(entry_type) name##_t;                                       \
+                                                                               \
+  static inline void name##_init(name##_t *set,                                \
+                                 uint64_t (*hash_function)(entry_type),        \
+                                 bool (*equals_function)(entry_type,           \
+                                                         entry_type)) {        \
+    set_init((*set), hash_function, equals_function);                          \
+  }                                                                            \
+                                                                               \
+  static inline void name##_free(name##_t *set) { set_free((*set)); }          \
+                                                                               \
+  static inline bool name##_add(name##_t *set, entry_type entry) {             \
+    return tree_is_valid_addr(set_add((*set), entry));                         \
+  }                                                                            \
+                                                                               \
+  static inline bool name##_has(name##_t *set, entry_type entry) {             \
+    return set_has((*set), entry);                                             \
+  }                                                                            \
+                                                                               \
+  static inline bool name##_remove(name##_t *set, entry_type entry) {          \
+    size_t size_before = set->size;                                            \
+    set_remove((*set), entry);                                                 \
+    return set->size != size_before;                                           \
+  }                                                                            \
+                                                                               \
+  static inline size_t name##_size(name##_t *set) { return set_size((*set)); }
+
+/* Defines prefix##_union_parallel(), prefix##_intersect_parallel() and
+ * prefix##_difference_parallel() for the tree set type set_type_name. They
+ * take pointers to the output and both inputs and a thread count, and
+ * produce the same sets as set_union() and friends. */
+#define set_declare_parallel(prefix, set_type_name)                            \
+  typedef struct {                                                             \
+    set_type_name *lhs;                                                        \
+    set_type_name *rhs;                                                        \
+    uint64_t start_hash;                                                       \
+    uint64_t end_hash;                                                         \
+    bool has_start;                                                            \
+    bool has_end;                                                              \
+    bool keep_lhs;                                                             \
+    bool keep_rhs;                                                             \
+    bool keep_common;                                                          \
+    tree_hash_pair_t *pairs;                                                   \
+    typeof(((set_type_name *)NULL)->entries) entries;                          \
+    size_t n;                                                                  \
+  } prefix##_merge_range_t;                                                    \
+                                                                               \
+  static inline void *prefix##_merge_range(void *arg) {                        \
+    prefix##_merge_range_t *range = arg;                                       \
+    tree_addr_t start_a = tree_first((*range->lhs));                           \
+    if (range->has_start) {                                                    \
+      start_a = tree_lower_bound((*range->lhs), range->start_hash);            \
+    }                                                                          \
+    tree_addr_t start_b = tree_first((*range->rhs));                           \
+    if (range->has_start) {                                                    \
+      start_b = tree_lower_bound((*range->rhs), range->start_hash);            \
+    }                                                                          \
+    range->n = 0;                                                              \
+    tree_merge_range((*range->lhs), (*range->rhs), start_a, start_b,           \
+                     range->end_hash, range->has_end, range->keep_lhs,         \
+                     range->keep_rhs, range->keep_common, set_get_entry,       \
+                     set_next, range->pairs, range->entries, range->n);        \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline void prefix##_merge_parallel(                                  \
+      set_type_name *out, set_type_name *a, set_type_name *b, bool keep_a,     \
+      bool keep_b, bool keep_both, size_t threads) {                           \
+    tree_merge_parallel((*out), (*a), (*b), keep_a, keep_b, keep_both,         \
+                        threads, prefix##_merge_range_t,                       \
+                        prefix##_merge_range, set_write_entry,                 \
+                        set_entry_columns);                                    \
+  }                                                                            \
+                                                                               \
+  static inline void prefix##_union_parallel(set_type_name *out,               \
+      set_type_name *a, set_type_name *b, size_t threads) {                    \
+    prefix##_merge_parallel(out, a, b, true, true, true, threads);             \
+  }                                                                            \
+                                                                               \
+  static inline void prefix##_intersect_parallel(set_type_name *out,           \
+      set_type_name *a, set_type_name *b, size_t threads) {                    \
+    prefix##_merge_parallel(out, a, b, false, false, true, threads);           \
+  }                                                                            \
+                                                                               \
+  static inline void prefix##_difference_parallel(set_type_name *out,          \
+      set_type_name *a, set_type_name *b, size_t threads) {                    \
+    prefix##_merge_parallel(out, a, b, true, false, false, threads);           \
+  }
+
+/* Defines prefix##_add(), prefix##_has() and prefix##_remove() for the tree
+ * set type set_type_name. They work like set_add() and friends on a pointer
+ * to the set, but call hash_function and equals_function directly rather
+ * than through the pointers in the set, so the compiler can inline them.
+ * The set is still set up with set_init() and the same two functions, and
+ * the other set_* operations keep working. */
+#define set_declare_static(prefix, set_type_name, hash_function,               \
+                           equals_function)                                    \
+  static inline bool prefix##_add(                                             \
+      set_type_name *set, typeof(*((set_type_name *)NULL)->entries) entry) {   \
+    tree_requires_backend((*set), SET_BACKEND_TREE);                           \
+    typeof(&equals_function) const declared_equals = equals_function;          \
+    return tree_is_valid_addr(tree_add_hashed(                                 \
+        (*set), hash_function(entry), entry, set_alloc_new_node,               \
+        set_write_entry, set_static_find_duplicate, set_entry_columns));       \
+  }                                                                            \
+                                                                               \
+  static inline bool prefix##_has(                                             \
+      set_type_name *set, typeof(*((set_type_name *)NULL)->entries) entry) {   \
+    tree_requires_backend((*set), SET_BACKEND_TREE);                           \
+    typeof(&equals_function) const declared_equals = equals_function;          \
+    return tree_is_valid_addr(                                                 \
+        set_static_find_node_entry((*set), hash_function(entry), entry));      \
+  }                                                                            \
+                                                                               \
+  static inline bool prefix##_remove(                                          \
+      set_type_name *set, typeof(*((set_type_name *)NULL)->entries) entry) {   \
+    tree_requires_backend((*set), SET_BACKEND_TREE);                           \
+    typeof(&equals_function) const declared_equals = equals_function;          \
+    size_t size_before = set->size;                                            \
+    tree_remove_hashed((*set), hash_function(entry), entry,                    \
+                       set_static_find_node_entry, set_clear_entry,            \
+                       set_entry_columns);                                     \
+    return set->size != size_before;                                           \
+  }
+
+/* Initializes out, a tree set, with the entries of a that are not in b */
+#define set_difference(out, a, b)                                              \
+  do {                                                                         \
+    if (tree_gallop_pays(a, b)) {                                              \
+      tree_filter(out, a, b, false, set_get_entry, set_first, set_next,        \
+                  set_has, set_write_entry, set_entry_columns);                \
+    } else {                                                                   \
+      tree_merge(out, a, b, true, false, false, set_get_entry, set_first,      \
+                 set_next, set_write_entry, set_entry_columns);                \
+    }                                                                          \
+  } while (0)
+
+#define set_empty(set) tree_empty(set, set_init_with_allocator, set_free)
+
+/* Calls column(set, field) on every entry column, which tree sets carve out
+ * of their single storage block */
+#define set_entry_columns(set, column) column(set, entries)
+
+#define set_equals(a, b) (set_size(a) == set_size(b) && set_is_subset(a, b))
+
+#define set_find_duplicate(set, node_addr, entry_var)                          \
+  tree_find_duplicate(set, node_addr, entry_var, set_get_entry, entries)
+
+#define set_find_entry(set, entry_var)                                         \
+  set_find_entry_hashed(set, set.hash_fn(entry_var), entry_var)
+
+#define set_find_entry_hashed(set, hash_value, entry_var)                      \
+  ({                                                                           \
+    uint64_t set_find_hash = (hash_value);                                     \
+    tree_dispatch(                                                             \
+        set, set_find_node_entry(set, set_find_hash, entry_var),               \
+        set_flat_find_entry(set, flat_mix(set_find_hash), entry_var),          \
+        set_btree_find_entry(set, set_find_hash, entry_var),                   \
+        set_frozen_find_entry(set, set_find_hash, entry_var));                 \
+  })
+
+#define set_find_node_entry(set, hash_value, entry_var)                        \
+  tree_find_node_entry(set, hash_value, entry_var, set_find_duplicate)
+
+#define set_first(set)                                                         \
+  tree_dispatch(set, tree_first(set), flat_first(set), btree_first(set),       \
+                frozen_first(set))
+
+#define set_flat_find_entry(set, hash_value, entry_var)                        \
+  flat_find_entry(set, hash_value, entry_var, set_get_entry)
+
+#define set_flat_rehash(set, new_capacity)                                     \
+  flat_rehash(set, new_capacity, set_get_entry, set_move_entry,                \
+              set_malloc_entries, set_free_data)
+
+/* Loops over every address of set in storage order rather than hash order,
+ * which streams through the entries of tree types instead of chasing
+ * pointers */
+#define set_foreach_unordered(set, addr)                                       \
+  for (tree_addr_t addr = set_unordered_first(set); tree_is_valid_addr(addr);  \
+       addr = set_unordered_next(set, addr))
+
+#define set_free(set)                                                          \
+  tree_dispatch(set, tree_free(set),                                           \
+                flat_free(set, set_free_data),                                 \
+                btree_free(set, set_free_data),                                \
+                frozen_free(set, set_free_data))
+
+#define set_free_data(set)                                                     \
+  do {                                                                         \
+    tree_dealloc(set, set.entries);                                            \
+  } while (0)
+
+#define set_freeze(frozen, set)                                                \
+  tree_freeze(frozen, set, set_get_entry, set_move_entry, set_malloc_entries,  \
+              set_first, set_next)
+
+#define set_frozen_find_entry(set, hash_value, entry_var)                      \
+  frozen_find_entry(set, hash_value, entry_var, set_get_entry)
+
+/* Initializes set with the n entries of an array. Tree sets are built in one
+ * pass with a single allocation, other types add the entries one by one. */
+#define set_from_array(set, entries, n, hash_function, equals_function)        \
+  tree_dispatch(set,                                                           \
+                tree_from_array(set, entries, n, hash_function,                \
+                                equals_function, set_entry_columns,            \
+                                set_copy_in),                                  \
+                set_from_array_by_add(set, entries, n, hash_function,          \
+                                      equals_function),                        \
+                set_from_array_by_add(set, entries, n, hash_function,          \
+                                      equals_function),                        \
+                tree_read_only(set))
+
+#define set_from_array_by_add(set, entries, n, hash_function, equals_function) \
+  do {                                                                         \
+    set_init(set, hash_function, equals_function);                             \
+    set_reserve(set, n);                                                       \
+    for (size_t from_i = 0; from_i < (n); from_i++) {                          \
+      set_add(set, (entries)[from_i]);                                         \
+    }                                                                          \
+  } while (0)
+
+#define set_get_entry(set, addr)                                               \
+  ({                                                                           \
+    tree_idx_t idx = tree_idx(addr);                                           \
+    assert(set.capacity > idx);                                                \
+    set.entries[idx];                                                          \
+  })
+
+/* Sets how a full tree or btree set grows: to percent of its capacity, but by
+ * at least increment slots. Doubling is (200, 0), 1.5x is (150, 0) and fixed
+ * steps of k slots are (100, k). Flat sets always double. */
+#define set_growth_policy(set, percent, increment)                             \
+  do {                                                                         \
+    set.growth_percent = (percent);                                            \
+    set.growth_increment = (increment);                                        \
+  } while (0)
+
+#define set_has(set, entry) tree_is_valid_addr(set_find_entry(set, entry))
+
+#define set_has_hashed(set, hash_value, entry)                                 \
+  ({                                                                           \
+    uint64_t set_has_hash = (hash_value);                                      \
+    assert(set_has_hash == set.hash_fn(entry));                                \
+    tree_is_valid_addr(set_find_entry_hashed(set, set_has_hash, entry));       \
+  })
+
+/* Looks up n entries and writes whether each is in set to the bool array
+ * out */
+#define set_has_many(set, entries, n, out)                                     \
+  tree_dispatch(                                                               \
+      set,                                                                     \
+      tree_find_many(set, entries, n, set_find_duplicate, set_has_out, out),   \
+      flat_find_many(set, entries, n, set_flat_find_entry, set_has_out, out),  \
+      tree_find_many_seq(set, entries, n, set_btree_find_entry, set_has_out,   \
+                         out),                                                 \
+      tree_find_many_seq(set, entries, n, set_frozen_find_entry, set_has_out,  \
+                         out))
+
+#define set_has_out(set, out, pos, addr) ((out)[pos] = tree_is_valid_addr(addr))
+
+/* Initializes out, a tree set, with the entries in both a and b. When one
+ * side is much smaller, its entries are looked up in the other one instead
+ * of walking both. */
+#define set_intersect(out, a, b)                                               \
+  do {                                                                         \
+    if (tree_gallop_pays(a, b)) {                                              \
+      tree_filter(out, a, b, true, set_get_entry, set_first, set_next,         \
+                  set_has, set_write_entry, set_entry_columns);                \
+    } else if (tree_gallop_pays(b, a)) {                                       \
+      tree_filter(out, b, a, true, set_get_entry, set_first, set_next,         \
+                  set_has, set_write_entry, set_entry_columns);                \
+    } else {                                                                   \
+      tree_merge(out, a, b, false, false, true, set_get_entry, set_first,      \
+                 set_next, set_write_entry, set_entry_columns);                \
+    }                                                                          \
+  } while (0)
+
+#define set_is_subset(a, b)                                                    \
+  (set_size(a) <= set_size(b) &&                                               \
+   (tree_gallop_pays(a, b)                                                     \
+        ? tree_all_found(a, b, set_get_entry, set_first, set_next, set_has)    \
+        : tree_merge_is_subset(a, b, set_get_entry, set_first, set_next)))
+
+/* Moves the entries of b into a. Every hash in a must be lower than every
+ * hash in b. b is consumed. */
+#define set_join(a, b)                                                         \
+  tree_join(a, b, set_get_entry, set_find_node_entry, set_clear_entry,         \
+            set_alloc_new_node, set_move_entry, set_entry_columns)
+
+/* Address of the first entry whose hash is not below hash_value, or 0 */
+#define set_lower_bound(set, hash_value)                                       \
+  tree_dispatch(set, tree_lower_bound(set, hash_value),                        \
+                (tree_requires_ordered(set), (tree_addr_t)0),                  \
+                btree_cursor_addr(set, btree_lower_bound(set, hash_value)),    \
+                frozen_lower_bound(set, hash_value))
+
+#define set_init(set, hash_function, equals_function)                          \
+  set_init_with_allocator(set, hash_function, equals_function,                 \
+                          set_libc_allocator())
+
+/* Initializes set with its buffers coming from allocator_ptr, which has to
+ * outlive it */
+#define set_init_with_allocator(set, hash_function, equals_function,           \
+                                allocator_ptr)                                 \
+  do {                                                                         \
+    set.allocator = (allocator_ptr);                                           \
+    tree_dispatch(set,                                                         \
+                  tree_init(set, hash_function, equals_function,               \
+                            set_entry_columns, set_alloc_new_node),            \
+                  flat_init(set, hash_function, equals_function,               \
+                            set_malloc_entries),                               \
+                  btree_init(set, hash_function, equals_function,              \
+                             set_malloc_entries),                              \
+                  frozen_init(set, hash_function, equals_function,             \
+                              set_malloc_entries));                            \
+  } while (0)
+#define set_malloc_entries(set)                                                \
+  set.entries = tree_malloc(set, sizeof(typeof(*set.entries)) * set.capacity)
+
+/* Opens a set saved with set_save() without reading it: lookups are served
+ * from a private mapping of the file, which is freed with set_free(). Returns
+ * false if the file is missing, damaged or written for another type. */
+#define set_mmap_open(set, path, hash_function, equals_function)               \
+  tree_mmap_open(set, path, hash_function, equals_function, set_entry_columns)
+
+#define set_move_entry(set, to_addr, src, from_addr)                           \
+  set_write_entry(set, to_addr, set_get_entry(src, from_addr))
+
+#define set_next(set, addr)                                                    \
+  tree_dispatch(set, tree_next(set, addr), flat_next(set, addr),               \
+                btree_next(set, addr), frozen_next(set, addr))
+
+#define set_random_sample(set, k, out_addrs)                                   \
+  tree_random_sample(set, k, out_addrs)
+
+/* First entry with a hash in [lo, hi), or 0. Iterate the range with
+ * set_range_next(). */
+#define set_range_first(set, lo, hi)                                           \
+  tree_range_first(set, lo, hi, set_lower_bound, set_get_entry)
+
+#define set_range_next(set, addr, hi)                                          \
+  tree_range_next(set, addr, hi, set_next, set_get_entry)
+
+#define set_rank(set, entry) tree_rank(set, entry, set_find_node_entry)
+
+#define set_realloc_entries(set)                                               \
+  set.entries = tree_realloc(set, set.entries,                                 \
+                             sizeof(typeof(*set.entries)) * set.capacity)
+
+#define set_remove(set, entry)                                                 \
+  tree_dispatch(set,                                                           \
+                tree_remove(set, entry, set_find_node_entry, set_clear_entry,  \
+                            set_entry_columns),                                \
+                flat_remove(set, entry, set_flat_find_entry),                  \
+                btree_remove(set, entry, set_btree_find_entry),                \
+                tree_read_only(set))
+
+#define set_remove_hashed(set, hash_value, entry)                              \
+  do {                                                                         \
+    uint64_t set_remove_hash = (hash_value);                                   \
+    assert(set_remove_hash == set.hash_fn(entry));                             \
+    tree_dispatch(set,                                                         \
+                  tree_remove_hashed(set, set_remove_hash, entry,              \
+                                     set_find_node_entry, set_clear_entry,     \
+                                     set_entry_columns),                       \
+                  flat_remove_hashed(set, set_remove_hash, entry,              \
+                                     set_flat_find_entry),                     \
+                  btree_remove_hashed(set, set_remove_hash, entry,             \
+                                      set_btree_find_entry),                   \
+                  tree_read_only(set));                                        \
+  } while (0)
+
+/* Removes every entry with a hash in [lo, hi) and returns how many there
+ * were */
+#define set_remove_hash_range(set, lo, hi)                                     \
+  tree_remove_hash_range(set, lo, hi, set_alloc_new_node, set_clear_entry,     \
+                         set_entry_columns)
+
+/* Grows set in one step to room for n entries in total, so that filling it
+ * up to n does not reallocate */
+#define set_reserve(set, n)                                                    \
+  tree_dispatch(set, tree_reserve(set, n, set_entry_columns),                  \
+                flat_reserve(set, n, set_flat_rehash),                         \
+                btree_reserve(set, n, set_realloc_entries),                    \
+                tree_read_only(set))
+
+/* Writes a tree set to path, replacing the file in one step. Returns false
+ * on I/O errors. */
+#define set_save(set, path) tree_save(set, path, set_entry_columns)
+
+#define set_select(set, k) tree_select(set, k)
+
+/* Adds entry_var to the shard the hash of entry_var picks, under its lock,
+ * and returns whether it was new */
+#define set_sharded_add(sharded, entry_var)                                    \
+  ({                                                                           \
+    uint64_t sharded_hash = sharded.shards[0].shard.hash_fn(entry_var);        \
+    typeof(sharded.shards[0]) *sharded_slot =                                  \
+        &sharded.shards[sharded_index(sharded, sharded_hash)];                 \
+    sharded_lock_write(&sharded_slot->lock, sharded_lock_kind(sharded));       \
+    tree_addr_t sharded_addr = tree_add_hashed(                                \
+        sharded_slot->shard, sharded_hash, entry_var, set_alloc_new_node,      \
+        set_write_entry, set_find_duplicate, set_entry_columns);               \
+    sharded_unlock(&sharded_slot->lock, sharded_lock_kind(sharded));           \
+    tree_is_valid_addr(sharded_addr);                                          \
+  })
+
+#define set_sharded_free(sharded) sharded_free(sharded, set_free)
+
+#define set_sharded_has(sharded, entry)                                        \
+  sharded_has(sharded, entry, set_find_node_entry)
+
+#define set_sharded_init(sharded, hash_function, equals_function)              \
+  sharded_init(sharded, hash_function, equals_function, set_init)
+
+#define set_sharded_remove(sharded, entry)                                     \
+  sharded_remove(sharded, entry, set_find_node_entry, set_clear_entry,         \
+                 set_entry_columns)
+
+#define set_sharded_shards(sharded) sharded_count(sharded)
+
+#define set_sharded_size(sharded) sharded_size(sharded)
+
+/* A set_snapshot() of shard i, the one covering the i-th slice of the hash
+ * range, for walking it without holding its lock */
+#define set_sharded_snapshot(sharded, i)                                       \
+  sharded_snapshot(sharded, i, set_entry_columns)
+
+/* Writes the entries of every shard, each under its lock, to an array of at
+ * least set_sharded_size() elements. The shards split the hash range in
+ * order, so the entries come out in hash order. Returns the number written. */
+#define set_sharded_to_array(sharded, entries)                                 \
+  ({                                                                           \
+    size_t sharded_n = 0;                                                      \
+    for (size_t sharded_i = 0; sharded_i < sharded_count(sharded);             \
+         sharded_i++) {                                                        \
+      typeof(sharded.shards[0]) *sharded_slot = &sharded.shards[sharded_i];    \
+      sharded_lock_read(&sharded_slot->lock, sharded_lock_kind(sharded));      \
+      sharded_n += tree_to_array(sharded_slot->shard, set_copy_out,            \
+                                 (entries) + sharded_n);                       \
+      sharded_unlock(&sharded_slot->lock, sharded_lock_kind(sharded));         \
+    }                                                                          \
+    sharded_n;                                                                 \
+  })
+
+/* A set split into n_shards tree sets by hash, each behind a spinlock, for
+ * many threads writing at once. Pick the lock with set_sharded_type_lock()
+ * and SET_SHARD_SPINLOCK or SET_SHARD_RWLOCK. */
+#define set_sharded_type(entry_type, n_shards)                                 \
+  set_sharded_type_lock(entry_type, n_shards, SET_SHARD_SPINLOCK)
+
+#define set_sharded_type_lock(entry_type, n_shards, lock_id)                   \
+  sharded_type(set_type(entry_type), n_shards, lock_id)
+
+#define set_size(tree) tree_size(tree)
+
+/* A read-only view of set as it is now, released with set_free(). O(1) for
+ * tree sets, which share their storage with the view until set is next
+ * changed; a clone for other types. */
+#define set_snapshot(set)                                                      \
+  tree_dispatch(set, tree_snapshot(set, set_entry_columns), set_clone(set),    \
+                set_clone(set), set_clone(set))
+
+/* Moves the entries of set with a hash below pivot_hash into lower and the
+ * others into upper. set is consumed. */
+#define set_split(set, pivot_hash, lower, upper)                               \
+  tree_split(set, pivot_hash, lower, upper, set_alloc_new_node,                \
+             set_move_entry, set_clear_entry, set_entry_columns)
+
+/* Lookup callbacks of set_declare_static(), comparing entries with the
+ * declared_equals of the function they expand in */
+#define set_static_find_duplicate(set, node_addr, entry_var)                   \
+  tree_find_duplicate_with(set, node_addr, entry_var, set_get_entry, entries,  \
+                           declared_equals)
+
+#define set_static_find_node_entry(set, hash_value, entry_var)                 \
+  tree_find_node_entry(set, hash_value, entry_var, set_static_find_duplicate)
+
+/* Initializes out, a tree set, with the entries in exactly one of a and b */
+#define set_symmetric_difference(out, a, b)                                    \
+  tree_merge(out, a, b, true, true, false, set_get_entry, set_first, set_next, \
+             set_write_entry, set_entry_columns)
+
+#define set_thaw(set, frozen)                                                  \
+  tree_dispatch(                                                               \
+      set,                                                                     \
+      tree_thaw(set, frozen, set_get_entry, set_move_entry,                    \
+                set_entry_columns),                                            \
+      set_thaw_by_add(set, frozen), set_thaw_by_add(set, frozen),              \
+      tree_read_only(set))
+
+#define set_thaw_by_add(set, frozen)                                           \
+  do {                                                                         \
+    set_init(set, frozen.hash_fn, frozen.equals_fn);                           \
+    set_reserve(set, frozen.size);                                             \
+    for (tree_addr_t thaw_addr = set_first(frozen);                            \
+         tree_is_valid_addr(thaw_addr);                                        \
+         thaw_addr = set_next(frozen, thaw_addr)) {                            \
+      typeof(*frozen.entries) thaw_entry = set_get_entry(frozen, thaw_addr);   \
+      set_add(set, thaw_entry);                                                \
+    }                                                                          \
+  } while (0)
+
+/* Writes the entries of set in iteration order (hash order for ordered
+ * types) to an array of at least set_size(set) elements. Returns the number
+ * of entries written. */
+#define set_to_array(set, entries)                                             \
+  tree_dispatch(                                                               \
+      set, tree_to_array(set, set_copy_out, entries),                          \
+      tree_to_array_seq(set, flat_first, flat_next, set_copy_out, entries),    \
+      tree_to_array_seq(set, btree_first, btree_next, set_copy_out, entries),  \
+      tree_to_array_seq(set, frozen_first, frozen_next, set_copy_out, entries))
+
+#define set_type(entry_type) set_type_backend(entry_type, SET_BACKEND_TREE)
+
+#define set_type_backend(entry_type, backend_id)                               \
+  struct {                                                                     \
+    entry_type *entries;                                                       \
+    uint64_t (*hash_fn)(entry_type);                                           \
+    bool (*equals_fn)(entry_type, entry_type);                                 \
+    const set_allocator_t *allocator;                                          \
+    tree_type_fields()                                                         \
+    flat_type_fields()                                                         \
+    btree_type_fields()                                                        \
+    frozen_type_fields()                                                       \
+    uint8_t backend[backend_id];                                               \
+  }
+
+#define set_type_btree(entry_type)                                             \
+  set_type_backend(entry_type, SET_BACKEND_BTREE)
+
+/* A tree set of byte strings that owns copies of them. The copies live in
+ * one arena rather than a malloc() each. */
+#define set_type_bytes()                                                       \
+  struct {                                                                     \
+    set_type(set_bytes_t) base;                                                \
+    tree_arena_t arena;                                                        \
+  }
+
+#define set_type_flat(entry_type) set_type_backend(entry_type, SET_BACKEND_FLAT)
+
+#define set_type_frozen(entry_type)                                            \
+  set_type_backend(entry_type, SET_BACKEND_FROZEN)
+
+/* Initializes out, a tree set, with the entries in a or b. Of two equal
+ * entries, the one in a is kept. */
+#define set_union(out, a, b)                                                   \
+  tree_merge(out, a, b, true, true, true, set_get_entry, set_first, set_next,  \
+             set_write_entry, set_entry_columns)
+
+#define set_unordered_first(set)                                               \
+  tree_dispatch(set, tree_unordered_next(set, 0), flat_first(set),             \
+                btree_first(set), frozen_first(set))
+
+#define set_unordered_next(set, addr)                                          \
+  tree_dispatch(set, tree_unordered_next(set, addr), flat_next(set, addr),     \
+                btree_next(set, addr), frozen_next(set, addr))
+
+/* Address of the first entry whose hash is above hash_value, or 0 */
+#define set_upper_bound(set, hash_value)                                       \
+  tree_upper_bound(set, hash_value, set_lower_bound)
+
+#define set_write_entry(set, addr, entry)                                      \
+  do {                                                                         \
+    tree_idx_t set_write_entry_idx = tree_idx(addr);                           \
+    assert(set.capacity > set_write_entry_idx);                                \
+    tree_touch(set, &set.entries[set_write_entry_idx], sizeof(*set.entries));  \
+    set.entries[set_write_entry_idx] = entry;                                  \
+  } while (0)
+
+#define sharded_count(sharded)                                                 \
+  (sizeof(sharded.shards) / sizeof(sharded.shards[0]))
+
+#define sharded_free(sharded, free_shard)                                      \
+  do {                                                                         \
+    for (size_t sharded_i = 0; sharded_i < sharded_count(sharded);             \
+         sharded_i++) {                                                        \
+      free_shard(sharded.shards[sharded_i].shard);                             \
+      sharded_lock_destroy(&sharded.shards[sharded_i].lock,                    \
+                           sharded_lock_kind(sharded));                        \
+    }                                                                          \
+  } while (0)
+
+#define sharded_has(sharded, entry, find_node_entry)                           \
+  ({                                                                           \
+    uint64_t sharded_hash = sharded.shards[0].shard.hash_fn(entry);            \
+    typeof(sharded.shards[0]) *sharded_slot =                                  \
+        &sharded.shards[sharded_index(sharded, sharded_hash)];                 \
+    sharded_lock_read(&sharded_slot->lock, sharded_lock_kind(sharded));        \
+    bool sharded_found = tree_is_valid_addr(                                   \
+        find_node_entry(sharded_slot->shard, sharded_hash, entry));            \
+    sharded_unlock(&sharded_slot->lock, sharded_lock_kind(sharded));           \
+    sharded_found;                                                             \
+  })
+
+/* The shard of a hash is picked by its high bits, scaled to the number of
+ * shards, so that shard i holds the i-th slice of the hash range */
+#define sharded_index(sharded, hash_value)                                     \
+  ((size_t)(((unsigned __int128)(hash_value) * sharded_count(sharded)) >> 64))
+
+#define sharded_init(sharded, hash_function, equals_function, init_shard)      \
+  do {                                                                         \
+    for (size_t sharded_i = 0; sharded_i < sharded_count(sharded);             \
+         sharded_i++) {                                                        \
+      init_shard(sharded.shards[sharded_i].shard, hash_function,               \
+                 equals_function);                                             \
+      sharded_lock_init(&sharded.shards[sharded_i].lock,                       \
+                        sharded_lock_kind(sharded));                           \
+    }                                                                          \
   } while (0)
 
-#define set_clone(set)                                                         \
-  tree_clone(set, set_malloc_entries, set_get_entry, set_write_entry)
+/* SET_SHARD_SPINLOCK or SET_SHARD_RWLOCK, as a compile-time constant */
+#define sharded_lock_kind(sharded) sizeof(sharded.shard_lock)
 
-#define set_create_entry(set, idx)                                             \
-  memset(&set.entries[idx], 0x00, sizeof(typeof(*set.entries)))
+/* Returns whether entry was in the set */
+#define sharded_remove(sharded, entry, find_node_entry, clear_entry,           \
+                       entry_columns)                                          \
+  ({                                                                           \
+    uint64_t sharded_hash = sharded.shards[0].shard.hash_fn(entry);            \
+    typeof(sharded.shards[0]) *sharded_slot =                                  \
+        &sharded.shards[sharded_index(sharded, sharded_hash)];                 \
+    sharded_lock_write(&sharded_slot->lock, sharded_lock_kind(sharded));       \
+    size_t sharded_before = sharded_slot->shard.size;                          \
+    tree_remove_hashed(sharded_slot->shard, sharded_hash, entry,               \
+                       find_node_entry, clear_entry, entry_columns);           \
+    bool sharded_removed = sharded_slot->shard.size != sharded_before;         \
+    sharded_unlock(&sharded_slot->lock, sharded_lock_kind(sharded));           \
+    sharded_removed;                                                           \
+  })
 
-#define set_empty(set) tree_empty(set, set_init, set_free)
+/* Sum of the shard sizes, each read under its lock. Writers on other shards
+ * carry on meanwhile, so under concurrent writes it is only a snapshot of
+ * each shard at a slightly different time. */
+#define sharded_size(sharded)                                                  \
+  ({                                                                           \
+    size_t sharded_total = 0;                                                  \
+    for (size_t sharded_i = 0; sharded_i < sharded_count(sharded);             \
+         sharded_i++) {                                                        \
+      typeof(sharded.shards[0]) *sharded_slot = &sharded.shards[sharded_i];    \
+      sharded_lock_read(&sharded_slot->lock, sharded_lock_kind(sharded));      \
+      sharded_total += sharded_slot->shard.size;                               \
+      sharded_unlock(&sharded_slot->lock, sharded_lock_kind(sharded));         \
+    }                                                                          \
+    sharded_total;                                                             \
+  })
 
-#define set_find_duplicate(set, node_addr, entry_var)                          \
-  tree_find_duplicate(set, node_addr, entry_var, set_get_entry, entries)
+/* Taking a snapshot changes the chunk map of the shard, so it needs the
+ * write lock */
+#define sharded_snapshot(sharded, i, entry_columns)                            \
+  ({                                                                           \
+    typeof(sharded.shards[0]) *sharded_slot = &sharded.shards[(i)];            \
+    sharded_lock_write(&sharded_slot->lock, sharded_lock_kind(sharded));       \
+    typeof(sharded_slot->shard) sharded_view =                                 \
+        tree_snapshot(sharded_slot->shard, entry_columns);                     \
+    sharded_unlock(&sharded_slot->lock, sharded_lock_kind(sharded));           \
+    sharded_view;                                                              \
+  })
 
-#define set_find_node_entry(set, hash_value, entry_var)                        \
-  tree_find_node_entry(set, hash_value, entry_var, set_find_duplicate)
+/* Every shard sits on cache lines of its own along with its lock, so that
+ * writers on different shards do not contend for a line */
+#define sharded_type(shard_type, n_shards, lock_id)                            \
+  struct {                                                                     \
+    struct {                                                                   \
+      shard_type shard;                                                        \
+      set_shard_lock_t lock;                                                   \
+    } __attribute__((aligned(64))) shards[n_shards];                           \
+    uint8_t shard_lock[lock_id];                                               \
+  }
 
-#define set_free(set) tree_free(set, set_free_data)
+#define sync_free(concurrent, free_copy)                                       \
+  do {                                                                         \
+    free_copy(concurrent.copies[0]);                                           \
+    free_copy(concurrent.copies[1]);                                           \
+  } while (0)
 
-#define set_free_data(set)                                                     \
+#define sync_init(concurrent, hash_function, equals_function, init_copy)       \
   do {                                                                         \
-    free(set.entries);                                                         \
+    tree_sync_init(&concurrent.sync);                                          \
+    init_copy(concurrent.copies[0], hash_function, equals_function);           \
+    init_copy(concurrent.copies[1], hash_function, equals_function);           \
   } while (0)
 
-#define set_get_entry(set, addr)                                               \
+/* Looks key_var up from a reader thread in the copy the writer leaves alone
+ * until the reader is done, so the lookup is the plain one and never starts
+ * over. The value of a match goes to value_out unless it is NULL. */
+#define sync_lookup(concurrent, reader, key_var, find_node_entry, key_column,  \
+                    value_column, value_out)                                   \
   ({                                                                           \
-    tree_idx_t idx = tree_idx(addr);                                           \
-    assert(set.capacity > idx);                                                \
-    set.entries[idx];                                                          \
+    tree_sync_t *sync_sync = &concurrent.sync;                                 \
+    int sync_reader = (reader);                                                \
+    typeof(*concurrent.copies[0].key_column) sync_key = (key_var);             \
+    uint64_t sync_hash = concurrent.copies[0].hash_fn(sync_key);               \
+    uint32_t sync_side;                                                        \
+    uint32_t sync_read =                                                       \
+        tree_sync_read_begin(sync_sync, sync_reader, &sync_side);              \
+    typeof(concurrent.copies[0]) *sync_copy = &concurrent.copies[sync_read];   \
+    tree_addr_t sync_addr =                                                    \
+        find_node_entry((*sync_copy), sync_hash, sync_key);                    \
+    bool sync_found = tree_is_valid_addr(sync_addr);                           \
+    if (sync_found && (value_out) != NULL) {                                   \
+      *(value_out) = sync_copy->value_column[tree_idx(sync_addr)];             \
+    }                                                                          \
+    tree_sync_read_end(sync_sync, sync_reader, sync_side);                     \
+    sync_found;                                                                \
   })
 
-#define set_has(set, entry)                                                    \
+/* Adds key_var with value_var to one copy of a concurrent map. Returns
+ * whether key_var was new. */
+#define sync_map_add(copy, hash_value, key_var, value_var)                     \
   ({                                                                           \
-    uint64_t hash = set.hash_fn(entry);                                        \
-    tree_addr_t node_addr = set_find_node_entry(set, hash, entry);             \
-    tree_is_valid_addr(node_addr);                                             \
+    tree_addr_t sync_addr =                                                    \
+        tree_add_hashed(copy, hash_value, key_var, map_alloc_new_node,         \
+                        map_write_key, map_find_duplicate, map_entry_columns); \
+    if (tree_is_valid_addr(sync_addr)) {                                       \
+      map_write_value(copy, sync_addr, value_var);                             \
+    }                                                                          \
+    tree_is_valid_addr(sync_addr);                                             \
   })
 
-#define set_init(set, hash_function, equals_function)                          \
-  tree_init(set, hash_function, equals_function, set_malloc_entries,           \
-            set_alloc_new_node)
-#define set_malloc_entries(set)                                                \
-  set.entries = malloc(sizeof(typeof(*set.entries)) * set.capacity)
-
-#define set_realloc_entries(set)                                               \
-  set.entries =                                                                \
-      realloc(set.entries, sizeof(typeof(*set.entries)) * set.capacity)
+#define sync_map_update(copy, hash_value, key_var, value_var)                  \
+  ({                                                                           \
+    tree_addr_t sync_addr = map_find_node_entry(copy, hash_value, key_var);    \
+    if (tree_is_valid_addr(sync_addr)) {                                       \
+      map_write_value(copy, sync_addr, value_var);                             \
+    }                                                                          \
+    tree_is_valid_addr(sync_addr);                                             \
+  })
 
-#define set_remove(set, entry)                                                 \
-  tree_remove(set, entry, set_find_node_entry, set_clear_entry)
+/* Returns whether entry was in the copy */
+#define sync_remove(copy, hash_value, entry, find_node_entry, clear_entry,     \
+                    entry_columns)                                             \
+  ({                                                                           \
+    size_t sync_before = copy.size;                                            \
+    tree_remove_hashed(copy, hash_value, entry, find_node_entry, clear_entry,  \
+                       entry_columns);                                         \
+    copy.size != sync_before;                                                  \
+  })
 
-#define set_size(tree) tree_size(tree)
+#define sync_set_add(copy, hash_value, entry_var)                              \
+  tree_is_valid_addr(tree_add_hashed(copy, hash_value, entry_var,              \
+                                     set_alloc_new_node, set_write_entry,      \
+                                     set_find_duplicate, set_entry_columns))
 
-#define set_type(entry_type)                                                   \
-  struct {                                                                     \
-    entry_type *entries;                                                       \
-    uint64_t (*hash_fn)(entry_type);                                           \
-    bool (*equals_fn)(entry_type, entry_type);                                 \
-    tree_type_fields()                                                         \
-  }
+#define sync_size(concurrent)                                                  \
+  __atomic_load_n(&concurrent.sync.size, __ATOMIC_RELAXED)
 
-#define set_write_entry(set, addr, entry)                                      \
-  do {                                                                         \
-    tree_idx_t set_write_entry_idx = tree_idx(addr);                           \
-    assert(set.capacity > set_write_entry_idx);                                \
-    set.entries[set_write_entry_idx] = entry;                                  \
-  } while (0)
+/* Applies write_copy(copy, ...) to the copy of concurrent that readers are
+ * not in and publishes it, then applies it to the other copy once the
+ * readers have left that one. A write that changed nothing is not published.
+ * A slot the writer frees in a copy is thus only reused once no reader can
+ * still be in that copy. Returns whether the first write_copy changed it. */
+#define sync_write(concurrent, write_copy, ...)                                \
+  ({                                                                           \
+    tree_sync_t *sync_sync = &concurrent.sync;                                 \
+    uint32_t sync_read = __atomic_load_n(&sync_sync->read, __ATOMIC_RELAXED);  \
+    typeof(concurrent.copies[0]) *sync_copy =                                  \
+        &concurrent.copies[sync_read ^ 1];                                     \
+    bool sync_changed = write_copy((*sync_copy), __VA_ARGS__);                 \
+    if (sync_changed) {                                                        \
+      __atomic_store_n(&sync_sync->size, sync_copy->size, __ATOMIC_RELAXED);   \
+      tree_sync_publish(sync_sync);                                            \
+      sync_copy = &concurrent.copies[sync_read];                               \
+      write_copy((*sync_copy), __VA_ARGS__);                                   \
+    }                                                                          \
+    sync_changed;                                                              \
+  })
 
 #define tree_add(tree, entry_var, alloc_new_node, tree_write_entry,            \
-                 find_duplicate)                                               \
+                 find_duplicate, entry_columns)                                \
+  tree_add_hashed(tree, tree.hash_fn(entry_var), entry_var, alloc_new_node,    \
+                  tree_write_entry, find_duplicate, entry_columns)
+
+/* tree_add with the hash of entry_var already at hand */
+#define tree_add_hashed(tree, hash_value, entry_var, alloc_new_node,           \
+                        tree_write_entry, find_duplicate, entry_columns)       \
   ({                                                                           \
     tree_addr_t retval = 0;                                                    \
+    tree_requires_writable(tree);                                              \
     do {                                                                       \
-      uint64_t hash = tree.hash_fn(entry_var);                                 \
+      uint64_t hash = (hash_value);                                            \
       start_trace(1, hash, trace_span("Adding entry"));                        \
-      tree_addr_t leaf_addr = tree_find_node(tree, hash);                      \
+      tree_addr_t parent_addr = 0;                                             \
+      tree_addr_t leaf_addr = tree.root;                                       \
+      bool leaf_is_left = false;                                               \
+      while (tree_is_inited(tree, leaf_addr)) {                                \
+        const tree_node_t *node = tree_read_node(tree, leaf_addr);             \
+        if (hash == node->hash) {                                              \
+          break;                                                               \
+        }                                                                      \
+        parent_addr = leaf_addr;                                               \
+        leaf_is_left = hash < node->hash;                                      \
+        leaf_addr = leaf_is_left ? node->left : node->right;                   \
+      }                                                                        \
                                                                                \
+      tree_addr_t collision_prev = 0;                                          \
       if (tree_is_inited(tree, leaf_addr) != 0) {                              \
         start_trace(18, hash, trace_span("Handle deduplication"));             \
         tree_addr_t duplicate_addr =                                           \
@@ -294,42 +3853,60 @@ typedef struct {
           break;                                                               \
         }                                                                      \
                                                                                \
-        tree_collision_t *collision = tree_get_collision(tree, leaf_addr);     \
+        const tree_collision_t *collision =                                    \
+            tree_read_collision(tree, leaf_addr);                              \
                                                                                \
         while (tree_is_valid_addr(collision->next)) {                          \
           leaf_addr = collision->next;                                         \
-          collision = tree_get_collision(tree, leaf_addr);                     \
+          collision = tree_read_collision(tree, leaf_addr);                    \
         }                                                                      \
-        tree_addr_t next;                                                      \
-        tree_addr_t n = tree_get_node(tree, leaf_addr)->right;                 \
-        while (tree_is_valid_addr(n)) {                                        \
-          next = n;                                                            \
-          n = tree_get_node(tree, next)->left;                                 \
+        collision_prev = leaf_addr;                                            \
+        parent_addr = leaf_addr;                                               \
+        leaf_is_left = false;                                                  \
+        leaf_addr = tree_read_node(tree, parent_addr)->right;                  \
+        while (tree_is_inited(tree, leaf_addr)) {                              \
+          parent_addr = leaf_addr;                                             \
+          leaf_is_left = true;                                                 \
+          leaf_addr = tree_read_node(tree, leaf_addr)->left;                   \
         }                                                                      \
-        collision->next = next;                                                \
-        tree_get_collision(tree, next)->prev = leaf_addr;                      \
-        leaf_addr = next;                                                      \
         end_trace();                                                           \
       }                                                                        \
                                                                                \
+      if (tree_is_shared_nil(leaf_addr)) {                                     \
+        leaf_addr = alloc_new_node(tree);                                      \
+        if (!tree_is_valid_addr(parent_addr)) {                                \
+          tree.root = leaf_addr;                                               \
+        } else if (leaf_is_left) {                                             \
+          tree_get_node(tree, parent_addr)->left = leaf_addr;                  \
+        } else {                                                               \
+          tree_get_node(tree, parent_addr)->right = leaf_addr;                 \
+        }                                                                      \
+      }                                                                        \
+                                                                               \
+      if (tree_is_valid_addr(collision_prev)) {                                \
+        tree_get_collision(tree, collision_prev)->next = leaf_addr;            \
+        tree_get_collision(tree, leaf_addr)->prev = collision_prev;            \
+      }                                                                        \
+                                                                               \
       start_trace(19, hash, trace_span("Allocing new leaf nodes"));            \
-      tree_addr_t left_addr = alloc_new_node(tree);                            \
-      tree_addr_t right_addr = alloc_new_node(tree);                           \
+      tree_addr_t left_addr =                                                  \
+          tree_alloc_leaf(tree, leaf_addr, alloc_new_node);                    \
+      tree_addr_t right_addr =                                                 \
+          tree_alloc_leaf(tree, leaf_addr, alloc_new_node);                    \
       end_trace();                                                             \
-      tree_get_node(tree, left_addr)->parent = leaf_addr;                      \
-      tree_get_node(tree, right_addr)->parent = leaf_addr;                     \
-      tree_write_color(tree, left_addr, NODE_COLOR_BLACK);                     \
-      tree_write_color(tree, right_addr, NODE_COLOR_BLACK);                    \
-                                                                               \
       tree_node_t *leaf = tree_get_node(tree, leaf_addr);                      \
                                                                                \
       *leaf = (tree_node_t){                                                   \
           .hash = hash,                                                        \
           .left = left_addr,                                                   \
-          .parent = leaf->parent,                                              \
+          .parent = parent_addr,                                               \
           .right = right_addr,                                                 \
+          .count = 1,                                                          \
       };                                                                       \
                                                                                \
+      tree_count_propagate(tree, parent_addr, 1);                              \
+      tree.size++;                                                             \
+                                                                               \
       tree_write_entry(tree, leaf_addr, entry_var);                            \
       tree_write_inited(tree, leaf_addr, true);                                \
       tree_write_color(tree, leaf_addr, NODE_COLOR_RED);                       \
@@ -345,100 +3922,478 @@ typedef struct {
 
 #define tree_addr(idx) (idx) + 1
 
-#define tree_alloc_new_node(set, create_entry, realloc_entries)                \
+/* Hash of the entry at addr. Tree nodes store it, other types rehash the
+ * entry. */
+#define tree_addr_hash(tree, addr, get_key)                                    \
+  tree_dispatch(tree, tree_read_node(tree, addr)->hash,                        \
+                tree.hash_fn(get_key(tree, addr)),                             \
+                tree.hash_fn(get_key(tree, addr)),                             \
+                tree.hash_fn(get_key(tree, addr)))
+
+/* Allocates size bytes aligned to align from the allocator of tree */
+#define tree_aligned_alloc(tree, align, size)                                  \
+  tree.allocator->alloc(tree.allocator->ctx, (size), (align))
+
+/* Whether every entry of src is in other, by looking each one up */
+#define tree_all_found(src, other, get_entry, first, next, has)                \
   ({                                                                           \
-    tree_addr_t retval = set.free_list_start;                                  \
-    if (tree_is_valid_addr(retval)) {                                          \
-      start_trace(20, retval, trace_span("Using existing free slot\n"));       \
-      tree_idx_t i = tree_idx(retval);                                         \
-      tree_idx_t byte_idx = floor((float)i / 8);                               \
-      uint8_t bit_idx = i % 8;                                                 \
-      uint8_t bmask = 1 << bit_idx;                                            \
-      set.inited[byte_idx] &= ~bmask;                                          \
-      set.colors[byte_idx] &= ~bmask;                                          \
-      set.nodes[i] = (tree_node_t)NODE_NIL;                                    \
-      set.collisions[i] = (tree_collision_t)COLLISION_NIL;                     \
-      set.free_list_start = set.free_list[i];                                  \
-      set.free_list[i] = 0;                                                    \
-      create_entry(set, i);                                                    \
-      end_trace();                                                             \
-    } else {                                                                   \
-      start_trace(21, 0, trace_span("Reallocating data"));                     \
-      tree_idx_t i = set.capacity;                                             \
-      retval = tree_addr(i);                                                   \
-      set.capacity *= 2;                                                       \
-      tree_idx_t flag_cap = set.capacity / 8;                                  \
-      tree_idx_t flag_i = i / 8;                                               \
-      tree_idx_t flag_offset = flag_cap - flag_i;                              \
-                                                                               \
-      set.nodes = realloc(set.nodes, sizeof(tree_node_t) * set.capacity);      \
-      set.collisions =                                                         \
-          realloc(set.collisions, sizeof(tree_collision_t) * set.capacity);    \
-      set.free_list =                                                          \
-          realloc(set.free_list, sizeof(tree_addr_t) * set.capacity);          \
-                                                                               \
-      set.free_list_start = tree_addr(i + 1);                                  \
-                                                                               \
-      start_trace(22, 0, trace_span("Free list expansion"));                   \
-      set.free_list[i] = 0;                                                    \
-      set.free_list[set.capacity - 1] = 0;                                     \
-      for (tree_idx_t idx = i + 1; idx < set.capacity - 1; idx++) {            \
-        set.free_list[idx] = tree_addr(idx + 1);                               \
+    bool all_found = true;                                                     \
+    for (tree_addr_t all_addr = first(src); tree_is_valid_addr(all_addr);      \
+         all_addr = next(src, all_addr)) {                                     \
+      typeof(*src.entries) all_entry = get_entry(src, all_addr);               \
+      if (!has(other, all_entry)) {                                            \
+        all_found = false;                                                     \
+        break;                                                                 \
       }                                                                        \
-      end_trace();                                                             \
-      realloc_entries(set);                                                    \
-      set.colors = realloc(set.colors, flag_cap);                              \
-      set.inited = realloc(set.inited, flag_cap);                              \
-      memset(&set.colors[flag_i], 0x00, flag_offset);                          \
-      memset(&set.inited[flag_i], 0x00, flag_offset);                          \
-      set.nodes[i] = (tree_node_t)NODE_NIL;                                    \
-      set.collisions[i] = (tree_collision_t)COLLISION_NIL;                     \
-      create_entry(set, i);                                                    \
+    }                                                                          \
+    all_found;                                                                 \
+  })
+
+/* Returns a black NIL leaf for parent_addr: a freshly allocated one, or the
+ * shared sentinel when SET_SHARED_NIL is enabled */
+#define tree_alloc_leaf(tree, parent_addr, alloc_new_node)                     \
+  ({                                                                           \
+    tree_addr_t leaf_retval = TREE_SHARED_NIL_ADDR;                            \
+    if (!SET_SHARED_NIL) {                                                     \
+      leaf_retval = alloc_new_node(tree);                                      \
+      tree_get_node(tree, leaf_retval)->parent = (parent_addr);                \
+      tree_write_color(tree, leaf_retval, NODE_COLOR_BLACK);                   \
+    }                                                                          \
+    leaf_retval;                                                               \
+  })
+
+#define tree_alloc_new_node(set, create_entry, entry_columns)                  \
+  ({                                                                           \
+    if (!tree_is_valid_addr(set.free_list_start)) {                            \
+      start_trace(21, 0, trace_span("Reallocating data"));                     \
+      tree_grow(set, tree_grown_capacity(set), entry_columns);                 \
       end_trace();                                                             \
     }                                                                          \
+    tree_addr_t retval = set.free_list_start;                                  \
+    start_trace(20, retval, trace_span("Using existing free slot\n"));         \
+    tree_idx_t i = tree_idx(retval);                                           \
+    uint8_t bmask = 1 << (i & 7);                                              \
+    tree_touch(set, &set.inited[i >> 3], 1);                                   \
+    tree_touch(set, &set.colors[i >> 3], 1);                                   \
+    tree_touch(set, &set.nodes[i], sizeof(tree_node_t));                       \
+    tree_touch(set, &set.collisions[i], sizeof(tree_collision_t));             \
+    tree_touch(set, &set.free_list[i], sizeof(tree_addr_t));                   \
+    set.inited[i >> 3] &= ~bmask;                                              \
+    set.colors[i >> 3] &= ~bmask;                                              \
+    set.nodes[i] = (tree_node_t)NODE_NIL;                                      \
+    set.collisions[i] = (tree_collision_t)COLLISION_NIL;                       \
+    set.free_list_start = set.free_list[i];                                    \
+    set.free_list[i] = 0;                                                      \
+    create_entry(set, i);                                                      \
+    end_trace();                                                               \
     retval;                                                                    \
   })
 
-#define tree_clone(tree, malloc_entries, get_entry, write_entry)               \
+/* Gives tree a fresh storage block of new_capacity slots, which must be a
+ * multiple of 8. Nothing is initialized. */
+#define tree_alloc_storage(tree, new_capacity, entry_columns)                  \
+  do {                                                                         \
+    size_t alloc_capacity = (new_capacity);                                    \
+    if (alloc_capacity > TREE_MAX_CAPACITY) {                                  \
+      tree_capacity_exceeded();                                                \
+    }                                                                          \
+    char *alloc_base = tree_aligned_alloc(                                     \
+        tree, 64, tree_storage_size(tree, alloc_capacity, entry_columns));     \
+    tree_carve_storage(tree, alloc_base, alloc_capacity, entry_columns);       \
+    tree.mapped_bytes = 0;                                                     \
+    tree.cow = NULL;                                                           \
+    tree.cow_chunks = NULL;                                                    \
+    tree.snapshot = false;                                                     \
+  } while (0)
+
+/* Backend id of a set or map type, as a compile-time constant */
+#define tree_backend(tree) sizeof(tree.backend)
+
+/* Number of black nodes on every path from root_addr down to a leaf */
+#define tree_black_height(tree, root_addr)                                     \
   ({                                                                           \
-    typeof(tree) clone;                                                        \
-    typeof(tree.hash_fn) hash_function = tree.hash_fn;                         \
-    typeof(tree.equals_fn) equals_function = tree.equals_fn;                   \
+    size_t black_height = 0;                                                   \
+    tree_addr_t black_cursor = (root_addr);                                    \
+    while (tree_is_inited(tree, black_cursor)) {                               \
+      black_height += !tree_is_red(tree, black_cursor);                        \
+      black_cursor = tree_read_node(tree, black_cursor)->left;                 \
+    }                                                                          \
+    black_height;                                                              \
+  })
+
+/* Allocates the storage of an empty tree exactly once and links n nodes
+ * holding the hashes of pairs, which must be sorted, into a perfectly
+ * balanced tree. Node i in hash order lives at tree_sorted_addr(i), and the
+ * caller writes its entry there. Every level but the deepest is full, so only
+ * the deepest one is colored red, and only when it is not full either. */
+#define tree_build_sorted(tree, pairs, n, entry_columns)                       \
+  do {                                                                         \
+    size_t build_count = (n);                                                  \
+    size_t build_slots =                                                       \
+        SET_SHARED_NIL ? build_count + 1 : 2 * build_count + 1;                \
+    tree.size = build_count;                                                   \
+    tree_alloc_storage(tree, (build_slots + 7) / 8 * 8, entry_columns);        \
+    tree_set_default_growth(tree);                                             \
+    memset(tree.colors, 0x00, tree.capacity / 8);                              \
+    memset(tree.inited, 0x00, tree.capacity / 8);                              \
+    memset(tree.free_list, 0x00, sizeof(tree_addr_t) * tree.capacity);         \
+    for (tree_idx_t build_i = 0; build_i < build_slots; build_i++) {           \
+      tree.nodes[build_i] = (tree_node_t)NODE_NIL;                             \
+      tree.collisions[build_i] = (tree_collision_t)COLLISION_NIL;              \
+    }                                                                          \
+    tree.free_list_start = 0;                                                  \
+    if (build_slots < tree.capacity) {                                         \
+      tree.free_list_start = tree_addr(build_slots);                           \
+      for (tree_idx_t build_i = build_slots; build_i < tree.capacity - 1;      \
+           build_i++) {                                                        \
+        tree.free_list[build_i] = tree_addr(build_i + 1);                      \
+      }                                                                        \
+    }                                                                          \
                                                                                \
-    clone.capacity = tree.capacity;                                            \
-    tree_idx_t flag_cap = clone.capacity / 8;                                  \
+    for (size_t build_i = 1; build_i < build_count; build_i++) {               \
+      if ((pairs)[build_i].hash == (pairs)[build_i - 1].hash) {                \
+        tree_get_collision(tree, tree_sorted_addr(build_i - 1))->next =        \
+            tree_sorted_addr(build_i);                                         \
+        tree_get_collision(tree, tree_sorted_addr(build_i))->prev =            \
+            tree_sorted_addr(build_i - 1);                                     \
+      }                                                                        \
+    }                                                                          \
                                                                                \
-    clone.root = tree.root;                                                    \
-    clone.nodes = malloc(sizeof(tree_node_t) * tree.capacity);                 \
-    clone.collisions = malloc(sizeof(tree_collision_t) * tree.capacity);       \
-    clone.entries = malloc(sizeof(typeof(*clone.entries)) * tree.capacity);    \
-    clone.free_list = malloc(sizeof(tree_addr_t) * tree.capacity);             \
-    clone.colors = malloc(flag_cap);                                           \
-    clone.inited = malloc(flag_cap);                                           \
-    malloc_entries(clone);                                                     \
+    size_t build_red_depth = SIZE_MAX;                                         \
+    if (build_count > 0 && ((build_count + 1) & build_count) != 0) {           \
+      build_red_depth = 63 - __builtin_clzll(build_count);                     \
+    }                                                                          \
+    tree_idx_t build_next_leaf = build_count;                                  \
+    struct {                                                                   \
+      size_t lo;                                                               \
+      size_t hi;                                                               \
+      size_t depth;                                                            \
+      tree_addr_t parent;                                                      \
+      bool is_left;                                                            \
+    } build_stack[64];                                                         \
+    size_t build_top = 0;                                                      \
+    build_stack[build_top++] = (typeof(*build_stack)){0, build_count, 0, 0};   \
+    while (build_top > 0) {                                                    \
+      typeof(*build_stack) build_span = build_stack[--build_top];              \
+      tree_addr_t build_addr = TREE_SHARED_NIL_ADDR;                           \
+      if (build_span.lo == build_span.hi) {                                    \
+        if (!SET_SHARED_NIL) {                                                 \
+          build_addr = tree_addr(build_next_leaf++);                           \
+          tree_get_node(tree, build_addr)->parent = build_span.parent;         \
+        }                                                                      \
+      } else {                                                                 \
+        size_t build_mid = (build_span.lo + build_span.hi) / 2;                \
+        build_addr = tree_sorted_addr(build_mid);                              \
+        *tree_get_node(tree, build_addr) = (tree_node_t){                      \
+            .hash = (pairs)[build_mid].hash,                                   \
+            .parent = build_span.parent,                                       \
+            .count = build_span.hi - build_span.lo,                            \
+        };                                                                     \
+        tree_write_inited(tree, build_addr, true);                             \
+        if (build_span.depth == build_red_depth) {                             \
+          tree_write_color(tree, build_addr, NODE_COLOR_RED);                  \
+        }                                                                      \
+        build_stack[build_top++] = (typeof(*build_stack)){                     \
+            build_mid + 1, build_span.hi, build_span.depth + 1, build_addr,    \
+            false};                                                            \
+        build_stack[build_top++] = (typeof(*build_stack)){                     \
+            build_span.lo, build_mid, build_span.depth + 1, build_addr, true}; \
+      }                                                                        \
+      if (!tree_is_valid_addr(build_span.parent)) {                            \
+        tree.root = build_addr;                                                \
+      } else if (build_span.is_left) {                                         \
+        tree_get_node(tree, build_span.parent)->left = build_addr;             \
+      } else {                                                                 \
+        tree_get_node(tree, build_span.parent)->right = build_addr;            \
+      }                                                                        \
+    }                                                                          \
+  } while (0)
+
+/* tree_build_sorted followed by writing entries[i] to node i */
+#define tree_build_sorted_entries(tree, pairs, entries, n, write_entry,        \
+                                  entry_columns)                               \
+  do {                                                                         \
+    size_t build_entries_n = (n);                                              \
+    tree_build_sorted(tree, pairs, build_entries_n, entry_columns);            \
+    for (size_t build_entries_i = 0; build_entries_i < build_entries_n;        \
+         build_entries_i++) {                                                  \
+      write_entry(tree, tree_sorted_addr(build_entries_i),                     \
+                  (entries)[build_entries_i]);                                 \
+    }                                                                          \
+  } while (0)
+
+/* Points every column of tree into the block at base, of n_slots slots. The
+ * node column comes first, so tree.nodes is base itself, and every column
+ * starts 64-byte aligned. */
+#define tree_carve_storage(tree, base, n_slots, entry_columns)                 \
+  do {                                                                         \
+    size_t storage_capacity = (n_slots);                                       \
+    char *storage_base = (base);                                               \
+    size_t storage_offset = 0;                                                 \
+    tree_storage_carve(tree, nodes);                                           \
+    tree_storage_carve(tree, collisions);                                      \
+    tree_storage_carve(tree, free_list);                                       \
+    entry_columns(tree, tree_storage_carve);                                   \
+    tree.colors = (uint8_t *)(storage_base + storage_offset);                  \
+    storage_offset += tree_column_bytes(storage_capacity / 8);                 \
+    tree.inited = (uint8_t *)(storage_base + storage_offset);                  \
+    tree.capacity = storage_capacity;                                          \
+  } while (0)
+
+/* Starts writing tree to path in a forked child, see set_checkpoint() */
+#define tree_checkpoint(tree, path, checkpoint, entry_columns)                 \
+  ({                                                                           \
+    uint32_t *checkpoint_chunks =                                              \
+        tree.cow == NULL                                                       \
+            ? NULL                                                             \
+            : tree_cow_pin(tree.cow, tree.cow_chunks, (char *)tree.nodes);     \
+    tree_checkpoint_fork((checkpoint), (path),                                 \
+                         tree_file_header(tree, entry_columns), tree.nodes,    \
+                         tree.cow, checkpoint_chunks);                         \
+  })
+
+/* One copy of the storage block, whatever the capacity of tree */
+#define tree_clone(tree, entry_columns)                                        \
+  ({                                                                           \
+    typeof(tree) clone = tree;                                                 \
+    tree_copy_storage(clone, tree, entry_columns);                             \
+    clone;                                                                     \
+  })
+
+/* Rounds a column up to whole cache lines, so that the next column of the
+ * storage block starts 64-byte aligned */
+#define tree_column_bytes(size) (((size) + 63) & ~(size_t)63)
+
+/* Rebuilds the buffers of tree with the live nodes at the lowest addresses
+ * in the given layout, followed by the NIL leaves. Capacity shrinks to the
+ * smallest doubling of ALLOC_CHUNK that leaves half of it free, and only when
+ * that halves it at least, so that a shrink is never followed right away by
+ * a regrow. */
+#define tree_compact(tree, layout, move_entry, entry_columns)                  \
+  do {                                                                         \
+    tree_requires_backend(tree, SET_BACKEND_TREE);                             \
+    tree_addr_t *compact_order =                                               \
+        malloc(sizeof(tree_addr_t) * (tree.size + 1));                         \
+    size_t compact_n = 0;                                                      \
+    if ((layout) == SET_LAYOUT_VEB) {                                          \
+      tree_layout_veb(tree.nodes, tree.inited, tree.root, 0,                   \
+                      tree_layout_height(tree.nodes, tree.inited, tree.root),  \
+                      compact_order, &compact_n);                              \
+    } else {                                                                   \
+      compact_n =                                                              \
+          tree_layout_bfs(tree.nodes, tree.inited, tree.root, compact_order);  \
+    }                                                                          \
+    assert(compact_n == tree.size);                                            \
                                                                                \
-    memset(clone.free_list, 0x00, sizeof(tree_addr_t) * tree.capacity);        \
-    memset(clone.colors, 0x00, flag_cap);                                      \
-    memset(clone.inited, 0x00, flag_cap);                                      \
+    size_t compact_first = SET_SHARED_NIL ? 1 : 0;                             \
+    size_t compact_used = SET_SHARED_NIL ? compact_n + 1 : 2 * compact_n + 1;  \
+    size_t compact_target = ALLOC_CHUNK;                                       \
+    while (compact_target < 2 * compact_used) {                                \
+      compact_target *= 2;                                                     \
+    }                                                                          \
+    typeof(tree) compact_dst = tree;                                           \
+    tree_alloc_storage(                                                        \
+        compact_dst,                                                           \
+        compact_target < tree.capacity ? compact_target : tree.capacity,       \
+        entry_columns);                                                        \
+    memset(compact_dst.colors, 0x00, compact_dst.capacity / 8);                \
+    memset(compact_dst.inited, 0x00, compact_dst.capacity / 8);                \
                                                                                \
-    clone.free_list_start = tree.free_list_start;                              \
+    /* Old address to new address, 0 for slots that are dropped */             \
+    tree_addr_t *compact_map = calloc(tree.capacity + 1, sizeof(tree_addr_t)); \
+    for (size_t compact_i = 0; compact_i < compact_n; compact_i++) {           \
+      compact_map[compact_order[compact_i]] =                                  \
+          tree_addr(compact_first + compact_i);                                \
+    }                                                                          \
+    if (SET_SHARED_NIL) {                                                      \
+      compact_map[TREE_SHARED_NIL_ADDR] = TREE_SHARED_NIL_ADDR;                \
+    } else {                                                                   \
+      tree_idx_t compact_leaf = compact_n;                                     \
+      if (!tree_is_inited(tree, tree.root)) {                                  \
+        compact_map[tree.root] = tree_addr(compact_leaf++);                    \
+      }                                                                        \
+      for (size_t compact_i = 0; compact_i < compact_n; compact_i++) {         \
+        const tree_node_t *compact_node =                                      \
+            tree_read_node(tree, compact_order[compact_i]);                    \
+        if (!tree_is_inited(tree, compact_node->left)) {                       \
+          compact_map[compact_node->left] = tree_addr(compact_leaf++);         \
+        }                                                                      \
+        if (!tree_is_inited(tree, compact_node->right)) {                      \
+          compact_map[compact_node->right] = tree_addr(compact_leaf++);        \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
                                                                                \
-    for (tree_idx_t i = 0; i < tree.capacity; i++) {                           \
-      tree_addr_t a = tree_addr(i);                                            \
-      clone.free_list[i] = tree.free_list[i];                                  \
-      clone.collisions[i] = tree.collisions[i];                                \
-      clone.nodes[i] = tree.nodes[i];                                          \
-      write_entry(clone, a, get_entry(tree, a));                               \
-      tree_write_color(clone, a, tree_is_red(tree, a));                        \
-      tree_write_inited(clone, a, tree_is_inited(tree, a));                    \
+    for (tree_addr_t compact_old = 1; compact_old <= tree.capacity;            \
+         compact_old++) {                                                      \
+      tree_addr_t compact_new = compact_map[compact_old];                      \
+      if (!tree_is_valid_addr(compact_new)) {                                  \
+        continue;                                                              \
+      }                                                                        \
+      const tree_node_t *compact_node = tree_read_node(tree, compact_old);     \
+      const tree_collision_t *compact_collision =                              \
+          tree_read_collision(tree, compact_old);                              \
+      compact_dst.nodes[tree_idx(compact_new)] = (tree_node_t){                \
+          .hash = compact_node->hash,                                          \
+          .left = compact_map[compact_node->left],                             \
+          .right = compact_map[compact_node->right],                           \
+          .parent = tree_is_shared_nil(compact_old)                            \
+                        ? 0                                                    \
+                        : compact_map[compact_node->parent],                   \
+          .count = compact_node->count,                                        \
+      };                                                                       \
+      compact_dst.collisions[tree_idx(compact_new)] = (tree_collision_t){      \
+          .next = compact_map[compact_collision->next],                        \
+          .prev = compact_map[compact_collision->prev],                        \
+      };                                                                       \
+      tree_write_color(compact_dst, compact_new,                               \
+                       tree_is_red(tree, compact_old));                        \
+      if (tree_is_inited(tree, compact_old)) {                                 \
+        tree_write_inited(compact_dst, compact_new, true);                     \
+        move_entry(compact_dst, compact_new, tree, compact_old);               \
+      }                                                                        \
     }                                                                          \
                                                                                \
-    clone.hash_fn = hash_function;                                             \
-    clone.equals_fn = equals_function;                                         \
+    for (size_t compact_i = compact_used; compact_i < compact_dst.capacity;    \
+         compact_i++) {                                                        \
+      compact_dst.free_list[compact_i] =                                       \
+          compact_i + 1 < compact_dst.capacity ? tree_addr(compact_i + 1) : 0; \
+    }                                                                          \
+    memset(compact_dst.free_list, 0x00, sizeof(tree_addr_t) * compact_used);   \
+    compact_dst.free_list_start =                                              \
+        compact_used < compact_dst.capacity ? tree_addr(compact_used) : 0;     \
+    compact_dst.root = compact_map[tree.root];                                 \
                                                                                \
-    clone;                                                                     \
+    free(compact_map);                                                         \
+    free(compact_order);                                                       \
+    tree_free(tree);                                                           \
+    tree = compact_dst;                                                        \
+  } while (0)
+
+/* Gives dst a block of its own holding a copy of the storage of src */
+#define tree_copy_storage(dst, src, entry_columns)                             \
+  do {                                                                         \
+    tree_alloc_storage(dst, src.capacity, entry_columns);                      \
+    memcpy(dst.nodes, src.nodes,                                               \
+           tree_storage_size(src, src.capacity, entry_columns));               \
+  } while (0)
+
+/* Copies the subtree at src_root of src into free slots of dst, keeping its
+ * shape and colors, and returns the address of the copy, whose parent is 0.
+ * Collision links are rebuilt within the copy. */
+#define tree_copy_subtree(dst, src, src_root, alloc_new_node, move_entry)      \
+  ({                                                                           \
+    struct {                                                                   \
+      tree_addr_t src_addr;                                                    \
+      tree_addr_t parent;                                                      \
+      bool is_left;                                                            \
+    } copy_stack[128];                                                         \
+    size_t copy_top = 0;                                                       \
+    tree_addr_t copy_root = 0;                                                 \
+    copy_stack[copy_top++] = (typeof(*copy_stack)){(src_root), 0, false};      \
+    while (copy_top > 0) {                                                     \
+      typeof(*copy_stack) copy_item = copy_stack[--copy_top];                  \
+      tree_addr_t copy_addr = TREE_SHARED_NIL_ADDR;                            \
+      if (!tree_is_shared_nil(copy_item.src_addr)) {                           \
+        copy_addr = alloc_new_node(dst);                                       \
+        const tree_node_t *copy_src = tree_read_node(src, copy_item.src_addr); \
+        *tree_get_node(dst, copy_addr) = (tree_node_t){                        \
+            .hash = copy_src->hash,                                            \
+            .parent = copy_item.parent,                                        \
+            .count = copy_src->count,                                          \
+        };                                                                     \
+        if (tree_is_inited(src, copy_item.src_addr)) {                         \
+          tree_write_inited(dst, copy_addr, true);                             \
+          tree_write_color(dst, copy_addr,                                     \
+                           tree_is_red(src, copy_item.src_addr));              \
+          move_entry(dst, copy_addr, src, copy_item.src_addr);                 \
+          copy_stack[copy_top++] =                                             \
+              (typeof(*copy_stack)){copy_src->right, copy_addr, false};        \
+          copy_stack[copy_top++] =                                             \
+              (typeof(*copy_stack)){copy_src->left, copy_addr, true};          \
+        }                                                                      \
+      }                                                                        \
+      if (!tree_is_valid_addr(copy_item.parent)) {                             \
+        copy_root = copy_addr;                                                 \
+      } else if (copy_item.is_left) {                                          \
+        tree_get_node(dst, copy_item.parent)->left = copy_addr;                \
+      } else {                                                                 \
+        tree_get_node(dst, copy_item.parent)->right = copy_addr;               \
+      }                                                                        \
+    }                                                                          \
+                                                                               \
+    if (tree_is_inited(dst, copy_root)) {                                      \
+      tree_addr_t copy_prev = tree_ult_in_branch(dst, copy_root, left);        \
+      tree_addr_t copy_next = tree_next(dst, copy_prev);                       \
+      while (tree_is_valid_addr(copy_next)) {                                  \
+        if (tree_read_node(dst, copy_next)->hash ==                            \
+            tree_read_node(dst, copy_prev)->hash) {                            \
+          tree_get_collision(dst, copy_prev)->next = copy_next;                \
+          tree_get_collision(dst, copy_next)->prev = copy_prev;                \
+        }                                                                      \
+        copy_prev = copy_next;                                                 \
+        copy_next = tree_next(dst, copy_next);                                 \
+      }                                                                        \
+    }                                                                          \
+    copy_root;                                                                 \
+  })
+
+#define tree_count(tree, addr) (tree_read_node(tree, addr)->count)
+
+/* Adds delta to the subtree count of node_addr and every ancestor above it */
+#define tree_count_propagate(tree, node_addr, delta)                           \
+  do {                                                                         \
+    if (!SET_SUBTREE_COUNTS) {                                                 \
+      break;                                                                   \
+    }                                                                          \
+    tree_addr_t count_cursor = (node_addr);                                    \
+    while (tree_is_valid_addr(count_cursor)) {                                 \
+      tree_node_t *count_node = tree_get_node(tree, count_cursor);             \
+      count_node->count += (delta);                                            \
+      count_cursor = count_node->parent;                                       \
+    }                                                                          \
+  } while (0)
+
+/* Counts the hashes in [lo, hi) as the difference of their ranks */
+#define tree_count_range(tree, lo, hi, range_first, range_next)                \
+  ({                                                                           \
+    size_t count_range_n = 0;                                                  \
+    if (SET_SUBTREE_COUNTS) {                                                  \
+      size_t count_range_lo = tree_rank_hash(tree, lo);                        \
+      size_t count_range_hi = tree_rank_hash(tree, hi);                        \
+      if (count_range_lo < count_range_hi) {                                   \
+        count_range_n = count_range_hi - count_range_lo;                       \
+      }                                                                        \
+    } else {                                                                   \
+      count_range_n = tree_count_range_scan(tree, lo, hi, range_first,         \
+                                            range_next);                       \
+    }                                                                          \
+    count_range_n;                                                             \
+  })
+
+#define tree_count_range_scan(tree, lo, hi, range_first, range_next)           \
+  ({                                                                           \
+    uint64_t count_scan_hi = (hi);                                             \
+    size_t count_scan_n = 0;                                                   \
+    for (tree_addr_t count_scan_addr = range_first(tree, lo, count_scan_hi);   \
+         tree_is_valid_addr(count_scan_addr);                                  \
+         count_scan_addr = range_next(tree, count_scan_addr, count_scan_hi)) { \
+      count_scan_n++;                                                          \
+    }                                                                          \
+    count_scan_n;                                                              \
   })
 
+/* Recomputes the subtree count of an inited node from its two children */
+#define tree_count_update(tree, node_addr)                                     \
+  do {                                                                         \
+    if (!SET_SUBTREE_COUNTS) {                                                 \
+      break;                                                                   \
+    }                                                                          \
+    tree_node_t *count_node = tree_get_node(tree, node_addr);                  \
+    count_node->count = 1 + tree_count(tree, count_node->left) +               \
+                        tree_count(tree, count_node->right);                   \
+  } while (0)
+
 #define tree_delete_fixup(tree, node_addr)                                     \
   do {                                                                         \
     while (node_addr != tree.root) {                                           \
@@ -499,16 +4454,113 @@ typedef struct {
     }                                                                          \
   } while (0)
 
-#define tree_empty(tree, set_init, set_free)                                   \
+#define tree_dealloc(tree, ptr) tree.allocator->free(tree.allocator->ctx, (ptr))
+
+/* Makes root_addr the black root of a standalone subtree and returns its new
+ * black height, given the one it had */
+#define tree_detach_root(tree, root_addr, black_height)                        \
+  ({                                                                           \
+    size_t detach_height = (black_height);                                     \
+    if (!tree_is_shared_nil(root_addr)) {                                      \
+      tree_get_node(tree, root_addr)->parent = 0;                              \
+    }                                                                          \
+    if (tree_is_red(tree, root_addr)) {                                        \
+      tree_write_color(tree, root_addr, NODE_COLOR_BLACK);                     \
+      detach_height++;                                                         \
+    }                                                                          \
+    detach_height;                                                             \
+  })
+
+/* Expands to the expression for the backend of a set or map type. Every type
+ * carries the fields of all backends, so each branch compiles for any type,
+ * but only the chosen one ends up in the program. */
+#define tree_dispatch(tree, tree_expr, flat_expr, btree_expr, frozen_expr)     \
+  __builtin_choose_expr(                                                       \
+      tree_backend(tree) == SET_BACKEND_FLAT, ({ flat_expr; }),                \
+      __builtin_choose_expr(                                                   \
+          tree_backend(tree) == SET_BACKEND_BTREE, ({ btree_expr; }),          \
+          __builtin_choose_expr(tree_backend(tree) == SET_BACKEND_FROZEN,      \
+                                ({ frozen_expr; }), ({ tree_expr; }))))
+
+#define tree_empty(tree, init_with_allocator, set_free)                        \
   do {                                                                         \
     typeof(tree.hash_fn) hash_fn = tree.hash_fn;                               \
     typeof(tree.equals_fn) equals_fn = tree.equals_fn;                         \
+    const set_allocator_t *empty_allocator = tree.allocator;                   \
     set_free(tree);                                                            \
-    set_init(tree, hash_fn, equals_fn);                                        \
+    init_with_allocator(tree, hash_fn, equals_fn, empty_allocator);            \
+  } while (0)
+
+/* Adds the size of an entry column of one slot to file_entry_bytes */
+#define tree_file_entry_bytes(tree, column)                                    \
+  file_entry_bytes += sizeof(*tree.column)
+
+#define tree_file_flags()                                                      \
+  ((SET_SHARED_NIL ? SET_FILE_SHARED_NIL : 0) |                                \
+   (SET_SUBTREE_COUNTS ? SET_FILE_SUBTREE_COUNTS : 0) |                        \
+   (SET_NODE_FLAGS ? SET_FILE_NODE_FLAGS : 0))
+
+/* Header for a file of the storage block of tree, without the checksums */
+#define tree_file_header(tree, entry_columns)                                  \
+  ({                                                                           \
+    tree_requires_backend(tree, SET_BACKEND_TREE);                             \
+    uint32_t file_entry_bytes = 0;                                             \
+    entry_columns(tree, tree_file_entry_bytes);                                \
+    (tree_file_header_t){                                                      \
+        .magic = SET_FILE_MAGIC,                                               \
+        .version = SET_FILE_VERSION,                                           \
+        .flags = tree_file_flags(),                                            \
+        .entry_bytes = file_entry_bytes,                                       \
+        .capacity = tree.capacity,                                             \
+        .size = tree.size,                                                     \
+        .storage_bytes =                                                       \
+            tree_storage_size(tree, tree.capacity, entry_columns),             \
+        .root = tree.root,                                                     \
+        .free_list_start = tree.free_list_start,                               \
+    };                                                                         \
+  })
+
+/* Builds out from the entries of the ordered set src that are (keep_found)
+ * or are not in other, by looking each one up. Used instead of a merge when
+ * src is much smaller than other. */
+#define tree_filter(out, src, other, keep_found, get_entry, first, next, has,  \
+                    write_entry, entry_columns)                                \
+  do {                                                                         \
+    tree_requires_backend(out, SET_BACKEND_TREE);                              \
+    tree_requires_ordered(src);                                                \
+    tree_hash_pair_t *filter_pairs =                                           \
+        malloc(sizeof(tree_hash_pair_t) * (src.size + 1));                     \
+    typeof(*src.entries) *filter_entries =                                     \
+        malloc(sizeof(*src.entries) * (src.size + 1));                         \
+    size_t filter_n = 0;                                                       \
+    for (tree_addr_t filter_addr = first(src);                                 \
+         tree_is_valid_addr(filter_addr);                                      \
+         filter_addr = next(src, filter_addr)) {                               \
+      typeof(*src.entries) filter_entry = get_entry(src, filter_addr);         \
+      if (has(other, filter_entry) == (keep_found)) {                          \
+        filter_pairs[filter_n].hash = src.hash_fn(filter_entry);               \
+        filter_pairs[filter_n].addr = tree_addr(filter_n);                     \
+        filter_entries[filter_n++] = filter_entry;                             \
+      }                                                                        \
+    }                                                                          \
+    out.allocator = src.allocator;                                             \
+    out.hash_fn = src.hash_fn;                                                 \
+    out.equals_fn = src.equals_fn;                                             \
+    tree_build_sorted_entries(out, filter_pairs, filter_entries, filter_n,     \
+                              write_entry, entry_columns);                     \
+    free(filter_pairs);                                                        \
+    free(filter_entries);                                                      \
   } while (0)
 
 #define tree_find_duplicate(tree, node_addr, entry_var, tree_get_entry,        \
                             f_entries)                                         \
+  tree_find_duplicate_with(tree, node_addr, entry_var, tree_get_entry,         \
+                           f_entries, tree.equals_fn)
+
+/* tree_find_duplicate comparing with equals_function, which
+ * set_declare_static() binds at compile time */
+#define tree_find_duplicate_with(tree, node_addr, entry_var, tree_get_entry,   \
+                                 f_entries, equals_function)                   \
   ({                                                                           \
     tree_addr_t retval = 0;                                                    \
     typeof(*tree.f_entries) entry_val = (entry_var);                           \
@@ -519,11 +4571,11 @@ typedef struct {
       do {                                                                     \
         typeof(*tree.f_entries) entry = tree_get_entry(tree, next);            \
         if ((next != node_addr || i == 0) &&                                   \
-            tree.equals_fn(entry, entry_val)) {                                \
+            (equals_function)(entry, entry_val)) {                             \
           retval = next;                                                       \
           break;                                                               \
         }                                                                      \
-        tree_collision_t *collision = tree_get_collision(tree, next);          \
+        const tree_collision_t *collision = tree_read_collision(tree, next);   \
         next = i == 1 ? collision->next : collision->prev;                     \
       } while (tree_is_valid_addr(next));                                      \
                                                                                \
@@ -534,13 +4586,77 @@ typedef struct {
     retval;                                                                    \
   })
 
+/* Looks up n keys in groups of TREE_BATCH_WIDTH. Each round moves every
+ * unfinished descent of the group down one level and prefetches the node it
+ * lands on, so the cache misses of a group overlap instead of adding up.
+ * write_out(tree, out, pos, addr) stores the result for key pos. */
+#define tree_find_many(tree, keys, n, find_duplicate, write_out, out)          \
+  do {                                                                         \
+    typeof(&*(keys)) many_keys = (keys);                                       \
+    size_t many_n = (n);                                                       \
+    for (size_t many_base = 0; many_base < many_n;                             \
+         many_base += TREE_BATCH_WIDTH) {                                      \
+      size_t many_width = many_n - many_base < TREE_BATCH_WIDTH                \
+                              ? many_n - many_base                             \
+                              : TREE_BATCH_WIDTH;                              \
+      uint64_t many_hashes[TREE_BATCH_WIDTH];                                  \
+      tree_addr_t many_cursors[TREE_BATCH_WIDTH];                              \
+      uint32_t many_active = 0;                                                \
+      for (size_t many_j = 0; many_j < many_width; many_j++) {                 \
+        many_hashes[many_j] = tree.hash_fn(many_keys[many_base + many_j]);     \
+        many_cursors[many_j] = tree.root;                                      \
+        many_active |= 1u << many_j;                                           \
+      }                                                                        \
+                                                                               \
+      while (many_active != 0) {                                               \
+        for (uint32_t many_lanes = many_active; many_lanes != 0;               \
+             many_lanes &= many_lanes - 1) {                                   \
+          int many_j = __builtin_ctz(many_lanes);                              \
+          tree_addr_t many_addr = many_cursors[many_j];                        \
+          tree_node_t *many_node = &tree.nodes[tree_idx(many_addr)];           \
+          if (!tree_is_inited(tree, many_addr) ||                              \
+              many_node->hash == many_hashes[many_j]) {                        \
+            many_active &= ~(1u << many_j);                                    \
+            continue;                                                          \
+          }                                                                    \
+          many_addr = many_hashes[many_j] < many_node->hash ? many_node->left  \
+                                                           : many_node->right; \
+          __builtin_prefetch(&tree.nodes[tree_idx(many_addr)]);                \
+          many_cursors[many_j] = many_addr;                                    \
+        }                                                                      \
+      }                                                                        \
+                                                                               \
+      for (size_t many_j = 0; many_j < many_width; many_j++) {                 \
+        tree_addr_t many_found = 0;                                            \
+        if (tree_is_inited(tree, many_cursors[many_j])) {                      \
+          many_found = find_duplicate(tree, many_cursors[many_j],              \
+                                      many_keys[many_base + many_j]);          \
+        }                                                                      \
+        write_out(tree, out, many_base + many_j, many_found);                  \
+      }                                                                        \
+    }                                                                          \
+  } while (0)
+
+/* tree_find_many for backends whose single lookups already prefetch or
+ * touch few cache lines */
+#define tree_find_many_seq(tree, keys, n, find_entry, write_out, out)          \
+  do {                                                                         \
+    typeof(&*(keys)) many_keys = (keys);                                       \
+    size_t many_n = (n);                                                       \
+    for (size_t many_i = 0; many_i < many_n; many_i++) {                       \
+      write_out(tree, out, many_i,                                             \
+                find_entry(tree, tree.hash_fn(many_keys[many_i]),              \
+                           many_keys[many_i]));                                \
+    }                                                                          \
+  } while (0)
+
 #define tree_find_node(tree, hash_value)                                       \
   ({                                                                           \
     tree_addr_t n_addr = tree.root;                                            \
     tree_addr_t find_node_retval;                                              \
     while (tree_is_valid_addr(n_addr)) {                                       \
       find_node_retval = n_addr;                                               \
-      tree_node_t *node = tree_get_node(tree, n_addr);                         \
+      const tree_node_t *node = tree_read_node(tree, n_addr);                  \
       if ((hash_value) > node->hash) {                                         \
         n_addr = node->right;                                                  \
       } else if ((hash_value) < node->hash) {                                  \
@@ -560,26 +4676,155 @@ typedef struct {
     if (tree_is_inited(tree, node_addr)) {                                     \
       retval = tree_find_duplicate(tree, node_addr, entry_var);                \
     }                                                                          \
-    retval;                                                                    \
-  })
-
-#define tree_first(tree) tree_ult(tree, left)
-
-#define tree_free(tree, free_data)                                             \
-  do {                                                                         \
-    free(tree.nodes);                                                          \
-    free(tree.colors);                                                         \
-    free(tree.inited);                                                         \
-    free(tree.free_list);                                                      \
-    free_data(tree);                                                           \
+    retval;                                                                    \
+  })
+
+#define tree_first(tree) tree_ult(tree, left)
+
+/* Storage mapped by tree_mmap_open goes back with the file header in front
+ * of it. Chunks shared with snapshots only go back with the last handle on
+ * them. */
+#define tree_free(tree)                                                        \
+  do {                                                                         \
+    if (tree.cow != NULL) {                                                    \
+      tree_cow_release(tree.cow, tree.cow_chunks, (char *)tree.nodes);         \
+    } else if (tree.mapped_bytes != 0) {                                       \
+      munmap((char *)tree.nodes - SET_FILE_HEADER_SIZE, tree.mapped_bytes);    \
+    } else {                                                                   \
+      tree_dealloc(tree, tree.nodes);                                          \
+    }                                                                          \
+  } while (0)
+
+#define tree_free_node(tree, addr)                                             \
+  do {                                                                         \
+    tree_idx_t idx = tree_idx(addr);                                           \
+    tree_touch(tree, &tree.free_list[idx], sizeof(tree_addr_t));               \
+    tree.free_list[idx] = tree.free_list_start;                                \
+    tree.free_list_start = addr;                                               \
+  } while (0)
+
+/* Returns every slot of the subtree at root_addr to the free list and
+ * returns the number of entries in it */
+#define tree_free_subtree(tree, root_addr, clear_entry)                        \
+  ({                                                                           \
+    tree_addr_t free_stack[128];                                               \
+    size_t free_top = 0;                                                       \
+    size_t free_count = 0;                                                     \
+    free_stack[free_top++] = (root_addr);                                      \
+    while (free_top > 0) {                                                     \
+      tree_addr_t free_addr = free_stack[--free_top];                          \
+      if (tree_is_shared_nil(free_addr)) {                                     \
+        continue;                                                              \
+      }                                                                        \
+      if (tree_is_inited(tree, free_addr)) {                                   \
+        tree_node_t *free_node = tree_get_node(tree, free_addr);               \
+        free_stack[free_top++] = free_node->left;                              \
+        free_stack[free_top++] = free_node->right;                             \
+        clear_entry(tree, free_addr);                                          \
+        free_count++;                                                          \
+      }                                                                        \
+      tree_write_color(tree, free_addr, NODE_COLOR_BLACK);                     \
+      tree_free_node(tree, free_addr);                                         \
+    }                                                                          \
+    free_count;                                                                \
+  })
+
+/* Copies the entries of src into an empty frozen set, sorted by hash */
+#define tree_freeze(frozen, src, get_entry, move_entry, malloc_entries, first, \
+                    next)                                                      \
+  do {                                                                         \
+    tree_requires_backend(frozen, SET_BACKEND_FROZEN);                         \
+    size_t freeze_n = src.size;                                                \
+    tree_hash_pair_t *freeze_pairs =                                           \
+        malloc(sizeof(tree_hash_pair_t) * (freeze_n * 2 + 1));                 \
+    size_t freeze_i = 0;                                                       \
+    tree_addr_t freeze_addr = first(src);                                      \
+    while (tree_is_valid_addr(freeze_addr)) {                                  \
+      freeze_pairs[freeze_i].hash = src.hash_fn(get_entry(src, freeze_addr));  \
+      freeze_pairs[freeze_i].addr = freeze_addr;                               \
+      freeze_i++;                                                              \
+      freeze_addr = next(src, freeze_addr);                                    \
+    }                                                                          \
+    tree_radix_sort(freeze_pairs, &freeze_pairs[freeze_n], freeze_n);          \
+                                                                               \
+    frozen.allocator = src.allocator;                                          \
+    frozen.hash_fn = src.hash_fn;                                              \
+    frozen.equals_fn = src.equals_fn;                                          \
+    frozen.size = freeze_n;                                                    \
+    frozen.capacity = freeze_n;                                                \
+    malloc_entries(frozen);                                                    \
+    frozen.frozen_count = 0;                                                   \
+    for (freeze_i = 0; freeze_i < freeze_n; freeze_i++) {                      \
+      move_entry(frozen, tree_addr(freeze_i), src,                             \
+                 freeze_pairs[freeze_i].addr);                                 \
+      if (freeze_i == 0 ||                                                     \
+          freeze_pairs[freeze_i].hash != freeze_pairs[freeze_i - 1].hash) {    \
+        frozen.frozen_count++;                                                 \
+      }                                                                        \
+    }                                                                          \
+    frozen.frozen_hashes =                                                     \
+        tree_aligned_alloc(frozen, 64,                                         \
+                           frozen_hash_bytes(frozen.frozen_count));            \
+    frozen.frozen_runs =                                                       \
+        tree_malloc(frozen, sizeof(frozen_run_t) * (frozen.frozen_count + 1)); \
+    frozen_eytzinger_fill(frozen.frozen_hashes, frozen.frozen_runs,            \
+                          freeze_pairs, freeze_n, frozen.frozen_count);        \
+    free(freeze_pairs);                                                        \
+  } while (0)
+
+/* Builds a tree from n keys in one pass over sorted hashes instead of n
+ * descents. Among entries that are equal, the first one in keys wins, the
+ * same as with repeated adds. copy_in(tree, addr, idx, keys, ...) writes
+ * entry idx of the source arrays to addr. */
+#define tree_from_array(tree, keys, n, hash_function, equals_function,         \
+                        entry_columns, copy_in, ...)                           \
+  do {                                                                         \
+    typeof(&*(keys)) from_keys = (keys);                                       \
+    size_t from_n = (n);                                                       \
+    tree.allocator = set_libc_allocator();                                     \
+    tree.hash_fn = hash_function;                                              \
+    tree.equals_fn = equals_function;                                          \
+    tree_hash_pair_t *from_pairs =                                             \
+        malloc(sizeof(tree_hash_pair_t) * (from_n * 2 + 1));                   \
+    for (size_t from_i = 0; from_i < from_n; from_i++) {                       \
+      from_pairs[from_i].hash = tree.hash_fn(from_keys[from_i]);               \
+      from_pairs[from_i].addr = tree_addr(from_i);                             \
+    }                                                                          \
+    tree_radix_sort(from_pairs, &from_pairs[from_n], from_n);                  \
+                                                                               \
+    size_t from_count = 0;                                                     \
+    size_t from_run = 0;                                                       \
+    for (size_t from_i = 0; from_i < from_n; from_i++) {                       \
+      tree_hash_pair_t from_pair = from_pairs[from_i];                         \
+      if (from_count > 0 &&                                                    \
+          from_pairs[from_count - 1].hash != from_pair.hash) {                 \
+        from_run = from_count;                                                 \
+      }                                                                        \
+      bool from_is_duplicate = false;                                          \
+      for (size_t from_j = from_run; from_j < from_count; from_j++) {          \
+        if (tree.equals_fn(from_keys[tree_idx(from_pairs[from_j].addr)],       \
+                           from_keys[tree_idx(from_pair.addr)])) {             \
+          from_is_duplicate = true;                                            \
+          break;                                                               \
+        }                                                                      \
+      }                                                                        \
+      if (!from_is_duplicate) {                                                \
+        from_pairs[from_count++] = from_pair;                                  \
+      }                                                                        \
+    }                                                                          \
+                                                                               \
+    tree_build_sorted(tree, from_pairs, from_count, entry_columns);            \
+    for (size_t from_i = 0; from_i < from_count; from_i++) {                   \
+      copy_in(tree, tree_sorted_addr(from_i),                                  \
+              tree_idx(from_pairs[from_i].addr), from_keys, ##__VA_ARGS__);    \
+    }                                                                          \
+    free(from_pairs);                                                          \
   } while (0)
 
-#define tree_free_node(tree, addr)                                             \
-  do {                                                                         \
-    tree_idx_t idx = tree_idx(addr);                                           \
-    tree.free_list[idx] = tree.free_list_start;                                \
-    tree.free_list_start = addr;                                               \
-  } while (0)
+/* Whether looking up every entry of small in large beats walking both, that
+ * is, when |small| * log2(|large|) < |large| */
+#define tree_gallop_pays(small, large)                                         \
+  ((small).size * (64 - __builtin_clzll((large).size | 1)) < (large).size)
 
 #define tree_get_collision(tree, addr)                                         \
   ({                                                                           \
@@ -590,17 +4835,19 @@ typedef struct {
           tree.capacity, idx);                                                 \
     }                                                                          \
     assert(tree.capacity > idx);                                               \
+    tree_touch(tree, &tree.collisions[idx], sizeof(tree_collision_t));         \
     &tree.collisions[idx];                                                     \
   })
 
 #define tree_get_node(tree, addr)                                              \
   ({                                                                           \
-    tree_addr_t a = (addr);                                                    \
+    tree_addr_t get_node_addr = (addr);                                        \
     tree_node_t *retval = NULL;                                                \
-    if (tree_is_valid_addr(a)) {                                               \
-      tree_idx_t idx = tree_idx(a);                                            \
+    if (tree_is_valid_addr(get_node_addr)) {                                   \
+      tree_idx_t idx = tree_idx(get_node_addr);                                \
       assert(tree.capacity > idx);                                             \
       retval = &tree.nodes[idx];                                               \
+      tree_touch(tree, retval, sizeof(tree_node_t));                           \
     }                                                                          \
     retval;                                                                    \
   })
@@ -608,24 +4855,76 @@ typedef struct {
 #define tree_get_sibling(tree, node, f_branch)                                 \
   tree_get_node(tree, tree_get_node(tree, node->parent)->f_branch)
 
+/* Moves the columns of tree into a block of new_capacity slots, or of
+ * TREE_MAX_CAPACITY ones if that is less, and puts the new slots in front of
+ * the free list, lowest address first */
+#define tree_grow(tree, new_capacity, entry_columns)                           \
+  do {                                                                         \
+    size_t grow_capacity = (new_capacity);                                     \
+    if (grow_capacity > TREE_MAX_CAPACITY) {                                   \
+      grow_capacity = TREE_MAX_CAPACITY;                                       \
+    }                                                                          \
+    if (grow_capacity <= tree.capacity) {                                      \
+      tree_capacity_exceeded();                                                \
+    }                                                                          \
+    typeof(tree) grow_old = tree;                                              \
+    tree_alloc_storage(tree, grow_capacity, entry_columns);                    \
+    tree_grow_copy(tree, nodes);                                               \
+    tree_grow_copy(tree, collisions);                                          \
+    tree_grow_copy(tree, free_list);                                           \
+    entry_columns(tree, tree_grow_copy);                                       \
+    size_t grow_flag_old = grow_old.capacity / 8;                              \
+    size_t grow_flag_new = tree.capacity / 8;                                  \
+    memcpy(tree.colors, grow_old.colors, grow_flag_old);                       \
+    memcpy(tree.inited, grow_old.inited, grow_flag_old);                       \
+    memset(&tree.colors[grow_flag_old], 0x00, grow_flag_new - grow_flag_old);  \
+    memset(&tree.inited[grow_flag_old], 0x00, grow_flag_new - grow_flag_old);  \
+    tree_free(grow_old);                                                       \
+                                                                               \
+    start_trace(22, 0, trace_span("Free list expansion"));                     \
+    for (tree_idx_t grow_i = grow_old.capacity; grow_i < tree.capacity - 1;    \
+         grow_i++) {                                                           \
+      tree.free_list[grow_i] = tree_addr(grow_i + 1);                          \
+    }                                                                          \
+    tree.free_list[tree.capacity - 1] = tree.free_list_start;                  \
+    tree.free_list_start = tree_addr(grow_old.capacity);                       \
+    end_trace();                                                               \
+  } while (0)
+
+/* Copies a column of the storage grow_old of tree_grow into tree */
+#define tree_grow_copy(tree, column)                                           \
+  memcpy(tree.column, grow_old.column,                                         \
+         sizeof(*tree.column) * grow_old.capacity)
+
+/* Next capacity of a full tree or btree under its growth policy: the larger
+ * of growth_percent of the current one and growth_increment more slots,
+ * rounded up to a multiple of 8 and at least 8 slots more */
+#define tree_grown_capacity(tree)                                              \
+  ({                                                                           \
+    size_t grown_capacity = tree.capacity * tree.growth_percent / 100;         \
+    if (grown_capacity < tree.capacity + tree.growth_increment) {              \
+      grown_capacity = tree.capacity + tree.growth_increment;                  \
+    }                                                                          \
+    if (grown_capacity < tree.capacity + 8) {                                  \
+      grown_capacity = tree.capacity + 8;                                      \
+    }                                                                          \
+    (grown_capacity + 7) / 8 * 8;                                              \
+  })
+
 #define tree_idx(addr) (addr) - 1
 
-#define tree_init(tree, hash_function, equals_function, malloc_entries,        \
+#define tree_init(tree, hash_function, equals_function, entry_columns,         \
                   alloc_new_node)                                              \
   do {                                                                         \
-    tree.capacity = ALLOC_CHUNK;                                               \
-    tree.nodes = malloc(sizeof(tree_node_t) * tree.capacity);                  \
-    tree.collisions = malloc(sizeof(tree_collision_t) * tree.capacity);        \
-    tree.free_list = malloc(sizeof(tree_addr_t) * tree.capacity);              \
-    tree.colors = malloc(tree.capacity / 8);                                   \
-    tree.inited = malloc(tree.capacity / 8);                                   \
+    tree_alloc_storage(tree, ALLOC_CHUNK, entry_columns);                      \
+    tree_set_default_growth(tree);                                             \
     tree.free_list_start = tree_addr(0);                                       \
+    tree.size = 0;                                                             \
     tree.free_list[0] = tree_addr(1);                                          \
     for (uint32_t i = 1; i < tree.capacity - 1; i++) {                         \
       tree.free_list[i] = tree_addr(i + 1);                                    \
     }                                                                          \
     tree.free_list[tree.capacity - 1] = 0;                                     \
-    malloc_entries(tree);                                                      \
     memset(tree.colors, 0x00, tree.capacity / 8);                              \
     memset(tree.inited, 0x00, tree.capacity / 8);                              \
     tree.root = alloc_new_node(tree);                                          \
@@ -633,17 +4932,513 @@ typedef struct {
     tree.equals_fn = equals_function;                                          \
   } while (0)
 
+
 #define tree_is_inited(tree, addr) tree_read_bitval(tree, addr, inited)
 #define tree_is_red(tree, addr) tree_read_bitval(tree, addr, colors)
+#define tree_is_shared_nil(addr)                                               \
+  (SET_SHARED_NIL && (tree_addr_t)(addr) == TREE_SHARED_NIL_ADDR)
 #define tree_is_valid_addr(addr) ((tree_addr_t)addr != 0)
 
+/* Moves the entries of b into a, where every hash in a is lower than every
+ * hash in b. The smaller of the two is copied into the storage of the larger
+ * one, without its entry next to the other set. That entry becomes the pivot
+ * of tree_join_at. */
+#define tree_join(a, b, get_key, find_node_entry, clear_entry, alloc_new_node, \
+                  move_entry, entry_columns)                                   \
+  do {                                                                         \
+    tree_requires_backend(a, SET_BACKEND_TREE);                                \
+    tree_requires_backend(b, SET_BACKEND_TREE);                                \
+    tree_requires_writable(a);                                                 \
+    tree_requires_writable(b);                                                 \
+    if (b.size == 0) {                                                         \
+      tree_free(b);                                                            \
+      break;                                                                   \
+    }                                                                          \
+    if (a.size == 0) {                                                         \
+      tree_free(a);                                                            \
+      a = b;                                                                   \
+      break;                                                                   \
+    }                                                                          \
+    assert(tree_read_node(a, tree_last(a))->hash <                             \
+           tree_read_node(b, tree_first(b))->hash);                            \
+                                                                               \
+    bool join_into_a = b.size <= a.size;                                       \
+    typeof(a) *join_dst = join_into_a ? &a : &b;                               \
+    typeof(a) *join_src = join_into_a ? &b : &a;                               \
+    tree_addr_t join_src_pivot =                                               \
+        join_into_a ? tree_first((*join_src)) : tree_last((*join_src));        \
+    tree_addr_t join_pivot = alloc_new_node((*join_dst));                      \
+    move_entry((*join_dst), join_pivot, (*join_src), join_src_pivot);          \
+    tree_get_node((*join_dst), join_pivot)->hash =                             \
+        tree_get_node((*join_src), join_src_pivot)->hash;                      \
+    tree_write_inited((*join_dst), join_pivot, true);                          \
+    typeof(get_key((*join_src), join_src_pivot)) join_key =                    \
+        get_key((*join_src), join_src_pivot);                                  \
+    tree_remove((*join_src), join_key, find_node_entry, clear_entry,           \
+                entry_columns);                                                \
+                                                                               \
+    tree_addr_t join_copy = tree_copy_subtree(                                 \
+        (*join_dst), (*join_src), join_src->root, alloc_new_node, move_entry); \
+    size_t join_copy_height = tree_black_height((*join_src), join_src->root);  \
+    size_t join_dst_height = tree_black_height((*join_dst), join_dst->root);   \
+    size_t join_height;                                                        \
+    if (join_into_a) {                                                         \
+      a.root = tree_join_at(a, a.root, join_dst_height, join_pivot, join_copy, \
+                            join_copy_height, join_height);                    \
+    } else {                                                                   \
+      b.root = tree_join_at(b, join_copy, join_copy_height, join_pivot,        \
+                            b.root, join_dst_height, join_height);             \
+    }                                                                          \
+    join_dst->size += join_src->size + 1;                                      \
+                                                                               \
+    /* The pivot was the end of a collision chain in the other set */          \
+    tree_addr_t join_neighbor = join_into_a ? tree_next(a, join_pivot)         \
+                                            : tree_prev(b, join_pivot);        \
+    if (tree_is_valid_addr(join_neighbor) &&                                   \
+        tree_get_node((*join_dst), join_neighbor)->hash ==                     \
+            tree_get_node((*join_dst), join_pivot)->hash) {                    \
+      tree_addr_t join_lo = join_into_a ? join_pivot : join_neighbor;          \
+      tree_addr_t join_hi = join_into_a ? join_neighbor : join_pivot;          \
+      tree_get_collision((*join_dst), join_lo)->next = join_hi;                \
+      tree_get_collision((*join_dst), join_hi)->prev = join_lo;                \
+    }                                                                          \
+                                                                               \
+    tree_free((*join_src));                                                    \
+    if (!join_into_a) {                                                        \
+      a = b;                                                                   \
+    }                                                                          \
+  } while (0)
+
+/* Links the subtrees at left_addr and right_addr, standalone trees of the same
+ * storage with the given black heights, under the detached node pivot_addr,
+ * whose hash lies between theirs. Returns the root of the joined tree and
+ * stores its black height in joined_height. Only the spine of the taller tree
+ * down to the height of the other one is touched, so this takes
+ * O(1 + |left_height - right_height|). */
+#define tree_join_at(tree, left_addr, left_height, pivot_addr, right_addr,     \
+                     right_height, joined_height)                              \
+  ({                                                                           \
+    tree_addr_t join_left = (left_addr);                                       \
+    tree_addr_t join_right = (right_addr);                                     \
+    tree_addr_t join_at_pivot = (pivot_addr);                                  \
+    size_t join_left_height = tree_detach_root(tree, join_left, left_height);  \
+    size_t join_right_height =                                                 \
+        tree_detach_root(tree, join_right, right_height);                      \
+    tree_addr_t join_root = join_at_pivot;                                     \
+    if (join_left_height == join_right_height) {                               \
+      tree_node_t *join_node = tree_get_node(tree, join_at_pivot);             \
+      join_node->left = join_left;                                             \
+      join_node->right = join_right;                                           \
+      join_node->parent = 0;                                                   \
+      if (!tree_is_shared_nil(join_left)) {                                    \
+        tree_get_node(tree, join_left)->parent = join_at_pivot;                \
+      }                                                                        \
+      if (!tree_is_shared_nil(join_right)) {                                   \
+        tree_get_node(tree, join_right)->parent = join_at_pivot;               \
+      }                                                                        \
+      tree_write_color(tree, join_at_pivot, NODE_COLOR_BLACK);                 \
+      tree_count_update(tree, join_at_pivot);                                  \
+      joined_height = join_left_height + 1;                                    \
+    } else if (join_left_height > join_right_height) {                         \
+      join_root = tree_join_dir(tree, join_left, join_left_height,             \
+                                join_at_pivot, join_right, join_right_height,  \
+                                joined_height, right, left);                   \
+    } else {                                                                   \
+      join_root = tree_join_dir(tree, join_right, join_right_height,           \
+                                join_at_pivot, join_left, join_left_height,    \
+                                joined_height, left, right);                   \
+    }                                                                          \
+    join_root;                                                                 \
+  })
+
+/* tree_join_at when tall_addr is the higher tree: walks down its f_branch
+ * spine to the first black node as high as short_addr, replaces it with the
+ * red pivot holding both, and fixes up from there. The joined height is then
+ * the known height of short_addr plus the black nodes above it. */
+#define tree_join_dir(tree, tall_addr, tall_height, pivot_addr, short_addr,    \
+                      short_height, joined_height, f_branch, f_direction)      \
+  ({                                                                           \
+    tree_addr_t dir_cursor = (tall_addr);                                      \
+    tree_addr_t dir_parent = 0;                                                \
+    size_t dir_height = (tall_height);                                         \
+    while (dir_height > (short_height) || tree_is_red(tree, dir_cursor)) {     \
+      dir_height -= !tree_is_red(tree, dir_cursor);                            \
+      dir_parent = dir_cursor;                                                 \
+      dir_cursor = tree_read_node(tree, dir_cursor)->f_branch;                 \
+    }                                                                          \
+                                                                               \
+    tree_node_t *dir_pivot = tree_get_node(tree, pivot_addr);                  \
+    dir_pivot->f_branch = (short_addr);                                        \
+    dir_pivot->f_direction = dir_cursor;                                       \
+    dir_pivot->parent = dir_parent;                                            \
+    if (!tree_is_shared_nil(short_addr)) {                                     \
+      tree_get_node(tree, short_addr)->parent = (pivot_addr);                  \
+    }                                                                          \
+    if (!tree_is_shared_nil(dir_cursor)) {                                     \
+      tree_get_node(tree, dir_cursor)->parent = (pivot_addr);                  \
+    }                                                                          \
+    tree_get_node(tree, dir_parent)->f_branch = (pivot_addr);                  \
+    tree_write_color(tree, pivot_addr, NODE_COLOR_RED);                        \
+    tree_count_update(tree, pivot_addr);                                       \
+    tree_count_propagate(tree, dir_parent,                                     \
+                         tree_count(tree, short_addr) + 1);                    \
+                                                                               \
+    tree.root = (tall_addr);                                                   \
+    tree_rb_insert_fixup(tree, pivot_addr);                                    \
+                                                                               \
+    tree_addr_t dir_probe = (short_addr);                                      \
+    joined_height = (short_height);                                            \
+    if (tree_is_shared_nil(dir_probe)) {                                       \
+      dir_probe = (pivot_addr);                                                \
+      joined_height = tree_black_height(tree, dir_probe);                      \
+    }                                                                          \
+    for (dir_probe = tree_read_node(tree, dir_probe)->parent;                  \
+         tree_is_valid_addr(dir_probe);                                        \
+         dir_probe = tree_read_node(tree, dir_probe)->parent) {                \
+      joined_height += !tree_is_red(tree, dir_probe);                          \
+    }                                                                          \
+    tree.root;                                                                 \
+  })
+
 #define tree_last(tree) tree_ult(tree, right)
 
+/* Address of the first node in hash order whose hash is not below
+ * hash_value, or 0 if there is none */
+#define tree_lower_bound(tree, hash_value)                                     \
+  ({                                                                           \
+    uint64_t lower_bound_hash = (hash_value);                                  \
+    tree_addr_t lower_bound_cursor = tree.root;                                \
+    tree_addr_t lower_bound_retval = 0;                                        \
+    while (tree_is_inited(tree, lower_bound_cursor)) {                         \
+      const tree_node_t *lower_bound_node =                                    \
+          tree_read_node(tree, lower_bound_cursor);                            \
+      if (lower_bound_node->hash >= lower_bound_hash) {                        \
+        lower_bound_retval = lower_bound_cursor;                               \
+        lower_bound_cursor = lower_bound_node->left;                           \
+      } else {                                                                 \
+        lower_bound_cursor = lower_bound_node->right;                          \
+      }                                                                        \
+    }                                                                          \
+    lower_bound_retval;                                                        \
+  })
+
+#define tree_malloc(tree, size)                                                \
+  tree.allocator->alloc(tree.allocator->ctx, (size), 0)
+
+/* Builds out from a merge walk over two sets ordered by the same hash.
+ * keep_a, keep_b and keep_both choose which of the entries only in a, only
+ * in b, and in both end up in out. */
+#define tree_merge(out, a, b, keep_a, keep_b, keep_both, get_entry, first,     \
+                   next, write_entry, entry_columns)                           \
+  do {                                                                         \
+    tree_requires_backend(out, SET_BACKEND_TREE);                              \
+    tree_requires_ordered(a);                                                  \
+    tree_requires_ordered(b);                                                  \
+    assert(a.hash_fn == b.hash_fn);                                            \
+    size_t merge_capacity = a.size + b.size + 1;                               \
+    tree_hash_pair_t *merge_pairs =                                            \
+        malloc(sizeof(tree_hash_pair_t) * merge_capacity);                     \
+    typeof(*a.entries) *merge_entries =                                        \
+        malloc(sizeof(*a.entries) * merge_capacity);                           \
+    size_t merge_n = 0;                                                        \
+    tree_merge_range(a, b, first(a), first(b), 0, false, keep_a, keep_b,       \
+                     keep_both, get_entry, next, merge_pairs, merge_entries,   \
+                     merge_n);                                                 \
+    out.allocator = a.allocator;                                               \
+    out.hash_fn = a.hash_fn;                                                   \
+    out.equals_fn = a.equals_fn;                                               \
+    tree_build_sorted_entries(out, merge_pairs, merge_entries, merge_n,        \
+                              write_entry, entry_columns);                     \
+    free(merge_pairs);                                                         \
+    free(merge_entries);                                                       \
+  } while (0)
+
+/* Whether every entry of a is in b, by a merge walk over two sets ordered by
+ * the same hash */
+#define tree_merge_is_subset(a, b, get_entry, first, next)                     \
+  ({                                                                           \
+    tree_requires_ordered(a);                                                  \
+    tree_requires_ordered(b);                                                  \
+    assert(a.hash_fn == b.hash_fn);                                            \
+    bool subset = true;                                                        \
+    tree_addr_t subset_b = first(b);                                           \
+    uint64_t subset_hash_b = 0;                                                \
+    if (tree_is_valid_addr(subset_b)) {                                        \
+      subset_hash_b = b.hash_fn(get_entry(b, subset_b));                       \
+    }                                                                          \
+    for (tree_addr_t subset_a = first(a); tree_is_valid_addr(subset_a);        \
+         subset_a = next(a, subset_a)) {                                       \
+      uint64_t subset_hash_a = a.hash_fn(get_entry(a, subset_a));              \
+      while (tree_is_valid_addr(subset_b) && subset_hash_b < subset_hash_a) {  \
+        subset_b = next(b, subset_b);                                          \
+        if (tree_is_valid_addr(subset_b)) {                                    \
+          subset_hash_b = b.hash_fn(get_entry(b, subset_b));                   \
+        }                                                                      \
+      }                                                                        \
+      /* Scan the run of b without consuming it, as more entries of a may      \
+       * share the hash */                                                     \
+      bool subset_found = false;                                               \
+      tree_addr_t subset_scan = subset_b;                                      \
+      uint64_t subset_scan_hash = subset_hash_b;                               \
+      while (tree_is_valid_addr(subset_scan) &&                                \
+             subset_scan_hash == subset_hash_a) {                              \
+        if (a.equals_fn(get_entry(a, subset_a), get_entry(b, subset_scan))) {  \
+          subset_found = true;                                                 \
+          break;                                                               \
+        }                                                                      \
+        subset_scan = next(b, subset_scan);                                    \
+        if (tree_is_valid_addr(subset_scan)) {                                 \
+          subset_scan_hash = b.hash_fn(get_entry(b, subset_scan));             \
+        }                                                                      \
+      }                                                                        \
+      if (!subset_found) {                                                     \
+        subset = false;                                                        \
+        break;                                                                 \
+      }                                                                        \
+    }                                                                          \
+    subset;                                                                    \
+  })
+
+/* Loads the hash at a merge cursor and returns whether the cursor is still
+ * inside the merged range, which ends before end_hash if has_end is set */
+#define tree_merge_load(tree, cursor, hash, get_entry, end_hash, has_end)      \
+  ({                                                                           \
+    bool load_live = tree_is_valid_addr(cursor);                               \
+    if (load_live) {                                                           \
+      hash = tree.hash_fn(get_entry(tree, cursor));                            \
+      load_live = !(has_end) || hash < (end_hash);                             \
+    }                                                                          \
+    load_live;                                                                 \
+  })
+
+/* Builds the tree set out from tree sets a and b with P threads. The larger
+ * input is split into P ranges of about equal size at the hashes of the
+ * entries tree_select finds, and range_fn merges one range of both inputs
+ * per thread into a disjoint slice of one shared buffer. The slices are then
+ * moved together and built into out. range_type is the argument struct that
+ * set_declare_parallel defines. Threads are started per call rather than
+ * kept in a pool: P is capped so that every range holds at least
+ * SET_PARALLEL_MIN_RANGE entries, which outweighs starting its thread. */
+#define tree_merge_parallel(out, a, b, keep_a, keep_b, keep_both, threads,     \
+                            range_type, range_fn, write_entry,                 \
+                            entry_columns)                                     \
+  do {                                                                         \
+    tree_requires_backend(out, SET_BACKEND_TREE);                              \
+    tree_requires_backend(a, SET_BACKEND_TREE);                                \
+    tree_requires_backend(b, SET_BACKEND_TREE);                                \
+    assert(a.hash_fn == b.hash_fn);                                            \
+    typeof(a) *par_larger = a.size >= b.size ? &a : &b;                        \
+    size_t par_threads = (threads) < 1 ? 1 : (threads);                        \
+    if (par_larger->size / SET_PARALLEL_MIN_RANGE < par_threads) {             \
+      par_threads = par_larger->size / SET_PARALLEL_MIN_RANGE;                 \
+      par_threads = par_threads < 1 ? 1 : par_threads;                         \
+    }                                                                          \
+    size_t par_capacity = a.size + b.size + 1;                                 \
+    tree_hash_pair_t *par_pairs =                                              \
+        malloc(sizeof(tree_hash_pair_t) * par_capacity);                       \
+    typeof(*a.entries) *par_entries =                                          \
+        malloc(sizeof(*a.entries) * par_capacity);                             \
+    range_type *par_ranges = calloc(par_threads, sizeof(range_type));          \
+    pthread_t *par_ids = malloc(sizeof(pthread_t) * par_threads);              \
+    bool *par_started = calloc(par_threads, sizeof(bool));                     \
+                                                                               \
+    for (size_t par_i = 0; par_i < par_threads; par_i++) {                     \
+      range_type *par_range = &par_ranges[par_i];                              \
+      par_range->lhs = &a;                                                     \
+      par_range->rhs = &b;                                                     \
+      par_range->keep_lhs = keep_a;                                            \
+      par_range->keep_rhs = keep_b;                                            \
+      par_range->keep_common = keep_both;                                      \
+      par_range->has_start = par_i > 0;                                        \
+      par_range->has_end = par_i + 1 < par_threads;                            \
+      size_t par_offset = 0;                                                   \
+      if (par_range->has_start) {                                              \
+        par_range->start_hash = par_ranges[par_i - 1].end_hash;                \
+        par_offset = tree_rank_hash(a, par_range->start_hash) +                \
+                     tree_rank_hash(b, par_range->start_hash);                 \
+      }                                                                        \
+      if (par_range->has_end) {                                                \
+        tree_addr_t par_split = tree_select(                                   \
+            (*par_larger), par_larger->size * (par_i + 1) / par_threads);      \
+        par_range->end_hash = tree_read_node((*par_larger), par_split)->hash;  \
+      }                                                                        \
+      par_range->pairs = &par_pairs[par_offset];                               \
+      par_range->entries = &par_entries[par_offset];                           \
+      /* A range whose thread cannot start is merged here instead */           \
+      if (par_i > 0) {                                                         \
+        par_started[par_i] =                                                   \
+            pthread_create(&par_ids[par_i], NULL, range_fn, par_range) == 0;   \
+        if (!par_started[par_i]) {                                             \
+          range_fn(par_range);                                                 \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+    range_fn(&par_ranges[0]);                                                  \
+                                                                               \
+    size_t par_n = par_ranges[0].n;                                            \
+    for (size_t par_i = 1; par_i < par_threads; par_i++) {                     \
+      range_type *par_range = &par_ranges[par_i];                              \
+      if (par_started[par_i]) {                                                \
+        pthread_join(par_ids[par_i], NULL);                                    \
+      }                                                                        \
+      memmove(&par_pairs[par_n], par_range->pairs,                             \
+              sizeof(tree_hash_pair_t) * par_range->n);                        \
+      memmove(&par_entries[par_n], par_range->entries,                         \
+              sizeof(*a.entries) * par_range->n);                              \
+      par_n += par_range->n;                                                   \
+    }                                                                          \
+                                                                               \
+    out.allocator = a.allocator;                                               \
+    out.hash_fn = a.hash_fn;                                                   \
+    out.equals_fn = a.equals_fn;                                               \
+    tree_build_sorted_entries(out, par_pairs, par_entries, par_n, write_entry, \
+                              entry_columns);                                  \
+    free(par_pairs);                                                           \
+    free(par_entries);                                                         \
+    free(par_ranges);                                                          \
+    free(par_ids);                                                             \
+    free(par_started);                                                         \
+  } while (0)
+
+/* Merges a and b from the cursors start_a and start_b up to end_hash (or to
+ * the end if has_end is false), appending the kept hashes and entries to
+ * pairs and entries and counting them in n. Every step compares the hashes
+ * at both cursors. Runs of equal hashes are matched entry by entry with
+ * equals_fn. */
+#define tree_merge_range(a, b, start_a, start_b, end_hash, has_end, keep_a,    \
+                         keep_b, keep_both, get_entry, next, pairs, entries,   \
+                         n)                                                    \
+  do {                                                                         \
+    size_t merge_run_capacity = 8;                                             \
+    tree_addr_t *merge_run = malloc(sizeof(tree_addr_t) * merge_run_capacity); \
+    tree_addr_t merge_a = (start_a);                                           \
+    tree_addr_t merge_b = (start_b);                                           \
+    uint64_t merge_hash_a = 0;                                                 \
+    uint64_t merge_hash_b = 0;                                                 \
+    bool merge_live_a = tree_merge_load(a, merge_a, merge_hash_a, get_entry,   \
+                                        end_hash, has_end);                    \
+    bool merge_live_b = tree_merge_load(b, merge_b, merge_hash_b, get_entry,   \
+                                        end_hash, has_end);                    \
+                                                                               \
+    while (merge_live_a || merge_live_b) {                                     \
+      if (!merge_live_b || (merge_live_a && merge_hash_a < merge_hash_b)) {    \
+        if (keep_a) {                                                          \
+          (pairs)[n].hash = merge_hash_a;                                      \
+          (entries)[n++] = get_entry(a, merge_a);                              \
+        }                                                                      \
+        merge_a = next(a, merge_a);                                            \
+        merge_live_a = tree_merge_load(a, merge_a, merge_hash_a, get_entry,    \
+                                       end_hash, has_end);                     \
+        continue;                                                              \
+      }                                                                        \
+      if (!merge_live_a || merge_hash_b < merge_hash_a) {                      \
+        if (keep_b) {                                                          \
+          (pairs)[n].hash = merge_hash_b;                                      \
+          (entries)[n++] = get_entry(b, merge_b);                              \
+        }                                                                      \
+        merge_b = next(b, merge_b);                                            \
+        merge_live_b = tree_merge_load(b, merge_b, merge_hash_b, get_entry,    \
+                                       end_hash, has_end);                     \
+        continue;                                                              \
+      }                                                                        \
+                                                                               \
+      /* Equal hashes: buffer the run of b, then match the run of a against    \
+       * it. Matched entries of b are cleared from the buffer. */              \
+      uint64_t merge_hash = merge_hash_a;                                      \
+      size_t merge_run_len = 0;                                                \
+      while (merge_live_b && merge_hash_b == merge_hash) {                     \
+        if (merge_run_len == merge_run_capacity) {                             \
+          merge_run_capacity *= 2;                                             \
+          merge_run =                                                          \
+              realloc(merge_run, sizeof(tree_addr_t) * merge_run_capacity);    \
+        }                                                                      \
+        merge_run[merge_run_len++] = merge_b;                                  \
+        merge_b = next(b, merge_b);                                            \
+        merge_live_b = tree_merge_load(b, merge_b, merge_hash_b, get_entry,    \
+                                       end_hash, has_end);                     \
+      }                                                                        \
+      while (merge_live_a && merge_hash_a == merge_hash) {                     \
+        bool merge_in_b = false;                                               \
+        for (size_t merge_j = 0; merge_j < merge_run_len; merge_j++) {         \
+          if (tree_is_valid_addr(merge_run[merge_j]) &&                        \
+              a.equals_fn(get_entry(a, merge_a),                               \
+                          get_entry(b, merge_run[merge_j]))) {                 \
+            merge_run[merge_j] = 0;                                            \
+            merge_in_b = true;                                                 \
+            break;                                                             \
+          }                                                                    \
+        }                                                                      \
+        if (merge_in_b ? (keep_both) : (keep_a)) {                             \
+          (pairs)[n].hash = merge_hash;                                        \
+          (entries)[n++] = get_entry(a, merge_a);                              \
+        }                                                                      \
+        merge_a = next(a, merge_a);                                            \
+        merge_live_a = tree_merge_load(a, merge_a, merge_hash_a, get_entry,    \
+                                       end_hash, has_end);                     \
+      }                                                                        \
+      for (size_t merge_j = 0; (keep_b) && merge_j < merge_run_len;            \
+           merge_j++) {                                                        \
+        if (tree_is_valid_addr(merge_run[merge_j])) {                          \
+          (pairs)[n].hash = merge_hash;                                        \
+          (entries)[n++] = get_entry(b, merge_run[merge_j]);                   \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+    free(merge_run);                                                           \
+  } while (0)
+
 #define tree_max_in_branch(tree, node_addr)                                    \
   tree_ult_in_branch(tree, node_addr, right);
 #define tree_min_in_branch(tree, node_addr)                                    \
   tree_ult_in_branch(tree, node_addr, left);
 
+/* Serves tree from a file written by tree_save, mapped copy-on-write, so
+ * that lookups only fault in the pages they touch. Changes stay in memory,
+ * and the first growth moves tree into a block of its own. The functions are
+ * typed like those of set_init, and only stored once the file checks out:
+ * returns false, leaving tree alone, unless the header is intact and written
+ * for a tree of the same type and build flags. */
+#define tree_mmap_open(tree, path, hash_function, equals_function,             \
+                       entry_columns)                                          \
+  ({                                                                           \
+    tree_requires_backend(tree, SET_BACKEND_TREE);                             \
+    /* Typed like set_init, so functions of another entry type are caught */   \
+    typeof(tree.hash_fn) open_hash_fn = hash_function;                         \
+    typeof(tree.equals_fn) open_equals_fn = equals_function;                   \
+    uint32_t file_entry_bytes = 0;                                             \
+    entry_columns(tree, tree_file_entry_bytes);                                \
+    size_t open_bytes = 0;                                                     \
+    char *open_base = tree_file_map((path), &open_bytes);                      \
+    const tree_file_header_t *open_header =                                    \
+        (const tree_file_header_t *)open_base;                                 \
+    /* The size is checked here as well as in the header check, so that the    \
+     * compiler can see that tree_free() unmaps rather than frees tree */      \
+    bool open_ok =                                                             \
+        open_base != NULL && open_bytes >= SET_FILE_HEADER_SIZE &&             \
+        tree_file_header_ok(open_header, open_bytes, tree_file_flags(),        \
+                            file_entry_bytes) &&                               \
+        open_header->storage_bytes ==                                          \
+            tree_storage_size(tree, open_header->capacity, entry_columns);     \
+    if (open_ok) {                                                             \
+      tree.hash_fn = open_hash_fn;                                             \
+      tree.equals_fn = open_equals_fn;                                         \
+      tree.allocator = set_libc_allocator();                                   \
+      tree_carve_storage(tree, open_base + SET_FILE_HEADER_SIZE,               \
+                         open_header->capacity, entry_columns);                \
+      tree.mapped_bytes = open_bytes;                                          \
+      tree.cow = NULL;                                                         \
+      tree.cow_chunks = NULL;                                                  \
+      tree.snapshot = false;                                                   \
+      tree.size = open_header->size;                                           \
+      tree.root = open_header->root;                                           \
+      tree.free_list_start = open_header->free_list_start;                     \
+      tree_set_default_growth(tree);                                           \
+    } else if (open_base != NULL) {                                            \
+      munmap(open_base, open_bytes);                                           \
+    }                                                                          \
+    open_ok;                                                                   \
+  })
+
 #define tree_next(tree, node_addr) tree_seq(tree, node_addr, right, left)
 #define tree_next_in_branch(tree, node_addr)                                   \
   tree_seq_in_branch(tree, node_addr, right, left);
@@ -652,6 +5447,102 @@ typedef struct {
 #define tree_prev_in_branch(tree, node_addr)                                   \
   tree_seq_in_branch(tree, node_addr, left, right);
 
+#define tree_rand_below(n)                                                     \
+  ((((uint64_t)rand() << 42) ^ ((uint64_t)rand() << 21) ^ (uint64_t)rand()) %  \
+   (n))
+
+/* Floyd's algorithm over ranks: writes the addresses of min(k, size) distinct,
+ * uniformly chosen entries to out_addrs in O(k^2 + k log n). Uses rand(), so
+ * seed with srand() if needed. */
+#define tree_random_sample(tree, k, out_addrs)                                 \
+  ({                                                                           \
+    tree_requires_backend(tree, SET_BACKEND_TREE);                             \
+    tree_requires_subtree_counts();                                            \
+    size_t sample_n = tree.size;                                               \
+    size_t sample_k = (k) < sample_n ? (k) : sample_n;                         \
+    size_t sample_written = 0;                                                 \
+    for (size_t sample_j = sample_n - sample_k; sample_j < sample_n;           \
+         sample_j++) {                                                         \
+      tree_addr_t sample_addr =                                                \
+          tree_select(tree, tree_rand_below(sample_j + 1));                    \
+      for (size_t sample_i = 0; sample_i < sample_written; sample_i++) {       \
+        if ((out_addrs)[sample_i] == sample_addr) {                            \
+          sample_addr = tree_select(tree, sample_j);                           \
+          break;                                                               \
+        }                                                                      \
+      }                                                                        \
+      (out_addrs)[sample_written++] = sample_addr;                             \
+    }                                                                          \
+    sample_written;                                                            \
+  })
+
+#define tree_range_first(tree, lo, hi, lower_bound, get_key)                   \
+  ({                                                                           \
+    tree_addr_t range_first_addr = lower_bound(tree, lo);                      \
+    if (tree_is_valid_addr(range_first_addr) &&                                \
+        tree_addr_hash(tree, range_first_addr, get_key) >= (hi)) {             \
+      range_first_addr = 0;                                                    \
+    }                                                                          \
+    range_first_addr;                                                          \
+  })
+
+#define tree_range_next(tree, addr, hi, next, get_key)                         \
+  ({                                                                           \
+    tree_addr_t range_next_addr = next(tree, addr);                            \
+    if (tree_is_valid_addr(range_next_addr) &&                                 \
+        tree_addr_hash(tree, range_next_addr, get_key) >= (hi)) {              \
+      range_next_addr = 0;                                                     \
+    }                                                                          \
+    range_next_addr;                                                           \
+  })
+
+/* 0-based position of entry in hash order. For entries not in the tree, this
+ * is the number of entries with a hash lower than that of the entry. */
+#define tree_rank(tree, entry_var, find_node_entry)                            \
+  ({                                                                           \
+    tree_requires_backend(tree, SET_BACKEND_TREE);                             \
+    tree_requires_subtree_counts();                                            \
+    uint64_t rank_hash = tree.hash_fn(entry_var);                              \
+    tree_addr_t rank_addr = find_node_entry(tree, rank_hash, entry_var);       \
+    tree_is_valid_addr(rank_addr) ? tree_rank_addr(tree, rank_addr)            \
+                                  : tree_rank_hash(tree, rank_hash);           \
+  })
+
+#define tree_rank_addr(tree, node_addr)                                        \
+  ({                                                                           \
+    tree_addr_t rank_cursor = (node_addr);                                     \
+    const tree_node_t *rank_node = tree_read_node(tree, rank_cursor);          \
+    size_t rank = tree_count(tree, rank_node->left);                           \
+    while (tree_is_valid_addr(rank_node->parent)) {                            \
+      const tree_node_t *rank_parent =                                         \
+          tree_read_node(tree, rank_node->parent);                             \
+      if (rank_parent->right == rank_cursor) {                                 \
+        rank += tree_count(tree, rank_parent->left) + 1;                       \
+      }                                                                        \
+      rank_cursor = rank_node->parent;                                         \
+      rank_node = rank_parent;                                                 \
+    }                                                                          \
+    rank;                                                                      \
+  })
+
+/* Number of entries with a hash strictly lower than hash_value */
+#define tree_rank_hash(tree, hash_value)                                       \
+  ({                                                                           \
+    uint64_t rank_hash_val = (hash_value);                                     \
+    tree_addr_t rank_cursor = tree.root;                                       \
+    size_t rank = 0;                                                           \
+    while (tree_is_inited(tree, rank_cursor)) {                                \
+      const tree_node_t *rank_node = tree_read_node(tree, rank_cursor);        \
+      if (rank_hash_val > rank_node->hash) {                                   \
+        rank += tree_count(tree, rank_node->left) + 1;                         \
+        rank_cursor = rank_node->right;                                        \
+      } else {                                                                 \
+        rank_cursor = rank_node->left;                                         \
+      }                                                                        \
+    }                                                                          \
+    rank;                                                                      \
+  })
+
 #define tree_rb_insert_fixup(tree, node_addr)                                  \
   do {                                                                         \
     tree_addr_t addr = (node_addr);                                            \
@@ -771,18 +5662,97 @@ typedef struct {
 #define tree_rb_insert_fixup_right(tree, node_addr)                            \
   tree_rb_insert_fixup_dir(tree, node_addr, left, right)
 
+#if SET_NODE_FLAGS
+#define tree_read_bitval(tree, addr, f_member)                                 \
+  ((bool)tree.nodes[tree_idx(addr)].f_member##_bit)
+#else
 #define tree_read_bitval(tree, addr, f_member)                                 \
   ({                                                                           \
     tree_idx_t idx = tree_idx(addr);                                           \
-    tree_idx_t byte_idx = floor((float)idx / 8);                               \
-    tree_idx_t bit_idx = idx % 8;                                              \
-    uint8_t mask = 1 << bit_idx;                                               \
-    (tree.f_member[byte_idx] & mask) != 0;                                     \
+    (tree.f_member[idx >> 3] >> (idx & 7) & 1) != 0;                           \
+  })
+#endif
+
+/* tree_get_collision() for reading, which leaves shared chunks alone */
+#define tree_read_collision(tree, addr)                                        \
+  ({                                                                           \
+    tree_idx_t read_collision_idx = tree_idx(addr);                            \
+    assert(tree.capacity > read_collision_idx);                                \
+    (const tree_collision_t *)&tree.collisions[read_collision_idx];            \
+  })
+
+/* tree_get_node() for reading, which leaves shared chunks alone */
+#define tree_read_node(tree, addr)                                             \
+  ({                                                                           \
+    tree_addr_t read_node_addr = (addr);                                       \
+    const tree_node_t *read_node_retval = NULL;                                \
+    if (tree_is_valid_addr(read_node_addr)) {                                  \
+      tree_idx_t read_node_idx = tree_idx(read_node_addr);                     \
+      assert(tree.capacity > read_node_idx);                                   \
+      read_node_retval = &tree.nodes[read_node_idx];                           \
+    }                                                                          \
+    read_node_retval;                                                          \
+  })
+
+/* Compile-time error for mutating a frozen set; thaw it into a mutable one */
+#define tree_read_only(tree)                                                   \
+  ((void)sizeof(char[tree_backend(tree) != SET_BACKEND_FROZEN ? 1 : -1]), 0)
+
+#define tree_realloc(tree, ptr, size)                                          \
+  tree.allocator->realloc(tree.allocator->ctx, (ptr), (size))
+
+#define tree_remove(tree, entry, find_node_entry, clear_entry, entry_columns)  \
+  tree_remove_hashed(tree, tree.hash_fn(entry), entry, find_node_entry,        \
+                     clear_entry, entry_columns)
+
+/* Removes every entry with a hash in [lo, hi) by splitting off the range
+ * and joining the rest back together, in O(log n + k) for k removed
+ * entries. The last entry below lo is the pivot of the join. */
+#define tree_remove_hash_range(tree, lo, hi, alloc_new_node, clear_entry,      \
+                               entry_columns)                                  \
+  ({                                                                           \
+    tree_requires_backend(tree, SET_BACKEND_TREE);                             \
+    tree_requires_writable(tree);                                              \
+    uint64_t range_lo = (lo);                                                  \
+    uint64_t range_hi = (hi);                                                  \
+    size_t range_removed = 0;                                                  \
+    if (range_lo < range_hi) {                                                 \
+      tree_addr_t range_below;                                                 \
+      tree_addr_t range_rest;                                                  \
+      tree_addr_t range_pivot;                                                 \
+      size_t range_below_height;                                               \
+      tree_split_roots(tree, range_lo, range_below, &range_below_height,       \
+                       range_rest, NULL, range_pivot, true, alloc_new_node);   \
+      tree.root = range_rest;                                                  \
+      tree_addr_t range_removed_root;                                          \
+      tree_addr_t range_no_pivot;                                              \
+      tree_addr_t range_above;                                                 \
+      size_t range_above_height;                                               \
+      tree_split_roots(tree, range_hi, range_removed_root, NULL, range_above,  \
+                       &range_above_height, range_no_pivot, false,             \
+                       alloc_new_node);                                        \
+      range_removed =                                                          \
+          tree_free_subtree(tree, range_removed_root, clear_entry);            \
+      if (tree_is_valid_addr(range_pivot)) {                                   \
+        size_t range_height;                                                   \
+        tree.root = tree_join_at(tree, range_below, range_below_height,        \
+                                 range_pivot, range_above, range_above_height, \
+                                 range_height);                                \
+      } else {                                                                 \
+        tree_free_subtree(tree, range_below, clear_entry);                     \
+        tree.root = range_above;                                               \
+      }                                                                        \
+      tree.size -= range_removed;                                              \
+    }                                                                          \
+    range_removed;                                                             \
   })
 
-#define tree_remove(tree, entry, find_node_entry, clear_entry)                 \
+/* tree_remove with the hash of entry already at hand */
+#define tree_remove_hashed(tree, hash_value, entry, find_node_entry,           \
+                           clear_entry, entry_columns)                         \
   do {                                                                         \
-    uint64_t hash = tree.hash_fn(entry);                                       \
+    tree_requires_writable(tree);                                              \
+    uint64_t hash = (hash_value);                                              \
     start_trace(11, hash, trace_span("Removing entry %lld"), hash);            \
     tree_addr_t node_addr = find_node_entry(tree, hash, entry);                \
                                                                                \
@@ -806,6 +5776,7 @@ typedef struct {
       trace(trace_result("Setting fixup target to right child: %lld"),         \
             right->hash);                                                      \
       fixup_target_addr = node->right;                                         \
+      tree_count_propagate(tree, node->parent, -1);                            \
       start_trace(12, node_addr,                                               \
                   trace_span("Transplanting right child (node %lld) here"),    \
                   right->hash);                                                \
@@ -817,6 +5788,7 @@ typedef struct {
       trace(trace_result("Setting fixup target to left child: %lld"),          \
             left->hash);                                                       \
       fixup_target_addr = node->left;                                          \
+      tree_count_propagate(tree, node->parent, -1);                            \
       start_trace(13, node_addr,                                               \
                   trace_span("Transplanting left child (node %lld) here"),     \
                   left->hash);                                                 \
@@ -828,6 +5800,7 @@ typedef struct {
       color_sample_addr = tree_min_in_branch(tree, node->right);               \
       tree_node_t *color_sample = tree_get_node(tree, color_sample_addr);      \
       color_sample_is_red = tree_is_red(tree, color_sample_addr);              \
+      tree_count_propagate(tree, color_sample->parent, -1);                    \
       trace(trace_info("Found color sample as minimum of right child: %lld - " \
                        "color is %s"),                                         \
             color_sample->hash, color_sample_is_red ? "red" : "black");        \
@@ -872,6 +5845,7 @@ typedef struct {
             color_sample->hash, node->hash);                                   \
       color_sample->left = node->left;                                         \
       tree_get_node(tree, color_sample->left)->parent = color_sample_addr;     \
+      color_sample->count = node->count;                                       \
       trace(trace_result("Setting color of color sample (%lld) to %s"),        \
             color_sample->hash,                                                \
             tree_is_red(tree, node_addr) ? "red" : "black");                   \
@@ -902,12 +5876,45 @@ typedef struct {
                                                                                \
     trace(trace_result("Freeing node"));                                       \
     tree_free_node(tree, node_addr);                                           \
+    tree.size--;                                                               \
     trace(trace_result("Clearing entry"));                                     \
     clear_entry(tree, node_addr);                                              \
                                                                                \
     end_trace();                                                               \
   } while (0)
 
+/* Compile-time guard for operations that only one backend implements */
+#define tree_requires_backend(tree, backend_id)                                \
+  ((void)sizeof(char[tree_backend(tree) == (backend_id) ? 1 : -1]))
+
+/* Compile-time error for flat sets, which are not ordered by hash */
+#define tree_requires_ordered(tree)                                            \
+  ((void)sizeof(char[tree_backend(tree) != SET_BACKEND_FLAT ? 1 : -1]))
+
+/* Compile-time guard for operations that rely on maintained subtree counts */
+#define tree_requires_subtree_counts()                                         \
+  ((void)sizeof(char[SET_SUBTREE_COUNTS ? 1 : -1]))
+
+/* Snapshots are read-only, their chunks are even mapped that way */
+#define tree_requires_writable(tree) assert(!tree.snapshot)
+
+/* Grows tree in one step to room for n entries, counting a NIL leaf per
+ * entry unless SET_SHARED_NIL is set. Never shrinks, and stops the program
+ * past TREE_MAX_CAPACITY slots. */
+#define tree_reserve(tree, n, entry_columns)                                   \
+  do {                                                                         \
+    size_t reserve_n = (n);                                                    \
+    size_t reserve_slots =                                                     \
+        SET_SHARED_NIL ? reserve_n + 1 : 2 * reserve_n + 1;                    \
+    reserve_slots = (reserve_slots + 7) / 8 * 8;                               \
+    if (reserve_slots > TREE_MAX_CAPACITY) {                                   \
+      tree_capacity_exceeded();                                                \
+    }                                                                          \
+    if (reserve_slots > tree.capacity) {                                       \
+      tree_grow(tree, reserve_slots, entry_columns);                           \
+    }                                                                          \
+  } while (0)
+
 #define tree_rot(tree, node_addr, f_branch, f_direction)                       \
   do {                                                                         \
     tree_addr_t n_addr = (node_addr);                                          \
@@ -921,7 +5928,8 @@ typedef struct {
     trace(trace_result("Binding %s field to %s child of %s child"),            \
           align_branch, align_direction, align_branch);                        \
     rot_node->f_branch = f_branch->f_direction;                                \
-    if (tree_is_valid_addr(f_branch->f_direction)) {                           \
+    if (tree_is_valid_addr(f_branch->f_direction) &&                           \
+        !tree_is_shared_nil(f_branch->f_direction)) {                          \
       tree_get_node(tree, f_branch->f_direction)->parent = n_addr;             \
     }                                                                          \
                                                                                \
@@ -943,11 +5951,45 @@ typedef struct {
           align_direction, align_branch);                                      \
     f_branch->f_direction = n_addr;                                            \
     rot_node->parent = f_branch_addr;                                          \
+                                                                               \
+    f_branch->count = rot_node->count;                                         \
+    tree_count_update(tree, n_addr);                                           \
   } while (0)
 
 #define tree_rot_left(tree, node_addr) tree_rot(tree, node_addr, right, left)
 #define tree_rot_right(tree, node_addr) tree_rot(tree, node_addr, left, right)
 
+/* Writes the storage block of tree behind a tree_file_header_t. Entries are
+ * written as they are, so they must not hold pointers. Returns false if the
+ * file could not be written. */
+#define tree_save(tree, path, entry_columns)                                   \
+  tree_file_write((path), tree_file_header(tree, entry_columns), tree.nodes,   \
+                  NULL)
+
+/* Address of the k:th (0-based) entry in hash order, or 0 if k >= size */
+#define tree_select(tree, k)                                                   \
+  ({                                                                           \
+    tree_requires_backend(tree, SET_BACKEND_TREE);                             \
+    tree_requires_subtree_counts();                                            \
+    size_t select_k = (k);                                                     \
+    tree_addr_t select_cursor = tree.root;                                     \
+    tree_addr_t select_retval = 0;                                             \
+    while (tree_is_inited(tree, select_cursor)) {                              \
+      const tree_node_t *select_node = tree_read_node(tree, select_cursor);    \
+      size_t select_left = tree_count(tree, select_node->left);                \
+      if (select_k < select_left) {                                            \
+        select_cursor = select_node->left;                                     \
+      } else if (select_k == select_left) {                                    \
+        select_retval = select_cursor;                                         \
+        break;                                                                 \
+      } else {                                                                 \
+        select_k -= select_left + 1;                                           \
+        select_cursor = select_node->right;                                    \
+      }                                                                        \
+    }                                                                          \
+    select_retval;                                                             \
+  })
+
 #define tree_seq(tree, node_addr, f_branch, f_direction)                       \
   ({                                                                           \
     tree_addr_t addr =                                                         \
@@ -955,9 +5997,9 @@ typedef struct {
                                                                                \
     if (!tree_is_valid_addr(addr)) {                                           \
       tree_addr_t scan_addr = node_addr;                                       \
-      tree_addr_t next = tree_get_node(tree, node_addr)->parent;               \
+      tree_addr_t next = tree_read_node(tree, node_addr)->parent;              \
       while (tree_is_valid_addr(next)) {                                       \
-        tree_node_t *next_node = tree_get_node(tree, next);                    \
+        const tree_node_t *next_node = tree_read_node(tree, next);             \
         if (next_node->f_direction == scan_addr) {                             \
           addr = next;                                                         \
           break;                                                               \
@@ -978,7 +6020,7 @@ typedef struct {
   ({                                                                           \
     tree_addr_t idx = 0;                                                       \
     if (tree_is_inited(tree, node_addr) == 1) {                                \
-      tree_node_t *node = tree_get_node(tree, node_addr);                      \
+      const tree_node_t *node = tree_read_node(tree, node_addr);               \
                                                                                \
       if (tree_is_inited(tree, node->f_branch) == 1) {                         \
         idx = tree_ult_in_branch(tree, node->f_branch, f_direction);           \
@@ -987,17 +6029,270 @@ typedef struct {
     idx;                                                                       \
   })
 
-#define tree_size(tree)                                                        \
+/* Sets the growth policy of a fresh tree, tree_clone copies it instead */
+#define tree_set_default_growth(tree)                                          \
+  do {                                                                         \
+    tree.growth_percent = SET_GROWTH_PERCENT;                                  \
+    tree.growth_increment = SET_GROWTH_INCREMENT;                              \
+  } while (0)
+
+#define tree_size(tree) ((size_t)tree.size)
+
+/* Address of the node at position pos in hash order of a tree made by
+ * tree_build_sorted */
+#define tree_sorted_addr(pos) tree_addr((pos) + SET_SHARED_NIL)
+
+/* A read-only handle on the storage of tree. The first one moves the block
+ * into the chunks of a tree_cow_t, which copies it once; after that, taking
+ * one maps the chunks of tree in O(chunks), and each chunk is copied the
+ * first time tree writes to it while a snapshot still maps it. Falls back to
+ * a clone if the chunks cannot be mapped. */
+#define tree_snapshot(tree, entry_columns)                                     \
+  ({                                                                           \
+    if (tree.cow == NULL) {                                                    \
+      uint32_t *snapshot_map;                                                  \
+      char *snapshot_base;                                                     \
+      tree_cow_t *snapshot_cow = tree_cow_create(                              \
+          (const char *)tree.nodes,                                            \
+          tree_storage_size(tree, tree.capacity, entry_columns),               \
+          &snapshot_map, &snapshot_base);                                      \
+      if (snapshot_cow != NULL) {                                              \
+        typeof(tree) snapshot_old = tree;                                      \
+        tree_carve_storage(tree, snapshot_base, tree.capacity, entry_columns); \
+        tree_free(snapshot_old);                                               \
+        tree.mapped_bytes = 0;                                                 \
+        tree.cow = snapshot_cow;                                               \
+        tree.cow_chunks = snapshot_map;                                        \
+      }                                                                        \
+    }                                                                          \
+    typeof(tree) snapshot_view = tree;                                         \
+    char *snapshot_view_base = NULL;                                           \
+    if (tree.cow != NULL) {                                                    \
+      snapshot_view.cow_chunks =                                               \
+          tree_cow_pin(tree.cow, tree.cow_chunks, (char *)tree.nodes);         \
+      snapshot_view_base =                                                     \
+          tree_cow_map(tree.cow, snapshot_view.cow_chunks, PROT_READ);         \
+      if (snapshot_view_base == NULL) {                                        \
+        tree_cow_release(tree.cow, snapshot_view.cow_chunks, NULL);            \
+      }                                                                        \
+    }                                                                          \
+    if (snapshot_view_base != NULL) {                                          \
+      tree_carve_storage(snapshot_view, snapshot_view_base, tree.capacity,     \
+                         entry_columns);                                       \
+    } else {                                                                   \
+      snapshot_view = tree_clone(tree, entry_columns);                         \
+    }                                                                          \
+    snapshot_view.snapshot = true;                                             \
+    snapshot_view;                                                             \
+  })
+
+/* Splits tree into lower, with the entries whose hash is below pivot_hash,
+ * and upper, with the rest. The larger half keeps the storage of tree after
+ * tree_split_roots, and the smaller one is copied into a new storage, so this
+ * takes O(log n + k) for k entries in the smaller half. */
+#define tree_split(tree, pivot_hash, lower, upper, alloc_new_node, move_entry, \
+                   clear_entry, entry_columns)                                 \
+  do {                                                                         \
+    tree_requires_backend(tree, SET_BACKEND_TREE);                             \
+    tree_requires_subtree_counts();                                            \
+    tree_requires_writable(tree);                                              \
+    tree_addr_t split_left;                                                    \
+    tree_addr_t split_right;                                                   \
+    tree_addr_t split_pivot;                                                   \
+    tree_split_roots(tree, (pivot_hash), split_left, NULL, split_right, NULL,  \
+                     split_pivot, false, alloc_new_node);                      \
+    size_t split_left_size = tree_count(tree, split_left);                     \
+    bool split_copy_left = split_left_size <= tree.size - split_left_size;     \
+    tree_addr_t split_moved = split_copy_left ? split_left : split_right;      \
+                                                                               \
+    typeof(tree) split_copy;                                                   \
+    split_copy.allocator = tree.allocator;                                     \
+    tree_init(split_copy, tree.hash_fn, tree.equals_fn, entry_columns,         \
+              alloc_new_node);                                                 \
+    split_copy.growth_percent = tree.growth_percent;                           \
+    split_copy.growth_increment = tree.growth_increment;                       \
+    if (!SET_SHARED_NIL) {                                                     \
+      tree_free_node(split_copy, split_copy.root);                             \
+    }                                                                          \
+    split_copy.root = tree_copy_subtree(split_copy, tree, split_moved,         \
+                                        alloc_new_node, move_entry);           \
+    split_copy.size = tree_free_subtree(tree, split_moved, clear_entry);       \
+    tree.root = split_copy_left ? split_right : split_left;                    \
+    tree.size -= split_copy.size;                                              \
+                                                                               \
+    typeof(tree) split_kept = tree;                                            \
+    lower = split_copy_left ? split_copy : split_kept;                         \
+    upper = split_copy_left ? split_kept : split_copy;                         \
+  } while (0)
+
+/* Splits the tree at tree.root into standalone subtrees of the same storage:
+ * left_addr with the hashes below hash_value and right_addr with the rest.
+ * Their black heights go to left_height and right_height, each a size_t
+ * pointer that may be NULL if the caller has no use for it. The path down
+ * to hash_value is taken apart bottom up, and every node on it is joined
+ * with its subtree on the other side by tree_join_at. The heights of those
+ * joins add up to O(log n). If take_pivot is set, the last entry of the
+ * left subtree is left out of it and stored in pivot_addr, or 0 if the left
+ * subtree is empty. */
+#define tree_split_roots(tree, hash_value, left_addr, left_height, right_addr, \
+                         right_height, pivot_addr, take_pivot, alloc_new_node) \
+  do {                                                                         \
+    uint64_t split_hash = (hash_value);                                        \
+    size_t *split_left_out = (left_height);                                    \
+    size_t *split_right_out = (right_height);                                  \
+    /* Both halves need a leaf of their own at the bottom of the path */       \
+    tree_addr_t split_spare = tree_alloc_leaf(tree, 0, alloc_new_node);        \
+    tree_addr_t split_path[128];                                               \
+    size_t split_heights[128];                                                 \
+    size_t split_depth = 0;                                                    \
+    tree_addr_t split_cursor = tree.root;                                      \
+    size_t split_height = tree_black_height(tree, split_cursor);               \
+    while (tree_is_inited(tree, split_cursor)) {                               \
+      split_height -= !tree_is_red(tree, split_cursor);                        \
+      split_path[split_depth] = split_cursor;                                  \
+      split_heights[split_depth++] = split_height;                             \
+      const tree_node_t *split_node = tree_read_node(tree, split_cursor);      \
+      split_cursor = split_node->hash < split_hash ? split_node->right         \
+                                                   : split_node->left;         \
+    }                                                                          \
+                                                                               \
+    tree_addr_t split_lo = split_cursor;                                       \
+    tree_addr_t split_hi = split_spare;                                        \
+    size_t split_lo_height = 0;                                                \
+    size_t split_hi_height = 0;                                                \
+    pivot_addr = 0;                                                            \
+    while (split_depth > 0) {                                                  \
+      tree_addr_t split_addr = split_path[--split_depth];                      \
+      size_t split_child_height = split_heights[split_depth];                  \
+      const tree_node_t *split_node = tree_read_node(tree, split_addr);        \
+      if (split_node->hash >= split_hash) {                                    \
+        split_hi = tree_join_at(tree, split_hi, split_hi_height, split_addr,   \
+                                split_node->right, split_child_height,         \
+                                split_hi_height);                              \
+      } else if ((take_pivot) && !tree_is_valid_addr(pivot_addr)) {            \
+        /* Nothing below the last node under hash_value went left */           \
+        pivot_addr = split_addr;                                               \
+        if (!SET_SHARED_NIL) {                                                 \
+          tree_free_node(tree, split_lo);                                      \
+        }                                                                      \
+        split_lo = split_node->left;                                           \
+        split_lo_height = split_child_height;                                  \
+      } else {                                                                 \
+        split_lo = tree_join_at(tree, split_node->left, split_child_height,    \
+                                split_addr, split_lo, split_lo_height,         \
+                                split_lo_height);                              \
+      }                                                                        \
+    }                                                                          \
+    split_lo_height = tree_detach_root(tree, split_lo, split_lo_height);       \
+    split_hi_height = tree_detach_root(tree, split_hi, split_hi_height);       \
+    if (split_left_out != NULL) {                                              \
+      *split_left_out = split_lo_height;                                       \
+    }                                                                          \
+    if (split_right_out != NULL) {                                             \
+      *split_right_out = split_hi_height;                                      \
+    }                                                                          \
+    left_addr = split_lo;                                                      \
+    right_addr = split_hi;                                                     \
+  } while (0)
+
+/* Adds the size of a column of tree_alloc_storage to storage_bytes */
+#define tree_storage_bytes(tree, column)                                       \
+  storage_bytes += tree_column_bytes(sizeof(*tree.column) * storage_capacity)
+
+/* Points a column of tree at the next free part of the storage block of
+ * tree_alloc_storage */
+#define tree_storage_carve(tree, column)                                       \
+  do {                                                                         \
+    tree.column = (typeof(tree.column))(storage_base + storage_offset);        \
+    storage_offset +=                                                          \
+        tree_column_bytes(sizeof(*tree.column) * storage_capacity);            \
+  } while (0)
+
+/* Size of the storage block of a tree of this type with n_slots slots */
+#define tree_storage_size(tree, n_slots, entry_columns)                        \
+  ({                                                                           \
+    size_t storage_capacity = (n_slots);                                       \
+    size_t storage_bytes = 2 * tree_column_bytes(storage_capacity / 8);        \
+    tree_storage_bytes(tree, nodes);                                           \
+    tree_storage_bytes(tree, collisions);                                      \
+    tree_storage_bytes(tree, free_list);                                       \
+    entry_columns(tree, tree_storage_bytes);                                   \
+    storage_bytes;                                                             \
+  })
+
+/* Rebuilds a mutable tree from a frozen set, whose entries are already
+ * distinct and sorted by hash */
+#define tree_thaw(tree, frozen, get_entry, move_entry, entry_columns)          \
+  do {                                                                         \
+    size_t thaw_n = frozen.size;                                               \
+    tree_hash_pair_t *thaw_pairs =                                             \
+        malloc(sizeof(tree_hash_pair_t) * (thaw_n + 1));                       \
+    for (size_t thaw_i = 0; thaw_i < thaw_n; thaw_i++) {                       \
+      thaw_pairs[thaw_i].hash =                                                \
+          frozen.hash_fn(get_entry(frozen, tree_addr(thaw_i)));                \
+      thaw_pairs[thaw_i].addr = tree_addr(thaw_i);                             \
+    }                                                                          \
+    tree.allocator = frozen.allocator;                                         \
+    tree.hash_fn = frozen.hash_fn;                                             \
+    tree.equals_fn = frozen.equals_fn;                                         \
+    tree_build_sorted(tree, thaw_pairs, thaw_n, entry_columns);                \
+    for (size_t thaw_i = 0; thaw_i < thaw_n; thaw_i++) {                       \
+      move_entry(tree, tree_sorted_addr(thaw_i), frozen, tree_addr(thaw_i));   \
+    }                                                                          \
+    free(thaw_pairs);                                                          \
+  } while (0)
+
+/* In-order walk with an explicit stack, so that no step climbs back up
+ * through parent pointers. A red-black tree of at most TREE_SIZE_LIMIT
+ * entries is at most 64 levels deep. copy_out(tree, addr, pos, ...) writes
+ * the entry at addr to position pos of the output arrays. */
+#define tree_to_array(tree, copy_out, ...)                                     \
   ({                                                                           \
-    tree_addr_t cursor = tree_first(tree);                                     \
-    size_t size = 0;                                                           \
-    while (tree_is_valid_addr(cursor) && tree_is_inited(tree, cursor)) {       \
-      size++;                                                                  \
-      cursor = tree_next(tree, cursor);                                        \
+    tree_addr_t to_array_stack[64];                                            \
+    size_t to_array_top = 0;                                                   \
+    size_t to_array_n = 0;                                                     \
+    tree_addr_t to_array_cursor = tree.root;                                   \
+    while (true) {                                                             \
+      while (tree_is_valid_addr(to_array_cursor) &&                            \
+             tree_is_inited(tree, to_array_cursor)) {                          \
+        to_array_stack[to_array_top++] = to_array_cursor;                      \
+        to_array_cursor = tree_read_node(tree, to_array_cursor)->left;         \
+      }                                                                        \
+      if (to_array_top == 0) {                                                 \
+        break;                                                                 \
+      }                                                                        \
+      to_array_cursor = to_array_stack[--to_array_top];                        \
+      copy_out(tree, to_array_cursor, to_array_n, __VA_ARGS__);                \
+      to_array_n++;                                                            \
+      to_array_cursor = tree_read_node(tree, to_array_cursor)->right;          \
+    }                                                                          \
+    to_array_n;                                                                \
+  })
+
+/* tree_to_array for backends that already iterate without climbing */
+#define tree_to_array_seq(tree, first, next, copy_out, ...)                    \
+  ({                                                                           \
+    size_t to_array_n = 0;                                                     \
+    for (tree_addr_t to_array_addr = first(tree);                              \
+         tree_is_valid_addr(to_array_addr);                                    \
+         to_array_addr = next(tree, to_array_addr)) {                          \
+      copy_out(tree, to_array_addr, to_array_n, __VA_ARGS__);                  \
+      to_array_n++;                                                            \
     }                                                                          \
-    size;                                                                      \
+    to_array_n;                                                                \
   })
 
+/* Copy on write: gives tree the chunks under bytes at ptr of its storage
+ * before they change, copying those a snapshot still maps */
+#define tree_touch(tree, ptr, bytes)                                           \
+  tree_dispatch(                                                               \
+      tree,                                                                    \
+      if (tree.cow != NULL && !tree.snapshot) {                                \
+        tree_cow_touch(tree.cow, tree.cow_chunks, (char *)tree.nodes, (ptr),   \
+                       (bytes));                                               \
+      },                                                                       \
+      (void)0, (void)0, (void)0)
+
 #define tree_transplant(tree, dest_addr, src_addr)                             \
   do {                                                                         \
     tree_node_t *dest = tree_get_node(tree, dest_addr);                        \
@@ -1022,8 +6317,15 @@ typedef struct {
   tree_addr_t free_list_start;                                                 \
   tree_addr_t root;                                                            \
   size_t capacity;                                                             \
+  size_t size;                                                                 \
   uint8_t *colors;                                                             \
-  uint8_t *inited;
+  uint8_t *inited;                                                             \
+  size_t growth_increment;                                                     \
+  size_t mapped_bytes;                                                         \
+  tree_cow_t *cow;                                                             \
+  uint32_t *cow_chunks;                                                        \
+  uint32_t growth_percent;                                                     \
+  bool snapshot;
 
 #define tree_ult(tree, f_direction)                                            \
   ({                                                                           \
@@ -1031,7 +6333,7 @@ typedef struct {
     tree_addr_t retval = 0;                                                    \
     while (tree_is_valid_addr(cursor) && tree_is_inited(tree, cursor)) {       \
       retval = cursor;                                                         \
-      cursor = tree_get_node(tree, cursor)->f_direction;                       \
+      cursor = tree_read_node(tree, cursor)->f_direction;                      \
     }                                                                          \
     retval;                                                                    \
   })
@@ -1039,9 +6341,9 @@ typedef struct {
 #define tree_ult_in_branch(tree, node_addr, f_direction)                       \
   ({                                                                           \
     tree_addr_t idx = (node_addr);                                             \
-    tree_node_t *node;                                                         \
+    const tree_node_t *node;                                                   \
     while (true) {                                                             \
-      node = tree_get_node(tree, idx);                                         \
+      node = tree_read_node(tree, idx);                                        \
       if (!tree_is_inited(tree, node->f_direction)) {                          \
         break;                                                                 \
       }                                                                        \
@@ -1050,17 +6352,37 @@ typedef struct {
     idx;                                                                       \
   })
 
+/* Next inited node after addr in storage order, or 0. Pass 0 to start. */
+#define tree_unordered_next(tree, addr)                                        \
+  ({                                                                           \
+    size_t unordered_idx =                                                     \
+        tree_bitmap_next(tree.inited, tree.capacity / 8, (addr));              \
+    unordered_idx < tree.capacity ? tree_addr(unordered_idx) : 0;              \
+  })
+
+
+/* The lower bound of the next hash, since hashes are integers */
+#define tree_upper_bound(tree, hash_value, lower_bound)                        \
+  ({                                                                           \
+    uint64_t upper_bound_hash = (hash_value);                                  \
+    upper_bound_hash == UINT64_MAX ? 0                                         \
+                                   : lower_bound(tree, upper_bound_hash + 1);  \
+  })
+
+/* The bitmaps are written even with SET_NODE_FLAGS, since storage order scans
+ * read them rather than the nodes */
 #define tree_write_bitval(tree, addr, f_member, val)                           \
   do {                                                                         \
     tree_idx_t idx = tree_idx(addr);                                           \
-    tree_idx_t byte_idx = floor((float)idx / 8);                               \
-    tree_idx_t bit_idx = idx % 8;                                              \
-    uint8_t mask = 1 << bit_idx;                                               \
-    if (val == 1) {                                                            \
-      tree.f_member[byte_idx] |= mask;                                         \
+    uint8_t mask = 1 << (idx & 7);                                             \
+    bool bitval = (val) == 1;                                                  \
+    tree_touch(tree, &tree.f_member[idx >> 3], 1);                             \
+    if (bitval) {                                                              \
+      tree.f_member[idx >> 3] |= mask;                                         \
     } else {                                                                   \
-      tree.f_member[byte_idx] &= ~mask;                                        \
+      tree.f_member[idx >> 3] &= ~mask;                                        \
     }                                                                          \
+    tree_write_node_bit(tree, idx, f_member, bitval);                          \
   } while (0)
 
 #define tree_write_color(tree, addr, val)                                      \
@@ -1069,4 +6391,14 @@ typedef struct {
 #define tree_write_inited(tree, addr, val)                                     \
   tree_write_bitval(tree, addr, inited, val)
 
+#if SET_NODE_FLAGS
+#define tree_write_node_bit(tree, idx, f_member, bitval)                       \
+  do {                                                                         \
+    tree_touch(tree, &tree.nodes[idx], sizeof(tree_node_t));                   \
+    tree.nodes[idx].f_member##_bit = (bitval);                                 \
+  } while (0)
+#else
+#define tree_write_node_bit(tree, idx, f_member, bitval) ((void)0)
+#endif
+
 #endif // !GENERIC_SET_H
@@ -0,0 +1,191 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "set.h"
+#include "setalloc.h"
+
+/* Every arena block is preceded by its size, so that realloc knows how much
+ * to copy */
+#define ARENA_HEADER sizeof(max_align_t)
+
+static size_t arena_align_up(size_t value, size_t align) {
+  return (value + align - 1) / align * align;
+}
+
+static set_arena_chunk_t *arena_new_chunk(set_arena_t *arena, size_t need) {
+  size_t size = arena->chunk_size > need ? arena->chunk_size : need;
+  set_arena_chunk_t *chunk = malloc(sizeof(set_arena_chunk_t) + size);
+  chunk->next = arena->chunks;
+  chunk->size = size;
+  chunk->used = 0;
+  arena->chunks = chunk;
+  return chunk;
+}
+
+static void *arena_alloc(void *ctx, size_t size, size_t align) {
+  set_arena_t *arena = ctx;
+  if (align < ARENA_HEADER) {
+    align = ARENA_HEADER;
+  }
+  set_arena_chunk_t *chunk = arena->chunks;
+  unsigned char *base = NULL;
+  size_t offset = 0;
+  if (chunk != NULL) {
+    base = (unsigned char *)chunk->data;
+    offset = arena_align_up((uintptr_t)(base + chunk->used + ARENA_HEADER),
+                            align) -
+             (uintptr_t)base;
+  }
+  if (chunk == NULL || offset + size > chunk->size) {
+    chunk = arena_new_chunk(arena, size + ARENA_HEADER + align);
+    base = (unsigned char *)chunk->data;
+    offset = arena_align_up((uintptr_t)(base + ARENA_HEADER), align) -
+             (uintptr_t)base;
+  }
+  memcpy(base + offset - ARENA_HEADER, &size, sizeof(size));
+  chunk->used = offset + size;
+  arena->last_block = base + offset;
+  arena->bytes_in_use += size;
+  return base + offset;
+}
+
+static void *arena_realloc(void *ctx, void *ptr, size_t size) {
+  set_arena_t *arena = ctx;
+  if (ptr == NULL) {
+    return arena_alloc(ctx, size, 0);
+  }
+  size_t old_size;
+  memcpy(&old_size, (unsigned char *)ptr - ARENA_HEADER, sizeof(old_size));
+  set_arena_chunk_t *chunk = arena->chunks;
+  size_t offset = (unsigned char *)ptr - (unsigned char *)chunk->data;
+  if (ptr == arena->last_block && offset + size <= chunk->size) {
+    memcpy((unsigned char *)ptr - ARENA_HEADER, &size, sizeof(size));
+    chunk->used = offset + size;
+    arena->bytes_in_use += size - old_size;
+    return ptr;
+  }
+  void *grown = arena_alloc(ctx, size, 0);
+  memcpy(grown, ptr, old_size < size ? old_size : size);
+  arena->bytes_in_use -= old_size;
+  return grown;
+}
+
+static void arena_free(void *ctx, void *ptr) {
+  set_arena_t *arena = ctx;
+  if (ptr != NULL) {
+    size_t size;
+    memcpy(&size, (unsigned char *)ptr - ARENA_HEADER, sizeof(size));
+    arena->bytes_in_use -= size;
+  }
+}
+
+void set_arena_init(set_arena_t *arena, size_t chunk_size) {
+  *arena = (set_arena_t){
+      .allocator =
+          {
+              .alloc = arena_alloc,
+              .realloc = arena_realloc,
+              .free = arena_free,
+              .ctx = arena,
+          },
+      .chunk_size = chunk_size,
+  };
+}
+
+/* Keeps the newest chunk for reuse and frees the others */
+void set_arena_reset(set_arena_t *arena) {
+  set_arena_chunk_t *chunk = arena->chunks;
+  if (chunk == NULL) {
+    return;
+  }
+  set_arena_chunk_t *older = chunk->next;
+  while (older != NULL) {
+    set_arena_chunk_t *next = older->next;
+    free(older);
+    older = next;
+  }
+  chunk->next = NULL;
+  chunk->used = 0;
+  arena->last_block = NULL;
+  arena->bytes_in_use = 0;
+}
+
+void set_arena_free(set_arena_t *arena) {
+  set_arena_reset(arena);
+  free(arena->chunks);
+  arena->chunks = NULL;
+}
+
+static bool pool_owns(set_pool_t *pool, void *ptr) {
+  unsigned char *bytes = ptr;
+  return bytes >= pool->blocks &&
+         bytes < pool->blocks + pool->block_size * pool->block_count;
+}
+
+static void *pool_alloc(void *ctx, size_t size, size_t align) {
+  set_pool_t *pool = ctx;
+  if (size > pool->block_size || align > 64 || pool->free_blocks == NULL) {
+    return align == 0 ? malloc(size)
+                      : aligned_alloc(align, arena_align_up(size, align));
+  }
+  void *block = pool->free_blocks;
+  memcpy(&pool->free_blocks, block, sizeof(void *));
+  pool->blocks_in_use++;
+  return block;
+}
+
+static void pool_free(void *ctx, void *ptr) {
+  set_pool_t *pool = ctx;
+  if (!pool_owns(pool, ptr)) {
+    free(ptr);
+    return;
+  }
+  memcpy(ptr, &pool->free_blocks, sizeof(void *));
+  pool->free_blocks = ptr;
+  pool->blocks_in_use--;
+}
+
+static void *pool_realloc(void *ctx, void *ptr, size_t size) {
+  set_pool_t *pool = ctx;
+  if (ptr == NULL) {
+    return pool_alloc(ctx, size, 0);
+  }
+  if (!pool_owns(pool, ptr)) {
+    return realloc(ptr, size);
+  }
+  if (size <= pool->block_size) {
+    return ptr;
+  }
+  void *grown = malloc(size);
+  memcpy(grown, ptr, pool->block_size);
+  pool_free(ctx, ptr);
+  return grown;
+}
+
+void set_pool_init(set_pool_t *pool, size_t block_size, size_t block_count) {
+  block_size = arena_align_up(block_size < 64 ? 64 : block_size, 64);
+  *pool = (set_pool_t){
+      .allocator =
+          {
+              .alloc = pool_alloc,
+              .realloc = pool_realloc,
+              .free = pool_free,
+              .ctx = pool,
+          },
+      .blocks = aligned_alloc(64, block_size * block_count),
+      .block_size = block_size,
+      .block_count = block_count,
+  };
+  for (size_t i = block_count; i > 0; i--) {
+    void *block = pool->blocks + (i - 1) * block_size;
+    memcpy(block, &pool->free_blocks, sizeof(void *));
+    pool->free_blocks = block;
+  }
+}
+
+void set_pool_free(set_pool_t *pool) {
+  free(pool->blocks);
+  pool->blocks = NULL;
+  pool->free_blocks = NULL;
+}
@@ -0,0 +1,47 @@
+#ifndef SET_ALLOC_H
+#define SET_ALLOC_H
+
+#include <stddef.h>
+
+#include "set.h"
+
+/* Bump allocator over a list of chunks. Frees are no-ops and everything is
+ * given back at once by set_arena_reset() or set_arena_free(), which suits
+ * sets that live as long as a request. A realloc of the last block handed out
+ * grows it in place when its chunk has room; any other one copies it, leaving
+ * the old block unused until the reset. */
+typedef struct set_arena_chunk {
+  struct set_arena_chunk *next;
+  size_t size;
+  size_t used;
+  max_align_t data[];
+} set_arena_chunk_t;
+
+typedef struct {
+  set_allocator_t allocator;
+  set_arena_chunk_t *chunks;
+  size_t chunk_size;
+  void *last_block;
+  size_t bytes_in_use;
+} set_arena_t;
+
+/* Pool of block_count blocks of block_size bytes (rounded up to a multiple
+ * of 64 and aligned to 64) carved out of one buffer. Requests that fit in a
+ * block take one from the free list, larger ones and any made while the pool
+ * is empty go to malloc(). Sets with a fixed small capacity, created and
+ * dropped often, are then served without calling into libc. */
+typedef struct {
+  set_allocator_t allocator;
+  unsigned char *blocks;
+  void *free_blocks;
+  size_t block_size;
+  size_t block_count;
+  size_t blocks_in_use;
+} set_pool_t;
+
+void set_arena_init(set_arena_t *arena, size_t chunk_size);
+void set_arena_reset(set_arena_t *arena);
+void set_arena_free(set_arena_t *arena);
+void set_pool_init(set_pool_t *pool, size_t block_size, size_t block_count);
+void set_pool_free(set_pool_t *pool);
+#endif // !SET_ALLOC_H
@@ -212,3 +212,31 @@ size_t debug_node_blackheight(tree_node_t *nodes, uint8_t *colors,
 
   return counter;
 }
+
+static void *debug_counting_alloc(void *ctx, size_t size, size_t align) {
+  debug_counting_allocator_t *counter = ctx;
+  counter->calls++;
+  counter->live_blocks++;
+  return align == 0 ? malloc(size)
+                    : aligned_alloc(align, (size + align - 1) / align * align);
+}
+
+static void *debug_counting_realloc(void *ctx, void *ptr, size_t size) {
+  debug_counting_allocator_t *counter = ctx;
+  counter->calls++;
+  counter->live_blocks += ptr == NULL;
+  return realloc(ptr, size);
+}
+
+static void debug_counting_free(void *ctx, void *ptr) {
+  debug_counting_allocator_t *counter = ctx;
+  counter->live_blocks -= ptr != NULL;
+  free(ptr);
+}
+
+void debug_counting_allocator_init(debug_counting_allocator_t *counter) {
+  *counter = (debug_counting_allocator_t){
+      .allocator = {debug_counting_alloc, debug_counting_realloc,
+                    debug_counting_free, counter},
+  };
+}
@@ -25,4 +25,14 @@ size_t debug_node_blackheight(tree_node_t *nodes, uint8_t *colors,
                               uint8_t *inited, tree_addr_t start_node,
                               bool is_start, bool assert_uniform_height);
 char *debug_draw_alloc_canvas(size_t canvas_width, size_t canvas_height);
+
+// An allocator on top of malloc() that counts the calls to alloc and realloc
+// and the blocks handed out and not yet freed
+typedef struct {
+  set_allocator_t allocator;
+  size_t calls;
+  size_t live_blocks;
+} debug_counting_allocator_t;
+
+void debug_counting_allocator_init(debug_counting_allocator_t *counter);
 #endif // !SET_DEBUG_H
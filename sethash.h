@@ -0,0 +1,134 @@
+#ifndef SET_HASH_H
+#define SET_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rapidhash/rapidhash.h"
+#include "set.h"
+
+/* Seed of the hash functions below that take no seed. Define it to an
+ * expression, such as a global set once at startup, to seed them at run
+ * time; it must not change while a set hashed with it is alive. */
+#ifndef SET_HASH_SEED
+#define SET_HASH_SEED 0x2d358dccaa6c78a5ull
+#endif // !SET_HASH_SEED
+
+/* Integers go through rapid_mix(), the 128-bit multiply of rapidhash whose
+ * halves are xored, with the seed and a secret folded into one side. A lane
+ * of that fits in a few 32-bit multiplies, so the _many() forms do four at a
+ * time with AVX2, unless RAPIDHASH_PROTECTED changes what rapid_mix() does. */
+#if defined(__AVX2__) && !defined(RAPIDHASH_PROTECTED)
+#define SET_HASH_MIX4
+#endif
+#define SET_HASH_SECRET_A 0x8bb84b93962eacc9ull
+#define SET_HASH_SECRET_B 0x4b33a62ed433d4a3ull
+
+static inline uint64_t set_hash_u64_seeded(uint64_t value, uint64_t seed) {
+  return rapid_mix(value ^ seed ^ SET_HASH_SECRET_A, SET_HASH_SECRET_B);
+}
+
+static inline uint64_t set_hash_u32_seeded(uint32_t value, uint64_t seed) {
+  return set_hash_u64_seeded(value, seed);
+}
+
+static inline uint64_t set_hash_bytes_seeded(const void *bytes, size_t len,
+                                             uint64_t seed) {
+  return rapidhash_withSeed(bytes, len, seed);
+}
+
+/* Hash functions to pass to set_init() and friends */
+static inline uint64_t set_hash_u32(uint32_t value) {
+  return set_hash_u32_seeded(value, SET_HASH_SEED);
+}
+
+static inline uint64_t set_hash_u64(uint64_t value) {
+  return set_hash_u64_seeded(value, SET_HASH_SEED);
+}
+
+static inline uint64_t set_hash_string(const char *value) {
+  return set_hash_bytes_seeded(value, strlen(value), SET_HASH_SEED);
+}
+
+/* For set_type_bytes() and map_type_bytes() */
+static inline uint64_t set_hash_bytes(set_bytes_t key) {
+  return set_hash_bytes_seeded(key.bytes, key.len, SET_HASH_SEED);
+}
+
+#ifdef SET_HASH_MIX4
+/* set_hash_u64_seeded() of the four lanes of values. AVX2 only multiplies
+ * 32-bit halves, so the 128-bit product is put together from four of them;
+ * mid collects the terms that straddle bit 64 along with their carries. */
+static inline __m256i set_hash_mix4(__m256i values, __m256i seed) {
+  const __m256i low_mask = _mm256_set1_epi64x(0xffffffffll);
+  const __m256i secret_a = _mm256_set1_epi64x((long long)SET_HASH_SECRET_A);
+  const __m256i secret_b = _mm256_set1_epi64x((long long)SET_HASH_SECRET_B);
+  const __m256i secret_b_hi = _mm256_srli_epi64(secret_b, 32);
+  __m256i a = _mm256_xor_si256(_mm256_xor_si256(values, seed), secret_a);
+  __m256i a_hi = _mm256_srli_epi64(a, 32);
+
+  __m256i lo_lo = _mm256_mul_epu32(a, secret_b);
+  __m256i lo_hi = _mm256_mul_epu32(a, secret_b_hi);
+  __m256i hi_lo = _mm256_mul_epu32(a_hi, secret_b);
+  __m256i hi_hi = _mm256_mul_epu32(a_hi, secret_b_hi);
+
+  __m256i mid = _mm256_add_epi64(
+      _mm256_add_epi64(_mm256_srli_epi64(lo_lo, 32),
+                       _mm256_and_si256(lo_hi, low_mask)),
+      _mm256_and_si256(hi_lo, low_mask));
+  __m256i low = _mm256_or_si256(_mm256_and_si256(lo_lo, low_mask),
+                                _mm256_slli_epi64(mid, 32));
+  __m256i high = _mm256_add_epi64(
+      _mm256_add_epi64(hi_hi, _mm256_srli_epi64(mid, 32)),
+      _mm256_add_epi64(_mm256_srli_epi64(lo_hi, 32),
+                       _mm256_srli_epi64(hi_lo, 32)));
+  return _mm256_xor_si256(low, high);
+}
+#endif
+
+/* Writes the hashes of n values to out, equal to what set_hash_u64_seeded()
+ * returns for each. Pass SET_HASH_SEED to get those of set_hash_u64(), for
+ * set_add_hashed() and friends. */
+static inline void set_hash_u64_many(const uint64_t *values, size_t n,
+                                     uint64_t seed, uint64_t *out) {
+  size_t i = 0;
+#ifdef SET_HASH_MIX4
+  const __m256i seed4 = _mm256_set1_epi64x((long long)seed);
+  for (; i < n / 4 * 4; i += 4) {
+    __m256i hashes = set_hash_mix4(
+        _mm256_loadu_si256((const __m256i *)&values[i]), seed4);
+    _mm256_storeu_si256((__m256i *)&out[i], hashes);
+  }
+#endif
+  for (; i < n; i++) {
+    out[i] = set_hash_u64_seeded(values[i], seed);
+  }
+}
+
+/* set_hash_u64_many() for 32-bit values, widened four at a time */
+static inline void set_hash_u32_many(const uint32_t *values, size_t n,
+                                     uint64_t seed, uint64_t *out) {
+  size_t i = 0;
+#ifdef SET_HASH_MIX4
+  const __m256i seed4 = _mm256_set1_epi64x((long long)seed);
+  for (; i < n / 4 * 4; i += 4) {
+    __m256i hashes = set_hash_mix4(
+        _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i *)&values[i])),
+        seed4);
+    _mm256_storeu_si256((__m256i *)&out[i], hashes);
+  }
+#endif
+  for (; i < n; i++) {
+    out[i] = set_hash_u32_seeded(values[i], seed);
+  }
+}
+
+/* Hashes of n NUL-terminated strings, as set_hash_string() with seed */
+static inline void set_hash_string_many(const char *const *values, size_t n,
+                                        uint64_t seed, uint64_t *out) {
+  for (size_t i = 0; i < n; i++) {
+    out[i] = set_hash_bytes_seeded(values[i], strlen(values[i]), seed);
+  }
+}
+#endif // !SET_HASH_H
@@ -0,0 +1,89 @@
+/* AUTOGENERATED FILE. DO NOT EDIT. */
+
+/*=======Automagically Detected Files To Include=====*/
+#include "unity.h"
+#include "set.h"
+#include "setdebug.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/*=======External Functions This Runner Calls=====*/
+extern void setUp(void);
+extern void tearDown(void);
+extern void test_keys_are_copied(void);
+extern void test_binary_keys_and_collisions(void);
+extern void test_arena_reclaimed(void);
+extern void test_snapshot_keeps_keys(void);
+extern void test_map_snapshot_keeps_keys(void);
+extern void test_bytes_map(void);
+
+
+/*=======Mock Management=====*/
+static void CMock_Init(void)
+{
+}
+static void CMock_Verify(void)
+{
+}
+static void CMock_Destroy(void)
+{
+}
+
+/*=======Test Reset Options=====*/
+void resetTest(void);
+void resetTest(void)
+{
+  tearDown();
+  CMock_Verify();
+  CMock_Destroy();
+  CMock_Init();
+  setUp();
+}
+void verifyTest(void);
+void verifyTest(void)
+{
+  CMock_Verify();
+}
+
+/*=======Test Runner Used To Run Each Test=====*/
+static void run_test(UnityTestFunction func, const char* name, UNITY_LINE_TYPE line_num)
+{
+    Unity.CurrentTestName = name;
+    Unity.CurrentTestLineNumber = (UNITY_UINT) line_num;
+#ifdef UNITY_USE_COMMAND_LINE_ARGS
+    if (!UnityTestMatches())
+        return;
+#endif
+    Unity.NumberOfTests++;
+    UNITY_CLR_DETAILS();
+    UNITY_EXEC_TIME_START();
+    CMock_Init();
+    if (TEST_PROTECT())
+    {
+        setUp();
+        func();
+    }
+    if (TEST_PROTECT())
+    {
+        tearDown();
+        CMock_Verify();
+    }
+    CMock_Destroy();
+    UNITY_EXEC_TIME_STOP();
+    UnityConcludeTest();
+}
+
+/*=======MAIN=====*/
+int main(void)
+{
+  UnityBegin("tests/bytes_set.c");
+  run_test(test_keys_are_copied, "test_keys_are_copied", 24);
+  run_test(test_binary_keys_and_collisions, "test_binary_keys_and_collisions", 54);
+  run_test(test_arena_reclaimed, "test_arena_reclaimed", 79);
+  run_test(test_snapshot_keeps_keys, "test_snapshot_keeps_keys", 122);
+  run_test(test_map_snapshot_keeps_keys, "test_map_snapshot_keeps_keys", 157);
+  run_test(test_bytes_map, "test_bytes_map", 173);
+
+  return UNITY_END();
+}
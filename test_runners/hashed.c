@@ -0,0 +1,89 @@
+/* AUTOGENERATED FILE. DO NOT EDIT. */
+
+/*=======Automagically Detected Files To Include=====*/
+#include "unity.h"
+#include "set.h"
+#include "sethash.h"
+#include "setdebug.h"
+#include <stdint.h>
+#include <string.h>
+
+/*=======External Functions This Runner Calls=====*/
+extern void setUp(void);
+extern void tearDown(void);
+extern void test_hashed_tree_set(void);
+extern void test_hashed_flat_set(void);
+extern void test_hashed_btree_set(void);
+extern void test_hashed_map(void);
+extern void test_many_matches_scalar(void);
+extern void test_builtin_hashers(void);
+
+
+/*=======Mock Management=====*/
+static void CMock_Init(void)
+{
+}
+static void CMock_Verify(void)
+{
+}
+static void CMock_Destroy(void)
+{
+}
+
+/*=======Test Reset Options=====*/
+void resetTest(void);
+void resetTest(void)
+{
+  tearDown();
+  CMock_Verify();
+  CMock_Destroy();
+  CMock_Init();
+  setUp();
+}
+void verifyTest(void);
+void verifyTest(void)
+{
+  CMock_Verify();
+}
+
+/*=======Test Runner Used To Run Each Test=====*/
+static void run_test(UnityTestFunction func, const char* name, UNITY_LINE_TYPE line_num)
+{
+    Unity.CurrentTestName = name;
+    Unity.CurrentTestLineNumber = (UNITY_UINT) line_num;
+#ifdef UNITY_USE_COMMAND_LINE_ARGS
+    if (!UnityTestMatches())
+        return;
+#endif
+    Unity.NumberOfTests++;
+    UNITY_CLR_DETAILS();
+    UNITY_EXEC_TIME_START();
+    CMock_Init();
+    if (TEST_PROTECT())
+    {
+        setUp();
+        func();
+    }
+    if (TEST_PROTECT())
+    {
+        tearDown();
+        CMock_Verify();
+    }
+    CMock_Destroy();
+    UNITY_EXEC_TIME_STOP();
+    UnityConcludeTest();
+}
+
+/*=======MAIN=====*/
+int main(void)
+{
+  UnityBegin("tests/hashed.c");
+  run_test(test_hashed_tree_set, "test_hashed_tree_set", 52);
+  run_test(test_hashed_flat_set, "test_hashed_flat_set", 53);
+  run_test(test_hashed_btree_set, "test_hashed_btree_set", 54);
+  run_test(test_hashed_map, "test_hashed_map", 56);
+  run_test(test_many_matches_scalar, "test_many_matches_scalar", 80);
+  run_test(test_builtin_hashers, "test_builtin_hashers", 109);
+
+  return UNITY_END();
+}
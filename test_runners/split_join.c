@@ -0,0 +1,93 @@
+/* AUTOGENERATED FILE. DO NOT EDIT. */
+
+/*=======Automagically Detected Files To Include=====*/
+#include "unity.h"
+#include "set.h"
+#include "setdebug.h"
+#include <stdint.h>
+
+/*=======External Functions This Runner Calls=====*/
+extern void setUp(void);
+extern void tearDown(void);
+extern void test_split(void);
+extern void test_split_at_the_ends(void);
+extern void test_split_keeps_equal_hashes_together(void);
+extern void test_join(void);
+extern void test_join_empty(void);
+extern void test_join_equal_hashes_at_the_seam(void);
+extern void test_remove_hash_range(void);
+extern void test_remove_hash_range_of_equal_hashes(void);
+extern void test_map_split_and_join(void);
+
+
+/*=======Mock Management=====*/
+static void CMock_Init(void)
+{
+}
+static void CMock_Verify(void)
+{
+}
+static void CMock_Destroy(void)
+{
+}
+
+/*=======Test Reset Options=====*/
+void resetTest(void);
+void resetTest(void)
+{
+  tearDown();
+  CMock_Verify();
+  CMock_Destroy();
+  CMock_Init();
+  setUp();
+}
+void verifyTest(void);
+void verifyTest(void)
+{
+  CMock_Verify();
+}
+
+/*=======Test Runner Used To Run Each Test=====*/
+static void run_test(UnityTestFunction func, const char* name, UNITY_LINE_TYPE line_num)
+{
+    Unity.CurrentTestName = name;
+    Unity.CurrentTestLineNumber = (UNITY_UINT) line_num;
+#ifdef UNITY_USE_COMMAND_LINE_ARGS
+    if (!UnityTestMatches())
+        return;
+#endif
+    Unity.NumberOfTests++;
+    UNITY_CLR_DETAILS();
+    UNITY_EXEC_TIME_START();
+    CMock_Init();
+    if (TEST_PROTECT())
+    {
+        setUp();
+        func();
+    }
+    if (TEST_PROTECT())
+    {
+        tearDown();
+        CMock_Verify();
+    }
+    CMock_Destroy();
+    UNITY_EXEC_TIME_STOP();
+    UnityConcludeTest();
+}
+
+/*=======MAIN=====*/
+int main(void)
+{
+  UnityBegin("tests/split_join.c");
+  run_test(test_split, "test_split", 57);
+  run_test(test_split_at_the_ends, "test_split_at_the_ends", 83);
+  run_test(test_split_keeps_equal_hashes_together, "test_split_keeps_equal_hashes_together", 106);
+  run_test(test_join, "test_join", 126);
+  run_test(test_join_empty, "test_join_empty", 151);
+  run_test(test_join_equal_hashes_at_the_seam, "test_join_equal_hashes_at_the_seam", 166);
+  run_test(test_remove_hash_range, "test_remove_hash_range", 189);
+  run_test(test_remove_hash_range_of_equal_hashes, "test_remove_hash_range_of_equal_hashes", 217);
+  run_test(test_map_split_and_join, "test_map_split_and_join", 234);
+
+  return UNITY_END();
+}
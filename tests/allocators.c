@@ -0,0 +1,129 @@
+#include <stdint.h>
+
+#include "set.h"
+#include "setalloc.h"
+#include "setdebug.h"
+#include "unity.h"
+
+uint64_t hash_fn(uint32_t value) { return value; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+typedef set_type_flat(uint32_t) flat_set_t;
+typedef set_type_btree(uint32_t) btree_set_t;
+typedef set_type_frozen(uint32_t) frozen_set_t;
+typedef map_type(uint32_t, uint32_t) map_t;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_every_buffer_is_returned(void) {
+  debug_counting_allocator_t counter;
+  debug_counting_allocator_init(&counter);
+
+  set_t a;
+  set_t b;
+  set_init_with_allocator(a, hash_fn, equals_fn, &counter.allocator);
+  set_init_with_allocator(b, hash_fn, equals_fn, &counter.allocator);
+  for (uint32_t i = 0; i < 5000; i++) {
+    set_add(a, i);
+    set_add(b, i * 2);
+  }
+  TEST_ASSERT_TRUE(counter.live_blocks > 0);
+
+  // Sets derived from a and b allocate from the same place
+  set_t result;
+  set_union(result, a, b);
+  TEST_ASSERT_EQUAL(7500, set_size(result));
+  set_t copy = set_clone(result);
+  set_compact(copy, SET_LAYOUT_VEB);
+  set_t lower;
+  set_t upper;
+  set_split(copy, 3000, lower, upper);
+  frozen_set_t frozen;
+  set_freeze(frozen, lower);
+  set_empty(upper);
+  set_add(upper, 1);
+
+  set_free(a);
+  set_free(b);
+  set_free(result);
+  set_free(lower);
+  set_free(upper);
+  set_free(frozen);
+  TEST_ASSERT_EQUAL(0, counter.live_blocks);
+}
+
+void test_arena(void) {
+  set_arena_t arena;
+  set_arena_init(&arena, 1 << 16);
+
+  set_t set;
+  flat_set_t flat;
+  btree_set_t btree;
+  map_t map;
+  set_init_with_allocator(set, hash_fn, equals_fn, &arena.allocator);
+  set_init_with_allocator(flat, hash_fn, equals_fn, &arena.allocator);
+  set_init_with_allocator(btree, hash_fn, equals_fn, &arena.allocator);
+  map_init_with_allocator(map, hash_fn, equals_fn, &arena.allocator);
+  for (uint32_t i = 0; i < 20000; i++) {
+    set_add(set, i);
+    set_add(flat, i);
+    set_add(btree, i);
+    map_add(map, i, i + 1);
+  }
+  for (uint32_t i = 0; i < 20000; i += 2) {
+    set_remove(set, i);
+  }
+  for (uint32_t i = 0; i < 20000; i++) {
+    TEST_ASSERT_EQUAL(i % 2 == 1, set_has(set, i));
+    TEST_ASSERT_TRUE(set_has(flat, i));
+    TEST_ASSERT_TRUE(set_has(btree, i));
+    TEST_ASSERT_EQUAL(i + 1, *map_get(map, i));
+  }
+  debug_node_blackheight(set.nodes, set.colors, set.inited, set.root, true,
+                         true);
+
+  set_free(set);
+  set_free(flat);
+  set_free(btree);
+  map_free(map);
+  TEST_ASSERT_EQUAL(0, arena.bytes_in_use);
+
+  // The arena is reusable after a reset
+  set_arena_reset(&arena);
+  set_init_with_allocator(set, hash_fn, equals_fn, &arena.allocator);
+  set_add(set, 42);
+  TEST_ASSERT_TRUE(set_has(set, 42));
+  set_arena_free(&arena);
+}
+
+void test_pool(void) {
+  set_pool_t pool;
+  set_pool_init(&pool, 32768, 64);
+
+  for (int round = 0; round < 100; round++) {
+    set_t set;
+    set_init_with_allocator(set, hash_fn, equals_fn, &pool.allocator);
+    for (uint32_t i = 0; i < 100; i++) {
+      set_add(set, i);
+    }
+    TEST_ASSERT_TRUE(pool.blocks_in_use > 0);
+    set_free(set);
+    TEST_ASSERT_EQUAL(0, pool.blocks_in_use);
+  }
+
+  // Outgrows the blocks and moves to malloc()
+  set_t set;
+  set_init_with_allocator(set, hash_fn, equals_fn, &pool.allocator);
+  for (uint32_t i = 0; i < 50000; i++) {
+    set_add(set, i);
+  }
+  for (uint32_t i = 0; i < 50000; i++) {
+    TEST_ASSERT_TRUE(set_has(set, i));
+  }
+  set_free(set);
+  TEST_ASSERT_EQUAL(0, pool.blocks_in_use);
+
+  set_pool_free(&pool);
+}
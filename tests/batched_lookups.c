@@ -0,0 +1,118 @@
+#include <stdint.h>
+
+#include "set.h"
+#include "unity.h"
+
+uint64_t hash_fn(uint32_t value) { return value; }
+uint64_t colliding_hash_fn(uint32_t value) { return value / 4; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+typedef set_type_flat(uint32_t) flat_set_t;
+typedef set_type_btree(uint32_t) btree_set_t;
+typedef set_type_frozen(uint32_t) frozen_set_t;
+typedef map_type(uint32_t, uint32_t) map_t;
+typedef map_type_flat(uint32_t, uint32_t) flat_map_t;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static uint32_t keys[1000];
+static bool found[1000];
+
+static void fill_keys(void) {
+  for (uint32_t i = 0; i < 1000; i++) {
+    keys[i] = (i * 7919) % 2000;
+  }
+}
+
+void test_tree_has_many(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 1000; i += 2) {
+    set_add(set, i);
+  }
+
+  fill_keys();
+  set_has_many(set, keys, 1000, found);
+  for (uint32_t i = 0; i < 1000; i++) {
+    TEST_ASSERT_EQUAL(set_has(set, keys[i]), found[i]);
+  }
+
+  set_free(set);
+}
+
+void test_tree_has_many_with_collisions(void) {
+  set_t set;
+  set_init(set, colliding_hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 1000; i += 3) {
+    set_add(set, i);
+  }
+
+  fill_keys();
+  set_has_many(set, keys, 1000, found);
+  for (uint32_t i = 0; i < 1000; i++) {
+    TEST_ASSERT_EQUAL(keys[i] < 1000 && keys[i] % 3 == 0, found[i]);
+  }
+
+  set_free(set);
+}
+
+void test_has_many_other_backends(void) {
+  flat_set_t flat;
+  btree_set_t btree;
+  set_init(flat, hash_fn, equals_fn);
+  set_init(btree, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 1000; i += 2) {
+    set_add(flat, i);
+    set_add(btree, i);
+  }
+  frozen_set_t frozen;
+  set_freeze(frozen, btree);
+
+  fill_keys();
+  set_has_many(flat, keys, 1000, found);
+  for (uint32_t i = 0; i < 1000; i++) {
+    TEST_ASSERT_EQUAL(keys[i] < 1000 && keys[i] % 2 == 0, found[i]);
+  }
+  set_has_many(btree, keys, 1000, found);
+  for (uint32_t i = 0; i < 1000; i++) {
+    TEST_ASSERT_EQUAL(keys[i] < 1000 && keys[i] % 2 == 0, found[i]);
+  }
+  set_has_many(frozen, keys, 1000, found);
+  for (uint32_t i = 0; i < 1000; i++) {
+    TEST_ASSERT_EQUAL(keys[i] < 1000 && keys[i] % 2 == 0, found[i]);
+  }
+
+  set_free(flat);
+  set_free(btree);
+  set_free(frozen);
+}
+
+void test_get_many(void) {
+  map_t map;
+  flat_map_t flat;
+  map_init(map, hash_fn, equals_fn);
+  map_init(flat, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 100; i++) {
+    map_add(map, i, i * 10);
+    map_add(flat, i, i * 10);
+  }
+
+  uint32_t lookups[] = {5, 150, 99, 0, 100};
+  uint32_t *values[5];
+  map_get_many(map, lookups, 5, values);
+  TEST_ASSERT_EQUAL(50, *values[0]);
+  TEST_ASSERT_NULL(values[1]);
+  TEST_ASSERT_EQUAL(990, *values[2]);
+  TEST_ASSERT_EQUAL(0, *values[3]);
+  TEST_ASSERT_NULL(values[4]);
+
+  map_get_many(flat, lookups, 5, values);
+  TEST_ASSERT_EQUAL(50, *values[0]);
+  TEST_ASSERT_NULL(values[1]);
+  TEST_ASSERT_EQUAL(990, *values[2]);
+
+  map_free(map);
+  map_free(flat);
+}
@@ -0,0 +1,192 @@
+#include <stdint.h>
+
+#include "set.h"
+#include "unity.h"
+
+uint64_t hash_fn(uint32_t value) { return value; }
+uint64_t colliding_hash_fn(uint32_t value) { return value / 40; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type_btree(uint32_t) set_t;
+typedef map_type_btree(uint32_t, uint32_t) map_t;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// Checks ordering, separators and back-links below node_addr, returning the
+// amount of entries in the subtree
+static size_t assert_node_valid(set_t *set, tree_addr_t node_addr,
+                                uint64_t low, uint64_t high) {
+  btree_node_t *node = btree_get_node((*set), node_addr);
+  size_t entries = 0;
+  TEST_ASSERT_TRUE(node->count <= BTREE_NODE_KEYS);
+  for (uint32_t i = node->count; i < BTREE_NODE_KEYS; i++) {
+    TEST_ASSERT_EQUAL_UINT64(UINT64_MAX, node->hashes[i]);
+  }
+
+  if (node->is_leaf) {
+    for (uint32_t i = 0; i < node->count; i++) {
+      uint64_t hash = node->hashes[i];
+      TEST_ASSERT_TRUE(low <= hash && hash <= high);
+      TEST_ASSERT_TRUE(i == 0 || node->hashes[i - 1] <= hash);
+      TEST_ASSERT_EQUAL_UINT64(
+          set->hash_fn(set_get_entry((*set), node->children[i])), hash);
+      TEST_ASSERT_EQUAL(node_addr,
+                        set->btree_leaves[tree_idx(node->children[i])]);
+    }
+    return node->count;
+  }
+
+  TEST_ASSERT_TRUE(node->count >= 1);
+  TEST_ASSERT_EQUAL_UINT64(UINT64_MAX, node->hashes[node->count - 1]);
+  for (uint32_t i = 0; i < node->count; i++) {
+    uint64_t child_low = i == 0 ? low : node->hashes[i - 1];
+    uint64_t child_high = i == node->count - 1 ? high : node->hashes[i];
+    TEST_ASSERT_EQUAL(node_addr,
+                      btree_get_node((*set), node->children[i])->parent);
+    entries += assert_node_valid(set, node->children[i], child_low, child_high);
+  }
+  return entries;
+}
+
+static void assert_set_valid(set_t *set) {
+  TEST_ASSERT_EQUAL(0, btree_get_node((*set), set->btree_root)->parent);
+  TEST_ASSERT_EQUAL(set_size((*set)),
+                    assert_node_valid(set, set->btree_root, 0, UINT64_MAX));
+
+  size_t visited = 0;
+  uint64_t last_hash = 0;
+  tree_addr_t cursor = set_first((*set));
+  while (tree_is_valid_addr(cursor)) {
+    uint64_t hash = set->hash_fn(set_get_entry((*set), cursor));
+    TEST_ASSERT_TRUE(last_hash <= hash);
+    last_hash = hash;
+    visited++;
+    cursor = set_next((*set), cursor);
+  }
+  TEST_ASSERT_EQUAL(set_size((*set)), visited);
+}
+
+void test_ordered_iteration(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+
+  TEST_ASSERT_EQUAL(0, set_first(set));
+
+  for (uint32_t i = 0; i < 1000; i++) {
+    uint32_t entry = (i * 7919) % 1000;
+    set_add(set, entry);
+  }
+  TEST_ASSERT_EQUAL(0, set_add(set, 5));
+  TEST_ASSERT_EQUAL(1000, set_size(set));
+
+  // Enough entries for at least three levels
+  TEST_ASSERT_FALSE(btree_get_node(set, set.btree_root)->is_leaf);
+
+  uint32_t expected = 0;
+  tree_addr_t cursor = set_first(set);
+  while (tree_is_valid_addr(cursor)) {
+    TEST_ASSERT_EQUAL(expected, set_get_entry(set, cursor));
+    expected++;
+    cursor = set_next(set, cursor);
+  }
+  TEST_ASSERT_EQUAL(1000, expected);
+  assert_set_valid(&set);
+
+  set_free(set);
+}
+
+void test_add_remove_stress(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+
+  srand(11);
+  for (uint32_t i = 0; i < 20000; i++) {
+    uint32_t added = rand() % 5000;
+    set_add(set, added);
+    uint32_t removed = rand() % 5000;
+    set_remove(set, removed);
+  }
+  assert_set_valid(&set);
+
+  for (uint32_t i = 0; i < 5000; i++) {
+    set_remove(set, i);
+  }
+  TEST_ASSERT_EQUAL(0, set_size(set));
+  TEST_ASSERT_EQUAL(0, set_first(set));
+  TEST_ASSERT_TRUE(btree_get_node(set, set.btree_root)->is_leaf);
+
+  // Freed nodes and entry slots get reused
+  uint32_t node_count = set.btree_node_count;
+  size_t capacity = set.capacity;
+  for (uint32_t i = 0; i < 1000; i++) {
+    set_add(set, i);
+  }
+  TEST_ASSERT_EQUAL(node_count, set.btree_node_count);
+  TEST_ASSERT_EQUAL(capacity, set.capacity);
+  assert_set_valid(&set);
+
+  set_free(set);
+}
+
+void test_collisions_span_leaves(void) {
+  set_t set;
+  set_init(set, colliding_hash_fn, equals_fn);
+
+  // Runs of 40 equal hashes do not fit in one leaf
+  for (uint32_t i = 0; i < 400; i++) {
+    uint32_t entry = (i * 7919) % 400;
+    set_add(set, entry);
+  }
+  for (uint32_t i = 0; i < 400; i += 3) {
+    set_remove(set, i);
+  }
+
+  for (uint32_t i = 0; i < 400; i++) {
+    TEST_ASSERT_EQUAL(i % 3 != 0, set_has(set, i));
+  }
+  assert_set_valid(&set);
+
+  set_free(set);
+}
+
+void test_clone_and_empty(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+
+  for (uint32_t i = 0; i < 300; i++) {
+    set_add(set, i);
+  }
+
+  set_t clone = set_clone(set);
+  set_empty(set);
+
+  TEST_ASSERT_EQUAL(0, set_size(set));
+  TEST_ASSERT_EQUAL(false, set_has(set, 10));
+  TEST_ASSERT_EQUAL(true, set_has(clone, 10));
+  assert_set_valid(&clone);
+
+  set_free(set);
+  set_free(clone);
+}
+
+void test_map(void) {
+  map_t map;
+  map_init(map, hash_fn, equals_fn);
+
+  for (uint32_t i = 0; i < 1000; i++) {
+    map_add(map, i, i * 2);
+  }
+  map_remove(map, 11);
+
+  TEST_ASSERT_EQUAL(999, map_size(map));
+  TEST_ASSERT_NULL(map_get(map, 11));
+  TEST_ASSERT_EQUAL(20, *map_get(map, 10));
+  TEST_ASSERT_EQUAL(1998, *map_get(map, 999));
+
+  tree_addr_t first = map_first(map);
+  TEST_ASSERT_EQUAL(0, map_get_key(map, first));
+  TEST_ASSERT_EQUAL(4, map_get_value(map, map_next(map, map_next(map, first))));
+
+  map_free(map);
+}
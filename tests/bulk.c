@@ -0,0 +1,160 @@
+#include <stdint.h>
+
+#include "set.h"
+#include "setdebug.h"
+#include "unity.h"
+
+uint64_t hash_fn(uint32_t value) { return value; }
+uint64_t colliding_hash_fn(uint32_t value) { return value / 4; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+typedef set_type_flat(uint32_t) flat_set_t;
+typedef map_type(uint32_t, uint32_t) map_t;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static void assert_valid_tree(set_t set) {
+  debug_node_blackheight(set.nodes, set.colors, set.inited, set.root, true,
+                         true);
+
+  size_t rank = 0;
+  for (tree_addr_t cursor = tree_first(set); tree_is_valid_addr(cursor);
+       cursor = tree_next(set, cursor)) {
+    tree_node_t *node = tree_get_node(set, cursor);
+    if (tree_is_red(set, cursor)) {
+      TEST_ASSERT_FALSE(tree_is_red(set, node->left));
+      TEST_ASSERT_FALSE(tree_is_red(set, node->right));
+    }
+    TEST_ASSERT_EQUAL(1 + tree_count(set, node->left) +
+                          tree_count(set, node->right),
+                      node->count);
+    TEST_ASSERT_EQUAL(cursor, set_select(set, rank));
+    rank++;
+  }
+  TEST_ASSERT_EQUAL(rank, set_size(set));
+}
+
+void test_from_array(void) {
+  uint32_t entries[3000];
+  for (uint32_t i = 0; i < 3000; i++) {
+    entries[i] = (i * 7919) % 2000;
+  }
+
+  set_t set;
+  set_from_array(set, entries, 3000, hash_fn, equals_fn);
+
+  TEST_ASSERT_EQUAL(2000, set_size(set));
+  for (uint32_t i = 0; i < 2500; i++) {
+    TEST_ASSERT_EQUAL(i < 2000, set_has(set, i));
+  }
+  assert_valid_tree(set);
+
+  // The built tree keeps working with regular adds and removes
+  for (uint32_t i = 0; i < 2000; i += 3) {
+    set_remove(set, i);
+  }
+  for (uint32_t i = 2000; i < 2100; i++) {
+    set_add(set, i);
+  }
+  TEST_ASSERT_EQUAL(1433, set_size(set));
+  assert_valid_tree(set);
+
+  set_free(set);
+}
+
+void test_from_array_with_collisions(void) {
+  uint32_t entries[] = {9, 1, 3, 8, 1, 0, 2, 10, 3, 11, 4};
+  uint32_t entry_count = sizeof(entries) / sizeof(*entries);
+
+  set_t set;
+  set_from_array(set, entries, entry_count, colliding_hash_fn, equals_fn);
+
+  TEST_ASSERT_EQUAL(9, set_size(set));
+  for (uint32_t i = 0; i < 12; i++) {
+    TEST_ASSERT_EQUAL(i != 5 && i != 6 && i != 7, set_has(set, i));
+  }
+  assert_valid_tree(set);
+
+  set_remove(set, 1);
+  set_remove(set, 9);
+  TEST_ASSERT_EQUAL(false, set_has(set, 1));
+  TEST_ASSERT_EQUAL(true, set_has(set, 0));
+  TEST_ASSERT_EQUAL(true, set_has(set, 10));
+  assert_valid_tree(set);
+
+  set_free(set);
+}
+
+void test_from_empty_array(void) {
+  uint32_t entries[1];
+
+  set_t set;
+  set_from_array(set, entries, 0, hash_fn, equals_fn);
+  TEST_ASSERT_EQUAL(0, set_size(set));
+  TEST_ASSERT_EQUAL(0, set_first(set));
+
+  for (uint32_t i = 0; i < 20; i++) {
+    set_add(set, i);
+  }
+  TEST_ASSERT_EQUAL(20, set_size(set));
+  assert_valid_tree(set);
+
+  set_free(set);
+}
+
+void test_to_array(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 500; i++) {
+    uint32_t entry = (i * 7919) % 1000;
+    set_add(set, entry);
+  }
+
+  uint32_t out[500];
+  TEST_ASSERT_EQUAL(500, set_to_array(set, out));
+
+  size_t i = 0;
+  for (tree_addr_t cursor = set_first(set); tree_is_valid_addr(cursor);
+       cursor = set_next(set, cursor)) {
+    TEST_ASSERT_EQUAL(set_get_entry(set, cursor), out[i++]);
+  }
+
+  set_free(set);
+}
+
+void test_flat_from_array(void) {
+  uint32_t entries[] = {5, 3, 5, 9};
+
+  flat_set_t set;
+  set_from_array(set, entries, 4, hash_fn, equals_fn);
+  TEST_ASSERT_EQUAL(3, set_size(set));
+
+  uint32_t out[3];
+  TEST_ASSERT_EQUAL(3, set_to_array(set, out));
+  TEST_ASSERT_EQUAL(17, out[0] + out[1] + out[2]);
+
+  set_free(set);
+}
+
+void test_map_from_arrays(void) {
+  uint32_t keys[] = {4, 2, 4, 8};
+  uint32_t values[] = {40, 20, 41, 80};
+
+  map_t map;
+  map_from_arrays(map, keys, values, 4, hash_fn, equals_fn);
+
+  TEST_ASSERT_EQUAL(3, map_size(map));
+  // The first of two equal keys wins, like with map_add
+  TEST_ASSERT_EQUAL(40, *map_get(map, 4));
+  TEST_ASSERT_EQUAL(20, *map_get(map, 2));
+
+  uint32_t out_keys[3];
+  uint32_t out_values[3];
+  TEST_ASSERT_EQUAL(3, map_to_arrays(map, out_keys, out_values));
+  TEST_ASSERT_EQUAL(2, out_keys[0]);
+  TEST_ASSERT_EQUAL(80, out_values[2]);
+
+  map_free(map);
+}
@@ -0,0 +1,191 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "set.h"
+#include "setdebug.h"
+#include "unity.h"
+
+uint64_t hash_fn(set_bytes_t key) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < key.len; i++) {
+    hash = (hash ^ (uint8_t)key.bytes[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+uint64_t colliding_hash_fn(set_bytes_t key) { return key.len / 4; }
+
+typedef set_type_bytes() bytes_set_t;
+typedef map_type_bytes(int) bytes_map_t;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_keys_are_copied(void) {
+  bytes_set_t set;
+  set_bytes_init(set, hash_fn);
+
+  char buffer[16];
+  for (int i = 0; i < 1000; i++) {
+    int len = snprintf(buffer, sizeof(buffer), "key-%d", i);
+    TEST_ASSERT_TRUE(set_bytes_add(set, buffer, len));
+  }
+  // The buffer is reused, the set has its own copies
+  memset(buffer, 'x', sizeof(buffer));
+  TEST_ASSERT_FALSE(set_bytes_add(set, "key-7", 5));
+  TEST_ASSERT_EQUAL(1000, set_bytes_size(set));
+
+  TEST_ASSERT_TRUE(set_bytes_has(set, "key-999", 7));
+  TEST_ASSERT_FALSE(set_bytes_has(set, "key-1000", 8));
+  // Only the first len bytes count, no NUL needed
+  TEST_ASSERT_TRUE(set_bytes_has(set, "key-12345", 6));
+  TEST_ASSERT_FALSE(set_bytes_has(set, "key-1", 4));
+
+  // Stored keys are NUL-terminated
+  set_foreach_unordered(set.base, addr) {
+    set_bytes_t key = set_get_entry(set.base, addr);
+    TEST_ASSERT_EQUAL(key.len, strlen(key.bytes));
+    TEST_ASSERT_TRUE(key.bytes >= set.arena.data &&
+                     key.bytes < set.arena.data + set.arena.used);
+  }
+  set_bytes_free(set);
+}
+
+void test_binary_keys_and_collisions(void) {
+  bytes_set_t set;
+  set_bytes_init(set, colliding_hash_fn);
+
+  const char keys[][4] = {{0, 0, 0, 0}, {0, 0, 0, 1}, {0, 1, 0, 0}, {'a', 0}};
+  for (size_t i = 0; i < 4; i++) {
+    TEST_ASSERT_TRUE(set_bytes_add(set, keys[i], 4));
+  }
+  TEST_ASSERT_TRUE(set_bytes_add(set, keys[3], 1));
+  TEST_ASSERT_TRUE(set_bytes_add(set, "", 0));
+  TEST_ASSERT_EQUAL(6, set_bytes_size(set));
+  for (size_t i = 0; i < 4; i++) {
+    TEST_ASSERT_TRUE(set_bytes_has(set, keys[i], 4));
+  }
+  TEST_ASSERT_TRUE(set_bytes_has(set, "a", 1));
+  TEST_ASSERT_TRUE(set_bytes_has(set, "b", 0));
+  TEST_ASSERT_FALSE(set_bytes_has(set, "b", 1));
+
+  TEST_ASSERT_TRUE(set_bytes_remove(set, keys[1], 4));
+  TEST_ASSERT_FALSE(set_bytes_remove(set, keys[1], 4));
+  TEST_ASSERT_FALSE(set_bytes_has(set, keys[1], 4));
+  TEST_ASSERT_TRUE(set_bytes_has(set, keys[2], 4));
+  set_bytes_free(set);
+}
+
+void test_arena_reclaimed(void) {
+  bytes_set_t set;
+  set_bytes_init(set, hash_fn);
+
+  char buffer[64];
+  for (int i = 0; i < 2000; i++) {
+    int len = snprintf(buffer, sizeof(buffer), "a somewhat longer key %d", i);
+    set_bytes_add(set, buffer, len);
+  }
+  for (int i = 0; i < 2000; i += 2) {
+    int len = snprintf(buffer, sizeof(buffer), "a somewhat longer key %d", i);
+    TEST_ASSERT_TRUE(set_bytes_remove(set, buffer, len));
+  }
+  size_t used = set.arena.used;
+  TEST_ASSERT_TRUE(set.arena.dead > 0);
+
+  set_bytes_compact(set, SET_LAYOUT_VEB);
+  TEST_ASSERT_EQUAL(0, set.arena.dead);
+  TEST_ASSERT_EQUAL(used / 2, set.arena.used);
+  TEST_ASSERT_TRUE(set.arena.capacity == set.arena.used);
+  for (int i = 0; i < 2000; i++) {
+    int len = snprintf(buffer, sizeof(buffer), "a somewhat longer key %d", i);
+    TEST_ASSERT_EQUAL(i % 2 == 1, set_bytes_has(set, buffer, len));
+  }
+  debug_node_blackheight(set.base.nodes, set.base.colors, set.base.inited,
+                         set.base.root, true, true);
+
+  // Growing copies the live keys only
+  for (int round = 0; round < 20; round++) {
+    for (int i = 0; i < 200; i++) {
+      int len = snprintf(buffer, sizeof(buffer), "churn %d", i);
+      set_bytes_add(set, buffer, len);
+    }
+    for (int i = 0; i < 200; i++) {
+      int len = snprintf(buffer, sizeof(buffer), "churn %d", i);
+      set_bytes_remove(set, buffer, len);
+    }
+  }
+  TEST_ASSERT_EQUAL(1000, set_bytes_size(set));
+  TEST_ASSERT_TRUE(set.arena.capacity <= 8 * (used / 2 + 200 * 10));
+  set_bytes_free(set);
+}
+
+void test_snapshot_keeps_keys(void) {
+  bytes_set_t set;
+  set_bytes_init(set, hash_fn);
+  char buffer[64];
+  for (int i = 0; i < 2000; i++) {
+    int len = snprintf(buffer, sizeof(buffer), "key-%d", i);
+    set_bytes_add(set, buffer, len);
+  }
+  bytes_set_t snapshot = set_bytes_snapshot(set);
+
+  // A key too large for the arena copies the keys without growing the tree
+  size_t capacity = set.base.capacity;
+  char *old_arena = set.arena.data;
+  static char large[1 << 16];
+  memset(large, 'z', sizeof(large));
+  TEST_ASSERT_TRUE(set_bytes_add(set, large, sizeof(large)));
+  TEST_ASSERT_EQUAL(capacity, set.base.capacity);
+  TEST_ASSERT_TRUE(set.arena.data != old_arena);
+  TEST_ASSERT_TRUE(set_bytes_remove(set, "key-7", 5));
+
+  set_bytes_free(set);
+  TEST_ASSERT_EQUAL(2000, set_bytes_size(snapshot));
+  TEST_ASSERT_FALSE(set_bytes_has(snapshot, large, sizeof(large)));
+  for (int i = 0; i < 2000; i++) {
+    int len = snprintf(buffer, sizeof(buffer), "key-%d", i);
+    TEST_ASSERT_TRUE(set_bytes_has(snapshot, buffer, len));
+  }
+  set_foreach_unordered(snapshot.base, addr) {
+    set_bytes_t key = set_get_entry(snapshot.base, addr);
+    TEST_ASSERT_TRUE(key.bytes >= old_arena &&
+                     key.bytes < old_arena + snapshot.arena.used);
+  }
+  set_bytes_free(snapshot);
+}
+
+void test_map_snapshot_keeps_keys(void) {
+  bytes_map_t map;
+  map_bytes_init(map, hash_fn);
+  TEST_ASSERT_TRUE(map_bytes_add(map, "one", 3, 1));
+  bytes_map_t snapshot = map_bytes_snapshot(map);
+  bytes_map_t twin = map_bytes_snapshot(map);
+  map_bytes_remove(map, "one", 3);
+  map_bytes_compact(map, SET_LAYOUT_VEB);
+  map_bytes_free(map);
+
+  TEST_ASSERT_EQUAL(1, *map_bytes_get(snapshot, "one", 3));
+  map_bytes_free(snapshot);
+  TEST_ASSERT_EQUAL(1, *map_bytes_get(twin, "one", 3));
+  map_bytes_free(twin);
+}
+
+void test_bytes_map(void) {
+  bytes_map_t map;
+  map_bytes_init(map, hash_fn);
+  TEST_ASSERT_TRUE(map_bytes_add(map, "one", 3, 1));
+  TEST_ASSERT_TRUE(map_bytes_add(map, "two", 3, 2));
+  TEST_ASSERT_FALSE(map_bytes_add(map, "one", 3, 10));
+  TEST_ASSERT_EQUAL(1, *map_bytes_get(map, "one", 3));
+  TEST_ASSERT_NULL(map_bytes_get(map, "on", 2));
+  TEST_ASSERT_TRUE(map_bytes_has(map, "two and more", 3));
+
+  *map_bytes_get(map, "two", 3) = 20;
+  TEST_ASSERT_TRUE(map_bytes_remove(map, "one", 3));
+  TEST_ASSERT_FALSE(map_bytes_has(map, "one", 3));
+  map_bytes_compact(map, SET_LAYOUT_BFS);
+  TEST_ASSERT_EQUAL(20, *map_bytes_get(map, "two", 3));
+  TEST_ASSERT_EQUAL(1, map_bytes_size(map));
+  TEST_ASSERT_EQUAL(4, map.arena.used);
+  map_bytes_free(map);
+}
@@ -0,0 +1,129 @@
+#include <stdint.h>
+#include <unistd.h>
+
+#include "set.h"
+#include "setdebug.h"
+#include "unity.h"
+
+uint64_t hash_fn(uint32_t value) { return value * 0x9E3779B97F4A7C15ull; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+typedef map_type(uint32_t, uint32_t) map_t;
+
+static char path[64];
+
+void setUp(void) {
+  snprintf(path, sizeof(path), "/tmp/set_checkpoint_test_%d.bin",
+           (int)getpid());
+}
+void tearDown(void) { remove(path); }
+
+void test_checkpoint_is_point_in_time(void) {
+  map_t map;
+  map_init(map, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 100000; i++) {
+    map_add(map, i, i);
+  }
+
+  set_checkpoint_t checkpoint;
+  TEST_ASSERT_TRUE(map_checkpoint(map, path, &checkpoint));
+
+  // The writer carries on, growing the map on the way
+  for (uint32_t i = 0; i < 100000; i += 2) {
+    map_remove(map, i);
+  }
+  for (uint32_t i = 100000; i < 300000; i++) {
+    map_add(map, i, i);
+  }
+  *map_get(map, 1) = 42;
+
+  TEST_ASSERT_TRUE(set_checkpoint_wait(&checkpoint));
+  TEST_ASSERT_EQUAL(SET_CHECKPOINT_DONE, set_checkpoint_poll(&checkpoint));
+  TEST_ASSERT_EQUAL(checkpoint.total_bytes,
+                    set_checkpoint_bytes_written(&checkpoint));
+  TEST_ASSERT_TRUE(set_file_verify(path));
+
+  map_t image;
+  TEST_ASSERT_TRUE(map_mmap_open(image, path, hash_fn, equals_fn));
+  TEST_ASSERT_EQUAL(100000, map_size(image));
+  for (uint32_t i = 0; i < 100000; i++) {
+    TEST_ASSERT_EQUAL(i, *map_get(image, i));
+  }
+  TEST_ASSERT_FALSE(map_has(image, 100000));
+  debug_node_blackheight(image.nodes, image.colors, image.inited, image.root,
+                         true, true);
+  map_free(image);
+  map_free(map);
+}
+
+void test_poll_until_done(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 50000; i++) {
+    set_add(set, i);
+  }
+
+  set_checkpoint_t checkpoint;
+  TEST_ASSERT_TRUE(set_checkpoint(set, path, &checkpoint));
+  uint64_t last_written = 0;
+  while (set_checkpoint_poll(&checkpoint) == SET_CHECKPOINT_RUNNING) {
+    uint64_t written = set_checkpoint_bytes_written(&checkpoint);
+    TEST_ASSERT_TRUE(written >= last_written);
+    TEST_ASSERT_TRUE(written <= checkpoint.total_bytes);
+    last_written = written;
+    usleep(100);
+  }
+  TEST_ASSERT_EQUAL(SET_CHECKPOINT_DONE, checkpoint.state);
+
+  set_t image;
+  TEST_ASSERT_TRUE(set_mmap_open(image, path, hash_fn, equals_fn));
+  TEST_ASSERT_EQUAL(50000, set_size(image));
+  set_free(image);
+  set_free(set);
+}
+
+void test_failed_checkpoint(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  uint32_t entry = 1;
+  set_add(set, entry);
+
+  set_checkpoint_t checkpoint;
+  TEST_ASSERT_TRUE(
+      set_checkpoint(set, "/nonexistent/dir/set.bin", &checkpoint));
+  TEST_ASSERT_FALSE(set_checkpoint_wait(&checkpoint));
+  TEST_ASSERT_EQUAL(SET_CHECKPOINT_FAILED, checkpoint.state);
+  TEST_ASSERT_EQUAL(0, set_checkpoint_bytes_written(&checkpoint));
+  set_free(set);
+}
+
+// The chunks a snapshot shares stay pinned for the child while the set and
+// the snapshot both move on
+void test_checkpoint_of_shared_storage(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 100000; i++) {
+    set_add(set, i);
+  }
+  set_t snapshot = set_snapshot(set);
+
+  set_checkpoint_t checkpoint;
+  TEST_ASSERT_TRUE(set_checkpoint(set, path, &checkpoint));
+  for (uint32_t i = 0; i < 100000; i += 2) {
+    set_remove(set, i);
+  }
+  set_free(snapshot);
+  TEST_ASSERT_TRUE(set_checkpoint_wait(&checkpoint));
+  TEST_ASSERT_TRUE(set_file_verify(path));
+
+  set_t image;
+  TEST_ASSERT_TRUE(set_mmap_open(image, path, hash_fn, equals_fn));
+  TEST_ASSERT_EQUAL(100000, set_size(image));
+  for (uint32_t i = 0; i < 100000; i++) {
+    TEST_ASSERT_TRUE(set_has(image, i));
+  }
+  set_free(image);
+  TEST_ASSERT_EQUAL(50000, set_size(set));
+  set_free(set);
+}
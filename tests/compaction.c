@@ -0,0 +1,177 @@
+#include <stdint.h>
+
+#include "set.h"
+#include "setdebug.h"
+#include "unity.h"
+
+uint64_t hash_fn(uint32_t value) { return value * 0x9E3779B97F4A7C15ull; }
+uint64_t colliding_hash_fn(uint32_t value) { return value / 4; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+typedef map_type(uint32_t, uint32_t) map_t;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// Left by churn(), before and after adding 20000 and up
+static bool churned(uint32_t i) {
+  return i < 20000 && (i % 5 == 0 || i >= 19900);
+}
+static bool churned_twice(uint32_t i) {
+  return i < 20000 ? churned(i) : i >= 29900;
+}
+
+static void assert_valid(set_t set, bool (*expected)(uint32_t)) {
+  size_t count = 0;
+  for (uint32_t i = 0; i < 30000; i++) {
+    TEST_ASSERT_EQUAL(expected(i), set_has(set, i));
+    count += expected(i);
+  }
+  TEST_ASSERT_EQUAL(count, set_size(set));
+  debug_node_blackheight(set.nodes, set.colors, set.inited, set.root, true,
+                         true);
+
+  size_t visited = 0;
+  uint64_t last_hash = 0;
+  for (tree_addr_t cursor = set_first(set); cursor;
+       cursor = set_next(set, cursor)) {
+    uint64_t hash = set.hash_fn(set_get_entry(set, cursor));
+    TEST_ASSERT_TRUE(visited == 0 || hash >= last_hash);
+    TEST_ASSERT_EQUAL(visited, set_rank(set, set_get_entry(set, cursor)));
+    last_hash = hash;
+    visited++;
+  }
+  TEST_ASSERT_EQUAL(count, visited);
+}
+
+// Adds 0 to 19999 and removes all but churned() of them
+static void churn(set_t *set) {
+  for (uint32_t i = 0; i < 20000; i++) {
+    set_add((*set), i);
+  }
+  for (uint32_t i = 0; i < 19900; i++) {
+    if (!churned(i)) {
+      set_remove((*set), i);
+    }
+  }
+}
+
+static void assert_live_nodes_first(set_t set) {
+  tree_addr_t first = SET_SHARED_NIL ? 2 : 1;
+  for (tree_addr_t addr = first; addr < first + set_size(set); addr++) {
+    TEST_ASSERT_TRUE(tree_is_inited(set, addr));
+  }
+}
+
+void test_compact_bfs(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  churn(&set);
+  size_t capacity = set.capacity;
+
+  set_compact(set, SET_LAYOUT_BFS);
+  assert_valid(set, churned);
+  assert_live_nodes_first(set);
+  TEST_ASSERT_TRUE(set.capacity < capacity);
+
+  // The root comes first, then its children
+  tree_addr_t root = SET_SHARED_NIL ? 2 : 1;
+  TEST_ASSERT_EQUAL(root, set.root);
+  TEST_ASSERT_EQUAL(root + 1, tree_get_node(set, set.root)->left);
+  TEST_ASSERT_EQUAL(root + 2, tree_get_node(set, set.root)->right);
+
+  set_free(set);
+}
+
+void test_compact_veb(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  churn(&set);
+  size_t capacity = set.capacity;
+
+  set_compact(set, SET_LAYOUT_VEB);
+  assert_valid(set, churned);
+  assert_live_nodes_first(set);
+  TEST_ASSERT_TRUE(set.capacity < capacity);
+
+  // The set keeps working after it
+  for (uint32_t i = 20000; i < 30000; i++) {
+    set_add(set, i);
+  }
+  for (uint32_t i = 20000; i < 29900; i++) {
+    set_remove(set, i);
+  }
+  assert_valid(set, churned_twice);
+
+  // Compacting again at the same size leaves the capacity alone
+  set_compact(set, SET_LAYOUT_VEB);
+  capacity = set.capacity;
+  set_compact(set, SET_LAYOUT_VEB);
+  TEST_ASSERT_EQUAL(capacity, set.capacity);
+  assert_valid(set, churned_twice);
+
+  set_free(set);
+}
+
+// Runs of equal hashes hang off their node and move along with it
+void test_compact_keeps_equal_hashes(void) {
+  set_t set;
+  set_init(set, colliding_hash_fn, equals_fn);
+  churn(&set);
+  set_compact(set, SET_LAYOUT_VEB);
+  assert_valid(set, churned);
+  assert_live_nodes_first(set);
+
+  set_remove(set, 19901);
+  TEST_ASSERT_TRUE(set_has(set, 19900));
+  TEST_ASSERT_TRUE(set_has(set, 19902));
+  set_compact(set, SET_LAYOUT_BFS);
+  TEST_ASSERT_FALSE(set_has(set, 19901));
+  TEST_ASSERT_TRUE(set_has(set, 19903));
+  debug_node_blackheight(set.nodes, set.colors, set.inited, set.root, true,
+                         true);
+
+  set_free(set);
+}
+
+void test_compact_empty(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  set_compact(set, SET_LAYOUT_VEB);
+  TEST_ASSERT_EQUAL(0, set_size(set));
+  TEST_ASSERT_EQUAL(0, set_first(set));
+
+  set_add(set, 1);
+  set_remove(set, 1);
+  set_compact(set, SET_LAYOUT_BFS);
+  set_add(set, 2);
+  TEST_ASSERT_TRUE(set_has(set, 2));
+  TEST_ASSERT_EQUAL(1, set_size(set));
+
+  set_free(set);
+}
+
+void test_compact_map(void) {
+  map_t map;
+  map_init(map, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 5000; i++) {
+    map_add(map, i, i * 3);
+  }
+  for (uint32_t i = 0; i < 5000; i += 2) {
+    map_remove(map, i);
+  }
+
+  map_compact(map, SET_LAYOUT_VEB);
+  TEST_ASSERT_EQUAL(2500, map_size(map));
+  for (uint32_t i = 0; i < 5000; i++) {
+    uint32_t *value = map_get(map, i);
+    if (i % 2 == 0) {
+      TEST_ASSERT_NULL(value);
+    } else {
+      TEST_ASSERT_EQUAL(i * 3, *value);
+    }
+  }
+
+  map_free(map);
+}
@@ -0,0 +1,183 @@
+#include <pthread.h>
+#include <stdint.h>
+
+#include "set.h"
+#include "setdebug.h"
+#include "unity.h"
+
+#define READER_COUNT 3
+#define BASE_COUNT 2000
+#define WRITE_ROUNDS 20
+
+uint64_t colliding_hash_fn(uint32_t value) { return value / 4; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef struct {
+  uint32_t value;
+  uint32_t check;
+} pair_t;
+
+typedef set_concurrent_type(uint32_t) concurrent_set_t;
+typedef map_concurrent_type(uint32_t, pair_t) concurrent_map_t;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static concurrent_set_t shared_set;
+static concurrent_map_t shared_map;
+static uint32_t published;
+static bool writer_done;
+
+// Every entry below published has been added for good, odd entries above
+// BASE_COUNT come and go, and nothing at or above 1 << 30 is ever added
+static void *check_set(void *arg) {
+  (void)arg;
+  int reader = set_concurrent_reader(shared_set);
+  TEST_ASSERT_TRUE(reader >= 0);
+  uint32_t key = 0;
+  while (!__atomic_load_n(&writer_done, __ATOMIC_ACQUIRE)) {
+    uint32_t high = __atomic_load_n(&published, __ATOMIC_ACQUIRE);
+    key = (key + 7919) % high;
+    TEST_ASSERT_TRUE(set_concurrent_has(shared_set, reader, key & ~1u));
+    TEST_ASSERT_FALSE(set_concurrent_has(shared_set, reader, key | 1u << 30));
+    set_concurrent_has(shared_set, reader, key | 1);
+  }
+  return NULL;
+}
+
+void test_readers_during_writes(void) {
+  set_concurrent_init(shared_set, colliding_hash_fn, equals_fn);
+  for (uint32_t i = 0; i < BASE_COUNT; i += 2) {
+    TEST_ASSERT_TRUE(set_concurrent_add(shared_set, i));
+  }
+  published = BASE_COUNT;
+  writer_done = false;
+
+  pthread_t readers[READER_COUNT];
+  for (size_t i = 0; i < READER_COUNT; i++) {
+    pthread_create(&readers[i], NULL, check_set, NULL);
+  }
+  // Growing a copy moves it to new storage, which no reader is in
+  for (uint32_t round = 0; round < WRITE_ROUNDS; round++) {
+    uint32_t high = published;
+    for (uint32_t i = high; i < high + BASE_COUNT; i += 2) {
+      set_concurrent_add(shared_set, i);
+      set_concurrent_add(shared_set, i + 1);
+    }
+    __atomic_store_n(&published, high + BASE_COUNT, __ATOMIC_RELEASE);
+    for (uint32_t i = BASE_COUNT + 1; i < high + BASE_COUNT; i += 4) {
+      TEST_ASSERT_TRUE(set_concurrent_remove(shared_set, i));
+    }
+    for (uint32_t i = BASE_COUNT + 1; i < high + BASE_COUNT; i += 4) {
+      set_concurrent_add(shared_set, i);
+    }
+    sched_yield();
+  }
+  __atomic_store_n(&writer_done, true, __ATOMIC_RELEASE);
+  for (size_t i = 0; i < READER_COUNT; i++) {
+    pthread_join(readers[i], NULL);
+  }
+
+  TEST_ASSERT_EQUAL(published - BASE_COUNT / 2,
+                    set_concurrent_size(shared_set));
+  for (size_t i = 0; i < 2; i++) {
+    TEST_ASSERT_EQUAL(set_concurrent_size(shared_set),
+                      set_size(shared_set.copies[i]));
+    debug_node_blackheight(shared_set.copies[i].nodes,
+                           shared_set.copies[i].colors,
+                           shared_set.copies[i].inited,
+                           shared_set.copies[i].root, true, true);
+  }
+  set_concurrent_free(shared_set);
+}
+
+// The writer keeps rewriting values, so a torn read shows as a mismatch
+static void *check_map(void *arg) {
+  (void)arg;
+  int reader = map_concurrent_reader(shared_map);
+  uint32_t key = 0;
+  while (!__atomic_load_n(&writer_done, __ATOMIC_ACQUIRE)) {
+    key = (key + 31) % BASE_COUNT;
+    pair_t pair;
+    TEST_ASSERT_TRUE(map_concurrent_get(shared_map, reader, key, &pair));
+    TEST_ASSERT_EQUAL(~pair.value, pair.check);
+    TEST_ASSERT_TRUE(map_concurrent_has(shared_map, reader, key));
+  }
+  return NULL;
+}
+
+void test_map_values_never_torn(void) {
+  map_concurrent_init(shared_map, colliding_hash_fn, equals_fn);
+  for (uint32_t i = 0; i < BASE_COUNT; i++) {
+    TEST_ASSERT_TRUE(map_concurrent_add(shared_map, i, ((pair_t){i, ~i})));
+  }
+  writer_done = false;
+
+  pthread_t readers[READER_COUNT];
+  for (size_t i = 0; i < READER_COUNT; i++) {
+    pthread_create(&readers[i], NULL, check_map, NULL);
+  }
+  for (uint32_t round = 0; round < WRITE_ROUNDS * 10; round++) {
+    for (uint32_t i = 0; i < BASE_COUNT; i++) {
+      uint32_t value = i + round;
+      TEST_ASSERT_TRUE(
+          map_concurrent_update(shared_map, i, ((pair_t){value, ~value})));
+    }
+  }
+  __atomic_store_n(&writer_done, true, __ATOMIC_RELEASE);
+  for (size_t i = 0; i < READER_COUNT; i++) {
+    pthread_join(readers[i], NULL);
+  }
+
+  TEST_ASSERT_FALSE(map_concurrent_update(shared_map, BASE_COUNT,
+                                          ((pair_t){0, ~0u})));
+  TEST_ASSERT_TRUE(map_concurrent_remove(shared_map, 5));
+  TEST_ASSERT_FALSE(map_concurrent_remove(shared_map, 5));
+  TEST_ASSERT_EQUAL(BASE_COUNT - 1, map_concurrent_size(shared_map));
+  map_concurrent_free(shared_map);
+}
+
+static concurrent_set_t waiting_set;
+
+static void *add_one(void *arg) {
+  (void)arg;
+  TEST_ASSERT_TRUE(set_concurrent_add(waiting_set, 1));
+  return NULL;
+}
+
+// The writer publishes a change in the other copy, then waits for the reader
+// to leave its copy before making the change there
+void test_writer_waits_for_a_reader_that_is_in(void) {
+  set_concurrent_init(waiting_set, colliding_hash_fn, equals_fn);
+  int reader = set_concurrent_reader(waiting_set);
+  TEST_ASSERT_EQUAL(0, reader);
+
+  uint32_t side;
+  uint32_t read = tree_sync_read_begin(&waiting_set.sync, reader, &side);
+  pthread_t writer;
+  pthread_create(&writer, NULL, add_one, NULL);
+  while (__atomic_load_n(&waiting_set.sync.read, __ATOMIC_SEQ_CST) == read) {
+    sched_yield();
+  }
+  // Published in the other copy, held back from this one
+  TEST_ASSERT_TRUE(set_has(waiting_set.copies[read ^ 1], 1));
+  TEST_ASSERT_FALSE(set_has(waiting_set.copies[read], 1));
+  tree_sync_read_end(&waiting_set.sync, reader, side);
+  pthread_join(writer, NULL);
+
+  TEST_ASSERT_TRUE(set_has(waiting_set.copies[read], 1));
+  TEST_ASSERT_TRUE(set_concurrent_has(waiting_set, reader, 1));
+  TEST_ASSERT_FALSE(set_concurrent_add(waiting_set, 1));
+  TEST_ASSERT_EQUAL(1, set_concurrent_size(waiting_set));
+  set_concurrent_free(waiting_set);
+}
+
+void test_reader_limit(void) {
+  concurrent_set_t set;
+  set_concurrent_init(set, colliding_hash_fn, equals_fn);
+  for (int i = 0; i < SET_MAX_READERS; i++) {
+    TEST_ASSERT_EQUAL(i, set_concurrent_reader(set));
+  }
+  TEST_ASSERT_EQUAL(-1, set_concurrent_reader(set));
+  set_concurrent_free(set);
+}
@@ -0,0 +1,73 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "set.h"
+#include "setdebug.h"
+#include "unity.h"
+
+uint64_t hash_fn(uint32_t value) { return value; }
+uint64_t colliding_hash_fn(uint32_t value) { return value / 4; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+uint64_t str_hash_fn(const char *value) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (; *value; value++) {
+    hash = (hash ^ (uint8_t)*value) * 0x100000001b3ull;
+  }
+  return hash;
+}
+bool str_equals_fn(const char *a, const char *b) { return strcmp(a, b) == 0; }
+
+set_declare(u32_set, uint32_t)
+map_declare(str_map, const char *, int)
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_declared_set(void) {
+  u32_set_t set;
+  u32_set_init(&set, colliding_hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 1000; i++) {
+    TEST_ASSERT_TRUE(u32_set_add(&set, i));
+  }
+  TEST_ASSERT_FALSE(u32_set_add(&set, 10));
+  TEST_ASSERT_EQUAL(1000, u32_set_size(&set));
+
+  for (uint32_t i = 0; i < 1000; i += 2) {
+    TEST_ASSERT_TRUE(u32_set_remove(&set, i));
+  }
+  TEST_ASSERT_FALSE(u32_set_remove(&set, 0));
+  TEST_ASSERT_EQUAL(500, u32_set_size(&set));
+  for (uint32_t i = 0; i < 1001; i++) {
+    TEST_ASSERT_EQUAL(i % 2 == 1 && i < 1000, u32_set_has(&set, i));
+  }
+
+  // The declared type is a plain set, so the macros still apply
+  TEST_ASSERT_TRUE(set_has(set, 999));
+  set_add(set, 1000);
+  TEST_ASSERT_TRUE(u32_set_has(&set, 1000));
+  debug_node_blackheight(set.nodes, set.colors, set.inited, set.root, true,
+                         true);
+  u32_set_free(&set);
+}
+
+void test_declared_map(void) {
+  str_map_t map;
+  str_map_init(&map, str_hash_fn, str_equals_fn);
+  TEST_ASSERT_TRUE(str_map_add(&map, "one", 1));
+  TEST_ASSERT_TRUE(str_map_add(&map, "two", 2));
+  TEST_ASSERT_FALSE(str_map_add(&map, "one", 10));
+  TEST_ASSERT_EQUAL(2, str_map_size(&map));
+  TEST_ASSERT_EQUAL(1, *str_map_get(&map, "one"));
+  TEST_ASSERT_NULL(str_map_get(&map, "three"));
+
+  *str_map_get(&map, "two") = 20;
+  TEST_ASSERT_EQUAL(20, *map_get(map, "two"));
+
+  TEST_ASSERT_TRUE(str_map_remove(&map, "one"));
+  TEST_ASSERT_FALSE(str_map_remove(&map, "one"));
+  TEST_ASSERT_FALSE(str_map_has(&map, "one"));
+  TEST_ASSERT_TRUE(str_map_has(&map, "two"));
+  TEST_ASSERT_EQUAL(1, str_map_size(&map));
+  str_map_free(&map);
+}
@@ -0,0 +1,162 @@
+#include <stdint.h>
+
+#include "set.h"
+#include "unity.h"
+
+uint64_t hash_fn(uint32_t value) { return value; }
+// Corrupt hashing function - always return 1 as hash
+uint64_t colliding_hash_fn(uint32_t value) { return 1; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type_flat(uint32_t) set_t;
+typedef map_type_flat(uint32_t, uint32_t) map_t;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static size_t count_by_iteration(set_t set) {
+  size_t count = 0;
+  tree_addr_t cursor = set_first(set);
+  while (tree_is_valid_addr(cursor)) {
+    count++;
+    cursor = set_next(set, cursor);
+  }
+  return count;
+}
+
+void test_add_has_remove(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+
+  TEST_ASSERT_EQUAL(0, set_size(set));
+  TEST_ASSERT_EQUAL(0, set_first(set));
+
+  tree_addr_t addr = set_add(set, 5);
+  TEST_ASSERT_NOT_EQUAL(0, addr);
+  TEST_ASSERT_EQUAL(5, set_get_entry(set, addr));
+  TEST_ASSERT_EQUAL(0, set_add(set, 5));
+  set_add(set, 7);
+
+  TEST_ASSERT_EQUAL(2, set_size(set));
+  TEST_ASSERT_EQUAL(true, set_has(set, 5));
+  TEST_ASSERT_EQUAL(true, set_has(set, 7));
+  TEST_ASSERT_EQUAL(false, set_has(set, 6));
+
+  set_remove(set, 5);
+  set_remove(set, 6);
+  TEST_ASSERT_EQUAL(1, set_size(set));
+  TEST_ASSERT_EQUAL(false, set_has(set, 5));
+  TEST_ASSERT_EQUAL(true, set_has(set, 7));
+
+  set_free(set);
+}
+
+void test_growth(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+
+  for (uint32_t i = 0; i < 10000; i++) {
+    set_add(set, i * 7);
+  }
+
+  TEST_ASSERT_EQUAL(10000, set_size(set));
+  TEST_ASSERT_EQUAL(10000, count_by_iteration(set));
+  TEST_ASSERT_TRUE(set.size <= flat_max_load(set.capacity));
+  for (uint32_t i = 0; i < 10000; i++) {
+    TEST_ASSERT_EQUAL(true, set_has(set, i * 7));
+    TEST_ASSERT_EQUAL(false, set_has(set, i * 7 + 1));
+  }
+
+  set_free(set);
+}
+
+void test_churn_does_not_grow(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+
+  for (uint32_t i = 0; i < 100; i++) {
+    set_add(set, i);
+  }
+  size_t capacity = set.capacity;
+
+  // Tombstones left by removals get cleared by rehashing in place, so the
+  // table grows at most once to get below half load
+  for (uint32_t i = 100; i < 100000; i++) {
+    set_add(set, i);
+    uint32_t removed = i - 100;
+    set_remove(set, removed);
+  }
+
+  TEST_ASSERT_EQUAL(100, set_size(set));
+  TEST_ASSERT_TRUE(set.capacity <= capacity * 2);
+  TEST_ASSERT_EQUAL(100, count_by_iteration(set));
+  for (uint32_t i = 99900; i < 100000; i++) {
+    TEST_ASSERT_EQUAL(true, set_has(set, i));
+  }
+
+  set_free(set);
+}
+
+void test_collisions(void) {
+  set_t set;
+  set_init(set, colliding_hash_fn, equals_fn);
+
+  // Spills over several probe groups
+  for (uint32_t i = 0; i < 100; i++) {
+    set_add(set, i);
+  }
+  for (uint32_t i = 0; i < 100; i += 2) {
+    set_remove(set, i);
+  }
+
+  TEST_ASSERT_EQUAL(50, set_size(set));
+  for (uint32_t i = 0; i < 100; i++) {
+    TEST_ASSERT_EQUAL(i % 2 == 1, set_has(set, i));
+  }
+
+  set_free(set);
+}
+
+void test_clone_and_empty(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+
+  for (uint32_t i = 0; i < 100; i++) {
+    set_add(set, i);
+  }
+
+  set_t clone = set_clone(set);
+  set_empty(set);
+
+  TEST_ASSERT_EQUAL(0, set_size(set));
+  TEST_ASSERT_EQUAL(false, set_has(set, 10));
+  TEST_ASSERT_EQUAL(100, set_size(clone));
+  TEST_ASSERT_EQUAL(true, set_has(clone, 10));
+
+  set_free(set);
+  set_free(clone);
+}
+
+void test_map(void) {
+  map_t map;
+  map_init(map, hash_fn, equals_fn);
+
+  for (uint32_t i = 0; i < 1000; i++) {
+    map_add(map, i, i * 2);
+  }
+  map_add(map, 10, 0);
+  map_remove(map, 11);
+
+  TEST_ASSERT_EQUAL(999, map_size(map));
+  TEST_ASSERT_EQUAL(true, map_has(map, 10));
+  TEST_ASSERT_EQUAL(false, map_has(map, 11));
+  TEST_ASSERT_NULL(map_get(map, 11));
+  TEST_ASSERT_EQUAL(20, *map_get(map, 10));
+  TEST_ASSERT_EQUAL(1998, *map_get(map, 999));
+
+  map_t clone = map_clone(map);
+  TEST_ASSERT_EQUAL(1998, *map_get(clone, 999));
+
+  map_free(map);
+  map_free(clone);
+}
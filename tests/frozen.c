@@ -0,0 +1,136 @@
+#include <stdint.h>
+
+#include "set.h"
+#include "unity.h"
+
+uint64_t hash_fn(uint32_t value) { return value; }
+uint64_t colliding_hash_fn(uint32_t value) { return value / 3; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+typedef set_type_flat(uint32_t) flat_set_t;
+typedef set_type_frozen(uint32_t) frozen_set_t;
+typedef map_type_btree(uint32_t, uint32_t) map_t;
+typedef map_type_frozen(uint32_t, uint32_t) frozen_map_t;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_freeze_tree(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 1000; i++) {
+    uint32_t entry = (i * 7919) % 2000;
+    set_add(set, entry);
+  }
+
+  frozen_set_t frozen;
+  set_freeze(frozen, set);
+  set_free(set);
+
+  TEST_ASSERT_EQUAL(1000, set_size(frozen));
+  for (uint32_t i = 0; i < 2000; i++) {
+    uint32_t entry = (i * 7919) % 2000;
+    TEST_ASSERT_EQUAL(i < 1000, set_has(frozen, entry));
+  }
+
+  // Entries are stored in hash order
+  uint32_t last = 0;
+  size_t visited = 0;
+  for (tree_addr_t addr = set_first(frozen); tree_is_valid_addr(addr);
+       addr = set_next(frozen, addr)) {
+    TEST_ASSERT_TRUE(visited == 0 || last < set_get_entry(frozen, addr));
+    last = set_get_entry(frozen, addr);
+    visited++;
+  }
+  TEST_ASSERT_EQUAL(1000, visited);
+
+  set_free(frozen);
+}
+
+void test_freeze_flat_with_collisions(void) {
+  flat_set_t set;
+  set_init(set, colliding_hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 3000; i += 2) {
+    set_add(set, i);
+  }
+
+  frozen_set_t frozen;
+  set_freeze(frozen, set);
+
+  TEST_ASSERT_EQUAL(1500, set_size(frozen));
+  TEST_ASSERT_EQUAL(1000, frozen.frozen_count);
+  for (uint32_t i = 0; i < 3000; i++) {
+    TEST_ASSERT_EQUAL(i % 2 == 0, set_has(frozen, i));
+  }
+
+  set_free(set);
+  set_free(frozen);
+}
+
+void test_freeze_empty(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+
+  frozen_set_t frozen;
+  set_freeze(frozen, set);
+
+  TEST_ASSERT_EQUAL(0, set_size(frozen));
+  TEST_ASSERT_EQUAL(0, set_first(frozen));
+  TEST_ASSERT_EQUAL(false, set_has(frozen, 0));
+
+  set_free(set);
+  set_free(frozen);
+}
+
+void test_thaw(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 100; i++) {
+    set_add(set, i);
+  }
+
+  frozen_set_t frozen;
+  set_freeze(frozen, set);
+  set_free(set);
+
+  flat_set_t thawed;
+  set_thaw(thawed, frozen);
+  set_add(thawed, 100);
+  set_remove(thawed, 0);
+
+  TEST_ASSERT_EQUAL(100, set_size(thawed));
+  TEST_ASSERT_EQUAL(true, set_has(thawed, 100));
+  TEST_ASSERT_EQUAL(false, set_has(thawed, 0));
+  TEST_ASSERT_EQUAL(true, set_has(frozen, 0));
+
+  set_free(frozen);
+  set_free(thawed);
+}
+
+void test_frozen_map(void) {
+  map_t map;
+  map_init(map, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 500; i++) {
+    map_add(map, i, i * 3);
+  }
+
+  frozen_map_t frozen;
+  map_freeze(frozen, map);
+  map_free(map);
+
+  TEST_ASSERT_EQUAL(500, map_size(frozen));
+  TEST_ASSERT_EQUAL(30, *map_get(frozen, 10));
+  TEST_ASSERT_NULL(map_get(frozen, 500));
+
+  frozen_map_t clone = map_clone(frozen);
+  map_free(frozen);
+  TEST_ASSERT_EQUAL(1497, *map_get(clone, 499));
+
+  map_t thawed;
+  map_thaw(thawed, clone);
+  TEST_ASSERT_EQUAL(3, *map_get(thawed, 1));
+
+  map_free(clone);
+  map_free(thawed);
+}
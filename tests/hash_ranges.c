@@ -0,0 +1,160 @@
+#include <stdint.h>
+
+#include "set.h"
+#include "unity.h"
+
+uint64_t hash_fn(uint32_t value) { return value; }
+uint64_t colliding_hash_fn(uint32_t value) { return value / 4; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+typedef set_type_btree(uint32_t) btree_set_t;
+typedef set_type_frozen(uint32_t) frozen_set_t;
+typedef map_type(uint32_t, uint32_t) map_t;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// Entries are the multiples of 3 below 3000
+static bool expected(uint32_t i) { return i < 3000 && i % 3 == 0; }
+
+static size_t brute_count(uint64_t (*hash)(uint32_t), uint64_t lo,
+                          uint64_t hi) {
+  size_t count = 0;
+  for (uint32_t i = 0; i < 3000; i++) {
+    count += expected(i) && hash(i) >= lo && hash(i) < hi;
+  }
+  return count;
+}
+
+static uint64_t brute_lower_bound(uint64_t (*hash)(uint32_t), uint64_t h) {
+  for (uint32_t i = 0; i < 3000; i++) {
+    if (expected(i) && hash(i) >= h) {
+      return hash(i);
+    }
+  }
+  return UINT64_MAX;
+}
+
+#define check_ranges(set, hash)                                                \
+  do {                                                                         \
+    for (uint64_t lo = 0; lo < 3100; lo += 37) {                               \
+      tree_addr_t bound = set_lower_bound(set, lo);                            \
+      uint64_t bound_hash = brute_lower_bound(hash, lo);                       \
+      if (bound_hash == UINT64_MAX) {                                          \
+        TEST_ASSERT_EQUAL(0, bound);                                           \
+      } else {                                                                 \
+        TEST_ASSERT_EQUAL(bound_hash, hash(set_get_entry(set, bound)));        \
+      }                                                                        \
+      tree_addr_t upper = set_upper_bound(set, lo);                            \
+      uint64_t upper_hash = brute_lower_bound(hash, lo + 1);                   \
+      if (upper_hash == UINT64_MAX) {                                          \
+        TEST_ASSERT_EQUAL(0, upper);                                           \
+      } else {                                                                 \
+        TEST_ASSERT_EQUAL(upper_hash, hash(set_get_entry(set, upper)));        \
+      }                                                                        \
+      for (uint64_t hi = lo; hi < lo + 400; hi += 53) {                        \
+        size_t seen = 0;                                                       \
+        for (tree_addr_t cursor = set_range_first(set, lo, hi); cursor;        \
+             cursor = set_range_next(set, cursor, hi)) {                       \
+          uint64_t h = hash(set_get_entry(set, cursor));                       \
+          TEST_ASSERT_TRUE(h >= lo && h < hi);                                 \
+          seen++;                                                              \
+        }                                                                      \
+        TEST_ASSERT_EQUAL(brute_count(hash, lo, hi), seen);                    \
+        TEST_ASSERT_EQUAL(seen, set_count_range(set, lo, hi));                 \
+      }                                                                        \
+    }                                                                          \
+  } while (0)
+
+void test_tree_ranges(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 3000; i += 3) {
+    set_add(set, i);
+  }
+  check_ranges(set, hash_fn);
+  TEST_ASSERT_EQUAL(3, set_get_entry(set, set_lower_bound(set, 1)));
+  TEST_ASSERT_EQUAL(6, set_get_entry(set, set_upper_bound(set, 3)));
+  TEST_ASSERT_EQUAL(4, set_count_range(set, 0, 10));
+  set_free(set);
+}
+
+void test_btree_and_frozen_ranges(void) {
+  btree_set_t btree;
+  set_init(btree, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 3000; i += 3) {
+    set_add(btree, i);
+  }
+  check_ranges(btree, hash_fn);
+
+  frozen_set_t frozen;
+  set_freeze(frozen, btree);
+  check_ranges(frozen, hash_fn);
+  set_free(btree);
+  set_free(frozen);
+}
+
+// Bounds land on the first entry of a hash, and ranges take all of them
+void test_ranges_over_equal_hashes(void) {
+  set_t set;
+  btree_set_t btree;
+  set_init(set, colliding_hash_fn, equals_fn);
+  set_init(btree, colliding_hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 3000; i += 3) {
+    set_add(set, i);
+    set_add(btree, i);
+  }
+  frozen_set_t frozen;
+  set_freeze(frozen, btree);
+
+  // 0 and 3 hash to 0, 6 to 1 and 9 to 2
+  TEST_ASSERT_EQUAL(2, set_count_range(set, 0, 1));
+  TEST_ASSERT_EQUAL(6, set_get_entry(set, set_upper_bound(set, 0)));
+  TEST_ASSERT_EQUAL(2, set_count_range(frozen, 1, 3));
+  check_ranges(set, colliding_hash_fn);
+  check_ranges(btree, colliding_hash_fn);
+  check_ranges(frozen, colliding_hash_fn);
+
+  set_free(set);
+  set_free(btree);
+  set_free(frozen);
+}
+
+void test_range_edges(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  TEST_ASSERT_EQUAL(0, set_lower_bound(set, 0));
+  TEST_ASSERT_EQUAL(0, set_count_range(set, 0, UINT64_MAX));
+
+  set_add(set, 0);
+  set_add(set, UINT32_MAX);
+  TEST_ASSERT_EQUAL(0, set_upper_bound(set, UINT64_MAX));
+  TEST_ASSERT_EQUAL(UINT32_MAX,
+                    set_get_entry(set, set_upper_bound(set, 0)));
+  TEST_ASSERT_EQUAL(2, set_count_range(set, 0, UINT64_MAX));
+  TEST_ASSERT_EQUAL(0, set_count_range(set, 10, 5));
+  TEST_ASSERT_EQUAL(0, set_range_first(set, 1, UINT32_MAX));
+
+  set_free(set);
+}
+
+void test_map_ranges(void) {
+  map_t map;
+  map_init(map, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 100; i++) {
+    map_add(map, i, i * 10);
+  }
+
+  uint32_t sum = 0;
+  for (tree_addr_t cursor = map_range_first(map, 10, 20); cursor;
+       cursor = map_range_next(map, cursor, 20)) {
+    sum += map_get_value(map, cursor);
+  }
+  TEST_ASSERT_EQUAL(1450, sum);
+  TEST_ASSERT_EQUAL(10, map_count_range(map, 10, 20));
+  TEST_ASSERT_EQUAL(50, map_get_key(map, map_lower_bound(map, 50)));
+  TEST_ASSERT_EQUAL(51, map_get_key(map, map_upper_bound(map, 50)));
+
+  map_free(map);
+}
@@ -0,0 +1,124 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "set.h"
+#include "sethash.h"
+#include "setdebug.h"
+#include "unity.h"
+
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+bool equals_u64_fn(uint64_t a, uint64_t b) { return a == b; }
+bool str_equals_fn(const char *a, const char *b) { return strcmp(a, b) == 0; }
+
+typedef set_type(uint32_t) set_t;
+typedef set_type_flat(uint32_t) flat_set_t;
+typedef set_type_btree(uint32_t) btree_set_t;
+typedef map_type(uint64_t, uint32_t) map_t;
+typedef map_type(const char *, int) str_map_t;
+typedef set_type_bytes() bytes_set_t;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+#define ENTRY_COUNT 1003
+
+#define assert_hashed_ops(set_kind)                                            \
+  do {                                                                         \
+    set_kind set;                                                              \
+    set_init(set, set_hash_u32, equals_fn);                                    \
+    uint32_t entries[ENTRY_COUNT];                                             \
+    uint64_t hashes[ENTRY_COUNT];                                              \
+    for (uint32_t i = 0; i < ENTRY_COUNT; i++) {                               \
+      entries[i] = i * 7;                                                      \
+    }                                                                          \
+    set_hash_u32_many(entries, ENTRY_COUNT, SET_HASH_SEED, hashes);            \
+    for (size_t i = 0; i < ENTRY_COUNT; i++) {                                 \
+      TEST_ASSERT_TRUE(tree_is_valid_addr(                                     \
+          set_add_hashed(set, hashes[i], entries[i])));                        \
+    }                                                                          \
+    TEST_ASSERT_FALSE(                                                         \
+        tree_is_valid_addr(set_add_hashed(set, hashes[3], entries[3])));       \
+    TEST_ASSERT_EQUAL(ENTRY_COUNT, set_size(set));                             \
+    for (size_t i = 0; i < ENTRY_COUNT; i += 2) {                              \
+      set_remove_hashed(set, hashes[i], entries[i]);                           \
+    }                                                                          \
+    for (size_t i = 0; i < ENTRY_COUNT; i++) {                                 \
+      TEST_ASSERT_EQUAL(i % 2 == 1,                                            \
+                        set_has_hashed(set, hashes[i], entries[i]));           \
+      TEST_ASSERT_EQUAL(i % 2 == 1, set_has(set, entries[i]));                 \
+    }                                                                          \
+    set_free(set);                                                             \
+  } while (0)
+
+void test_hashed_tree_set(void) { assert_hashed_ops(set_t); }
+void test_hashed_flat_set(void) { assert_hashed_ops(flat_set_t); }
+void test_hashed_btree_set(void) { assert_hashed_ops(btree_set_t); }
+
+void test_hashed_map(void) {
+  map_t map;
+  map_init(map, set_hash_u64, equals_u64_fn);
+  uint64_t keys[ENTRY_COUNT];
+  uint64_t hashes[ENTRY_COUNT];
+  for (uint64_t i = 0; i < ENTRY_COUNT; i++) {
+    keys[i] = i << 40 | i;
+  }
+  set_hash_u64_many(keys, ENTRY_COUNT, SET_HASH_SEED, hashes);
+  for (size_t i = 0; i < ENTRY_COUNT; i++) {
+    map_add_hashed(map, hashes[i], keys[i], (uint32_t)i);
+  }
+  TEST_ASSERT_EQUAL(ENTRY_COUNT, map_size(map));
+  for (size_t i = 0; i < ENTRY_COUNT; i++) {
+    TEST_ASSERT_EQUAL(i, *map_get_hashed(map, hashes[i], keys[i]));
+    TEST_ASSERT_EQUAL(i, *map_get(map, keys[i]));
+  }
+  map_remove_hashed(map, hashes[5], keys[5]);
+  TEST_ASSERT_FALSE(map_has_hashed(map, hashes[5], keys[5]));
+  TEST_ASSERT_NULL(map_get_hashed(map, hashes[5], keys[5]));
+  TEST_ASSERT_TRUE(map_has_hashed(map, hashes[6], keys[6]));
+  map_free(map);
+}
+
+void test_many_matches_scalar(void) {
+  uint32_t small[37];
+  uint64_t large[37];
+  uint64_t out[37];
+  for (uint32_t i = 0; i < 37; i++) {
+    small[i] = i * 0x9E3779B9u;
+    large[i] = (uint64_t)i * 0x9E3779B97F4A7C15ull;
+  }
+  set_hash_u32_many(small, 37, 42, out);
+  for (size_t i = 0; i < 37; i++) {
+    TEST_ASSERT_TRUE(out[i] == set_hash_u32_seeded(small[i], 42));
+  }
+  set_hash_u64_many(large, 37, 42, out);
+  for (size_t i = 0; i < 37; i++) {
+    TEST_ASSERT_TRUE(out[i] == set_hash_u64_seeded(large[i], 42));
+  }
+  // Seeds change every hash
+  TEST_ASSERT_TRUE(set_hash_u64_seeded(large[1], 42) !=
+                   set_hash_u64_seeded(large[1], 43));
+
+  const char *strings[] = {"", "a", "foo", "a longer string than the others"};
+  set_hash_string_many(strings, 4, SET_HASH_SEED, out);
+  for (size_t i = 0; i < 4; i++) {
+    TEST_ASSERT_TRUE(out[i] == set_hash_string(strings[i]));
+    set_bytes_t key = {strings[i], strlen(strings[i])};
+    TEST_ASSERT_TRUE(out[i] == set_hash_bytes(key));
+  }
+}
+
+void test_builtin_hashers(void) {
+  str_map_t map;
+  map_init(map, set_hash_string, str_equals_fn);
+  map_add(map, "foo", 1);
+  map_add(map, "bar", 2);
+  TEST_ASSERT_EQUAL(2, *map_get(map, "bar"));
+  TEST_ASSERT_EQUAL(1, *map_get_hashed(map, set_hash_string("foo"), "foo"));
+  map_free(map);
+
+  bytes_set_t bytes;
+  set_bytes_init(bytes, set_hash_bytes);
+  TEST_ASSERT_TRUE(set_bytes_add(bytes, "foo", 3));
+  TEST_ASSERT_TRUE(set_bytes_has(bytes, "foobar", 3));
+  set_bytes_free(bytes);
+}
@@ -0,0 +1,151 @@
+#include <stdint.h>
+#include <unistd.h>
+
+#include "set.h"
+#include "setdebug.h"
+#include "unity.h"
+
+uint64_t hash_fn(uint32_t value) { return value; }
+uint64_t colliding_hash_fn(uint32_t value) { return value / 4; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+uint64_t wide_hash_fn(uint64_t value) { return value; }
+bool wide_equals_fn(uint64_t a, uint64_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+typedef set_type(uint64_t) wide_set_t;
+typedef map_type(uint32_t, uint64_t) map_t;
+
+static char path[64];
+
+void setUp(void) {
+  snprintf(path, sizeof(path), "/tmp/set_mmap_test_%d.bin", (int)getpid());
+}
+void tearDown(void) { remove(path); }
+
+static void flip_bit(long offset) {
+  FILE *file = fopen(path, "r+b");
+  fseek(file, offset, SEEK_SET);
+  int byte = fgetc(file);
+  fseek(file, offset, SEEK_SET);
+  fputc(byte ^ 1, file);
+  fclose(file);
+}
+
+static void build(set_t *set, uint32_t n) {
+  set_init((*set), colliding_hash_fn, equals_fn);
+  for (uint32_t i = 0; i < n; i++) {
+    uint32_t entry = i * 3;
+    set_add((*set), entry);
+  }
+  for (uint32_t i = 0; i < n; i += 5) {
+    uint32_t entry = i * 3;
+    set_remove((*set), entry);
+  }
+}
+
+void test_save_and_open(void) {
+  set_t set;
+  build(&set, 20000);
+  TEST_ASSERT_TRUE(set_save(set, path));
+  TEST_ASSERT_TRUE(set_file_verify(path));
+
+  set_t mapped;
+  TEST_ASSERT_TRUE(set_mmap_open(mapped, path, colliding_hash_fn, equals_fn));
+  TEST_ASSERT_EQUAL(set_size(set), set_size(mapped));
+  for (uint32_t i = 0; i < 60000; i++) {
+    TEST_ASSERT_EQUAL(set_has(set, i), set_has(mapped, i));
+  }
+  debug_node_blackheight(mapped.nodes, mapped.colors, mapped.inited,
+                         mapped.root, true, true);
+
+  // Walks in hash order as well
+  tree_addr_t a = set_first(set);
+  tree_addr_t b = set_first(mapped);
+  while (tree_is_valid_addr(a)) {
+    TEST_ASSERT_EQUAL(set_get_entry(set, a), set_get_entry(mapped, b));
+    a = set_next(set, a);
+    b = set_next(mapped, b);
+  }
+  TEST_ASSERT_FALSE(tree_is_valid_addr(b));
+
+  set_free(mapped);
+  set_free(set);
+}
+
+void test_mapped_set_is_writable(void) {
+  set_t set;
+  build(&set, 1000);
+  size_t size = set_size(set);
+  TEST_ASSERT_TRUE(set_save(set, path));
+  set_free(set);
+
+  set_t mapped;
+  TEST_ASSERT_TRUE(set_mmap_open(mapped, path, colliding_hash_fn, equals_fn));
+  set_remove(mapped, 3);
+  TEST_ASSERT_FALSE(set_has(mapped, 3));
+
+  // Grows out of the mapping into a block of its own
+  for (uint32_t i = 100000; i < 110000; i++) {
+    set_add(mapped, i);
+  }
+  TEST_ASSERT_EQUAL(0, mapped.mapped_bytes);
+  TEST_ASSERT_EQUAL(size - 1 + 10000, set_size(mapped));
+  TEST_ASSERT_TRUE(set_has(mapped, 6));
+  TEST_ASSERT_TRUE(set_has(mapped, 109999));
+  set_free(mapped);
+
+  // The file is untouched
+  TEST_ASSERT_TRUE(set_file_verify(path));
+  TEST_ASSERT_TRUE(set_mmap_open(mapped, path, colliding_hash_fn, equals_fn));
+  TEST_ASSERT_EQUAL(size, set_size(mapped));
+  TEST_ASSERT_TRUE(set_has(mapped, 3));
+  set_free(mapped);
+}
+
+void test_map(void) {
+  map_t map;
+  map_init(map, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 5000; i++) {
+    map_add(map, i, (uint64_t)i << 32);
+  }
+  TEST_ASSERT_TRUE(map_save(map, path));
+  map_free(map);
+
+  map_t mapped;
+  TEST_ASSERT_TRUE(map_mmap_open(mapped, path, hash_fn, equals_fn));
+  for (uint32_t i = 0; i < 5000; i++) {
+    TEST_ASSERT_EQUAL((uint64_t)i << 32, *map_get(mapped, i));
+  }
+  TEST_ASSERT_NULL(map_get(mapped, 5000));
+  map_free(mapped);
+}
+
+void test_rejects_bad_files(void) {
+  set_t set;
+  TEST_ASSERT_FALSE(set_mmap_open(set, path, hash_fn, equals_fn));
+
+  build(&set, 1000);
+  TEST_ASSERT_TRUE(set_save(set, path));
+  set_free(set);
+
+  // Another entry type
+  wide_set_t wide;
+  TEST_ASSERT_FALSE(set_mmap_open(wide, path, wide_hash_fn, wide_equals_fn));
+
+  // A flipped bit in the data only shows up in a full check
+  flip_bit(SET_FILE_HEADER_SIZE + 100);
+  TEST_ASSERT_FALSE(set_file_verify(path));
+  TEST_ASSERT_TRUE(set_mmap_open(set, path, hash_fn, equals_fn));
+  set_free(set);
+
+  // One in the header is caught on open
+  flip_bit(20);
+  TEST_ASSERT_FALSE(set_mmap_open(set, path, hash_fn, equals_fn));
+
+  // As is a truncated file
+  build(&set, 1000);
+  TEST_ASSERT_TRUE(set_save(set, path));
+  set_free(set);
+  TEST_ASSERT_EQUAL(0, truncate(path, 4096));
+  TEST_ASSERT_FALSE(set_mmap_open(set, path, hash_fn, equals_fn));
+}
@@ -0,0 +1,123 @@
+#include <signal.h>
+#include <stdint.h>
+
+#define SET_NODE_FLAGS true
+#include "set.h"
+#include "setdebug.h"
+#include "unity.h"
+
+uint64_t hash_fn(uint32_t value) { return value; }
+uint64_t colliding_hash_fn(uint32_t value) { return value / 4; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// The bits in the nodes must agree with the bitmaps of every live slot
+static void assert_flags_match(set_t set) {
+  set_foreach_unordered(set, addr) {
+    tree_idx_t idx = tree_idx(addr);
+    TEST_ASSERT_TRUE(set.nodes[idx].inited_bit);
+    TEST_ASSERT_EQUAL(set.colors[idx / 8] >> (idx % 8) & 1,
+                      set.nodes[idx].colors_bit);
+  }
+  debug_node_blackheight(set.nodes, set.colors, set.inited, set.root, true,
+                         true);
+}
+
+void test_node_is_no_larger(void) {
+  TEST_ASSERT_EQUAL(24, sizeof(tree_node_t));
+}
+
+void test_add_remove_stress(void) {
+  set_t set;
+  set_init(set, colliding_hash_fn, equals_fn);
+
+  srand(7);
+  for (uint32_t i = 0; i < 20000; i++) {
+    uint32_t added = rand() % 5000;
+    set_add(set, added);
+    if (i % 3 == 0) {
+      uint32_t removed = rand() % 5000;
+      set_remove(set, removed);
+    }
+  }
+  assert_flags_match(set);
+
+  for (uint32_t i = 0; i < 5000; i++) {
+    set_remove(set, i);
+  }
+  TEST_ASSERT_EQUAL(0, set_size(set));
+  TEST_ASSERT_FALSE(tree_is_inited(set, set.root));
+  set_free(set);
+}
+
+void test_rebuilt_trees(void) {
+  uint32_t entries[3000];
+  for (uint32_t i = 0; i < 3000; i++) {
+    entries[i] = i * 3;
+  }
+  set_t set;
+  set_from_array(set, entries, 3000, hash_fn, equals_fn);
+  assert_flags_match(set);
+
+  for (uint32_t i = 0; i < 3000; i += 2) {
+    set_remove(set, i * 3);
+  }
+  set_compact(set, SET_LAYOUT_VEB);
+  assert_flags_match(set);
+  for (uint32_t i = 0; i < 3000; i++) {
+    TEST_ASSERT_EQUAL(i % 2 == 1, set_has(set, i * 3));
+  }
+
+  set_t clone = set_clone(set);
+  set_add(clone, 1);
+  assert_flags_match(clone);
+  TEST_ASSERT_TRUE(set_has(clone, 1));
+  TEST_ASSERT_FALSE(set_has(set, 1));
+  set_free(clone);
+  set_free(set);
+}
+
+// Whether running step in a child process stops it with abort()
+static bool aborts(void (*step)(void)) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    step();
+    _exit(0);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  return WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT;
+}
+
+static void reserve_past_limit(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  set_reserve(set, 1u << 30);
+}
+
+// A full set at the limit, which grows before writing anything
+static void grow_past_limit(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  set.capacity = TREE_MAX_CAPACITY;
+  set.free_list_start = 0;
+  set_add(set, 1);
+}
+
+static void reserve_within_limit(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  set_reserve(set, 4);
+}
+
+// Subtree counts have 30 bits, so sets must stop short of 2^30 slots
+void test_capacity_limit(void) {
+  TEST_ASSERT_EQUAL(1u << 30, TREE_MAX_CAPACITY);
+  TEST_ASSERT_TRUE(aborts(reserve_past_limit));
+  TEST_ASSERT_TRUE(aborts(grow_past_limit));
+  TEST_ASSERT_FALSE(aborts(reserve_within_limit));
+}
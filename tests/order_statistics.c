@@ -0,0 +1,148 @@
+#include <stdint.h>
+
+#include "set.h"
+#include "setdebug.h"
+#include "unity.h"
+
+uint64_t hash_fn(uint32_t value) { return value; }
+uint64_t colliding_hash_fn(uint32_t value) { return value / 4; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static void assert_counts_consistent(set_t set) {
+  tree_addr_t cursor = tree_first(set);
+  size_t rank = 0;
+  while (tree_is_valid_addr(cursor)) {
+    tree_node_t *node = tree_get_node(set, cursor);
+    TEST_ASSERT_EQUAL(1 + tree_count(set, node->left) +
+                          tree_count(set, node->right),
+                      node->count);
+    TEST_ASSERT_EQUAL(rank, tree_rank_addr(set, cursor));
+    TEST_ASSERT_EQUAL(cursor, set_select(set, rank));
+    rank++;
+    cursor = tree_next(set, cursor);
+  }
+  TEST_ASSERT_EQUAL(rank, set_size(set));
+  TEST_ASSERT_EQUAL(rank, tree_count(set, set.root));
+}
+
+void test_size_is_tracked(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+
+  TEST_ASSERT_EQUAL(0, set_size(set));
+
+  set_add(set, 4);
+  set_add(set, 8);
+  set_add(set, 4);
+  TEST_ASSERT_EQUAL(2, set_size(set));
+
+  set_remove(set, 15);
+  TEST_ASSERT_EQUAL(2, set_size(set));
+
+  set_remove(set, 4);
+  TEST_ASSERT_EQUAL(1, set_size(set));
+
+  set_empty(set);
+  TEST_ASSERT_EQUAL(0, set_size(set));
+
+  set_free(set);
+}
+
+void test_select_and_rank(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+
+  for (uint32_t i = 0; i < 100; i++) {
+    set_add(set, i * 3);
+  }
+
+  for (uint32_t i = 0; i < 100; i++) {
+    TEST_ASSERT_EQUAL(i * 3, set_get_entry(set, set_select(set, i)));
+    TEST_ASSERT_EQUAL(i, set_rank(set, i * 3));
+  }
+
+  TEST_ASSERT_EQUAL(0, set_select(set, 100));
+
+  // Entries that are not in the set rank by the amount of lower hashes
+  TEST_ASSERT_EQUAL(1, set_rank(set, 1));
+  TEST_ASSERT_EQUAL(100, set_rank(set, 1000));
+
+  assert_counts_consistent(set);
+
+  set_free(set);
+}
+
+void test_counts_survive_removals(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+
+  srand(1);
+  for (uint32_t i = 0; i < 2000; i++) {
+    uint32_t added = rand() % 1000;
+    set_add(set, added);
+    if (i % 3 == 0) {
+      uint32_t removed = rand() % 1000;
+      set_remove(set, removed);
+    }
+  }
+
+  assert_counts_consistent(set);
+  debug_node_blackheight(set.nodes, set.colors, set.inited, set.root, true,
+                         true);
+
+  while (set_size(set) > 0) {
+    set_remove(set, set_get_entry(set, set.root));
+  }
+  TEST_ASSERT_EQUAL(0, tree_count(set, set.root));
+
+  set_free(set);
+}
+
+void test_counts_with_collisions(void) {
+  set_t set;
+  set_init(set, colliding_hash_fn, equals_fn);
+
+  for (uint32_t i = 0; i < 64; i++) {
+    set_add(set, i);
+  }
+  set_remove(set, 5);
+  set_remove(set, 6);
+
+  TEST_ASSERT_EQUAL(62, set_size(set));
+  TEST_ASSERT_EQUAL(7, set_rank(set, 9));
+  TEST_ASSERT_EQUAL(4, set_rank(set, 5));
+  assert_counts_consistent(set);
+
+  set_free(set);
+}
+
+void test_random_sample(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+
+  for (uint32_t i = 0; i < 50; i++) {
+    set_add(set, i);
+  }
+
+  tree_addr_t sample[60];
+  srand(7);
+  size_t written = set_random_sample(set, 20, sample);
+  TEST_ASSERT_EQUAL(20, written);
+
+  for (size_t i = 0; i < written; i++) {
+    TEST_ASSERT_EQUAL(true, tree_is_inited(set, sample[i]));
+    for (size_t j = i + 1; j < written; j++) {
+      TEST_ASSERT_NOT_EQUAL(sample[i], sample[j]);
+    }
+  }
+
+  written = set_random_sample(set, 60, sample);
+  TEST_ASSERT_EQUAL(50, written);
+
+  set_free(set);
+}
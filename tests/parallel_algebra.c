@@ -0,0 +1,122 @@
+#include <stdint.h>
+
+// Small ranges, so that the test sets are split across every thread
+#define SET_PARALLEL_MIN_RANGE 64
+#include "set.h"
+#include "setdebug.h"
+#include "unity.h"
+
+uint64_t colliding_hash_fn(uint32_t value) { return value / 4; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+set_declare_parallel(set, set_t)
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static void assert_same(set_t expected, set_t actual) {
+  TEST_ASSERT_EQUAL(set_size(expected), set_size(actual));
+  tree_addr_t cursor = set_first(actual);
+  for (tree_addr_t other = set_first(expected); tree_is_valid_addr(other);
+       other = set_next(expected, other)) {
+    TEST_ASSERT_EQUAL(set_get_entry(expected, other),
+                      set_get_entry(actual, cursor));
+    cursor = set_next(actual, cursor);
+  }
+  debug_node_blackheight(actual.nodes, actual.colors, actual.inited,
+                         actual.root, true, true);
+}
+
+// a holds the multiples of 2 and b those of 3, hashed so that groups of
+// four entries collide
+static void make_inputs(set_t *a, set_t *b, uint32_t a_size,
+                        uint32_t b_size) {
+  set_init((*a), colliding_hash_fn, equals_fn);
+  set_init((*b), colliding_hash_fn, equals_fn);
+  for (uint32_t i = 0; i < a_size; i++) {
+    set_add((*a), i * 2);
+  }
+  for (uint32_t i = 0; i < b_size; i++) {
+    set_add((*b), i * 3);
+  }
+}
+
+void test_union_parallel(void) {
+  set_t a;
+  set_t b;
+  make_inputs(&a, &b, 3000, 2000);
+  set_t expected;
+  set_union(expected, a, b);
+  for (size_t threads = 1; threads <= 8; threads++) {
+    set_t actual;
+    set_union_parallel(&actual, &a, &b, threads);
+    assert_same(expected, actual);
+    set_free(actual);
+  }
+  set_free(expected);
+  set_free(a);
+  set_free(b);
+}
+
+void test_intersect_parallel(void) {
+  set_t a;
+  set_t b;
+  make_inputs(&a, &b, 3000, 2000);
+  set_t expected;
+  set_intersect(expected, a, b);
+  for (size_t threads = 1; threads <= 8; threads++) {
+    set_t actual;
+    set_intersect_parallel(&actual, &a, &b, threads);
+    assert_same(expected, actual);
+    set_free(actual);
+  }
+  set_free(expected);
+  set_free(a);
+  set_free(b);
+}
+
+void test_difference_parallel(void) {
+  set_t a;
+  set_t b;
+  make_inputs(&a, &b, 3000, 2000);
+  set_t expected;
+  set_t actual;
+  set_difference(expected, a, b);
+  set_difference_parallel(&actual, &a, &b, 5);
+  assert_same(expected, actual);
+  set_free(expected);
+  set_free(actual);
+
+  // Ranges are cut from the larger input, here the one taken away
+  set_difference(expected, b, a);
+  set_difference_parallel(&actual, &b, &a, 5);
+  assert_same(expected, actual);
+  set_free(expected);
+  set_free(actual);
+  set_free(a);
+  set_free(b);
+}
+
+// Too few entries for a range per thread, so fewer threads run
+void test_small_inputs(void) {
+  set_t a;
+  set_t b;
+  make_inputs(&a, &b, 3, 7);
+  set_t expected;
+  set_t actual;
+  set_union(expected, a, b);
+  set_union_parallel(&actual, &a, &b, 8);
+  assert_same(expected, actual);
+  set_free(expected);
+  set_free(actual);
+  set_free(a);
+  set_free(b);
+
+  make_inputs(&a, &b, 0, 0);
+  set_intersect_parallel(&actual, &a, &b, 4);
+  TEST_ASSERT_EQUAL(0, set_size(actual));
+  set_free(actual);
+  set_free(a);
+  set_free(b);
+}
@@ -0,0 +1,162 @@
+#include <stdint.h>
+
+#include "set.h"
+#include "setdebug.h"
+#include "unity.h"
+
+uint64_t hash_fn(uint32_t value) { return value; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+typedef set_type_flat(uint32_t) flat_set_t;
+typedef set_type_btree(uint32_t) btree_set_t;
+typedef map_type(uint32_t, uint64_t) map_t;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static bool is_aligned(const void *ptr) { return (uintptr_t)ptr % 64 == 0; }
+
+void test_single_block(void) {
+  debug_counting_allocator_t counter;
+  debug_counting_allocator_init(&counter);
+  map_t map;
+  map_init_with_allocator(map, hash_fn, equals_fn, &counter.allocator);
+  TEST_ASSERT_EQUAL(1, counter.calls);
+
+  // Every column starts on a cache line, in order, inside the node block
+  const char *base = (const char *)map.nodes;
+  const void *columns[] = {map.nodes,  map.collisions, map.free_list,
+                           map.keys,   map.values,     map.colors,
+                           map.inited};
+  for (size_t i = 0; i < sizeof(columns) / sizeof(*columns); i++) {
+    TEST_ASSERT_TRUE(is_aligned(columns[i]));
+    TEST_ASSERT_TRUE((const char *)columns[i] >= base);
+  }
+  TEST_ASSERT_TRUE((const char *)map.keys >=
+                   (const char *)(map.free_list + map.capacity));
+  TEST_ASSERT_TRUE((const char *)map.values >=
+                   (const char *)(map.keys + map.capacity));
+
+  // One call per growth
+  size_t capacity = map.capacity;
+  size_t growths = 0;
+  for (uint32_t i = 0; i < 5000; i++) {
+    map_add(map, i, (uint64_t)i * 3);
+    if (map.capacity != capacity) {
+      capacity = map.capacity;
+      growths++;
+    }
+  }
+  TEST_ASSERT_EQUAL(1 + growths, counter.calls);
+  for (uint32_t i = 0; i < 5000; i++) {
+    TEST_ASSERT_EQUAL((uint64_t)i * 3, *map_get(map, i));
+  }
+  debug_node_blackheight(map.nodes, map.colors, map.inited, map.root, true,
+                         true);
+  map_free(map);
+}
+
+void test_reserve(void) {
+  debug_counting_allocator_t counter;
+  debug_counting_allocator_init(&counter);
+  set_t set;
+  set_init_with_allocator(set, hash_fn, equals_fn, &counter.allocator);
+  for (uint32_t i = 0; i < 100; i++) {
+    set_add(set, i);
+  }
+  set_reserve(set, 20000);
+  TEST_ASSERT_EQUAL(2, counter.calls);
+  size_t capacity = set.capacity;
+  for (uint32_t i = 100; i < 20000; i++) {
+    set_add(set, i);
+  }
+  TEST_ASSERT_EQUAL(capacity, set.capacity);
+  TEST_ASSERT_EQUAL(2, counter.calls);
+  for (uint32_t i = 0; i < 20000; i++) {
+    TEST_ASSERT_TRUE(set_has(set, i));
+  }
+
+  // Never shrinks
+  set_reserve(set, 10);
+  TEST_ASSERT_EQUAL(capacity, set.capacity);
+  set_free(set);
+
+  flat_set_t flat;
+  set_init(flat, hash_fn, equals_fn);
+  set_reserve(flat, 20000);
+  capacity = flat.capacity;
+  for (uint32_t i = 0; i < 20000; i++) {
+    set_add(flat, i);
+  }
+  TEST_ASSERT_EQUAL(capacity, flat.capacity);
+  set_free(flat);
+
+  btree_set_t btree;
+  set_init(btree, hash_fn, equals_fn);
+  set_reserve(btree, 20000);
+  capacity = btree.capacity;
+  for (uint32_t i = 0; i < 20000; i++) {
+    set_add(btree, i);
+  }
+  TEST_ASSERT_EQUAL(capacity, btree.capacity);
+  for (uint32_t i = 0; i < 20000; i++) {
+    TEST_ASSERT_TRUE(set_has(btree, i));
+  }
+  set_free(btree);
+}
+
+void test_growth_policy(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  set_growth_policy(set, 150, 0);
+  size_t capacity = set.capacity;
+  for (uint32_t i = 0; i < 5000; i++) {
+    set_add(set, i);
+    if (set.capacity != capacity) {
+      TEST_ASSERT_EQUAL((capacity * 3 / 2 + 7) / 8 * 8, set.capacity);
+      capacity = set.capacity;
+    }
+  }
+
+  // Clones keep the policy
+  set_t clone = set_clone(set);
+  TEST_ASSERT_EQUAL(150, clone.growth_percent);
+  set_free(clone);
+  set_free(set);
+
+  btree_set_t btree;
+  set_init(btree, hash_fn, equals_fn);
+  set_growth_policy(btree, 100, 1000);
+  capacity = btree.capacity;
+  for (uint32_t i = 0; i < 5000; i++) {
+    set_add(btree, i);
+    if (btree.capacity != capacity) {
+      TEST_ASSERT_EQUAL(capacity + 1000, btree.capacity);
+      capacity = btree.capacity;
+    }
+  }
+  for (uint32_t i = 0; i < 5000; i++) {
+    TEST_ASSERT_TRUE(set_has(btree, i));
+  }
+  set_free(btree);
+}
+
+void test_bulk_load(void) {
+  uint32_t entries[3000];
+  for (uint32_t i = 0; i < 3000; i++) {
+    entries[i] = i * 7;
+  }
+  flat_set_t flat;
+  set_from_array(flat, entries, 3000, hash_fn, equals_fn);
+  TEST_ASSERT_EQUAL(4096, flat.capacity);
+  TEST_ASSERT_EQUAL(3000, set_size(flat));
+  set_free(flat);
+
+  set_t set;
+  set_from_array(set, entries, 3000, hash_fn, equals_fn);
+  size_t capacity = set.capacity;
+  set_reserve(set, 3000);
+  TEST_ASSERT_EQUAL(capacity, set.capacity);
+  set_free(set);
+}
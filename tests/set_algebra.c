@@ -0,0 +1,176 @@
+#include <stdint.h>
+
+#include "set.h"
+#include "setdebug.h"
+#include "unity.h"
+
+uint64_t colliding_hash_fn(uint32_t value) { return value / 4; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+typedef set_type_btree(uint32_t) btree_set_t;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static void add_range(set_t *set, uint32_t from, uint32_t to, uint32_t step) {
+  for (uint32_t i = from; i < to; i += step) {
+    set_add((*set), i);
+  }
+}
+
+static void assert_members(set_t set, bool (*expected)(uint32_t)) {
+  size_t count = 0;
+  for (uint32_t i = 0; i < 3000; i++) {
+    TEST_ASSERT_EQUAL(expected(i), set_has(set, i));
+    count += expected(i);
+  }
+  TEST_ASSERT_EQUAL(count, set_size(set));
+  debug_node_blackheight(set.nodes, set.colors, set.inited, set.root, true,
+                         true);
+}
+
+// a holds the multiples of 2 below 2000, b 1000 and the multiples of 3 from
+// 1002 on
+static bool in_a(uint32_t i) { return i < 2000 && i % 2 == 0; }
+static bool in_b(uint32_t i) {
+  return i == 1000 || (i >= 1002 && i < 3000 && i % 3 == 0);
+}
+
+// a and b from in_a and in_b, hashed so that groups of four entries collide
+static void make_inputs(set_t *a, set_t *b) {
+  set_init((*a), colliding_hash_fn, equals_fn);
+  set_init((*b), colliding_hash_fn, equals_fn);
+  add_range(a, 0, 2000, 2);
+  add_range(b, 1002, 3000, 3);
+  set_add((*b), 1000); // Hash collides with 1001 and 1002
+}
+
+static bool in_union(uint32_t i) { return in_a(i) || in_b(i); }
+
+void test_union(void) {
+  set_t a;
+  set_t b;
+  set_t result;
+  make_inputs(&a, &b);
+  set_union(result, a, b);
+  assert_members(result, in_union);
+  TEST_ASSERT_TRUE(set_has(result, 1000));
+  TEST_ASSERT_TRUE(set_has(result, 1002));
+  set_free(result);
+  set_free(a);
+  set_free(b);
+}
+
+static bool in_intersection(uint32_t i) { return in_a(i) && in_b(i); }
+
+void test_intersect(void) {
+  set_t a;
+  set_t b;
+  set_t result;
+  make_inputs(&a, &b);
+  set_intersect(result, a, b);
+  assert_members(result, in_intersection);
+  // 1000 to 1003 share a hash, and are matched entry by entry
+  TEST_ASSERT_TRUE(set_has(result, 1000));
+  TEST_ASSERT_TRUE(set_has(result, 1002));
+  TEST_ASSERT_FALSE(set_has(result, 1001));
+  set_free(result);
+  set_free(a);
+  set_free(b);
+}
+
+static bool in_difference(uint32_t i) { return in_a(i) && !in_b(i); }
+
+void test_difference(void) {
+  set_t a;
+  set_t b;
+  set_t result;
+  make_inputs(&a, &b);
+  set_difference(result, a, b);
+  assert_members(result, in_difference);
+  TEST_ASSERT_FALSE(set_has(result, 1000));
+  set_free(result);
+
+  set_difference(result, b, a);
+  TEST_ASSERT_FALSE(set_has(result, 1002));
+  TEST_ASSERT_TRUE(set_has(result, 1005));
+  TEST_ASSERT_EQUAL(set_size(b) - 168, set_size(result));
+  set_free(result);
+  set_free(a);
+  set_free(b);
+}
+
+static bool in_symmetric_difference(uint32_t i) { return in_a(i) != in_b(i); }
+
+void test_symmetric_difference(void) {
+  set_t a;
+  set_t b;
+  set_t result;
+  make_inputs(&a, &b);
+  set_symmetric_difference(result, a, b);
+  assert_members(result, in_symmetric_difference);
+  set_free(result);
+  set_free(a);
+  set_free(b);
+}
+
+void test_unequal_sizes(void) {
+  set_t small;
+  set_t large;
+  set_init(small, colliding_hash_fn, equals_fn);
+  set_init(large, colliding_hash_fn, equals_fn);
+  add_range(&small, 0, 40, 4);
+  add_range(&large, 0, 20000, 2);
+  set_add(small, 7);
+
+  set_t result;
+  set_intersect(result, small, large);
+  TEST_ASSERT_EQUAL(10, set_size(result));
+  TEST_ASSERT_EQUAL(false, set_has(result, 7));
+  set_free(result);
+
+  set_intersect(result, large, small);
+  TEST_ASSERT_EQUAL(10, set_size(result));
+  set_free(result);
+
+  set_difference(result, small, large);
+  TEST_ASSERT_EQUAL(1, set_size(result));
+  TEST_ASSERT_EQUAL(true, set_has(result, 7));
+  set_free(result);
+
+  TEST_ASSERT_FALSE(set_is_subset(small, large));
+  set_remove(small, 7);
+  TEST_ASSERT_TRUE(set_is_subset(small, large));
+  TEST_ASSERT_FALSE(set_is_subset(large, small));
+
+  set_free(small);
+  set_free(large);
+}
+
+void test_subset_and_equals(void) {
+  set_t a;
+  btree_set_t b;
+  set_init(a, colliding_hash_fn, equals_fn);
+  set_init(b, colliding_hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 100; i++) {
+    set_add(a, i);
+    set_add(b, 99 - i);
+  }
+
+  TEST_ASSERT_TRUE(set_equals(a, b));
+  TEST_ASSERT_TRUE(set_is_subset(a, b));
+
+  // Same size and hashes, different entries
+  set_remove(b, 42);
+  set_add(b, 1000);
+  TEST_ASSERT_FALSE(set_equals(a, b));
+  TEST_ASSERT_FALSE(set_is_subset(b, a));
+
+  set_remove(b, 1000);
+  TEST_ASSERT_FALSE(set_equals(a, b));
+  TEST_ASSERT_TRUE(set_is_subset(b, a));
+
+  set_free(a);
+  set_free(b);
+}
@@ -0,0 +1,153 @@
+#include <pthread.h>
+#include <stdint.h>
+
+#include "set.h"
+#include "setdebug.h"
+#include "unity.h"
+
+#define THREAD_COUNT 8
+#define PER_THREAD 5000
+
+uint64_t hash_fn(uint32_t value) { return value * 0x9E3779B97F4A7C15ull; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_sharded_type(uint32_t, 16) sharded_set_t;
+typedef set_sharded_type_lock(uint32_t, 5, SET_SHARD_RWLOCK) rw_sharded_set_t;
+typedef map_sharded_type(uint32_t, uint32_t, 8) sharded_map_t;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static sharded_set_t shared_set;
+static rw_sharded_set_t shared_rw_set;
+
+static void *add_range(void *arg) {
+  uint32_t first = (uint32_t)(uintptr_t)arg * PER_THREAD;
+  for (uint32_t i = first; i < first + PER_THREAD; i++) {
+    set_sharded_add(shared_set, i);
+    // Every thread adds the entries of the next one as well
+    set_sharded_add(shared_set, (i + PER_THREAD) % (THREAD_COUNT * PER_THREAD));
+  }
+  return NULL;
+}
+
+static void *remove_odd(void *arg) {
+  uint32_t first = (uint32_t)(uintptr_t)arg * PER_THREAD;
+  for (uint32_t i = first + 1; i < first + PER_THREAD; i += 2) {
+    TEST_ASSERT_TRUE(set_sharded_remove(shared_set, i));
+  }
+  return NULL;
+}
+
+static void run_threads(void *(*fn)(void *)) {
+  pthread_t threads[THREAD_COUNT];
+  for (uintptr_t i = 0; i < THREAD_COUNT; i++) {
+    pthread_create(&threads[i], NULL, fn, (void *)i);
+  }
+  for (size_t i = 0; i < THREAD_COUNT; i++) {
+    pthread_join(threads[i], NULL);
+  }
+}
+
+void test_concurrent_adds_and_removes(void) {
+  set_sharded_init(shared_set, hash_fn, equals_fn);
+  run_threads(add_range);
+  TEST_ASSERT_EQUAL(THREAD_COUNT * PER_THREAD, set_sharded_size(shared_set));
+  for (uint32_t i = 0; i < THREAD_COUNT * PER_THREAD; i++) {
+    TEST_ASSERT_TRUE(set_sharded_has(shared_set, i));
+  }
+
+  run_threads(remove_odd);
+  TEST_ASSERT_EQUAL(THREAD_COUNT * PER_THREAD / 2,
+                    set_sharded_size(shared_set));
+  for (uint32_t i = 0; i < THREAD_COUNT * PER_THREAD; i++) {
+    TEST_ASSERT_EQUAL(i % 2 == 0, set_sharded_has(shared_set, i));
+  }
+  TEST_ASSERT_FALSE(set_sharded_remove(shared_set, 1));
+
+  for (size_t i = 0; i < set_sharded_shards(shared_set); i++) {
+    debug_node_blackheight(
+        shared_set.shards[i].shard.nodes, shared_set.shards[i].shard.colors,
+        shared_set.shards[i].shard.inited, shared_set.shards[i].shard.root,
+        true, true);
+  }
+  set_sharded_free(shared_set);
+}
+
+static void *add_and_look_up(void *arg) {
+  uint32_t first = (uint32_t)(uintptr_t)arg * PER_THREAD;
+  for (uint32_t i = first; i < first + PER_THREAD; i++) {
+    TEST_ASSERT_TRUE(set_sharded_add(shared_rw_set, i));
+    TEST_ASSERT_TRUE(set_sharded_has(shared_rw_set, i));
+    TEST_ASSERT_FALSE(set_sharded_add(shared_rw_set, i));
+  }
+  return NULL;
+}
+
+void test_rwlock_shards(void) {
+  set_sharded_init(shared_rw_set, hash_fn, equals_fn);
+  TEST_ASSERT_EQUAL(5, set_sharded_shards(shared_rw_set));
+  run_threads(add_and_look_up);
+  TEST_ASSERT_EQUAL(THREAD_COUNT * PER_THREAD,
+                    set_sharded_size(shared_rw_set));
+  set_sharded_free(shared_rw_set);
+}
+
+void test_iteration_in_hash_order(void) {
+  sharded_set_t set;
+  set_sharded_init(set, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 10000; i++) {
+    set_sharded_add(set, i);
+  }
+
+  uint32_t *entries = malloc(sizeof(uint32_t) * set_sharded_size(set));
+  TEST_ASSERT_EQUAL(10000, set_sharded_to_array(set, entries));
+  for (size_t i = 1; i < 10000; i++) {
+    TEST_ASSERT_TRUE(hash_fn(entries[i - 1]) < hash_fn(entries[i]));
+  }
+  free(entries);
+
+  // A snapshot per shard, walked while the shards keep changing
+  typeof(set.shards[0].shard) views[16];
+  for (size_t i = 0; i < set_sharded_shards(set); i++) {
+    views[i] = set_sharded_snapshot(set, i);
+  }
+  for (uint32_t i = 10000; i < 11000; i++) {
+    set_sharded_add(set, i);
+  }
+  size_t seen = 0;
+  for (size_t i = 0; i < set_sharded_shards(set); i++) {
+    set_foreach_unordered(views[i], addr) {
+      TEST_ASSERT_TRUE(set_get_entry(views[i], addr) < 10000);
+      seen++;
+    }
+    set_free(views[i]);
+  }
+  TEST_ASSERT_EQUAL(10000, seen);
+  set_sharded_free(set);
+}
+
+void test_sharded_map(void) {
+  sharded_map_t map;
+  map_sharded_init(map, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 1000; i++) {
+    TEST_ASSERT_TRUE(map_sharded_add(map, i, i * 2));
+  }
+  TEST_ASSERT_FALSE(map_sharded_add(map, 7, 0));
+
+  uint32_t value = 0;
+  TEST_ASSERT_TRUE(map_sharded_get(map, 7, &value));
+  TEST_ASSERT_EQUAL(14, value);
+  TEST_ASSERT_FALSE(map_sharded_get(map, 1000, &value));
+  TEST_ASSERT_TRUE(map_sharded_has(map, 999));
+  TEST_ASSERT_TRUE(map_sharded_remove(map, 999));
+  TEST_ASSERT_FALSE(map_sharded_has(map, 999));
+
+  uint32_t keys[1000];
+  uint32_t values[1000];
+  TEST_ASSERT_EQUAL(999, map_sharded_to_arrays(map, keys, values));
+  for (size_t i = 0; i < 999; i++) {
+    TEST_ASSERT_EQUAL(keys[i] * 2, values[i]);
+  }
+  map_sharded_free(map);
+}
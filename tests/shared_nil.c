@@ -0,0 +1,106 @@
+#include <stdint.h>
+
+#define SET_SHARED_NIL true
+#include "set.h"
+#include "setdebug.h"
+#include "unity.h"
+
+uint64_t hash_fn(uint32_t value) { return value; }
+uint64_t colliding_hash_fn(uint32_t value) { return value / 4; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static void assert_leaves_shared(set_t set, tree_addr_t addr) {
+  if (!tree_is_inited(set, addr)) {
+    TEST_ASSERT_EQUAL(TREE_SHARED_NIL_ADDR, addr);
+    return;
+  }
+  tree_node_t *node = tree_get_node(set, addr);
+  TEST_ASSERT_EQUAL(1 + tree_count(set, node->left) +
+                        tree_count(set, node->right),
+                    node->count);
+  assert_leaves_shared(set, node->left);
+  assert_leaves_shared(set, node->right);
+}
+
+void test_one_slot_per_entry(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+
+  TEST_ASSERT_EQUAL(TREE_SHARED_NIL_ADDR, set.root);
+
+  // 511 entries and the sentinel fill the first chunk exactly
+  for (uint32_t i = 0; i < ALLOC_CHUNK - 1; i++) {
+    set_add(set, i);
+  }
+  TEST_ASSERT_EQUAL(ALLOC_CHUNK, set.capacity);
+
+  set_add(set, ALLOC_CHUNK);
+  TEST_ASSERT_EQUAL(ALLOC_CHUNK * 2, set.capacity);
+  TEST_ASSERT_EQUAL(ALLOC_CHUNK, set_size(set));
+
+  assert_leaves_shared(set, set.root);
+
+  set_free(set);
+}
+
+void test_add_remove_stress(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+
+  srand(3);
+  for (uint32_t i = 0; i < 3000; i++) {
+    uint32_t added = rand() % 1000;
+    set_add(set, added);
+    if (i % 2 == 0) {
+      uint32_t removed = rand() % 1000;
+      set_remove(set, removed);
+    }
+  }
+
+  debug_node_blackheight(set.nodes, set.colors, set.inited, set.root, true,
+                         true);
+  assert_leaves_shared(set, set.root);
+
+  size_t rank = 0;
+  tree_addr_t cursor = tree_first(set);
+  while (tree_is_valid_addr(cursor)) {
+    TEST_ASSERT_EQUAL(cursor, set_select(set, rank));
+    rank++;
+    cursor = tree_next(set, cursor);
+  }
+  TEST_ASSERT_EQUAL(rank, set_size(set));
+
+  while (set_size(set) > 0) {
+    set_remove(set, set_get_entry(set, set.root));
+  }
+  TEST_ASSERT_EQUAL(TREE_SHARED_NIL_ADDR, set.root);
+
+  set_free(set);
+}
+
+void test_collisions(void) {
+  set_t set;
+  set_init(set, colliding_hash_fn, equals_fn);
+
+  for (uint32_t i = 0; i < 64; i++) {
+    set_add(set, i);
+  }
+  set_remove(set, 5);
+  set_remove(set, 6);
+
+  TEST_ASSERT_EQUAL(62, set_size(set));
+  for (uint32_t i = 0; i < 64; i++) {
+    TEST_ASSERT_EQUAL(i != 5 && i != 6, set_has(set, i));
+  }
+
+  debug_node_blackheight(set.nodes, set.colors, set.inited, set.root, true,
+                         true);
+  assert_leaves_shared(set, set.root);
+
+  set_free(set);
+}
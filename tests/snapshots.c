@@ -0,0 +1,175 @@
+#include <stdint.h>
+
+#include "set.h"
+#include "setdebug.h"
+#include "unity.h"
+
+uint64_t hash_fn(uint32_t value) { return value; }
+uint64_t colliding_hash_fn(uint32_t value) { return value / 4; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+typedef set_type_flat(uint32_t) flat_set_t;
+typedef map_type(uint32_t, uint32_t) map_t;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static void assert_range(set_t set, uint32_t lo, uint32_t hi) {
+  TEST_ASSERT_EQUAL(hi - lo, set_size(set));
+  for (uint32_t i = lo; i < hi; i++) {
+    TEST_ASSERT_TRUE(set_has(set, i));
+  }
+  TEST_ASSERT_FALSE(set_has(set, hi));
+  debug_node_blackheight(set.nodes, set.colors, set.inited, set.root, true,
+                         true);
+}
+
+// How many chunks two handles on the same storage both map
+static size_t count_shared(const tree_cow_t *cow, const uint32_t *a,
+                           const uint32_t *b) {
+  size_t shared = 0;
+  for (size_t i = 0; i < cow->chunks; i++) {
+    shared += ((a[i] ^ b[i]) & ~TREE_COW_OWNED) == 0;
+  }
+  return shared;
+}
+#define shared_chunks(a, b)                                                    \
+  count_shared((a).cow, (a).cow_chunks, (b).cow_chunks)
+
+void test_snapshot_shares_until_written(void) {
+  set_t set;
+  set_init(set, colliding_hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 200000; i++) {
+    set_add(set, i);
+  }
+
+  set_t snapshot = set_snapshot(set);
+  TEST_ASSERT_EQUAL_PTR(set.cow, snapshot.cow);
+  size_t chunks = set.cow->chunks;
+  TEST_ASSERT_TRUE(chunks > 16);
+  TEST_ASSERT_EQUAL(chunks, shared_chunks(set, snapshot));
+
+  // Lookups on either side copy nothing
+  TEST_ASSERT_TRUE(set_has(set, 10));
+  TEST_ASSERT_TRUE(set_has(snapshot, 10));
+  TEST_ASSERT_EQUAL(chunks, shared_chunks(set, snapshot));
+
+  // A write copies the few chunks it lands on, not the whole block
+  set_remove(set, 10);
+  TEST_ASSERT_TRUE(shared_chunks(set, snapshot) < chunks);
+  TEST_ASSERT_TRUE(shared_chunks(set, snapshot) > chunks * 3 / 4);
+  TEST_ASSERT_FALSE(set_has(set, 10));
+  assert_range(snapshot, 0, 200000);
+
+  for (uint32_t i = 200000; i < 300000; i++) {
+    set_add(set, i);
+  }
+  TEST_ASSERT_EQUAL(299999, set_size(set));
+  assert_range(snapshot, 0, 200000);
+
+  set_free(set);
+  assert_range(snapshot, 0, 200000);
+  set_free(snapshot);
+}
+
+void test_snapshots_released_independently(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  set_t snapshots[4];
+  for (uint32_t i = 0; i < 4; i++) {
+    for (uint32_t j = i * 100; j < (i + 1) * 100; j++) {
+      set_add(set, j);
+    }
+    snapshots[i] = set_snapshot(set);
+  }
+  // Two views of the same version share every chunk
+  set_t twin = set_snapshot(set);
+  TEST_ASSERT_EQUAL(twin.cow->chunks, shared_chunks(snapshots[3], twin));
+
+  set_free(snapshots[1]);
+  set_free(set);
+  assert_range(snapshots[0], 0, 100);
+  assert_range(snapshots[2], 0, 300);
+  set_free(snapshots[3]);
+  assert_range(twin, 0, 400);
+  set_free(twin);
+  set_free(snapshots[2]);
+  assert_range(snapshots[0], 0, 100);
+  set_free(snapshots[0]);
+}
+
+void test_growth_and_compaction_while_shared(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 500; i++) {
+    set_add(set, i);
+  }
+  set_t before_reserve = set_snapshot(set);
+  set_reserve(set, 100000);
+  TEST_ASSERT_TRUE(set.nodes != before_reserve.nodes);
+  set_t before_compact = set_snapshot(set);
+  set_compact(set, SET_LAYOUT_VEB);
+  set_add(set, 500);
+
+  assert_range(set, 0, 501);
+  assert_range(before_reserve, 0, 500);
+  assert_range(before_compact, 0, 500);
+  set_free(before_compact);
+  set_free(before_reserve);
+  set_free(set);
+}
+
+void test_map_values_are_copied_on_write(void) {
+  map_t map;
+  map_init(map, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 100000; i++) {
+    map_add(map, i, i);
+  }
+
+  map_t snapshot = map_snapshot(map);
+  TEST_ASSERT_EQUAL(7, *map_get(snapshot, 7));
+  TEST_ASSERT_EQUAL_PTR(map.cow, snapshot.cow);
+  size_t chunks = map.cow->chunks;
+
+  // Handing out a value pointer copies the one chunk it is in
+  *map_get(map, 7) = 70;
+  TEST_ASSERT_EQUAL(chunks - 1, shared_chunks(map, snapshot));
+  map_remove(map, 8);
+  TEST_ASSERT_EQUAL(70, *map_get(map, 7));
+  TEST_ASSERT_NULL(map_get(map, 8));
+  TEST_ASSERT_EQUAL(7, *map_get(snapshot, 7));
+  TEST_ASSERT_EQUAL(8, *map_get(snapshot, 8));
+
+  map_free(snapshot);
+
+  // Once the last snapshot is gone, writes go in place again
+  tree_node_t *nodes = map.nodes;
+  uint32_t file_chunks[chunks];
+  for (size_t i = 0; i < chunks; i++) {
+    file_chunks[i] = map.cow_chunks[i] & ~TREE_COW_OWNED;
+  }
+  for (uint32_t i = 1000; i < 100000; i += 1000) {
+    map_remove(map, i);
+  }
+  TEST_ASSERT_EQUAL_PTR(nodes, map.nodes);
+  for (size_t i = 0; i < chunks; i++) {
+    TEST_ASSERT_EQUAL(file_chunks[i], map.cow_chunks[i] & ~TREE_COW_OWNED);
+  }
+  TEST_ASSERT_EQUAL(99900, map_size(map));
+  map_free(map);
+}
+
+void test_flat_snapshot_is_a_copy(void) {
+  flat_set_t flat;
+  set_init(flat, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 100; i++) {
+    set_add(flat, i);
+  }
+  flat_set_t snapshot = set_snapshot(flat);
+  set_remove(flat, 5);
+  TEST_ASSERT_TRUE(set_has(snapshot, 5));
+  TEST_ASSERT_EQUAL(100, set_size(snapshot));
+  set_free(snapshot);
+  set_free(flat);
+}
@@ -0,0 +1,263 @@
+#include <stdint.h>
+
+#include "set.h"
+#include "setdebug.h"
+#include "unity.h"
+
+uint64_t hash_fn(uint32_t value) { return value; }
+uint64_t colliding_hash_fn(uint32_t value) { return value / 4; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+typedef map_type(uint32_t, uint32_t) map_t;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static void assert_valid_tree(set_t set) {
+  debug_node_blackheight(set.nodes, set.colors, set.inited, set.root, true,
+                         true);
+  TEST_ASSERT_FALSE(tree_is_red(set, set.root));
+
+  size_t rank = 0;
+  uint64_t prev_hash = 0;
+  for (tree_addr_t cursor = tree_first(set); tree_is_valid_addr(cursor);
+       cursor = tree_next(set, cursor)) {
+    tree_node_t *node = tree_get_node(set, cursor);
+    if (tree_is_red(set, cursor)) {
+      TEST_ASSERT_FALSE(tree_is_red(set, node->left));
+      TEST_ASSERT_FALSE(tree_is_red(set, node->right));
+    }
+    TEST_ASSERT_EQUAL(1 + tree_count(set, node->left) +
+                          tree_count(set, node->right),
+                      node->count);
+    TEST_ASSERT_TRUE(rank == 0 || prev_hash <= node->hash);
+    prev_hash = node->hash;
+    rank++;
+  }
+  TEST_ASSERT_EQUAL(rank, set_size(set));
+}
+
+static void assert_range(set_t set, uint32_t from, uint32_t to,
+                         uint32_t limit) {
+  for (uint32_t i = 0; i < limit; i++) {
+    TEST_ASSERT_EQUAL(i >= from && i < to, set_has(set, i));
+  }
+  TEST_ASSERT_EQUAL(to - from, set_size(set));
+  assert_valid_tree(set);
+}
+
+// Adds 0 to n - 1 in a scrambled order
+static void add_scrambled(set_t *set, uint32_t n) {
+  for (uint32_t i = 0; i < n; i++) {
+    set_add((*set), (i * 7919) % n);
+  }
+}
+
+void test_split(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  add_scrambled(&set, 1000);
+
+  set_t lower;
+  set_t upper;
+  set_split(set, 499, lower, upper);
+  assert_range(lower, 0, 499, 1100);
+  assert_range(upper, 499, 1000, 1100);
+
+  // Both halves keep working on their own
+  for (uint32_t i = 0; i < 499; i += 2) {
+    set_remove(lower, i);
+  }
+  for (uint32_t i = 1000; i < 1100; i++) {
+    set_add(upper, i);
+  }
+  assert_valid_tree(lower);
+  TEST_ASSERT_EQUAL(249, set_size(lower));
+  assert_range(upper, 499, 1100, 1200);
+
+  set_free(lower);
+  set_free(upper);
+}
+
+void test_split_at_the_ends(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  add_scrambled(&set, 1000);
+  set_t lower;
+  set_t upper;
+  set_split(set, 0, lower, upper);
+  assert_range(lower, 0, 0, 1100);
+  assert_range(upper, 0, 1000, 1100);
+  set_free(lower);
+
+  set_split(upper, 1000, lower, upper);
+  assert_range(lower, 0, 1000, 1100);
+  assert_range(upper, 0, 0, 1100);
+  set_free(upper);
+
+  set_split(lower, 999, lower, upper);
+  assert_range(lower, 0, 999, 1100);
+  assert_range(upper, 999, 1000, 1100);
+  set_free(lower);
+  set_free(upper);
+}
+
+void test_split_keeps_equal_hashes_together(void) {
+  set_t set;
+  set_init(set, colliding_hash_fn, equals_fn);
+  add_scrambled(&set, 1000);
+
+  // 400 to 403 all hash to 100
+  set_t lower;
+  set_t upper;
+  set_split(set, 100, lower, upper);
+  assert_range(lower, 0, 400, 1100);
+  assert_range(upper, 400, 1000, 1100);
+  set_remove(upper, 401);
+  TEST_ASSERT_TRUE(set_has(upper, 400));
+  TEST_ASSERT_TRUE(set_has(upper, 402));
+  assert_valid_tree(upper);
+
+  set_free(lower);
+  set_free(upper);
+}
+
+void test_join(void) {
+  set_t a;
+  set_t b;
+  set_init(a, hash_fn, equals_fn);
+  set_init(b, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 1000; i++) {
+    uint32_t entry = (i * 7919) % 1000;
+    if (entry < 100) {
+      set_add(a, entry);
+    } else {
+      set_add(b, entry);
+    }
+  }
+
+  set_join(a, b);
+  assert_range(a, 0, 1000, 1100);
+  for (uint32_t i = 0; i < 1000; i += 3) {
+    set_remove(a, i);
+  }
+  assert_valid_tree(a);
+  TEST_ASSERT_EQUAL(666, set_size(a));
+
+  set_free(a);
+}
+
+void test_join_empty(void) {
+  set_t a;
+  set_t b;
+  set_init(a, hash_fn, equals_fn);
+  set_init(b, hash_fn, equals_fn);
+  add_scrambled(&b, 1000);
+  set_join(a, b);
+  assert_range(a, 0, 1000, 1100);
+
+  set_init(b, hash_fn, equals_fn);
+  set_join(a, b);
+  assert_range(a, 0, 1000, 1100);
+  set_free(a);
+}
+
+void test_join_equal_hashes_at_the_seam(void) {
+  set_t a;
+  set_t b;
+  set_init(a, colliding_hash_fn, equals_fn);
+  set_init(b, colliding_hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 500; i++) {
+    set_add(a, i);
+  }
+  for (uint32_t i = 500; i < 1000; i++) {
+    set_add(b, i);
+  }
+
+  set_join(a, b);
+  assert_range(a, 0, 1000, 1100);
+  set_remove(a, 499);
+  set_remove(a, 500);
+  TEST_ASSERT_TRUE(set_has(a, 498));
+  TEST_ASSERT_TRUE(set_has(a, 501));
+  assert_valid_tree(a);
+
+  set_free(a);
+}
+
+void test_remove_hash_range(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  add_scrambled(&set, 1000);
+
+  TEST_ASSERT_EQUAL(10, set_remove_hash_range(set, 10, 20));
+  TEST_ASSERT_EQUAL(0, set_remove_hash_range(set, 10, 20));
+  TEST_ASSERT_EQUAL(0, set_remove_hash_range(set, 300, 300));
+  TEST_ASSERT_EQUAL(1, set_remove_hash_range(set, 0, 1));
+  TEST_ASSERT_EQUAL(500, set_remove_hash_range(set, 500, 2000));
+  for (uint32_t i = 0; i < 1000; i++) {
+    TEST_ASSERT_EQUAL(i > 0 && i < 500 && (i < 10 || i >= 20),
+                      set_has(set, i));
+  }
+  TEST_ASSERT_EQUAL(489, set_size(set));
+  assert_valid_tree(set);
+
+  // Freed slots are reused
+  for (uint32_t i = 0; i < 1000; i++) {
+    set_add(set, i);
+  }
+  assert_range(set, 0, 1000, 1100);
+
+  TEST_ASSERT_EQUAL(1000, set_remove_hash_range(set, 0, UINT64_MAX));
+  assert_range(set, 0, 0, 1100);
+  set_free(set);
+}
+
+void test_remove_hash_range_of_equal_hashes(void) {
+  set_t set;
+  set_init(set, colliding_hash_fn, equals_fn);
+  add_scrambled(&set, 1000);
+
+  // Every entry from 400 to 599, four to a hash
+  TEST_ASSERT_EQUAL(200, set_remove_hash_range(set, 100, 150));
+  TEST_ASSERT_EQUAL(4, set_remove_hash_range(set, 0, 1));
+  for (uint32_t i = 0; i < 1000; i++) {
+    TEST_ASSERT_EQUAL(i >= 4 && (i < 400 || i >= 600), set_has(set, i));
+  }
+  TEST_ASSERT_EQUAL(796, set_size(set));
+  assert_valid_tree(set);
+
+  set_free(set);
+}
+
+void test_map_split_and_join(void) {
+  map_t map;
+  map_init(map, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 300; i++) {
+    map_add(map, i, i * 10);
+  }
+
+  map_t lower;
+  map_t upper;
+  map_split(map, 100, lower, upper);
+  TEST_ASSERT_EQUAL(100, map_size(lower));
+  TEST_ASSERT_EQUAL(200, map_size(upper));
+  TEST_ASSERT_EQUAL(990, *map_get(lower, 99));
+  TEST_ASSERT_NULL(map_get(lower, 100));
+  TEST_ASSERT_EQUAL(1000, *map_get(upper, 100));
+
+  TEST_ASSERT_EQUAL(50, map_remove_hash_range(upper, 150, 200));
+  map_join(lower, upper);
+  TEST_ASSERT_EQUAL(250, map_size(lower));
+  for (uint32_t i = 0; i < 300; i++) {
+    uint32_t *value = map_get(lower, i);
+    if (i >= 150 && i < 200) {
+      TEST_ASSERT_NULL(value);
+    } else {
+      TEST_ASSERT_EQUAL(i * 10, *value);
+    }
+  }
+
+  map_free(lower);
+}
@@ -0,0 +1,88 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "set.h"
+#include "setdebug.h"
+#include "unity.h"
+
+static inline uint64_t colliding_hash_fn(uint32_t value) { return value / 4; }
+static inline bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+static inline uint64_t string_hash_fn(const char *value) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (; *value != '\0'; value++) {
+    hash = (hash ^ (uint8_t)*value) * 0x100000001b3ull;
+  }
+  return hash;
+}
+static inline bool string_equals_fn(const char *a, const char *b) {
+  return strcmp(a, b) == 0;
+}
+
+typedef set_type(uint32_t) set_t;
+typedef map_type(const char *, uint32_t) map_t;
+
+set_declare_static(ids, set_t, colliding_hash_fn, equals_fn)
+map_declare_static(names, map_t, string_hash_fn, string_equals_fn)
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_static_set_matches_runtime_set(void) {
+  set_t set;
+  set_init(set, colliding_hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 1000; i++) {
+    TEST_ASSERT_TRUE(ids_add(&set, i));
+  }
+  TEST_ASSERT_FALSE(ids_add(&set, 7));
+  TEST_ASSERT_EQUAL(1000, set_size(set));
+
+  for (uint32_t i = 1; i < 1000; i += 2) {
+    TEST_ASSERT_TRUE(ids_remove(&set, i));
+  }
+  TEST_ASSERT_FALSE(ids_remove(&set, 1));
+
+  // The generic operations see the same set
+  for (uint32_t i = 0; i < 1001; i++) {
+    TEST_ASSERT_EQUAL(i % 2 == 0 && i < 1000, ids_has(&set, i));
+    TEST_ASSERT_EQUAL(i % 2 == 0 && i < 1000, set_has(set, i));
+  }
+  set_add(set, 1001);
+  TEST_ASSERT_TRUE(ids_has(&set, 1001));
+  debug_node_blackheight(set.nodes, set.colors, set.inited, set.root, true,
+                         true);
+  set_free(set);
+}
+
+void test_static_map(void) {
+  map_t map;
+  map_init(map, string_hash_fn, string_equals_fn);
+  TEST_ASSERT_TRUE(names_add(&map, "one", 1));
+  TEST_ASSERT_TRUE(names_add(&map, "two", 2));
+  TEST_ASSERT_FALSE(names_add(&map, "one", 10));
+
+  // Equal strings at other addresses are found
+  char key[8];
+  strcpy(key, "two");
+  TEST_ASSERT_TRUE(names_has(&map, key));
+  TEST_ASSERT_EQUAL(2, *names_get(&map, key));
+  *names_get(&map, "one") = 11;
+  TEST_ASSERT_EQUAL(11, *map_get(map, "one"));
+  TEST_ASSERT_NULL(names_get(&map, "three"));
+
+  TEST_ASSERT_TRUE(names_remove(&map, key));
+  TEST_ASSERT_FALSE(names_has(&map, "two"));
+  TEST_ASSERT_EQUAL(1, map_size(map));
+  map_free(map);
+}
+
+void test_static_map_copies_shared_values(void) {
+  map_t map;
+  map_init(map, string_hash_fn, string_equals_fn);
+  names_add(&map, "one", 1);
+  map_t snapshot = map_snapshot(map);
+  *names_get(&map, "one") = 2;
+  TEST_ASSERT_EQUAL(1, *map_get(snapshot, "one"));
+  map_free(snapshot);
+  map_free(map);
+}
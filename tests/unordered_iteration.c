@@ -0,0 +1,110 @@
+#include <stdint.h>
+
+#include "set.h"
+#include "unity.h"
+
+uint64_t hash_fn(uint32_t value) { return value; }
+uint64_t colliding_hash_fn(uint32_t value) { return value / 4; }
+bool equals_fn(uint32_t a, uint32_t b) { return a == b; }
+
+typedef set_type(uint32_t) set_t;
+typedef set_type_flat(uint32_t) flat_set_t;
+typedef set_type_btree(uint32_t) btree_set_t;
+typedef set_type_frozen(uint32_t) frozen_set_t;
+typedef map_type(uint32_t, uint32_t) map_t;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static bool seen[5000];
+
+#define assert_visits_all(set, expected)                                       \
+  do {                                                                         \
+    memset(seen, 0, sizeof(seen));                                             \
+    size_t visited = 0;                                                        \
+    set_foreach_unordered(set, cursor) {                                       \
+      uint32_t entry = set_get_entry(set, cursor);                             \
+      TEST_ASSERT_TRUE(expected(entry));                                       \
+      TEST_ASSERT_FALSE(seen[entry]);                                          \
+      seen[entry] = true;                                                      \
+      visited++;                                                               \
+    }                                                                          \
+    TEST_ASSERT_EQUAL(set_size(set), visited);                                 \
+  } while (0)
+
+static bool below_5000(uint32_t i) { return i < 5000; }
+static bool odd_or_large(uint32_t i) { return i % 2 == 1 || i >= 4500; }
+
+void test_tree(void) {
+  set_t set;
+  set_init(set, hash_fn, equals_fn);
+  assert_visits_all(set, below_5000);
+
+  for (uint32_t i = 0; i < 5000; i++) {
+    set_add(set, i);
+  }
+  assert_visits_all(set, below_5000);
+
+  // Leaves long empty stretches in the bitmap
+  for (uint32_t i = 0; i < 4500; i += 2) {
+    set_remove(set, i);
+  }
+  assert_visits_all(set, odd_or_large);
+
+  set_free(set);
+}
+
+// Entries that share a hash sit in slots of their own like any other
+void test_tree_with_equal_hashes(void) {
+  set_t set;
+  set_init(set, colliding_hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 5000; i++) {
+    set_add(set, i);
+  }
+  for (uint32_t i = 0; i < 4500; i += 2) {
+    set_remove(set, i);
+  }
+  assert_visits_all(set, odd_or_large);
+  set_free(set);
+}
+
+void test_other_backends(void) {
+  flat_set_t flat;
+  btree_set_t btree;
+  set_init(flat, hash_fn, equals_fn);
+  set_init(btree, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 5000; i++) {
+    set_add(flat, i);
+    set_add(btree, i);
+  }
+  frozen_set_t frozen;
+  set_freeze(frozen, btree);
+
+  assert_visits_all(flat, below_5000);
+  assert_visits_all(frozen, below_5000);
+
+  assert_visits_all(btree, below_5000);
+
+  set_free(flat);
+  set_free(btree);
+  set_free(frozen);
+}
+
+void test_map(void) {
+  map_t map;
+  map_init(map, hash_fn, equals_fn);
+  for (uint32_t i = 0; i < 1000; i++) {
+    map_add(map, i, i * 2);
+  }
+  map_remove(map, 500);
+
+  uint64_t sum = 0;
+  map_foreach_unordered(map, cursor) {
+    TEST_ASSERT_EQUAL(map_get_key(map, cursor) * 2,
+                      map_get_value(map, cursor));
+    sum += map_get_value(map, cursor);
+  }
+  TEST_ASSERT_EQUAL(999 * 1000 - 1000, sum);
+
+  map_free(map);
+}